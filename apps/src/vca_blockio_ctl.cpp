@@ -26,6 +26,7 @@
 #include <errno.h>
 #include <stdbool.h>
 #include <sys/stat.h>
+#include <linux/fs.h>
 
 #include "vca_blockio_ctl.h"
 #include "vca_defs.h"
@@ -130,12 +131,39 @@ bool is_blk_disk_rw(filehandle_t blk_dev_fd, unsigned int blk_dev_id)
 
 	if (info.exist) {
 		return (info.mode == VCABLK_DISK_MODE_READ_WRITE &&
-			info.type == VCABLK_DISK_TYPE_FILE);
+			(info.type == VCABLK_DISK_TYPE_FILE ||
+			 info.type == VCABLK_DISK_TYPE_BDEV));
 	}
 
 	return false;
 }
 
+bool is_blk_bdev_path(const char *path)
+{
+	struct stat buf;
+
+	if (stat(path, &buf))
+		return false;
+	return S_ISBLK(buf.st_mode);
+}
+
+static size_t get_bdev_size(const char *path)
+{
+	uint64_t size = 0;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		LOG_ERROR("Cannot open block device %s: %s\n", path, strerror(errno));
+		return 0;
+	}
+	if (ioctl(fd, BLKGETSIZE64, &size) < 0) {
+		LOG_ERROR("Cannot get size of block device %s: %s\n", path, strerror(errno));
+		size = 0;
+	}
+	close(fd);
+	return size;
+}
+
 size_t get_blk_file_size(struct vca_blk_dev_info blk_dev_info) {
 	size_t blk_dev_size;
 
@@ -143,7 +171,10 @@ size_t get_blk_file_size(struct vca_blk_dev_info blk_dev_info) {
 		return MB_TO_B(blk_dev_info.size_mb);
 	else {
 		if (file_exists(blk_dev_info.path.c_str())) {
-			blk_dev_size = get_file_size(blk_dev_info.path.c_str());
+			if (blk_dev_info.type == VCABLK_DISK_TYPE_BDEV)
+				blk_dev_size = get_bdev_size(blk_dev_info.path.c_str());
+			else
+				blk_dev_size = get_file_size(blk_dev_info.path.c_str());
 			if (blk_dev_size < BLK_SECTOR_SIZE || blk_dev_size % BLK_SECTOR_SIZE) {
 				LOG_ERROR("Invalid block device size. Expected multiple of %d\n", BLK_SECTOR_SIZE);
 				return 0;
@@ -168,6 +199,7 @@ int open_blk_dev(filehandle_t blk_dev_fd, struct vca_blk_dev_info blk_dev_info)
 	disk.disk_id = blk_dev_info.blk_dev_id;
 	disk.type = blk_dev_info.type;
 	disk.mode = blk_dev_info.mode == BLK_MODE_RO ? VCABLK_DISK_MODE_READ_ONLY : VCABLK_DISK_MODE_READ_WRITE;
+	disk.flags = blk_dev_info.direct ? VCABLK_DISK_FLAG_DIRECT : 0;
 
 	blk_dev_size = get_blk_file_size(blk_dev_info);
 	if (blk_dev_size == 0) { // "0" means an error
@@ -38,6 +38,8 @@
 #define BLK_CONFIG_PATH_STR		"path"
 #define BLK_CONFIG_RAMDISK_SIZE_STR	"ramdisk-size-mb"
 #define BLK_CONFIG_ENABLED_STR		"enabled"
+#define BLK_CONFIG_DIRECT_STR		"direct"
+#define BLK_CONFIG_BDEV_STR		"bdev"
 
 #define BLK_STATE_ACTIVE_STR		"active"
 #define BLK_STATE_INACTIVE_STR		"inactive"
@@ -56,6 +58,7 @@ struct vca_blk_dev_info {
 	std::string path;
 	size_t size_mb;
 	bool enabled;
+	bool direct;
 };
 
 enum blk_state {
@@ -74,6 +77,7 @@ std::string get_mode_string(int blockio_mode);
 bool check_blk_disk_exist(filehandle_t blk_dev_fd, unsigned int blk_dev_id);
 bool is_blk_disk_opened(filehandle_t blk_dev_fd, unsigned int blk_dev_id);
 bool is_blk_disk_rw(filehandle_t blk_dev_fd, unsigned int blk_dev_id);
+bool is_blk_bdev_path(const char *path);
 size_t get_blk_file_size(struct vca_blk_dev_info blk_dev_info);
 int open_blk_dev(filehandle_t blk_dev_fd, struct vca_blk_dev_info blk_dev_info);
 int close_blk_dev(filehandle_t blk_dev_fd, unsigned int blk_dev_id);
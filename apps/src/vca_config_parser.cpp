@@ -93,6 +93,8 @@ const data_field & blk_dev_fields(blk_dev_fields::_enum field) {
 		blk_dev[blk_dev_fields::path] = new data_field(data_field::string, "path", "");
 		blk_dev[blk_dev_fields::ramdisk_size_mb] = new data_field(data_field::number, "ramdisk-size-mb", "");
 		blk_dev[blk_dev_fields::enabled] = new data_field(data_field::number, "enabled", "");
+		blk_dev[blk_dev_fields::direct] = new data_field(data_field::number, "direct", "");
+		blk_dev[blk_dev_fields::bdev] = new data_field(data_field::number, "bdev", "");
 	}
 	return *blk_dev[field];
 }
@@ -322,13 +324,18 @@ bool vca_config::save_blk_field(unsigned int card_id, unsigned int cpu_id, unsig
 							if (v.first == "block-devs") {
 								BOOST_FOREACH(ptree::value_type & v, v.second.get_child("")) {
 									if (v.first == get_block_dev_name_from_id(blk_dev_id)) {
+										bool found = false;
 										BOOST_FOREACH(ptree::value_type & v, v.second.get_child("")) {
 											if (v.first == field_name) {
 												v.second.data().clear();
 												v.second.data().append(field_value);
+												found = true;
 												break;
 											}
 										}
+										// config from older release may miss field
+										if (!found)
+											v.second.put(field_name, field_value);
 									}
 								}
 							}
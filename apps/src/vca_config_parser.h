@@ -93,6 +93,8 @@ struct blk_dev_fields {
 		path,
 		ramdisk_size_mb,
 		enabled,
+		direct,
+		bdev,
 		ENUM_SIZE
 	};
 };
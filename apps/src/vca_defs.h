@@ -61,6 +61,8 @@
 #define VCACTLD_LOCK_PATH		"/var/lock/vca/LCK.vcactld"
 #define VCACTL_NODE_LOCK_PATH		"/var/lock/vca/LCK.vcactl_node"
 
+#define VCACTL_BOOT_PROFILE_PATH	"/var/log/vcactl_boot_profile.json"
+
 /* Defines for separating blocks of code */
 #define VCACTL_PARSING_FUNCTIONS 1
 
@@ -33,6 +33,7 @@
 #include <string.h>
 
 #include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/interprocess/sync/file_lock.hpp>
 
 #include <vca_mgr_ioctl.h>
@@ -49,6 +50,8 @@
 #include "version.h"
 
 #include <sys/mman.h>
+#include <time.h>
+#include <algorithm>
 
 #define VCASYSFSDIR						"/sys/class/vca"
 #define LINK_DOWN_STATE					"link_down"
@@ -226,10 +229,12 @@ public:
 		execution_flags["--force"] = false;
 		execution_flags["--skip-modprobe-check"] = false;
 		execution_flags["--skip-card-type-check"] = false;
+		execution_flags["--profile"] = false;
 	}
 	bool is_force_cmd_enabled() { return execution_flags["--force"]; }
 	bool is_modprobe_check_skipped() { return execution_flags["--skip-modprobe-check"]; }
 	bool needs_card_type_check() { return !execution_flags["--skip-card-type-check"]; }
+	bool is_profile_enabled() { return execution_flags["--profile"]; }
 
 	void add_arg(const char *name, const char *value) {
 		data_field *df = new data_field(data_field::string, name, value);
@@ -352,6 +357,8 @@ protected:
 public:
 	function_caller(function f): f(f), calls_count(0) {}
 	virtual void call(caller_data data) = 0;
+	/* called once all calls are finished */
+	virtual void report() {}
 	virtual ~function_caller(){}
 };
 
@@ -388,16 +395,17 @@ private:
 	struct thread_data {
 		function f;
 		caller_data data;
-		thread_data(function f, caller_data data):
-			f(f), data(data){}
+		threaded_caller *caller;
+		thread_data(function f, caller_data data, threaded_caller *caller):
+			f(f), data(data), caller(caller){}
 	};
 	static void *thread_func(void *arg) {
 		thread_data *d = (thread_data*)arg;
+		bool success = false;
 		try {
-			bool success = d->f(d->data);
+			success = d->f(d->data);
 			if (!success)
 				command_err = EAGAIN;
-			delete d;
 		}
 		catch (boost::interprocess::interprocess_exception &ex) {
 			d->data.LOG_CPU_ERROR("Exception (interprocess_exception) encountered while executing "
@@ -409,23 +417,51 @@ private:
 				"%s command: %s\n", d->data.get_cmd_name(), ex.what());
 			command_err = EAGAIN;
 		}
+		d->caller->finished(d->data, success);
+		delete d;
 		return NULL;
 	}
 	static thread_manager * _thread_mgr;
+	/* progress and summary of calls running concurrently on many nodes */
+	bool aggregate;
+	boost::mutex results_lock;
+	unsigned int finished_count;
+	std::vector<std::pair<int, int> > failed;
+	void finished(const caller_data &data, bool success) {
+		if (!aggregate)
+			return;
+		boost::lock_guard<boost::mutex> lock(results_lock);
+		finished_count++;
+		if (!success)
+			failed.push_back(std::make_pair(data.card_id, data.cpu_id));
+		data.LOG_CPU(VERBOSE_DEFAULT, "%s %s (%u of %u nodes done)\n",
+			data.args.get_cmd_name(), success ? "finished" : "failed",
+			finished_count, calls_count);
+	}
 public:
 	static void set_thread_manager(thread_manager * tm) {
 		_thread_mgr = tm;
 	}
-	threaded_caller(function f): function_caller(f) {}
+	threaded_caller(function f, bool aggregate = false):
+		function_caller(f), aggregate(aggregate), finished_count(0) {}
 	void call(caller_data data) {
 		if (_thread_mgr) {
 			data.caller_id = calls_count++;
-			_thread_mgr->create_thread(thread_func, new thread_data(f, data));
+			_thread_mgr->create_thread(thread_func, new thread_data(f, data, this));
 		}
 
 		else
 			data.LOG_CPU_ERROR("Thread manager not set for threaded_caller!\n");
 	}
+	void report() {
+		if (!aggregate || calls_count < 2)
+			return;
+		LOG_INFO("%u of %u nodes succeeded\n",
+			calls_count - (unsigned int)failed.size(), calls_count);
+		for (size_t i = 0; i < failed.size(); i++)
+			LOG_ERROR("Card: %d Cpu: %d - failed\n",
+				failed[i].first, failed[i].second);
+	}
 };
 
 thread_manager *threaded_caller::_thread_mgr = NULL;
@@ -455,7 +491,7 @@ std::string get_card_gen(const unsigned card_id);
 struct cmd_desc {
 	const char * name;
 	function_caller * caller;
-	arg_parser args[6];
+	arg_parser args[7];
 	subcmds *subcmd;
 	size_t args_size;
 
@@ -465,7 +501,8 @@ struct cmd_desc {
 		arg_parser arg2 = NULL,
 		arg_parser arg3 = NULL,
 		arg_parser arg4 = NULL,
-		arg_parser arg5 = NULL) :
+		arg_parser arg5 = NULL,
+		arg_parser arg6 = NULL) :
 		name(name), caller(caller), subcmd(NULL), args_size(0) {
 		if (arg0)
 			args[args_size++] = arg0;
@@ -484,6 +521,9 @@ struct cmd_desc {
 		else return;
 		if (arg5)
 			args[args_size++] = arg5;
+		else return;
+		if (arg6)
+			args[args_size++] = arg6;
 	}
 	cmd_desc(const char* name, function_caller * caller, subcmds *sub,
 		arg_parser arg0 = NULL,
@@ -491,7 +531,8 @@ struct cmd_desc {
 		arg_parser arg2 = NULL,
 		arg_parser arg3 = NULL,
 		arg_parser arg4 = NULL,
-		arg_parser arg5 = NULL) :
+		arg_parser arg5 = NULL,
+		arg_parser arg6 = NULL) :
 		name(name), caller(caller), subcmd(sub), args_size(0) {
 		if (arg0)
 			args[args_size++] = arg0;
@@ -510,6 +551,9 @@ struct cmd_desc {
 		else return;
 		if (arg5)
 			args[args_size++] = arg5;
+		else return;
+		if (arg6)
+			args[args_size++] = arg6;
 	}
 	bool parse_args(char *argv[], args_holder &holder) const {
 		for (const arg_parser* parser = args, *const end = args + args_size; parser < end; ++parser)
@@ -737,6 +781,16 @@ const char* get_csm_ioctl_name(unsigned long ioctl_cmd)
 		return "LBP_BOOT_LBPDISK";
 	case VCA_GET_MEM_INFO:
 		return "VCA_GET_MEM_INFO";
+	case LBP_REGISTER_IMAGE:
+		return "LBP_REGISTER_IMAGE";
+	case LBP_UNREGISTER_IMAGE:
+		return "LBP_UNREGISTER_IMAGE";
+	case LBP_BOOT_RAMDISK_IMAGE:
+		return "LBP_BOOT_RAMDISK_IMAGE";
+	case LBP_BOOT_RAMDISK_STREAM:
+		return "LBP_BOOT_RAMDISK_STREAM";
+	case LBP_GET_PHASE_TIMES:
+		return "LBP_GET_PHASE_TIMES";
 	default:
 		LOG_DEBUG("csm ioctl command name for %lx not found!\n", ioctl_cmd);
 		return "";
@@ -1396,6 +1450,372 @@ bool try_ioctl_with_img(filehandle_t cpu_fd, unsigned long ioctl_cmd, const call
 	return false;
 }
 
+/*
+ * Key identifying contents of a boot image file. Change time has nanosecond
+ * resolution and moves with every write, unlike mtime which can be set back.
+ */
+static bool boot_image_key(const char *path, const struct stat & info,
+			   char *name, size_t len)
+{
+	int ret = snprintf(name, len, "%s:%llu:%lld:%lld.%09ld", path,
+			   (unsigned long long)info.st_ino, (long long)info.st_size,
+			   (long long)info.st_ctim.tv_sec, (long)info.st_ctim.tv_nsec);
+	return ret >= 0 && ret < (int)len;
+}
+
+/* Boot images registered in the driver by this run, keyed by boot_image_key() */
+struct registered_boot_image {
+	/* The driver drops the image when this fd is closed, also on a kill */
+	filehandle_t fd;
+	__u32 id; // 0 when the driver could not keep the image
+	unsigned int boots; // nodes booting the image in this run
+	registered_boot_image(): fd(-1), id(0), boots(0) {}
+};
+static std::map<std::string, registered_boot_image> boot_images;
+static boost::mutex boot_images_lock;
+
+/*
+ * The first node booting an image uploads it straight from the mapped file.
+ * Registering pays off only when more nodes of this run boot the same image,
+ * so it is done on the second boot of it, the nodes booted from then on get
+ * the image from kernel memory without another copy from the file.
+ * Return false when the image is to be uploaded the old way.
+ */
+bool get_boot_image_id(const caller_data & d, const char *path,
+		       const struct stat & info, const void *img, __u32 & id)
+{
+	char name[VCA_LBP_IMAGE_NAME_LEN];
+	if (!boot_image_key(path, info, name, sizeof(name)))
+		return false;
+
+	boost::mutex::scoped_lock lock(boot_images_lock);
+	registered_boot_image & image = boot_images[name];
+	if (++image.boots == 1)
+		return false;
+	if (image.boots > 2) {
+		id = image.id;
+		return id != 0;
+	}
+
+	vca_csm_ioctl_image_desc desc;
+	memset(&desc, 0, sizeof(desc));
+	desc.mem = (void *)img;
+	desc.mem_info = info.st_size;
+	STRCPY_S(desc.name, name, sizeof(desc.name));
+	image.fd = open_cpu_fd(d.card_id, d.cpu_id);
+	/* drivers without the registry reject the ioctl, not an error */
+	if (image.fd == -1 || ioctl(image.fd, LBP_REGISTER_IMAGE, &desc) ||
+	    desc.ret != LBP_STATE_OK) {
+		d.LOG_CPU(DEBUG_INFO, "Boot image not kept by the driver, uploading it for each node\n");
+		if (image.fd != -1)
+			close_file(image.fd);
+		image.fd = -1;
+	} else {
+		image.id = desc.id;
+	}
+	id = image.id;
+	return id != 0;
+}
+
+bool boot_registered_image(filehandle_t cpu_fd, const caller_data & d, __u32 id)
+{
+	d.LOG_CPU(DEBUG_INFO, "%s %u\n", get_csm_ioctl_name(LBP_BOOT_RAMDISK_IMAGE), id);
+	vca_csm_ioctl_image_desc desc;
+	memset(&desc, 0, sizeof(desc));
+	desc.id = id;
+	if (ioctl(cpu_fd, LBP_BOOT_RAMDISK_IMAGE, &desc) || desc.ret != LBP_STATE_OK) {
+		/* dropped under memory pressure or card error, retried by upload */
+		d.LOG_CPU(DEBUG_INFO, "Boot from registered image %u failed\n", id);
+		return false;
+	}
+	return true;
+}
+
+void unregister_boot_images()
+{
+	boost::mutex::scoped_lock lock(boot_images_lock);
+	for (std::map<std::string, registered_boot_image>::iterator it = boot_images.begin();
+	     it != boot_images.end(); ++it) {
+		if (!it->second.id)
+			continue;
+		close_on_exit cpu_fd(it->second.fd);
+		vca_csm_ioctl_image_desc desc;
+		memset(&desc, 0, sizeof(desc));
+		desc.id = it->second.id;
+		if (ioctl(cpu_fd, LBP_UNREGISTER_IMAGE, &desc))
+			LOG_DEBUG("%s %u failed\n", get_csm_ioctl_name(LBP_UNREGISTER_IMAGE), desc.id);
+	}
+	boot_images.clear();
+}
+
+/* Compressed boot images are decompressed on the fly while being uploaded */
+enum boot_image_compression {
+	BOOT_IMAGE_RAW,
+	BOOT_IMAGE_GZIP,
+	BOOT_IMAGE_ZSTD,
+};
+
+#define ZSTD_FRAME_MAGIC		0xFD2FB528
+#define ZSTD_SKIPPABLE_MAGIC		0x184D2A50
+#define ZSTD_SKIPPABLE_MAGIC_MASK	0xFFFFFFF0
+#define ZSTD_BLOCK_HEADER_SIZE		3
+#define ZSTD_CHECKSUM_SIZE		4
+#define DECOMPRESS_READ_SIZE		(1024 * 1024)
+
+static boot_image_compression get_boot_image_compression(filehandle_t fd)
+{
+	unsigned char magic[4];
+	if (pread(fd, magic, sizeof(magic), 0) != sizeof(magic))
+		return BOOT_IMAGE_RAW;
+	if (magic[0] == 0x1f && magic[1] == 0x8b)
+		return BOOT_IMAGE_GZIP;
+	if (magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+		return BOOT_IMAGE_ZSTD;
+	return BOOT_IMAGE_RAW;
+}
+
+static __u64 get_le(const unsigned char *buf, int len)
+{
+	__u64 val = 0;
+	while (len--)
+		val = (val << 8) | buf[len];
+	return val;
+}
+
+/*
+ * Sum up content sizes declared in headers of all zstd frames of the file,
+ * blocks are walked only to find where the next frame starts.
+ * Return false when a frame does not declare its size.
+ */
+static bool get_zstd_content_size(filehandle_t fd, off_t file_size, size_t & size)
+{
+	static const int dict_id_size[] = { 0, 1, 2, 4 };
+	static const int fcs_size[] = { 0, 2, 4, 8 };
+	unsigned char hdr[18];
+	off_t pos = 0;
+	__u64 total = 0;
+
+	while (pos < file_size) {
+		if (pread(fd, hdr, sizeof(hdr), pos) < 8)
+			return false;
+		__u32 magic = get_le(hdr, 4);
+		if ((magic & ZSTD_SKIPPABLE_MAGIC_MASK) == ZSTD_SKIPPABLE_MAGIC) {
+			pos += 8 + get_le(hdr + 4, 4);
+			continue;
+		}
+		if (magic != ZSTD_FRAME_MAGIC)
+			return false;
+
+		unsigned char desc = hdr[4];
+		bool single_segment = desc & 0x20;
+		int fcs_flag = desc >> 6;
+		int fcs_len = fcs_size[fcs_flag];
+		if (!fcs_flag && single_segment)
+			fcs_len = 1;
+		if (!fcs_len)
+			return false;
+		int fcs_off = 5 + (single_segment ? 0 : 1) + dict_id_size[desc & 3];
+		__u64 fcs = get_le(hdr + fcs_off, fcs_len);
+		if (fcs_len == 2)
+			fcs += 256;
+		total += fcs;
+
+		pos += fcs_off + fcs_len;
+		for (;;) {
+			unsigned char block[ZSTD_BLOCK_HEADER_SIZE];
+			if (pread(fd, block, sizeof(block), pos) != sizeof(block))
+				return false;
+			__u32 block_hdr = get_le(block, sizeof(block));
+			bool last = block_hdr & 1;
+			int type = (block_hdr >> 1) & 3;
+			pos += sizeof(block) + (type == 1 ? 1 : block_hdr >> 3);
+			if (last)
+				break;
+		}
+		if (desc & 0x04)
+			pos += ZSTD_CHECKSUM_SIZE;
+	}
+	if (pos != file_size || total != (size_t)total)
+		return false;
+	size = total;
+	return true;
+}
+
+/*
+ * Find the tool decompressing the image. Tools are taken from the safe path
+ * only. pigz, when installed, inflates gzip with separate threads for
+ * reading, writing and checking.
+ */
+static bool find_decompressor(boot_image_compression compression, std::string & bin)
+{
+	static const char *const dirs[] = { "/usr/sbin", "/usr/bin", "/sbin", "/bin" };
+	const char *tools[2] = { NULL, NULL };
+	if (compression == BOOT_IMAGE_ZSTD) {
+		tools[0] = "zstd";
+	} else {
+		tools[0] = "pigz";
+		tools[1] = "gzip";
+	}
+
+	for (size_t t = 0; t < sizeof(tools) / sizeof(tools[0]) && tools[t]; t++)
+		for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+			bin = std::string(dirs[i]) + "/" + tools[t];
+			if (!access(bin.c_str(), X_OK))
+				return true;
+		}
+	bin.clear();
+	return false;
+}
+
+/*
+ * Start decompression of the image with the tool found by find_decompressor()
+ * into a pipe, the read end of the pipe is returned in out_fd.
+ */
+static pid_t spawn_decompressor(const std::string & bin, const char *path,
+				filehandle_t & out_fd)
+{
+	/* nothing but exec in the child, other threads may hold locks */
+	char const *const args[] = { bin.c_str(), "-dcq", "--", path, NULL };
+	char const *const env[] = { VCA_SAFE_PATH, NULL };
+
+	int pipe_fd[2];
+	if (pipe2(pipe_fd, O_CLOEXEC) == FAIL) {
+		LOG_ERROR("Cannot create pipe for decompression: %s\n", strerror(errno));
+		return FAIL;
+	}
+
+	pid_t pid = fork();
+	if (!pid) {
+		if (dup2(pipe_fd[1], STDOUT_FILENO) == FAIL)
+			_exit(EXIT_FAILURE);
+		execve(args[0], (char **)args, (char **)env);
+		_exit(EXIT_FAILURE);
+	}
+	close(pipe_fd[1]);
+	if (pid == FAIL) {
+		LOG_ERROR("Fork failed: %s\n", strerror(errno));
+		close(pipe_fd[0]);
+		return FAIL;
+	}
+	out_fd = pipe_fd[0];
+	return pid;
+}
+
+static bool wait_decompressor(pid_t pid, const char *path)
+{
+	int status;
+	while (waitpid(pid, &status, 0) == FAIL) {
+		if (errno != EINTR) {
+			LOG_ERROR("Waitpid() error: %s\n", strerror(errno));
+			return false;
+		}
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+		LOG_ERROR("Decompression of %s failed\n", path);
+		return false;
+	}
+	return true;
+}
+
+/* Uncompressed sizes of images, keyed by boot_image_key() */
+static std::map<std::string, size_t> boot_image_sizes;
+static boost::mutex boot_image_sizes_lock;
+
+/*
+ * The driver has to be told the exact size of the image before it is
+ * streamed. Zstd frames may declare it. Gzip keeps the size only modulo
+ * 2^32 and only per member, so gzip images and zstd frames not declaring
+ * it are decompressed once just to count bytes. The result is shared by
+ * all nodes booted.
+ */
+bool get_uncompressed_size(const caller_data & d, filehandle_t fd, const char *path,
+			   const struct stat & info, boot_image_compression compression,
+			   const std::string & decompressor, size_t & size)
+{
+	char name[VCA_LBP_IMAGE_NAME_LEN];
+	boot_image_key(path, info, name, sizeof(name));
+
+	boost::mutex::scoped_lock lock(boot_image_sizes_lock);
+	std::map<std::string, size_t>::iterator it = boot_image_sizes.find(name);
+	if (it != boot_image_sizes.end()) {
+		size = it->second;
+		return size != 0;
+	}
+
+	if (compression != BOOT_IMAGE_ZSTD ||
+	    !get_zstd_content_size(fd, info.st_size, size)) {
+		d.LOG_CPU(DEBUG_INFO, "Counting uncompressed size of %s\n", path);
+		filehandle_t pipe_fd;
+		pid_t pid = spawn_decompressor(decompressor, path, pipe_fd);
+		if (pid == FAIL)
+			return false;
+		std::vector<char> buf(DECOMPRESS_READ_SIZE);
+		ssize_t len;
+		size = 0;
+		while ((len = read(pipe_fd, &buf[0], buf.size())) > 0 ||
+		       (len == FAIL && errno == EINTR))
+			if (len > 0)
+				size += len;
+		close(pipe_fd);
+		if (!wait_decompressor(pid, path) || len == FAIL)
+			size = 0;
+	}
+	d.LOG_CPU(DEBUG_INFO, "Uncompressed size of %s is %zu\n", path, size);
+	boot_image_sizes[name] = size;
+	return size != 0;
+}
+
+/*
+ * host_error is set when the stream failed on the host side, the card is not
+ * to blame then and resetting it would not help
+ */
+bool csm_ioctl_with_stream(filehandle_t cpu_fd, const caller_data & d,
+			   const std::string & decompressor, const char *path, size_t size,
+			   bool & host_error)
+{
+	d.LOG_CPU(DEBUG_INFO, "%s\n", get_csm_ioctl_name(LBP_BOOT_RAMDISK_STREAM));
+	vca_csm_ioctl_stream_desc desc;
+	host_error = true;
+	pid_t pid = spawn_decompressor(decompressor, path, desc.fd);
+	if (pid == FAIL)
+		return false;
+	desc.size = size;
+	bool ok = csm_ioctl(cpu_fd, LBP_BOOT_RAMDISK_STREAM, &desc);
+	/*
+	 * the driver refuses an image larger than expected, the rest of it
+	 * is dropped with SIGPIPE
+	 */
+	close(desc.fd);
+	if (!wait_decompressor(pid, path))
+		return false;
+
+	host_error = false;
+	return ok && check_lbp_state_ok(desc.ret, LBP_BOOT_RAMDISK_STREAM, d);
+}
+
+bool try_ioctl_with_stream(filehandle_t cpu_fd, const caller_data & d,
+			   const std::string & decompressor, const char *path, size_t size)
+{
+	for(int i = 0; i < AFTER_HANDSHAKE_RESET_TRIES; i++) {
+		bool host_error;
+		if (csm_ioctl_with_stream(cpu_fd, d, decompressor, path, size, host_error))
+			return true;
+		if (host_error) {
+			d.LOG_CPU_ERROR("Could not stream decompressed image %s\n", path);
+			return false;
+		}
+
+		reset(d);
+
+		if(!try_handshake(cpu_fd, d))
+			return false;
+	}
+	d.LOG_CPU_ERROR("Failed to execute IOCTL (%s) after %d tries.\n",
+		get_csm_ioctl_name(LBP_BOOT_RAMDISK_STREAM), AFTER_HANDSHAKE_RESET_TRIES);
+
+	return false;
+}
+
 bool csm_ioctl_with_blk(filehandle_t cpu_fd, unsigned long ioctl_cmd, const caller_data & d)
 {
 	d.LOG_CPU(DEBUG_INFO, "%s\n", get_csm_ioctl_name(ioctl_cmd));
@@ -2018,6 +2438,7 @@ bool get_blk_config_field(caller_data d, unsigned int blk_dev_id, struct vca_blk
 	blk_dev_info.type = VCABLK_DISK_TYPE_FILE;
 	blk_dev_info.size_mb = 0;
 	blk_dev_info.mode = BLK_MODE_RW;
+	blk_dev_info.direct = false;
 	blk_dev_info.path = config.get_blk_field(d.card_id, d.cpu_id, blk_dev_id, blk_dev_fields::path).get_string();
 
 	if (mode == BLOCKIO_MODE_RAMDISK) {
@@ -2039,6 +2460,15 @@ bool get_blk_config_field(caller_data d, unsigned int blk_dev_id, struct vca_blk
 		if (mode == BLOCKIO_MODE_RO) {
 			blk_dev_info.mode = BLK_MODE_RO;
 		}
+		blk_dev_info.direct = config.get_blk_field(d.card_id, d.cpu_id, blk_dev_id, blk_dev_fields::direct).get_number();
+		if (config.get_blk_field(d.card_id, d.cpu_id, blk_dev_id, blk_dev_fields::bdev).get_number()) {
+			if (!is_blk_bdev_path(blk_dev_info.path.c_str())) {
+				d.LOG_CPU_ERROR("File (%s) used from config to create block device %s is not a block device!\n",
+					blk_dev_info.path.c_str(), get_block_dev_name_from_id(blk_dev_id).c_str());
+				return false;
+			}
+			blk_dev_info.type = VCABLK_DISK_TYPE_BDEV;
+		}
 	}
 	else {
 		d.LOG_CPU_ERROR("Incorrect block device mode (%s) in config file for block device %s!\n",
@@ -2120,12 +2550,232 @@ bool get_bios_cfg_for(caller_data &d, filehandle_t fd, vca_lbp_bios_param param,
 	return true;
 }
 
+/* Phases of a boot timed with --profile */
+struct boot_phase {
+	std::string name;
+	std::string source;	// "vcactl" or "driver"
+	__u64 start_ns;
+	__u64 duration_ns;	// of the last run
+	__u64 runs;
+	__u64 total_ns;		// of all runs
+	bool ok;
+};
+
+struct node_boot_profile {
+	int card_id;
+	int cpu_id;
+	std::string image;
+	__u64 start_ns;
+	__u64 duration_ns;
+	bool ok;
+	std::vector<boot_phase> phases;
+};
+
+static std::vector<node_boot_profile> boot_profiles;
+static boost::mutex boot_profiles_lock;
+
+/* Same clock as ktime_get() in the driver, phases of both are comparable */
+static __u64 monotonic_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Timeline of one node boot. Each mark() ends the phase running and starts
+ * the next one, the profile is kept for the report when the boot returns.
+ */
+class boot_profiler {
+	const caller_data & d;
+	bool enabled;
+	node_boot_profile profile;
+	int running;
+	vca_csm_ioctl_phase_times driver_base;
+	bool have_driver_base;
+
+	bool read_driver_phases(filehandle_t cpu_fd, vca_csm_ioctl_phase_times & times) {
+		memset(&times, 0, sizeof(times));
+		if (ioctl(cpu_fd, LBP_GET_PHASE_TIMES, &times) || times.ret != LBP_STATE_OK) {
+			d.LOG_CPU(DEBUG_INFO, "%s failed, no driver phases in profile\n",
+				  get_csm_ioctl_name(LBP_GET_PHASE_TIMES));
+			return false;
+		}
+		return true;
+	}
+public:
+	boot_profiler(const caller_data & d) : d(d), enabled(d.args.is_profile_enabled()), running(-1),
+		have_driver_base(false) {
+		profile.card_id = d.card_id;
+		profile.cpu_id = d.cpu_id;
+		profile.start_ns = monotonic_ns();
+		profile.duration_ns = 0;
+		profile.ok = false;
+	}
+	~boot_profiler() {
+		if (!enabled)
+			return;
+		end(profile.ok);
+		profile.duration_ns = monotonic_ns() - profile.start_ns;
+		boost::mutex::scoped_lock lock(boot_profiles_lock);
+		boot_profiles.push_back(profile);
+	}
+	bool is_enabled() const {
+		return enabled;
+	}
+	void set_image(const char *path) {
+		profile.image = path;
+	}
+	void mark(const char *name) {
+		if (!enabled)
+			return;
+		__u64 now = monotonic_ns();
+		end(true, now);
+		boot_phase phase = { name, "vcactl", now, 0, 1, 0, false };
+		running = profile.phases.size();
+		profile.phases.push_back(phase);
+	}
+	void end(bool ok, __u64 now = 0) {
+		if (!enabled || running < 0)
+			return;
+		boot_phase & phase = profile.phases[running];
+		phase.duration_ns = (now ? now : monotonic_ns()) - phase.start_ns;
+		phase.total_ns = phase.duration_ns;
+		phase.ok = ok;
+		running = -1;
+	}
+	void succeeded() {
+		profile.ok = true;
+	}
+	/*
+	 * Driver counters are kept since the module was loaded, take them
+	 * before the boot so runs of its phases are counted for this boot only
+	 */
+	void start_driver_phases(filehandle_t cpu_fd) {
+		if (enabled)
+			have_driver_base = read_driver_phases(cpu_fd, driver_base);
+	}
+	/*
+	 * Add phases the driver run since the boot started. The timeline shows
+	 * the last run of each, runs and total tell how often and how long all
+	 * of them took.
+	 */
+	void add_driver_phases(filehandle_t cpu_fd) {
+		if (!enabled)
+			return;
+		vca_csm_ioctl_phase_times times;
+		if (!read_driver_phases(cpu_fd, times))
+			return;
+		for (__u32 i = 0; i < times.nr_phases && i < VCA_LBP_PHASES_MAX; i++) {
+			const vca_lbp_phase_time & t = times.phases[i];
+			if (!t.count || t.last_start_ns < profile.start_ns)
+				continue;
+			boot_phase phase = { std::string(t.name, strnlen(t.name, sizeof(t.name))),
+					     "driver", t.last_start_ns, t.last_us * 1000, 1, t.last_us * 1000, true };
+			const vca_lbp_phase_time & b = driver_base.phases[i];
+			if (have_driver_base && i < driver_base.nr_phases &&
+			    !strncmp(t.name, b.name, sizeof(t.name)) && t.count > b.count) {
+				phase.runs = t.count - b.count;
+				phase.total_ns = (t.total_us - b.total_us) * 1000;
+			}
+			profile.phases.push_back(phase);
+		}
+	}
+};
+
+static std::string json_escape(const std::string & str)
+{
+	std::string out;
+	for (size_t i = 0; i < str.size(); i++) {
+		unsigned char c = str[i];
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		} else if (c < 0x20) {
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			out += buf;
+		} else {
+			out += c;
+		}
+	}
+	return out;
+}
+
+static bool phase_starts_before(const boot_phase & a, const boot_phase & b)
+{
+	return a.start_ns < b.start_ns;
+}
+
+/* Print timelines of all nodes booted and save them for aggregation */
+void report_boot_profiles()
+{
+	boost::mutex::scoped_lock lock(boot_profiles_lock);
+	if (boot_profiles.empty())
+		return;
+
+	FILE *json = fopen(VCACTL_BOOT_PROFILE_PATH, "w");
+	if (!json)
+		LOG_ERROR("Cannot write boot profile to %s: %s\n", VCACTL_BOOT_PROFILE_PATH, strerror(errno));
+	else
+		fprintf(json, "{\n\t\"version\": 1,\n\t\"nodes\": [");
+
+	for (size_t n = 0; n < boot_profiles.size(); n++) {
+		node_boot_profile & p = boot_profiles[n];
+		std::stable_sort(p.phases.begin(), p.phases.end(), phase_starts_before);
+
+		LOG_INFO("Card: %d Cpu: %d - boot profile, %s in %.3f ms:\n", p.card_id, p.cpu_id,
+			 p.ok ? "succeeded" : "failed", p.duration_ns / 1e6);
+		LOG_INFO("%12s %12s  %s\n", "start_ms", "duration_ms", "phase");
+		for (size_t i = 0; i < p.phases.size(); i++) {
+			const boot_phase & ph = p.phases[i];
+			char runs[64] = "";
+			if (ph.runs > 1)
+				snprintf(runs, sizeof(runs), " (last of %llu runs, %.3f ms total)",
+					 (unsigned long long)ph.runs, ph.total_ns / 1e6);
+			LOG_INFO("%12.3f %12.3f  %s%s%s%s\n", (ph.start_ns - p.start_ns) / 1e6,
+				 ph.duration_ns / 1e6, ph.source == "driver" ? "  driver/" : "",
+				 ph.name.c_str(), runs, ph.ok ? "" : " (failed)");
+		}
+
+		if (!json)
+			continue;
+		fprintf(json, "%s\n\t\t{\n\t\t\t\"card\": %d,\n\t\t\t\"cpu\": %d,\n"
+			"\t\t\t\"image\": \"%s\",\n\t\t\t\"ok\": %s,\n\t\t\t\"duration_ms\": %.3f,\n"
+			"\t\t\t\"phases\": [", n ? "," : "", p.card_id, p.cpu_id,
+			json_escape(p.image).c_str(), p.ok ? "true" : "false", p.duration_ns / 1e6);
+		for (size_t i = 0; i < p.phases.size(); i++) {
+			const boot_phase & ph = p.phases[i];
+			fprintf(json, "%s\n\t\t\t\t{ \"name\": \"%s\", \"source\": \"%s\", "
+				"\"start_ms\": %.3f, \"duration_ms\": %.3f, \"runs\": %llu, "
+				"\"total_ms\": %.3f, \"ok\": %s }",
+				i ? "," : "", json_escape(ph.name).c_str(), ph.source.c_str(),
+				(ph.start_ns - p.start_ns) / 1e6, ph.duration_ns / 1e6,
+				(unsigned long long)ph.runs, ph.total_ns / 1e6,
+				ph.ok ? "true" : "false");
+		}
+		fprintf(json, "\n\t\t\t]\n\t\t}");
+	}
+
+	if (json) {
+		fprintf(json, "\n\t]\n}\n");
+		if (fclose(json))
+			LOG_ERROR("Cannot write boot profile to %s: %s\n", VCACTL_BOOT_PROFILE_PATH, strerror(errno));
+		else
+			LOG_INFO("Boot profile saved in %s\n", VCACTL_BOOT_PROFILE_PATH);
+	}
+	boot_profiles.clear();
+}
+
 bool boot(caller_data d)
 {
 	using namespace boost::interprocess;
 
 	d.LOG_CPU(DEBUG_INFO, "Running \"boot\" function!\n");
 
+	boot_profiler profile(d);
+	profile.mark("prepare");
+
 	if (!validate_node_range(d)) {
 		d.LOG_CPU_ERROR("Invalid caller data\n");
 		return false;
@@ -2138,6 +2788,7 @@ bool boot(caller_data d)
 		d.LOG_CPU_ERROR("Node is locked. Use `lslocks` to see what process holds the lock.\n");
 		return false;
 	}
+	profile.start_driver_phases(cpu_fd);
 	#ifdef SGX
 	unsigned long long current_state;
 	std::string fix_command;
@@ -2196,12 +2847,17 @@ bool boot(caller_data d)
 
 	if (!relative_path)
 		return false;
+	profile.set_image(relative_path);
 
 	char boot_path[PATH_MAX + 1];
 	struct stat info;
 	char const*file_lbp = NULL;
+	boot_image_compression compression = BOOT_IMAGE_RAW;
+	std::string decompressor;
+	size_t image_size = 0;
+	bool blk_boot = !strcmp(relative_path, BLOCKIO_BOOT_DEV_NAME);
 
-	if (!strcmp(relative_path, BLOCKIO_BOOT_DEV_NAME)) {
+	if (blk_boot) {
 		d.LOG_CPU(DEBUG_INFO, "BOOT BLOCK DEVICE!\n");
 		STRCPY_S(boot_path, relative_path, sizeof(boot_path));
 	} else {
@@ -2217,13 +2873,31 @@ bool boot(caller_data d)
 			d.LOG_CPU_ERROR("fstat: %s: %s\n", strerror(errno), boot_path);
 			return false;
 		}
-		file_lbp = (char*)mmap(0, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
-		if (file_lbp == MAP_FAILED) {
-			d.LOG_CPU_ERROR("Could not open file: %s\n", boot_path);
-			return false;
+		compression = get_boot_image_compression(fd);
+		if (compression != BOOT_IMAGE_RAW) {
+			if (!find_decompressor(compression, decompressor)) {
+				d.LOG_CPU_ERROR("No %s found to decompress file: %s\n",
+					compression == BOOT_IMAGE_ZSTD ? "zstd" : "pigz or gzip",
+					boot_path);
+				return false;
+			}
+			profile.mark("image_size");
+			/* never mapped, decompressed straight into the driver */
+			if (!get_uncompressed_size(d, fd, boot_path, info, compression,
+						   decompressor, image_size)) {
+				d.LOG_CPU_ERROR("Could not decompress file: %s\n", boot_path);
+				return false;
+			}
+		} else {
+			file_lbp = (char*)mmap(0, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			if (file_lbp == MAP_FAILED) {
+				d.LOG_CPU_ERROR("Could not open file: %s\n", boot_path);
+				return false;
+			}
 		}
 	}
 
+	profile.mark("check_state");
 	unsigned char mac_addr[6] = {0};
 	enum vca_card_type type = get_card_type(d.card_id);
 	if (type & VCA_PRODUCTION) {
@@ -2245,7 +2919,7 @@ bool boot(caller_data d)
 			return false;
 		}
 
-		if (!file_lbp) {
+		if (blk_boot) {
 			close_on_exit blk_dev_fd = open_blk_fd(d.card_id, d.cpu_id);
 			if (!blk_dev_fd)
 				return false;
@@ -2256,6 +2930,7 @@ bool boot(caller_data d)
 			}
 		}
 
+		profile.mark("prepare_cpu");
 		/* Make sure vop device is removed. It is possible that virtio device is removed
 		 * while old vop device is still registered. This happens when card reset
 		 * was triggered by the card rather than via vcactl */
@@ -2269,7 +2944,9 @@ bool boot(caller_data d)
 			return false;
 		}
 
+		profile.mark("set_bios_params");
 		if (try_set_new_bios_params(cpu_fd, d)) {
+			profile.mark("bios_reset");
 			reset(d);
 			d.LOG_CPU(DEBUG_INFO, "WAITING FOR BIOS UP!\n");
 			if (!wait_bios(d))
@@ -2279,6 +2956,7 @@ bool boot(caller_data d)
 				return false;
 		}
 
+		profile.mark("get_mac_addr");
 		if (!get_mac_addr(cpu_fd, d, mac_addr)) {
 			d.LOG_CPU_ERROR("Could not get mac address!\n");
 			return false;
@@ -2296,23 +2974,36 @@ bool boot(caller_data d)
 			}
 		}
 
+		profile.mark("set_time");
 		if (!set_time(cpu_fd, d)){
 			d.LOG_CPU_ERROR("Could not set time!\n");
 			return false;
 		}
 
+		profile.mark("upload");
 		bool boot_res = false;
-		if (!file_lbp) {
+		if (blk_boot) {
 			d.LOG_CPU(DEBUG_INFO, "TRYING TO BOOT VCABLK0!\n");
 			boot_res = try_ioctl_with_blk(cpu_fd, LBP_BOOT_BLKDISK, d);
+		} else if (compression != BOOT_IMAGE_RAW) {
+			d.LOG_CPU(DEBUG_INFO, "TRYING TO BOOT LBP FROM COMPRESSED IMAGE!\n");
+			boot_res = try_ioctl_with_stream(cpu_fd, d, decompressor, boot_path, image_size);
 		} else {
 			d.LOG_CPU(DEBUG_INFO, "TRYING TO BOOT LBP!\n");
-			boot_res = try_ioctl_with_img(cpu_fd, LBP_BOOT_RAMDISK, d, (void*)file_lbp, info.st_size);
+			__u32 image_id;
+			if (get_boot_image_id(d, boot_path, info, file_lbp, image_id))
+				boot_res = boot_registered_image(cpu_fd, d, image_id);
+			if (!boot_res)
+				boot_res = try_ioctl_with_img(cpu_fd, LBP_BOOT_RAMDISK, d, (void*)file_lbp, info.st_size);
 			munmap((void*)file_lbp, info.st_size);
 		}
 
+		profile.end(boot_res);
+		profile.add_driver_phases(cpu_fd);
+
 		if (boot_res) {
 			d.LOG_CPU(DEBUG_INFO, "EFI OS LOADER COMPLETED!\n");
+			profile.mark("start_csm");
 			start_csm(cpu_fd, d);
 		}
 		else {
@@ -2320,13 +3011,29 @@ bool boot(caller_data d)
 			return false;
 		}
 	} else {
+		profile.mark("start_csm");
 		start_csm(cpu_fd, d);
 	}
 
-	if (pass_script(d, mac_addr))
-		return config.save_cpu_field(d.card_id, d.cpu_id, "last-os-image", boot_path);
+	profile.mark("pass_script");
+	if (!pass_script(d, mac_addr))
+		return false;
+	if (!config.save_cpu_field(d.card_id, d.cpu_id, "last-os-image", boot_path))
+		return false;
 
-	return false;
+	/*
+	 * card side OS startup is timed by waiting for it, only when profiling,
+	 * an OS not coming up in time is a failed phase, not a failed boot
+	 */
+	profile.succeeded();
+	if (profile.is_enabled()) {
+		profile.mark("os_startup");
+		bool os_up = wait(d);
+		if (!os_up)
+			d.LOG_CPU(DEBUG_INFO, "OS startup not timed, waiting for the OS failed\n");
+		profile.end(os_up);
+	}
+	return true;
 }
 
 bool boot_USB(caller_data d)
@@ -3790,13 +4497,13 @@ static void print_blk_dev_description(unsigned int card_id, unsigned int cpu_id,
 	if (size_mb == "") size_mb = dash;
 	if (file_path == "") file_path = dash;
 
-	printf("%5u %5u %9s %9s %8s %9s %s\n", card_id, cpu_id, name.c_str(), get_blk_state_cstr(state), mode.c_str(), size_mb.c_str(), file_path.c_str());
+	printf("%5u %5u %9s %9s %10s %9s %s\n", card_id, cpu_id, name.c_str(), get_blk_state_cstr(state), mode.c_str(), size_mb.c_str(), file_path.c_str());
 }
 
 static void print_blk_dev_header()
 {
-	printf("%5s %5s %9s %9s %8s %9s %2s\n", "Card", "Cpu", "Name", "State", "Mode", "Size(MB)", "FilePath");
-	printf("------------------------------------------------------------\n");
+	printf("%5s %5s %9s %9s %10s %9s %2s\n", "Card", "Cpu", "Name", "State", "Mode", "Size(MB)", "FilePath");
+	printf("--------------------------------------------------------------\n");
 }
 
 bool reboot(caller_data d)
@@ -4388,6 +5095,10 @@ bool print_blk_list(caller_data d, filehandle_t blk_dev_fd, unsigned int blk_dev
 		else {
 			file_path = info.file_path;
 			mode = get_mode_string(info.mode);
+			if (info.type == VCABLK_DISK_TYPE_BDEV)
+				mode += "-" BLOCKIO_OPTION_BDEV;
+			else if (info.flags & VCABLK_DISK_FLAG_DIRECT)
+				mode += "-" BLOCKIO_OPTION_DIRECT;
 		}
 
 		size_mb = int_to_string(B_TO_MB(info.size));
@@ -4410,6 +5121,10 @@ bool print_blk_list(caller_data d, filehandle_t blk_dev_fd, unsigned int blk_dev
 		} else {
 			file_path = s_path;
 			mode = s_mode;
+			if (config.get_blk_field(d.card_id, d.cpu_id, blk_dev_id, blk_dev_fields::bdev).get_number())
+				mode += "-" BLOCKIO_OPTION_BDEV;
+			else if (config.get_blk_field(d.card_id, d.cpu_id, blk_dev_id, blk_dev_fields::direct).get_number())
+				mode += "-" BLOCKIO_OPTION_DIRECT;
 		}
 
 		if (is_blk_enabled(d.card_id, d.cpu_id, blk_dev_id))
@@ -4448,7 +5163,7 @@ bool blockio_ctl_list(caller_data d)
 	return true;
 }
 
-bool update_blk_config_fields(caller_data d, unsigned int blk_dev_id, const char *mode, const char *ramdisk_size, const char *file_path)
+bool update_blk_config_fields(caller_data d, unsigned int blk_dev_id, const char *mode, const char *ramdisk_size, const char *file_path, const char *option)
 {
 	if (!config.blk_dev_exist(d.card_id, d.cpu_id, blk_dev_id)) {
 		if (config.add_blk_dev_fields(d.card_id, d.cpu_id, blk_dev_id)) {
@@ -4464,7 +5179,11 @@ bool update_blk_config_fields(caller_data d, unsigned int blk_dev_id, const char
 
 	if (!config.save_blk_field(d.card_id, d.cpu_id, blk_dev_id, BLK_CONFIG_MODE_STR, "") ||
 		!config.save_blk_field(d.card_id, d.cpu_id, blk_dev_id, BLK_CONFIG_RAMDISK_SIZE_STR, "0") ||
-		!config.save_blk_field(d.card_id, d.cpu_id, blk_dev_id, BLK_CONFIG_PATH_STR, ""))
+		!config.save_blk_field(d.card_id, d.cpu_id, blk_dev_id, BLK_CONFIG_PATH_STR, "") ||
+		!config.save_blk_field(d.card_id, d.cpu_id, blk_dev_id, BLK_CONFIG_DIRECT_STR,
+			option && !strcmp(option, BLOCKIO_OPTION_DIRECT) ? "1" : "0") ||
+		!config.save_blk_field(d.card_id, d.cpu_id, blk_dev_id, BLK_CONFIG_BDEV_STR,
+			option && !strcmp(option, BLOCKIO_OPTION_BDEV) ? "1" : "0"))
 		return false;
 
 	if (mode && (!ramdisk_size != !file_path)) {
@@ -4500,6 +5219,9 @@ bool check_blk_path(caller_data d, int cards_num)
 	// TODO: refactor handling of command starting in order to simplify
 	//       and remove this ugly static
 	static std::string previous_file_path;
+	// boot runs this for all nodes at once
+	static boost::mutex previous_file_path_lock;
+	boost::lock_guard<boost::mutex> lock(previous_file_path_lock);
 	unsigned int blk_dev_id = atoi(d.args.get_arg(BLOCKIO_ID_ARG).c_str());
 	std::string mode = d.args.get_arg(BLOCKIO_MODE_ARG);
 	std::string file_path;
@@ -4574,7 +5296,7 @@ bool blockio_ctl_open(caller_data d)
 		if (!is_unsigned_number(disk_size.c_str()) || atoi(disk_size.c_str()) == 0) {
 			LOG_ERROR("Cannot parse ramdisk size! %s \n", disk_size.c_str());
 			return false;
-		} else if (!update_blk_config_fields(d, blk_dev_id, mode.c_str(), disk_size.c_str(), NULL)) {
+		} else if (!update_blk_config_fields(d, blk_dev_id, mode.c_str(), disk_size.c_str(), NULL, NULL)) {
 			d.LOG_CPU_ERROR("Cannot update config for block device %s\n",
 				get_block_dev_name_from_id(blk_dev_id).c_str());
 			return false;
@@ -4582,6 +5304,7 @@ bool blockio_ctl_open(caller_data d)
 		d.LOG_CPU(DEBUG_INFO, "Using block device described in config\n");
 	} else if (!strcmp(mode.c_str(), BLOCKIO_MODE_RO) || !strcmp(mode.c_str(), BLOCKIO_MODE_RW)) {
 		std::string file_path = d.args.get_arg(BLOCKIO_MODE_PARAM_ARG);
+		std::string option = d.args.get_arg(BLOCKIO_OPTION_ARG);
 		char resolved_path[PATH_MAX + 1];
 		if (!realpath(file_path.c_str(), resolved_path)) {
 			d.LOG_CPU_ERROR("Cannot canonicalize block path (got %s): %s!\n",
@@ -4590,7 +5313,11 @@ bool blockio_ctl_open(caller_data d)
 		} else if (!file_exists(resolved_path)) {
 			d.LOG_CPU_ERROR("Wrong blockio type param! Can't access file %s.\n", resolved_path);
 			return false;
-		} else if (!update_blk_config_fields(d, blk_dev_id, mode.c_str(), NULL, resolved_path)) {
+		} else if (option == BLOCKIO_OPTION_BDEV && !is_blk_bdev_path(resolved_path)) {
+			d.LOG_CPU_ERROR("Option " BLOCKIO_OPTION_BDEV " needs a block device, %s is not.\n", resolved_path);
+			return false;
+		} else if (!update_blk_config_fields(d, blk_dev_id, mode.c_str(), NULL, resolved_path,
+				option.empty() ? NULL : option.c_str())) {
 			d.LOG_CPU_ERROR("Cannot update config for block device %s\n",
 				get_block_dev_name_from_id(blk_dev_id).c_str());
 			return false;
@@ -4966,6 +5693,28 @@ parsing_output optional_blockio_type_param(const char *arg, args_holder &holder)
 	return PARSED;
 }
 
+parsing_output optional_blockio_option(const char *arg, args_holder &holder)
+{
+	if (!arg)
+		return NOT_PARSED;
+
+	if (holder.get_arg(SUBCMD) != BLOCKIO_SUBCMD_OPEN)
+		return NOT_PARSED;
+
+	if (holder.get_arg(BLOCKIO_MODE_ARG) != BLOCKIO_MODE_RO &&
+	    holder.get_arg(BLOCKIO_MODE_ARG) != BLOCKIO_MODE_RW)
+		return NOT_PARSED;
+
+	if (strcmp(arg, BLOCKIO_OPTION_DIRECT) && strcmp(arg, BLOCKIO_OPTION_BDEV)) {
+		LOG_ERROR("Wrong blockio option %s! Allowed values: %s, %s.\n", arg,
+			BLOCKIO_OPTION_DIRECT, BLOCKIO_OPTION_BDEV);
+		return PARSING_FAILED;
+	}
+
+	holder.add_arg(BLOCKIO_OPTION_ARG, arg);
+	return PARSED;
+}
+
 parsing_output optional_file(const char *arg, args_holder & holder)
 {
 	if (!arg)
@@ -5318,7 +6067,7 @@ static cmd_desc const commands_desc[] = {
     cmd_desc("reset", new threaded_caller(_reset), optional_card_id, optional_cpu_id),
     cmd_desc("wait", new threaded_caller(wait), optional_card_id, optional_cpu_id),
     cmd_desc("wait-BIOS", new threaded_caller(wait_bios), optional_card_id, optional_cpu_id),
-    cmd_desc("boot", new sequential_caller(boot), optional_card_id, optional_cpu_id, optional_file, optional_value_force_get_last_os),
+    cmd_desc("boot", new threaded_caller(boot, true), optional_card_id, optional_cpu_id, optional_file, optional_value_force_get_last_os),
     cmd_desc("reboot", new threaded_caller(reboot), optional_card_id, optional_cpu_id, optional_file),
     cmd_desc("update-BIOS", new threaded_caller(update_bios), optional_card_id, optional_cpu_id, requires_file),
     cmd_desc("recover-BIOS", new threaded_caller(update_bios), optional_card_id, optional_cpu_id, requires_file),
@@ -5341,7 +6090,7 @@ static cmd_desc const commands_desc[] = {
     cmd_desc("pwrbtn-long", new threaded_caller(hold_power_button), optional_card_id, optional_cpu_id),
     cmd_desc("help", new sequential_caller(help)),
     cmd_desc("blockio", new sequential_caller(blockio_ctl), get_subcmds("blockio"), requires_subcommand, optional_card_id, optional_cpu_id,
-						  optional_blockio_id, optional_blockio_type, optional_blockio_type_param),
+						  optional_blockio_id, optional_blockio_type, optional_blockio_type_param, optional_blockio_option),
     cmd_desc("os-shutdown", new sequential_caller(os_shutdown), optional_card_id, optional_cpu_id),
     cmd_desc("get-BIOS-cfg", new sequential_caller(get_bios_cfg), optional_card_id, optional_cpu_id, optional_bios_cfg_name),
     cmd_desc("set-BIOS-cfg", new threaded_caller(set_bios_cfg), optional_card_id, optional_cpu_id, requires_bios_cfg_name_and_value_pairs),
@@ -5520,6 +6269,10 @@ int main(int argc, char *argv[])
 
 		/* ~thread_manager waits for all threads to finish before exitting */
 		delete thread_mgr;
+		if (cmd)
+			cmd->caller->report();
+		unregister_boot_images();
+		report_boot_profiles();
 
 		return command_err;
 	}
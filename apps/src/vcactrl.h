@@ -93,9 +93,12 @@
 #define BLOCKIO_ID_ARG		"blockio_id"
 #define BLOCKIO_MODE_ARG	"blockio_mode"
 #define BLOCKIO_MODE_PARAM_ARG	"blockio_mode_param"
+#define BLOCKIO_OPTION_ARG	"blockio_option"
 #define BLOCKIO_MODE_RO		"RO"
 #define BLOCKIO_MODE_RW		"RW"
 #define BLOCKIO_MODE_RAMDISK	"ramdisk"
+#define BLOCKIO_OPTION_DIRECT	"direct"
+#define BLOCKIO_OPTION_BDEV	"bdev"
 #define BLOCKIO_BOOT_DEV_NAME	"vcablk0"
 
 #define GOLD_CMD		"golden-BIOS"
@@ -153,29 +153,46 @@ static int vcablk_device_stop_id(struct vcablk_dev *fdev, int dev_id, bool force
 	return err;
 }
 
+static void vcablk_device_response_clean(struct vcablk_dev *fdev, int dev_id)
+{
+	struct vcablk_device_response *response = &fdev->pages->devs[dev_id].response;
+	int i;
+
+	response->queues_num = 0;
+	for (i = 0; i < VCABLK_MAX_QUEUES; i++) {
+		response->queues[i].request_ring = 0;
+		response->queues[i].request_ring_size = 0;
+		response->queues[i].completion_ring = 0;
+		response->queues[i].completion_ring_size = 0;
+		response->queues[i].done_db = -1;
+	}
+	wmb();
+}
+
 static int vcablk_device_destroy_id(struct vcablk_dev *fdev, int dev_id)
 {
 	int err;
 	/* TODO: Frontend should wait on bcknd to stop. */
 
 	if (fdev->vcablk_disks) {
-		struct vcablk_ring *ring_req = vcablk_disk_get_rings_req(fdev->vcablk_disks[dev_id]);
-		struct vcablk_ring *completion_ring = vcablk_disk_get_rings_ack(fdev->vcablk_disks[dev_id]);
+		struct vcablk_ring *rings_req[VCABLK_MAX_QUEUES];
+		struct vcablk_ring *completion_rings[VCABLK_MAX_QUEUES];
+		int queues_num = vcablk_disk_get_queues_num(fdev->vcablk_disks[dev_id]);
+		int i;
+
+		for (i = 0; i < queues_num; i++) {
+			rings_req[i] = vcablk_disk_get_rings_req(fdev->vcablk_disks[dev_id], i);
+			completion_rings[i] = vcablk_disk_get_rings_ack(fdev->vcablk_disks[dev_id], i);
+		}
 		err = vcablk_disk_destroy(fdev->vcablk_disks[dev_id]);
 
-		fdev->pages->devs[dev_id].response.request_ring = 0;
-		fdev->pages->devs[dev_id].response.request_ring_size = 0;
-		fdev->pages->devs[dev_id].response.completion_ring = 0;
-		fdev->pages->devs[dev_id].response.completion_ring_size = 0;
-		fdev->pages->devs[dev_id].response.done_db = -1;
-		wmb();
+		vcablk_device_response_clean(fdev, dev_id);
 
 		fdev->vcablk_disks[dev_id] = NULL;
-		destroy_ring(fdev, ring_req);
-		ring_req = NULL;
-
-		destroy_ring(fdev, completion_ring);
-		completion_ring = NULL;
+		for (i = 0; i < queues_num; i++) {
+			destroy_ring(fdev, rings_req[i]);
+			destroy_ring(fdev, completion_rings[i]);
+		}
 
 	} else {
 		err = -ENODEV;
@@ -214,9 +231,13 @@ static void vcablk_clean(struct vcablk_dev *fdev)
 
 static int vcablk_task_create(struct vcablk_dev *fdev, int dev_id)
 {
-	struct vcablk_ring *ring_req = NULL, *completion_ring = NULL;
+	struct vcablk_ring *rings_req[VCABLK_MAX_QUEUES] = { NULL };
+	struct vcablk_ring *completion_rings[VCABLK_MAX_QUEUES] = { NULL };
+	int done_dbs_local[VCABLK_MAX_QUEUES];
+	struct vcablk_device_response *response;
+	int queues_num;
 	int err;
-	int done_db_local;
+	int i;
 	static struct vcablk_disk *dev = NULL;
 
 	if (dev_id < 0 || dev_id >= fdev->max_dev) {
@@ -232,32 +253,61 @@ static int vcablk_task_create(struct vcablk_dev *fdev, int dev_id)
 		goto exit;
 	}
 
-	ring_req = init_request_ring(fdev, VCABLK_QUEUE_REQUESTS_NUMS);
-	if (IS_ERR(ring_req)) {
-		err = PTR_ERR(ring_req);
-		goto deinit_rings;
-	}
+	response = &fdev->pages->devs[dev_id].response;
+	queues_num = vcablk_disk_queues_num(fdev->pages->devs[dev_id].queues_max);
 
-	completion_ring = init_completion_ring(fdev, VCABLK_QUEUE_ACK_NUMS);
-	if (IS_ERR(completion_ring)) {
-		err = PTR_ERR(completion_ring);
-		goto deinit_rings;
+	/*
+	 * Doorbell for each hardware queue. Doorbells are handed out
+	 * round-robin from a small pool, the ones of other disks and devices
+	 * may be shared, a completion raised for another queue only makes
+	 * this one find its ring empty. Queues of the disk never share one,
+	 * queues_num is cut where a doorbell would come again.
+	 */
+	for (i = 0; i < queues_num; i++) {
+		int j;
+
+		done_dbs_local[i] = fdev->hw_ops->next_db(fdev->parent);
+		if (done_dbs_local[i] < 0) {
+			pr_err("%s: Can not get Doorbell\n", __func__);
+			err = -ENODEV;
+			goto exit;
+		}
+		for (j = 0; j < i && done_dbs_local[j] != done_dbs_local[i]; j++)
+			;
+		if (j < i) {
+			pr_info("%s: dev %i queues limited to %i by doorbells\n",
+					__func__, dev_id, i);
+			queues_num = i;
+			break;
+		}
 	}
 
-	done_db_local = fdev->hw_ops->next_db(fdev->parent);
-	if (done_db_local < 0) {
-		pr_err("%s: Can not get Doorbell\n", __func__);
-		err = -ENODEV;
-		goto deinit_rings;
+	/* Ring pair for each hardware queue */
+	for (i = 0; i < queues_num; i++) {
+		rings_req[i] = init_request_ring(fdev,
+				VCABLK_QUEUE_REQUESTS_NUMS_PER_QUEUE(queues_num));
+		if (IS_ERR(rings_req[i])) {
+			err = PTR_ERR(rings_req[i]);
+			rings_req[i] = NULL;
+			goto deinit_rings;
+		}
+
+		completion_rings[i] = init_completion_ring(fdev, VCABLK_QUEUE_ACK_NUMS);
+		if (IS_ERR(completion_rings[i])) {
+			err = PTR_ERR(completion_rings[i]);
+			completion_rings[i] = NULL;
+			goto deinit_rings;
+		}
 	}
 
-	pr_info("%s: start create id dev %i\n", __func__, dev_id);
+	pr_info("%s: start create id dev %i queues %i\n", __func__, dev_id,
+			queues_num);
 	dev = vcablk_disk_create(
 			fdev,
 			dev_id,
 			fdev->pages->devs[dev_id].size_bytes,
 			fdev->pages->devs[dev_id].read_only,
-			ring_req, completion_ring, done_db_local,
+			queues_num, rings_req, completion_rings, done_dbs_local,
 			fdev->pages->devs[dev_id].request_db);
 
 	if (IS_ERR(dev)) {
@@ -270,27 +320,24 @@ static int vcablk_task_create(struct vcablk_dev *fdev, int dev_id)
 	pr_info("%s: device create id %i\n", __func__, dev_id);
 	fdev->vcablk_disks[dev_id] = dev;
 
-	fdev->pages->devs[dev_id].response.request_ring = ring_req->dma_addr;
-	fdev->pages->devs[dev_id].response.request_ring_size = ring_req->size_alloc;
-	fdev->pages->devs[dev_id].response.completion_ring = completion_ring->dma_addr;
-	fdev->pages->devs[dev_id].response.completion_ring_size = completion_ring->size_alloc;
-	fdev->pages->devs[dev_id].response.done_db = done_db_local;
+	for (i = 0; i < queues_num; i++) {
+		response->queues[i].request_ring = rings_req[i]->dma_addr;
+		response->queues[i].request_ring_size = rings_req[i]->size_alloc;
+		response->queues[i].completion_ring = completion_rings[i]->dma_addr;
+		response->queues[i].completion_ring_size = completion_rings[i]->size_alloc;
+		response->queues[i].done_db = done_dbs_local[i];
+	}
+	response->queues_num = queues_num;
 	wmb();
 
 	return 0;
 deinit_rings:
-	fdev->pages->devs[dev_id].response.request_ring = 0;
-	fdev->pages->devs[dev_id].response.request_ring_size = 0;
-	fdev->pages->devs[dev_id].response.completion_ring = 0;
-	fdev->pages->devs[dev_id].response.completion_ring_size = 0;
-	fdev->pages->devs[dev_id].response.done_db = -1;
-	wmb();
-
-	destroy_ring(fdev, ring_req);
-	ring_req = NULL;
+	vcablk_device_response_clean(fdev, dev_id);
 
-	destroy_ring(fdev, completion_ring);
-	completion_ring = NULL;
+	for (i = 0; i < VCABLK_MAX_QUEUES; i++) {
+		destroy_ring(fdev, rings_req[i]);
+		destroy_ring(fdev, completion_rings[i]);
+	}
 exit:
 	pr_err("%s failed with status %d\n", __func__, err);
 	return err;
@@ -430,6 +477,8 @@ struct vcablk_dev* vcablk_init(struct device *dev, void* dev_page, size_t dev_pa
 
 	fdev->pages = dev_page;
 	fdev->pages->version_frontend = VCA_BLK_VERSION;
+	fdev->pages->features_frontend = VCABLK_FEATURE_SEGMENTS;
+	fdev->pages->features_backend = 0;
 	fdev->pages->dev_page_size = dev_page_size;
 	fdev->pages->reinit_dev_page = 1;
 	fdev->pages->destroy_devpage = 0;
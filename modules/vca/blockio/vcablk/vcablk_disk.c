@@ -36,11 +36,22 @@
 #include <linux/genhd.h>
 #include <linux/blkdev.h>
 #include <linux/kthread.h>
+#include <linux/vmalloc.h>
 #include <linux/version.h>
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5,1,16) || LINUX_VERSION_CODE == KERNEL_VERSION(4,18,0) // the blk_status_t actually appeared in 4.13.x
+	#define VCABLK_BLK_MQ
 	#include <linux/blk-mq.h>
 #endif
 
+#ifdef VCABLK_BLK_MQ
+/* Status of request put back to queue until the completion handler restart it */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 17, 0)
+#define VCABLK_STS_RING_FULL	BLK_STS_DEV_RESOURCE
+#else
+#define VCABLK_STS_RING_FULL	BLK_STS_RESOURCE
+#endif
+#endif /* VCABLK_BLK_MQ */
+
 #include "vcablk_common/vcablk_common.h"
 #include "vcablk_hal.h"
 #include "vcablk_pool.h"
@@ -75,9 +86,15 @@ struct vcablk_bio_context {
 	__u16 id;
 	struct request *req;
 	unsigned bvec_ctxs_idx;
-	struct bvec_context bvec_ctxs[VCABLK_BIO_SPLIT_SIZE];
+	struct bvec_context *bvec_ctxs;     /* split_size entries of queue */
+
+	/* Segment table not sent yet, used if backend accept segments */
+	__u16 segments_num;
+	__u64 sector;
+	__u64 sectors_num;
 };
 
+#ifndef VCABLK_BLK_MQ
 #define REQ_RING_SIZE (2048)
 #define REQ_RING_MASK ((REQ_RING_SIZE)-1)
 
@@ -92,6 +109,48 @@ struct request_ring {
 	 * To be safe add biggest array, because can be some sync requests. */
 	struct request* ring[REQ_RING_SIZE];
 };
+#endif /* VCABLK_BLK_MQ */
+
+/*
+ * Request and completion ring pair shared with backend,
+ * one for each hardware queue.
+ */
+struct vcablk_queue {
+	struct vcablk_disk *dev;
+	int id;
+	struct mutex lock;                  /* Serialize requests put to ring */
+
+	int bio_done_db;
+	void *bio_done_irq;
+
+	int request_db;
+	wait_queue_head_t	request_ring_wait; /* wait queue for release request_ring */
+	struct vcablk_ring *request_ring;
+	__u16 request_ring_alloc;
+	struct vcablk_ring *completion_ring;
+
+	struct work_struct request_completion_work;
+#ifdef VCABLK_BLK_MQ
+	struct blk_mq_hw_ctx *hctx;         /* Restarted when ring space released */
+#endif
+
+	vcablk_pool_t *bio_context_pool;
+	spinlock_t bio_context_pool_lock;
+	wait_queue_head_t bio_context_pool_wait;
+
+	__u16 split_request_error;          /* Remember error of part split request */
+
+	/* Pages of a request sent in one part, VCABLK_MAX_SEGMENTS when the
+	 * backend accept segment tables, VCABLK_BIO_SPLIT_SIZE otherwise */
+	unsigned split_size;
+	struct bvec_context *bvec_ctxs;     /* split_size for each bio_context */
+
+	/* Segment tables, split_size elements for each bio_context,
+	 * NULL when backend not accept VCABLK_FEATURE_SEGMENTS */
+	struct vcablk_segment *segments;
+	dma_addr_t segments_da;
+	size_t segments_size;
+};
 
 /*
  * The internal representation of our device.
@@ -105,36 +164,26 @@ struct vcablk_disk {
 	short ref_cnt;                      /* How many users */
 	struct request_queue *queue;        /* The device request queue */
 	struct gendisk *gdisk;              /* The gendisk structure */
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,1,16) || LINUX_VERSION_CODE == KERNEL_VERSION(4,18,0) // the blk_status_t actually appeared in 4.13.x
+#ifdef VCABLK_BLK_MQ
 	struct blk_mq_tag_set tag_set;
 #endif
 	bool gdisk_started;
 	bool read_only;
+	bool stopping;                      /* Break waits on rings */
 	int dev_id;
 
-	struct task_struct	*request_thread;   /* Request task */
-	wait_queue_head_t	request_event;     /* wait queue for incoming requests */
-	wait_queue_head_t	request_ring_wait; /* wait queue for release request_ring */
-	int bio_done_db;
-	void *bio_done_irq;
-
-	int request_db;
-	struct vcablk_ring *request_ring;
-	__u16 request_ring_alloc;
-	struct vcablk_ring *completion_ring;
-
 	struct vcablk_dev* fdev;
 
-	struct work_struct request_completion_work;
-
-	vcablk_pool_t *bio_context_pool;
-	spinlock_t bio_context_pool_lock;
-	wait_queue_head_t bio_context_pool_wait;
+	int queues_num;
+	struct vcablk_queue queues[VCABLK_MAX_QUEUES];
 
-	__u16 split_request_error;          /* Remember error of part split request */
+#ifndef VCABLK_BLK_MQ
+	struct task_struct	*request_thread;   /* Request task */
+	wait_queue_head_t	request_event;     /* wait queue for incoming requests */
 
 	struct request_ring req_ring;
 	spinlock_t req_ring_lock;
+#endif /* VCABLK_BLK_MQ */
 };
 
 /**
@@ -157,10 +206,10 @@ vcablk_disk_format_name(char *prefix, int index, char *buf, int buflen)
 }
 
 static void
-vcablk_disk_request_clean(struct vcablk_disk *dev,
+vcablk_disk_request_clean(struct vcablk_queue *queue,
 		struct vcablk_bio_context *bio_context)
 {
-	struct vcablk_dev* fdev = dev->fdev;
+	struct vcablk_dev* fdev = queue->dev->fdev;
 	unsigned int i;
 	for (i = 0; i <bio_context->bvec_ctxs_idx; ++i) {
 		struct bvec_context *map = bio_context->bvec_ctxs + i;
@@ -171,10 +220,10 @@ vcablk_disk_request_clean(struct vcablk_disk *dev,
 	}
 	/* Clean bvec_ctxs_idx, to check that request ended */
 	bio_context->bvec_ctxs_idx = 0;
-	spin_lock(&dev->bio_context_pool_lock);
-	vcablk_pool_push(dev->bio_context_pool, bio_context);
-	spin_unlock(&dev->bio_context_pool_lock);
-	wake_up(&dev->bio_context_pool_wait);
+	spin_lock(&queue->bio_context_pool_lock);
+	vcablk_pool_push(queue->bio_context_pool, bio_context);
+	spin_unlock(&queue->bio_context_pool_lock);
+	wake_up(&queue->bio_context_pool_wait);
 }
 
 static void
@@ -182,40 +231,43 @@ vcablk_disk_request_end(struct vcablk_disk *dev, struct request *req, int ret)
 {
 	if (ret)
 		pr_err("%s: ret %i\n", __func__, ret);
-	spin_lock_irq(&dev->lock);
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,1,16) || LINUX_VERSION_CODE == KERNEL_VERSION(4,18,0) // the blk_status_t actually appeared in 4.13.x
-	blk_mq_end_request(req, ret);
+#ifdef VCABLK_BLK_MQ
+	/* Hardware queues complete independently, no need of device lock */
+	blk_mq_end_request(req, errno_to_blk_status(ret));
 #else
+	spin_lock_irq(&dev->lock);
 	__blk_end_request_all(req, ret);
+	spin_unlock_irq(&dev->lock);
 #endif
 	if( ret )
 		pr_err("%s: Block I/O queue error %d\n", __func__, ret);
-	spin_unlock_irq(&dev->lock);
 }
 
 static void
-vcablk_disk_request_done(struct vcablk_disk *dev, __u16 id, int ret)
+vcablk_disk_request_done(struct vcablk_queue *queue, __u16 id, int ret)
 {
+	struct vcablk_disk *dev = queue->dev;
+
 	if (id) {
 		/* Cookie id increment because 0 is invalid */
 		struct vcablk_bio_context *bio_context = (struct vcablk_bio_context *)
-				vcablk_pool_get_by_id(dev->bio_context_pool, id - 1);
+				vcablk_pool_get_by_id(queue->bio_context_pool, id - 1);
 		if (bio_context) {
 			struct request *req = bio_context->req;
 			bio_context->req = NULL;
-			vcablk_disk_request_clean(dev, bio_context);
+			vcablk_disk_request_clean(queue, bio_context);
 			bio_context = NULL;
 			if (req) {
 				/* Last part of split for BIO request. */
-				if (dev->split_request_error) {
-					ret = dev->split_request_error;
-					dev->split_request_error = 0;
+				if (queue->split_request_error) {
+					ret = queue->split_request_error;
+					queue->split_request_error = 0;
 				}
 				vcablk_disk_request_end(dev, req, ret);
 			} else {
 				if (ret) {
 					/* Remember error for no last split request */
-					dev->split_request_error = ret;
+					queue->split_request_error = ret;
 				}
 			}
 		} else {
@@ -229,18 +281,19 @@ vcablk_disk_request_done(struct vcablk_disk *dev, __u16 id, int ret)
 }
 
 static struct vcablk_request *
-vcablk_disk_request_alloc_next(struct vcablk_disk *dev,
+vcablk_disk_request_alloc_next(struct vcablk_queue *queue,
 		int (*stop_f)(struct vcablk_disk *))
 {
-	struct vcablk_ring *ring = dev->request_ring;
+	struct vcablk_disk *dev = queue->dev;
+	struct vcablk_ring *ring = queue->request_ring;
 	struct vcablk_request *req = NULL;
 
-	while (VCA_RB_BUFF_FULL(dev->request_ring_alloc,
+	while (VCA_RB_BUFF_FULL(queue->request_ring_alloc,
 			ring->last_used, ring->num_elems)
 			&& (!stop_f || !stop_f(dev))) {
 		/* Pooling 1 sec on space in ring request.*/
-		int ret = wait_event_interruptible_timeout(dev->request_ring_wait,
-					!VCA_RB_BUFF_FULL(dev->request_ring_alloc,
+		int ret = wait_event_interruptible_timeout(queue->request_ring_wait,
+					!VCA_RB_BUFF_FULL(queue->request_ring_alloc,
 					READ_ONCE(ring->last_used), ring->num_elems)
 					|| (stop_f && stop_f(dev)),
 					msecs_to_jiffies(TIMEOUT_SEC * 1000));
@@ -249,68 +302,69 @@ vcablk_disk_request_alloc_next(struct vcablk_disk *dev,
 		}
 		pr_warn("%s: Wait for ring request TIMEOUT!!!  %i second last_alloc %i, "
 					"last_add %i num_elems %i. Pooling again.\n", __func__,
-					TIMEOUT_SEC, dev->request_ring_alloc, ring->last_add,
+					TIMEOUT_SEC, queue->request_ring_alloc, ring->last_add,
 					(int)ring->num_elems);
 	}
 
 	rmb();
-	if (!VCA_RB_BUFF_FULL(dev->request_ring_alloc, ring->last_used, ring->num_elems)) {
-		req = VCABLK_RB_GET_REQUEST(dev->request_ring_alloc, ring->num_elems, ring->elems);
-		dev->request_ring_alloc = VCA_RB_COUNTER_ADD(dev->request_ring_alloc, 1, ring->num_elems);
+	if (!VCA_RB_BUFF_FULL(queue->request_ring_alloc, ring->last_used, ring->num_elems)) {
+		req = VCABLK_RB_GET_REQUEST(queue->request_ring_alloc, ring->num_elems, ring->elems);
+		queue->request_ring_alloc = VCA_RB_COUNTER_ADD(queue->request_ring_alloc, 1, ring->num_elems);
 	} else {
 		pr_err("%s: request_ring_alloc full!!! last_alloc %i, "
-				"last_add %i last_used %i num_elems %i\n", __func__, dev->request_ring_alloc,
+				"last_add %i last_used %i num_elems %i\n", __func__, queue->request_ring_alloc,
 				ring->last_add, ring->last_used, (int)ring->num_elems);
 	}
 	return req;
 }
 
 static int
-vcablk_disk_request_start(struct vcablk_disk *dev)
+vcablk_disk_request_start(struct vcablk_queue *queue)
 {
-	struct vcablk_ring *ring = dev->request_ring;
-	struct vcablk_dev* fdev = dev->fdev;
+	struct vcablk_ring *ring = queue->request_ring;
+	struct vcablk_dev* fdev = queue->dev->fdev;
 
-	if (ring->last_add == dev->request_ring_alloc) {
+	if (ring->last_add == queue->request_ring_alloc) {
 		pr_err("%s: ERROR No requests to start, last_alloc %i,"
-			"last_add %i\n", __func__,dev->request_ring_alloc ,ring->last_add);
+			"last_add %i\n", __func__,queue->request_ring_alloc ,ring->last_add);
 		return -EINVAL;
 	}
 
 	wmb();
-	ring->last_add = dev->request_ring_alloc;
+	ring->last_add = queue->request_ring_alloc;
 	wmb();
 
 	/* Send IRQ request */
-	fdev->hw_ops->send_intr(fdev->parent, dev->request_db);
+	fdev->hw_ops->send_intr(fdev->parent, queue->request_db);
 	return 0;
 }
 
 static void
-vcablk_disk_request_break(struct vcablk_disk *dev,
+vcablk_disk_request_break(struct vcablk_queue *queue,
 		struct vcablk_bio_context *bio_context)
 {
-	struct vcablk_ring *ring = dev->request_ring;
+	struct vcablk_ring *ring = queue->request_ring;
 	pr_debug("%s: last_alloc %i, last_add %i, id %i\n",
-		__func__, dev->request_ring_alloc, ring->last_add,
+		__func__, queue->request_ring_alloc, ring->last_add,
 		bio_context?bio_context->id:0);
-	dev->request_ring_alloc = ring->last_add;
+	queue->request_ring_alloc = ring->last_add;
 
 	if (bio_context)
-		vcablk_disk_request_clean(dev, bio_context);
+		vcablk_disk_request_clean(queue, bio_context);
 
-	wake_up(&dev->request_ring_wait);
+	wake_up(&queue->request_ring_wait);
 }
 
 static dma_addr_t
-vcablk_disk_map_page(struct vcablk_disk *dev, struct vcablk_bio_context *bio_context,
+vcablk_disk_map_page(struct vcablk_queue *queue, struct vcablk_bio_context *bio_context,
 		struct bio_vec *bvec, enum dma_data_direction dir)
 {
+	struct vcablk_disk *dev = queue->dev;
 	dma_addr_t da;
 	int err;
 	struct bvec_context *bvctx = NULL;
 
-	if (bio_context->bvec_ctxs_idx >= VCABLK_BIO_SPLIT_SIZE) {
+	if (bio_context->bvec_ctxs_idx >= queue->split_size) {
 		pr_err("%s: bvec context alloc error\n", __func__);
 		return 0;
 	}
@@ -336,12 +390,13 @@ vcablk_disk_map_page(struct vcablk_disk *dev, struct vcablk_bio_context *bio_con
 }
 
 static int
-vcablk_disk_request_step(struct vcablk_disk *dev, struct bio_vec *bvec,
+vcablk_disk_request_step(struct vcablk_queue *queue, struct bio_vec *bvec,
 		struct vcablk_bio_context *bio_context, __u8 request,
 		unsigned long sector, unsigned long sectors_num,
 		int (*stop_f)(struct vcablk_disk *))
 {
-	struct vcablk_request *req = vcablk_disk_request_alloc_next(dev, stop_f);
+	struct vcablk_disk *dev = queue->dev;
+	struct vcablk_request *req = vcablk_disk_request_alloc_next(queue, stop_f);
 	if (!req) {
 		pr_err("%s: No available free request ring %s\n",
 				__func__, dev->gdisk->disk_name);
@@ -350,6 +405,7 @@ vcablk_disk_request_step(struct vcablk_disk *dev, struct bio_vec *bvec,
 	}
 	req->request_type = request;
 	req->cookie = bio_context->id;
+	req->segments_num = 0;
 
 	pr_debug("%s: Create request: cookie %u, request %u, "
 			"sectors_num %lu, sector %lu\n",
@@ -358,7 +414,7 @@ vcablk_disk_request_step(struct vcablk_disk *dev, struct bio_vec *bvec,
 	if (bvec && (request == REQUEST_READ || request == REQUEST_WRITE)) {
 		enum dma_data_direction dir =
 				(request == REQUEST_WRITE) ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
-		dma_addr_t da = vcablk_disk_map_page(dev, bio_context, bvec, dir);
+		dma_addr_t da = vcablk_disk_map_page(queue, bio_context, bvec, dir);
 		if (!da) {
 			pr_err("%s: Invalid MAP memory!!\n", __func__);
 			return -ENOMEM;
@@ -371,19 +427,104 @@ vcablk_disk_request_step(struct vcablk_disk *dev, struct bio_vec *bvec,
 	return 0;
 }
 
+static struct vcablk_segment *
+vcablk_disk_segments(struct vcablk_queue *queue,
+		struct vcablk_bio_context *bio_context)
+{
+	/* Cookie id is pool id incremented by one */
+	return queue->segments + (bio_context->id - 1) * queue->split_size;
+}
+
+/*
+ * Add bvec to segment table of bio_context. Segment is merged with previous
+ * one, when both are contiguous in DMA address space.
+ */
+static int
+vcablk_disk_segment_add(struct vcablk_queue *queue, struct bio_vec *bvec,
+		struct vcablk_bio_context *bio_context, __u8 request,
+		unsigned long sector, unsigned long sectors_num)
+{
+	struct vcablk_segment *segments = vcablk_disk_segments(queue, bio_context);
+	struct vcablk_segment *segment;
+	enum dma_data_direction dir =
+			(request == REQUEST_WRITE_SEGMENTS) ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
+	dma_addr_t da = vcablk_disk_map_page(queue, bio_context, bvec, dir);
+	if (!da) {
+		pr_err("%s: Invalid MAP memory!!\n", __func__);
+		return -ENOMEM;
+	}
+
+	if (!bio_context->segments_num) {
+		bio_context->sector = sector;
+		bio_context->sectors_num = 0;
+	} else {
+		segment = segments + bio_context->segments_num - 1;
+		if (segment->phys_buff +
+				((__u64)segment->sectors_num << SECTOR_SHIFT) == da) {
+			segment->sectors_num += sectors_num;
+			bio_context->sectors_num += sectors_num;
+			return 0;
+		}
+	}
+
+	segment = segments + bio_context->segments_num;
+	segment->phys_buff = da;
+	segment->sectors_num = sectors_num;
+	bio_context->segments_num++;
+	bio_context->sectors_num += sectors_num;
+	return 0;
+}
+
+/*
+ * Put to ring single request describing whole segment table of bio_context.
+ */
+static int
+vcablk_disk_segments_step(struct vcablk_queue *queue,
+		struct vcablk_bio_context *bio_context, __u8 request,
+		int (*stop_f)(struct vcablk_disk *))
+{
+	struct vcablk_request *req;
+
+	if (!bio_context->segments_num)
+		return 0;
+
+	req = vcablk_disk_request_alloc_next(queue, stop_f);
+	if (!req) {
+		pr_err("%s: No available free request ring %s\n",
+				__func__, queue->dev->gdisk->disk_name);
+		return -EBUSY;
+	}
+
+	pr_debug("%s: Create request: cookie %u, request %u, segments %u, "
+			"sectors_num %llu, sector %llu\n", __func__, bio_context->id,
+			request, bio_context->segments_num,
+			bio_context->sectors_num, bio_context->sector);
+
+	req->request_type = request;
+	req->cookie = bio_context->id;
+	req->sector = bio_context->sector;
+	req->sectors_num = bio_context->sectors_num;
+	req->segments_num = bio_context->segments_num;
+	req->phys_buff = queue->segments_da +
+			(vcablk_disk_segments(queue, bio_context) - queue->segments) *
+			sizeof(struct vcablk_segment);
+	return 0;
+}
+
 static struct vcablk_bio_context *
-vcablk_disk_get_bio_context(struct vcablk_disk *dev,
+vcablk_disk_get_bio_context(struct vcablk_queue *queue,
 		int (*stop_f)(struct vcablk_disk *))
 {
+	struct vcablk_disk *dev = queue->dev;
 	struct vcablk_bio_context *bio_context = NULL;
 	__u16 id;
 
-	while (!vcablk_is_available(dev->bio_context_pool)
+	while (!vcablk_is_available(queue->bio_context_pool)
 			&& (!stop_f || !stop_f(dev))) {
 
 		/* Pooling 1 sec on free bio context.*/
-		int ret = wait_event_interruptible_timeout(dev->bio_context_pool_wait,
-				vcablk_is_available(dev->bio_context_pool) || (stop_f && stop_f(dev)),
+		int ret = wait_event_interruptible_timeout(queue->bio_context_pool_wait,
+				vcablk_is_available(queue->bio_context_pool) || (stop_f && stop_f(dev)),
 				msecs_to_jiffies(TIMEOUT_SEC * 1000));
 		rmb();
 		if (ret >0) {
@@ -393,32 +534,45 @@ vcablk_disk_get_bio_context(struct vcablk_disk *dev,
 				"Try pooling again.\n", __func__, TIMEOUT_SEC);
 	}
 
-	if (!vcablk_is_available(dev->bio_context_pool)) {
-		wait_event_interruptible(dev->bio_context_pool_wait,
-				vcablk_is_available(dev->bio_context_pool) || (stop_f && stop_f(dev)));
+	if (!vcablk_is_available(queue->bio_context_pool)) {
+		wait_event_interruptible(queue->bio_context_pool_wait,
+				vcablk_is_available(queue->bio_context_pool) || (stop_f && stop_f(dev)));
 	}
 
-	spin_lock(&dev->bio_context_pool_lock);
-	bio_context = vcablk_pool_pop(dev->bio_context_pool, &id);
-	spin_unlock(&dev->bio_context_pool_lock);
+	spin_lock(&queue->bio_context_pool_lock);
+	bio_context = vcablk_pool_pop(queue->bio_context_pool, &id);
+	spin_unlock(&queue->bio_context_pool_lock);
 	if (bio_context) {
 		/*Cookie id 0 is invalid*/
 		bio_context->id = id + 1;
 		bio_context->req = NULL;
+		bio_context->bvec_ctxs = queue->bvec_ctxs + id * queue->split_size;
 		bio_context->bvec_ctxs_idx = 0;
+		bio_context->segments_num = 0;
 	} else {
 		pr_err("%s: Get  bio_context Error!!!\n", __func__);
 	}
 	return bio_context;
 }
 
+static bool
+vcablk_disk_request_sync(struct request *req)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 13, 0)
+	return req_op(req) & (REQ_OP_FLUSH | REQ_SYNC | REQ_PREFLUSH | REQ_FUA);
+#else
+	return req->cmd_flags & (REQ_FLUSH | REQ_FUA | REQ_SYNC);
+#endif
+}
+
 /*
  * Transfer a single BIO.
  */
 static int
-vcablk_disk_async_request(struct vcablk_disk *dev, struct request *req,
+vcablk_disk_async_request(struct vcablk_queue *queue, struct request *req,
 		int (*stop_f)(struct vcablk_disk *))
 {
+	struct vcablk_disk *dev = queue->dev;
 	struct req_iterator iter;
 #ifdef BIO_FORMAT_SECTOR
 	struct bio_vec bvec;
@@ -429,36 +583,26 @@ vcablk_disk_async_request(struct vcablk_disk *dev, struct request *req,
 	#define GBIOVP(bvec) (bvec)
 	#define GBIOSEC(bio) (bio->bi_sector)
 #endif /* BIO_FORMAT_SECTOR */
-	unsigned long do_sync = false;
+	bool do_sync = vcablk_disk_request_sync(req);
 	int ret = 0;
 	__u8 request;
 	struct vcablk_bio_context *bio_context_previous = NULL;
 	struct vcablk_bio_context *bio_context;
 
 	if (rq_data_dir(req)) {
-		request = REQUEST_WRITE;
+		request = queue->segments ? REQUEST_WRITE_SEGMENTS : REQUEST_WRITE;
 	} else {
-		request = REQUEST_READ;
-	}
-
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 13, 0)
-	if (req_op(req) & (REQ_OP_FLUSH | REQ_SYNC | REQ_PREFLUSH | REQ_FUA)) {
-		do_sync = true;
-	}
-#else
-	if ( req->cmd_flags & (REQ_FLUSH | REQ_FUA | REQ_SYNC)) {
-		do_sync = true;
+		request = queue->segments ? REQUEST_READ_SEGMENTS : REQUEST_READ;
 	}
-#endif
 
-	bio_context = vcablk_disk_get_bio_context(dev, stop_f);
+	bio_context = vcablk_disk_get_bio_context(queue, stop_f);
 	if (!bio_context) {
 		ret = -EIO;
 		goto end;
 	}
 
 	if (do_sync) {
-		ret = vcablk_disk_request_step(dev, NULL, bio_context, REQUEST_SYNC, 0, 0, stop_f);
+		ret = vcablk_disk_request_step(queue, NULL, bio_context, REQUEST_SYNC, 0, 0, stop_f);
 		if (ret) {
 			ret = -EIO;
 			goto end;
@@ -467,31 +611,42 @@ vcablk_disk_async_request(struct vcablk_disk *dev, struct request *req,
 	/* Do each segment independently. */
 	rq_for_each_segment(bvec, req, iter) {
 		unsigned long sectors_num = GBIOVP(bvec)->bv_len >> SECTOR_SHIFT;
-		if (bio_context->bvec_ctxs_idx >= VCABLK_BIO_SPLIT_SIZE) {
+		if (bio_context->bvec_ctxs_idx >= queue->split_size) {
 			/* Split BIO request on parts. Before get new part, start last prepared part.
-			 * Once request can be bigger that possible to execute without split. */
-			ret = vcablk_disk_request_start(dev);
+			 * Only a request touching more pages than the queue limits
+			 * allow, e.g. not aligned to pages, is split with segments. */
+			ret = vcablk_disk_segments_step(queue, bio_context, request, stop_f);
+			if (ret)
+				goto end;
+			ret = vcablk_disk_request_start(queue);
 			if (ret) {
 				ret = -EIO;
 				goto end;
 			}
 			bio_context_previous = bio_context;
-			bio_context = vcablk_disk_get_bio_context(dev, stop_f);
+			bio_context = vcablk_disk_get_bio_context(queue, stop_f);
 			if (!bio_context) {
 				ret = -EIO;
 				goto end;
 			}
 		}
 
-		ret = vcablk_disk_request_step(dev, GBIOVP(bvec), bio_context,
-				request, GBIOSEC(req->bio), sectors_num, stop_f);
+		if (queue->segments)
+			ret = vcablk_disk_segment_add(queue, GBIOVP(bvec), bio_context,
+					request, GBIOSEC(req->bio), sectors_num);
+		else
+			ret = vcablk_disk_request_step(queue, GBIOVP(bvec), bio_context,
+					request, GBIOSEC(req->bio), sectors_num, stop_f);
 
 		if (ret)
 			goto end;
 		GBIOSEC(req->bio) += sectors_num;
 	}
+	ret = vcablk_disk_segments_step(queue, bio_context, request, stop_f);
+	if (ret)
+		goto end;
 	if (do_sync) {
-		ret = vcablk_disk_request_step(dev, NULL, bio_context, REQUEST_SYNC, 0, 0, stop_f);
+		ret = vcablk_disk_request_step(queue, NULL, bio_context, REQUEST_SYNC, 0, 0, stop_f);
 		if (ret) {
 			ret = -EIO;
 			goto end;
@@ -500,19 +655,18 @@ vcablk_disk_async_request(struct vcablk_disk *dev, struct request *req,
 
 	/* Set req pointer only for last bio_context who will call vcablk_disk_request_end()*/
 	bio_context->req = req;
-	ret = vcablk_disk_request_start(dev);
+	ret = vcablk_disk_request_start(queue);
 
 end:
 	if (ret) {
-		vcablk_disk_request_break(dev, bio_context);
-		/* Before end bio, check that last executed split part of request finished
-		   bio_context_previous->bvec_ctxs_idx is expected to be zeroed on IRQ by call chain: 
-		   vcablk_disk_request_completion_handler()
-		     ->vcablk_disk_request_done()
-			   ->vcablk_disk_request_clean()
-		*/
-		while (bio_context_previous && bio_context_previous->bvec_ctxs_idx)
-			// empty;
+		vcablk_disk_request_break(queue, bio_context);
+		/* Before end bio, wait until started split part of request unmap
+		 * its pages, vcablk_disk_request_clean() zero bvec_ctxs_idx in
+		 * the completion handler and wake up the pool waiters. */
+		if (bio_context_previous)
+			wait_event(queue->bio_context_pool_wait,
+					!READ_ONCE(bio_context_previous->bvec_ctxs_idx) ||
+					(stop_f && stop_f(dev)));
 		vcablk_disk_request_end(dev, req, -EIO);
 	}
 	return ret;
@@ -521,7 +675,114 @@ end:
 #undef GBIOVP
 }
 
+#ifdef VCABLK_BLK_MQ
+static int
+vcablk_disk_queue_stop(struct vcablk_disk *dev)
+{
+	int ret = READ_ONCE(dev->stopping);
+	if (ret) {
+		pr_warn("%s: %s Queue should stop\n", dev->gdisk->disk_name, __func__);
+	}
+	return ret;
+}
 
+static int
+vcablk_disk_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
+		unsigned int hctx_idx)
+{
+	struct vcablk_disk *dev = data;
+
+	if (hctx_idx >= dev->queues_num)
+		return -EINVAL;
+	hctx->driver_data = &dev->queues[hctx_idx];
+	dev->queues[hctx_idx].hctx = hctx;
+	return 0;
+}
+
+/*
+ * Completions of a hardware queue are handled in the done doorbell irq,
+ * steer it to the CPUs submitting on the queue.
+ */
+static void
+vcablk_disk_declare_affinity(struct vcablk_disk *dev)
+{
+	struct vcablk_dev *fdev = dev->fdev;
+	struct blk_mq_hw_ctx *hctx;
+	struct vcablk_queue *queue;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,18,0)
+	unsigned long i;
+#else
+	int i;
+#endif
+
+	if (!fdev->hw_ops->set_irq_affinity)
+		return;
+
+	queue_for_each_hw_ctx(dev->queue, hctx, i) {
+		queue = hctx->driver_data;
+		if (queue && queue->bio_done_db >= 0)
+			fdev->hw_ops->set_irq_affinity(fdev->parent,
+					queue->bio_done_db, hctx->cpumask);
+	}
+}
+
+/*
+ * Ring entries used to send request, see vcablk_disk_async_request().
+ */
+static unsigned
+vcablk_disk_request_entries(struct vcablk_queue *queue, struct request *req)
+{
+	struct req_iterator iter;
+#ifdef BIO_FORMAT_SECTOR
+	struct bio_vec bvec;
+#else
+	struct bio_vec *bvec;
+#endif
+	unsigned pages = 0;
+	unsigned entries;
+
+	rq_for_each_segment(bvec, req, iter)
+		++pages;
+
+	entries = queue->segments ? DIV_ROUND_UP(pages, queue->split_size) : pages;
+	if (vcablk_disk_request_sync(req))
+		entries += 2;
+	return entries;
+}
+
+/*
+ * Requests are put to ring of hardware queue directly from submitting
+ * context, queue lock is held only to keep order of ring entries.
+ * Request not fitting in the ring goes back to the block layer, the
+ * completion handler restart the hardware queue when backend release
+ * ring entries. Only request bigger than the whole ring waits for space.
+ */
+static blk_status_t
+vcablk_disk_request_fn(struct blk_mq_hw_ctx *hctx, const struct blk_mq_queue_data* bd)
+{
+	struct vcablk_queue *queue = hctx->driver_data;
+	struct vcablk_ring *ring = queue->request_ring;
+	struct request *req = bd->rq;
+	unsigned entries = vcablk_disk_request_entries(queue, req);
+	__u16 last_used;
+	unsigned used;
+
+	mutex_lock(&queue->lock);
+	last_used = READ_ONCE(ring->last_used);
+	used = VCA_RB_BUFF_USED(last_used, queue->request_ring_alloc, ring->num_elems);
+	if ((used && used + entries > ring->num_elems) ||
+			!vcablk_is_available(queue->bio_context_pool)) {
+		mutex_unlock(&queue->lock);
+		return VCABLK_STS_RING_FULL;
+	}
+
+	blk_mq_start_request(req);
+	// blk_mq_end_request(req, <blk_status_t>) will run after getting confirmation by vcablk_disk_request_end() from completing the task on the other side of PCI
+	vcablk_disk_async_request(queue, req, vcablk_disk_queue_stop);
+	mutex_unlock(&queue->lock);
+	return BLK_STS_OK;
+}
+#else
 static int
 vcablk_disk_thread_stop(struct vcablk_disk *dev)
 {
@@ -557,73 +818,48 @@ vcablk_disk_make_request_thread(void *data)
 		spin_unlock_irq(&dev->req_ring_lock);
 
 		BUG_ON(!req);
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,1,16) || LINUX_VERSION_CODE == KERNEL_VERSION(4,18,0) // the blk_status_t actually appeared in 4.13.x
-		blk_mq_start_request(req);
-		// blk_mq_end_request(req, <blk_status_t>) will run after getting confirmation by vcablk_disk_request_end() from completing the task on the other side of PCI
-#endif
-		vcablk_disk_async_request(dev, req, vcablk_disk_thread_stop);
+		vcablk_disk_async_request(&dev->queues[0], req, vcablk_disk_thread_stop);
 	}
 	pr_debug("%s: Thread stop\n", __func__);
 	do_exit(0);
 	return 0;
 }
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,1,16) || LINUX_VERSION_CODE == KERNEL_VERSION(4,18,0) // the blk_status_t actually appeared in 4.13.x
-	static blk_status_t vcablk_disk_request_fn(struct blk_mq_hw_ctx *hctx, const struct blk_mq_queue_data* bd)
-	{
-		struct request *req = bd->rq;
-		struct vcablk_disk *dev = req->q->queuedata;
-		spin_lock_irq(&dev->req_ring_lock);
-		rmb();
-		{
-			int new_head;
-			blk_status_t status = BLK_STS_OK;
-			new_head = (dev->req_ring.head +1 )&REQ_RING_MASK;
-			if (new_head == dev->req_ring.tail) {
-				pr_err("%s: Ring request is too small!!! Ignore request.\n", __func__);
-				status = BLK_STS_IOERR;
-			} else {
-				dev->req_ring.ring[dev->req_ring.head] = req;
-				dev->req_ring.head = new_head;
-			}
-		}
-		wmb();
-		spin_unlock_irq(&dev->req_ring_lock);
-		wake_up(&dev->request_event);
-		return BLK_STS_OK;
-	}
-#else
-	static void vcablk_disk_request_fn(struct request_queue *q)
-	{
-		struct request *req;
-		struct vcablk_disk *dev = q->queuedata;
+static void vcablk_disk_request_fn(struct request_queue *q)
+{
+	struct request *req;
+	struct vcablk_disk *dev = q->queuedata;
 
-		int new_head;
-		spin_lock_irq(&dev->req_ring_lock);
-		rmb();
-		while ((req = blk_peek_request(q)) != NULL) {
-			blk_start_request(req);
-			new_head = (dev->req_ring.head +1 )&REQ_RING_MASK;
-			if (new_head == dev->req_ring.tail) {
-				pr_err("%s: Ring request is too small!!! Ignore request.\n", __func__);
-				__blk_end_request_all(req, -EIO);
-				break;
-			}
-			dev->req_ring.ring[dev->req_ring.head] = req;
-			dev->req_ring.head = new_head;
+	int new_head;
+	spin_lock_irq(&dev->req_ring_lock);
+	rmb();
+	while ((req = blk_peek_request(q)) != NULL) {
+		blk_start_request(req);
+		new_head = (dev->req_ring.head +1 )&REQ_RING_MASK;
+		if (new_head == dev->req_ring.tail) {
+			pr_err("%s: Ring request is too small!!! Ignore request.\n", __func__);
+			__blk_end_request_all(req, -EIO);
+			break;
 		}
-		wmb();
-		spin_unlock_irq(&dev->req_ring_lock);
-		wake_up(&dev->request_event);
+		dev->req_ring.ring[dev->req_ring.head] = req;
+		dev->req_ring.head = new_head;
 	}
-#endif
+	wmb();
+	spin_unlock_irq(&dev->req_ring_lock);
+	wake_up(&dev->request_event);
+}
+#endif /* VCABLK_BLK_MQ */
+
 static void
 vcablk_disk_request_completion_handler(struct work_struct *work)
 {
-	struct vcablk_disk *dev =
-			container_of(work, struct vcablk_disk, request_completion_work);
-	struct vcablk_ring *ring = dev->completion_ring;
+	struct vcablk_queue *queue =
+			container_of(work, struct vcablk_queue, request_completion_work);
+	struct vcablk_ring *ring = queue->completion_ring;
 	__u16 last_used = ring->last_used;
+#ifdef VCABLK_BLK_MQ
+	struct blk_mq_hw_ctx *hctx;
+#endif
 	for (; last_used != ring->last_add;) {
 		struct vcablk_completion *ack =
 				VCABLK_RB_GET_COMPLETION(last_used, ring->num_elems, ring->elems);
@@ -637,19 +873,25 @@ vcablk_disk_request_completion_handler(struct work_struct *work)
 		 * to not block ring ack for backend.
 		 */
 		ring->last_used = last_used;
-		vcablk_disk_request_done(dev, request_id, ret);
-		wake_up(&dev->request_ring_wait);
+		vcablk_disk_request_done(queue, request_id, ret);
+		wake_up(&queue->request_ring_wait);
 	}
+#ifdef VCABLK_BLK_MQ
+	/* Run requests sent back to block layer on full ring */
+	hctx = READ_ONCE(queue->hctx);
+	if (hctx)
+		blk_mq_run_hw_queue(hctx, true);
+#endif
 }
 
 static irqreturn_t
 vcablk_disk_ack_irq(int irq, void *data)
 {
-	struct vcablk_disk *dev = (struct vcablk_disk *)data;
-	struct vcablk_dev* fdev = dev->fdev;
-	schedule_work(&dev->request_completion_work);
+	struct vcablk_queue *queue = (struct vcablk_queue *)data;
+	struct vcablk_dev* fdev = queue->dev->fdev;
+	schedule_work(&queue->request_completion_work);
 
-	fdev->hw_ops->ack_interrupt(fdev->parent, dev->bio_done_db);
+	fdev->hw_ops->ack_interrupt(fdev->parent, queue->bio_done_db);
 	return IRQ_HANDLED;
 }
 
@@ -694,6 +936,7 @@ int
 vcablk_disk_stop(struct vcablk_disk *dev, bool force)
 {
 	int err = 0;
+	int i;
 
 	/* Check that device created a nd not stopped*/
 	if (!dev)
@@ -713,6 +956,13 @@ vcablk_disk_stop(struct vcablk_disk *dev, bool force)
 			pr_err("%s: device BUSY %i\n", __func__, err);
 			return err;
 		}
+	} else {
+		/* Wake up requests waiting on rings of stopped backend */
+		WRITE_ONCE(dev->stopping, true);
+		for (i = 0; i < dev->queues_num; ++i) {
+			wake_up_all(&dev->queues[i].request_ring_wait);
+			wake_up_all(&dev->queues[i].bio_context_pool_wait);
+		}
 	}
 
 	if (dev->gdisk) {
@@ -722,17 +972,21 @@ vcablk_disk_stop(struct vcablk_disk *dev, bool force)
 			dev->gdisk_started = false;
 		}
 
-		if (dev->bio_context_pool) {
+		for (i = 0; i < dev->queues_num; ++i) {
+			struct vcablk_queue *queue = &dev->queues[i];
 			void *ptr = NULL;
 			int itr;
+
+			if (!queue->bio_context_pool)
+				continue;
 			/* Clean all memory mapping */
-			vcablk_pool_foreach_used(ptr, dev->bio_context_pool, itr) {
+			vcablk_pool_foreach_used(ptr, queue->bio_context_pool, itr) {
 				struct vcablk_bio_context *bio_context = (struct vcablk_bio_context *)ptr;
 				pr_err("%s: NOT CLEAN REQUEST dev %i clean bio_context %p "
 						"id %u\n", __func__, dev->dev_id, bio_context,
 						bio_context->id);
-				vcablk_disk_request_clean(dev, bio_context);
-				wake_up(&dev->request_ring_wait);
+				vcablk_disk_request_clean(queue, bio_context);
+				wake_up(&queue->request_ring_wait);
 				BUG_ON(1);
 			}
 		}
@@ -740,41 +994,73 @@ vcablk_disk_stop(struct vcablk_disk *dev, bool force)
 		put_disk(dev->gdisk);
 		dev->gdisk = NULL;
 	}
-	flush_work(&dev->request_completion_work);
+	for (i = 0; i < dev->queues_num; ++i)
+		flush_work(&dev->queues[i].request_completion_work);
 
 	return err;
 }
 
-struct vcablk_ring *
-vcablk_disk_get_rings_req(struct vcablk_disk *dev)
+int
+vcablk_disk_get_queues_num(struct vcablk_disk *dev)
 {
 	if (!dev)
+		return 0;
+	return dev->queues_num;
+}
+
+struct vcablk_ring *
+vcablk_disk_get_rings_req(struct vcablk_disk *dev, int queue_id)
+{
+	if (!dev || queue_id >= dev->queues_num)
 		return NULL;
-	return dev->request_ring;
+	return dev->queues[queue_id].request_ring;
 }
 
 struct vcablk_ring *
-vcablk_disk_get_rings_ack(struct vcablk_disk *dev)
+vcablk_disk_get_rings_ack(struct vcablk_disk *dev, int queue_id)
 {
-	if (!dev)
+	if (!dev || queue_id >= dev->queues_num)
 		return NULL;
-	return dev->completion_ring;
+	return dev->queues[queue_id].completion_ring;
+}
+
+static void
+vcablk_disk_queue_deinit(struct vcablk_queue *queue)
+{
+	struct vcablk_dev* fdev = queue->dev->fdev;
+
+	vcablk_pool_deinit(queue->bio_context_pool);
+	queue->bio_context_pool = NULL;
+	vfree(queue->bvec_ctxs);
+	queue->bvec_ctxs = NULL;
+
+	if (queue->segments) {
+		vcablk_dma_unmap_single(fdev->parent, queue->segments_da,
+				queue->segments_size);
+		kfree(queue->segments);
+		queue->segments = NULL;
+	}
+
+	if (queue->bio_done_irq) {
+		fdev->hw_ops->free_irq(fdev->parent, queue->bio_done_irq, queue);
+		queue->bio_done_irq = NULL;
+	}
+	queue->bio_done_db = -1;
+
+	queue->request_ring = NULL;
+	queue->completion_ring = NULL;
 }
 
 int
 vcablk_disk_destroy(struct vcablk_disk *dev)
 {
-	struct vcablk_dev* fdev;
 	int err = 0;
-	int dev_id;
+	int i;
 
 	/* Check that device created */
 	if (!dev)
 		return -ENODEV;
 
-	fdev = dev->fdev;
-	dev_id = dev->dev_id;
-
 	err = vcablk_disk_stop(dev, true);
 
 	if (err)
@@ -782,27 +1068,33 @@ vcablk_disk_destroy(struct vcablk_disk *dev)
 
 	pr_debug("%s: destroy device id %i\n", __func__, dev->dev_id);
 
+#ifdef VCABLK_BLK_MQ
+	/* Completion handler stop restarting hardware queues */
+	for (i = 0; i < dev->queues_num; ++i) {
+		WRITE_ONCE(dev->queues[i].hctx, NULL);
+		flush_work(&dev->queues[i].request_completion_work);
+	}
+	if (dev->queue) {
+		blk_cleanup_queue(dev->queue);
+		dev->queue = NULL;
+	}
+	if (dev->tag_set.tags)
+		blk_mq_free_tag_set(&dev->tag_set);
+#else
 	if (dev->request_thread) {
 		kthread_stop(dev->request_thread);
 		dev->request_thread = NULL;
 	}
 
-	vcablk_pool_deinit(dev->bio_context_pool);
-	dev->bio_context_pool = NULL;
-
-	if (dev->bio_done_db >= 0) {
-		fdev->hw_ops->free_irq(fdev->parent,dev->bio_done_irq, dev);
-		dev->bio_done_db = -1;
-		dev->bio_done_irq = NULL;
-	}
-
 	if (dev->queue) {
 		dev->queue = NULL;
 	}
+#endif /* VCABLK_BLK_MQ */
+
+	for (i = 0; i < dev->queues_num; ++i)
+		vcablk_disk_queue_deinit(&dev->queues[i]);
 	wmb();
 
-	dev->request_ring = NULL;
-	dev->completion_ring = NULL;
 	kfree(dev);
 
 	return err;
@@ -847,42 +1139,141 @@ static struct block_device_operations vcablk_ops = {
 	.getgeo		= vcablk_disk_getgeo
 };
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,1,16) || LINUX_VERSION_CODE == KERNEL_VERSION(4,18,0) // the blk_status_t actually appeared in 4.13.x
+#ifdef VCABLK_BLK_MQ
 	static struct blk_mq_ops _mq_ops = {
 		.queue_rq = vcablk_disk_request_fn,
+		.init_hctx = vcablk_disk_init_hctx,
 	};
 #endif
+
+/*
+ * Number of ring pairs to create, one for each submitting CPU when
+ * backend can serve them.
+ */
+int
+vcablk_disk_queues_num(int queues_max)
+{
+#ifdef VCABLK_BLK_MQ
+	int queues_num = min_t(int, num_online_cpus(), VCABLK_MAX_QUEUES);
+	return clamp_t(int, queues_max, 1, queues_num);
+#else
+	return 1;
+#endif
+}
+
+static int
+vcablk_disk_queue_init(struct vcablk_disk *dev, int id,
+		struct vcablk_ring *ring_req, struct vcablk_ring *completion_ring,
+		int bio_done_db, int request_db)
+{
+	struct vcablk_dev* fdev = dev->fdev;
+	struct vcablk_queue *queue = &dev->queues[id];
+	int err;
+
+	queue->dev = dev;
+	queue->id = id;
+	mutex_init(&queue->lock);
+	init_waitqueue_head(&queue->request_ring_wait);
+	init_waitqueue_head(&queue->bio_context_pool_wait);
+	spin_lock_init(&queue->bio_context_pool_lock);
+	INIT_WORK(&queue->request_completion_work, vcablk_disk_request_completion_handler);
+	queue->split_request_error = 0;
+
+	queue->request_ring = ring_req;
+	queue->request_ring_alloc = ring_req->last_add;
+	queue->completion_ring = completion_ring;
+	queue->request_db = request_db;
+	queue->bio_done_db = bio_done_db;
+
+	if (queue->bio_done_db < 0) {
+		pr_err("%s: Can not get Doorbell\n", __func__);
+		return -ENODEV;
+	}
+
+	queue->bio_context_pool = vcablk_pool_init(VCABLK_BIO_CTX_POOL_SIZE,
+			sizeof (struct vcablk_bio_context));
+	if (!queue->bio_context_pool)
+		return -ENOMEM;
+
+	/* Whole request in a single segment table, see vcablk_disk_create() */
+	queue->split_size = (fdev->pages->features_backend & VCABLK_FEATURE_SEGMENTS) ?
+			VCABLK_MAX_SEGMENTS : VCABLK_BIO_SPLIT_SIZE;
+	queue->bvec_ctxs = vzalloc(queue->bio_context_pool->num *
+			queue->split_size * sizeof(struct bvec_context));
+	if (!queue->bvec_ctxs)
+		return -ENOMEM;
+
+	if (fdev->pages->features_backend & VCABLK_FEATURE_SEGMENTS) {
+		queue->segments_size = queue->bio_context_pool->num *
+				queue->split_size * sizeof(struct vcablk_segment);
+		/* Tables are only read by the backend through DMA mapping */
+		queue->segments = kmalloc(queue->segments_size, GFP_KERNEL);
+		if (!queue->segments)
+			return -ENOMEM;
+		err = vcablk_dma_map_single(fdev->parent, queue->segments,
+				queue->segments_size, &queue->segments_da);
+		if (err) {
+			pr_err("%s: Can not map segment tables err %i\n",
+					__func__, err);
+			kfree(queue->segments);
+			queue->segments = NULL;
+			return err;
+		}
+	}
+
+	queue->bio_done_irq =
+			fdev->hw_ops->request_irq(fdev->parent, vcablk_disk_ack_irq,
+					"IRQ_DONE_ACK", queue, queue->bio_done_db);
+
+	if (IS_ERR(queue->bio_done_irq)) {
+		queue->bio_done_irq = NULL;
+		return -EIO;
+	}
+
+	return 0;
+}
+
 /*
  * Set up our internal device.
  * size - Size of device in bytes
  */
 struct vcablk_disk *
 vcablk_disk_create(struct vcablk_dev* fdev, int uniq_id, size_t size, bool read_only,
-		struct vcablk_ring *ring_req, struct vcablk_ring *completion_ring,
-		int bio_done_db, int request_db)
+		int queues_num, struct vcablk_ring **rings_req,
+		struct vcablk_ring **completion_rings, int *bio_done_dbs, int *request_dbs)
 {
 	int err = 0;
 	struct gendisk *disk = NULL;
 	struct vcablk_disk *dev = NULL;
 	unsigned sectors_num;
 	int hardsect_size;
+	int i;
 
-	if (!ring_req) {
-		pr_err("%s: Disk with ID %i ring_req is NULL\n", __func__, uniq_id);
-		err = -EFAULT;
+	if (queues_num < 1 || queues_num > VCABLK_MAX_QUEUES) {
+		pr_err("%s: Disk with ID %i wrong number of queues %i\n",
+				__func__, uniq_id, queues_num);
+		err = -EINVAL;
 		goto exit;
 	}
 
-	if (!completion_ring) {
-		pr_err("%s: Disk with ID %i completion_ring is NULL\n", __func__, uniq_id);
-		err = -EFAULT;
-		goto exit;
-	}
+	for (i = 0; i < queues_num; ++i) {
+		if (!rings_req[i]) {
+			pr_err("%s: Disk with ID %i ring_req is NULL\n", __func__, uniq_id);
+			err = -EFAULT;
+			goto exit;
+		}
 
-	if (request_db < 0) {
-		pr_err("%s: Disk with ID %i irq_request is NULL\n", __func__, uniq_id);
-		err = -EFAULT;
-		goto exit;
+		if (!completion_rings[i]) {
+			pr_err("%s: Disk with ID %i completion_ring is NULL\n", __func__, uniq_id);
+			err = -EFAULT;
+			goto exit;
+		}
+
+		if (request_dbs[i] < 0) {
+			pr_err("%s: Disk with ID %i irq_request is NULL\n", __func__, uniq_id);
+			err = -EFAULT;
+			goto exit;
+		}
 	}
 
 	hardsect_size = SECTOR_SIZE;
@@ -905,41 +1296,21 @@ vcablk_disk_create(struct vcablk_dev* fdev, int uniq_id, size_t size, bool read_
 	spin_lock_init(&dev->lock);
 	dev->fdev = fdev;
 
-	dev->bio_done_db = bio_done_db;
-
-	if (dev->bio_done_db < 0) {
-		pr_err("%s: Can not get Doorbell\n", __func__);
-		err = -ENODEV;
-		goto err;
-	}
-
-	init_waitqueue_head(&dev->request_ring_wait);
-
-	init_waitqueue_head(&dev->bio_context_pool_wait);
-	dev->bio_context_pool = vcablk_pool_init(VCABLK_BIO_CTX_POOL_SIZE,
-			sizeof (struct vcablk_bio_context));
-	if (!dev->bio_context_pool) {
-		err =-ENOMEM;
-		goto err;
+	dev->queues_num = queues_num;
+	for (i = 0; i < queues_num; ++i) {
+		err = vcablk_disk_queue_init(dev, i, rings_req[i], completion_rings[i],
+				bio_done_dbs[i], request_dbs[i]);
+		if (err) {
+			pr_err("%s: Can not init queue %i err %i\n", __func__, i, err);
+			goto err;
+		}
 	}
-	spin_lock_init(&dev->bio_context_pool_lock);
 
+#ifndef VCABLK_BLK_MQ
 	dev->req_ring.head = 0;
 	dev->req_ring.tail = 0;
 	spin_lock_init(&dev->req_ring_lock);
-
-
-	dev->split_request_error = 0;
-
-	dev->bio_done_irq =
-			fdev->hw_ops->request_irq(fdev->parent, vcablk_disk_ack_irq,
-					"IRQ_DONE_ACK", dev, dev->bio_done_db);
-
-	if (IS_ERR(dev->bio_done_irq)) {
-		dev->bio_done_irq = NULL;
-		err =-EIO;
-		goto err;
-	}
+#endif /* VCABLK_BLK_MQ */
 
 	/* Set size of disk */
 	dev->hardsect_size = hardsect_size; /* Base size of block */
@@ -953,15 +1324,15 @@ vcablk_disk_create(struct vcablk_dev* fdev, int uniq_id, size_t size, bool read_
 	dev->geo.cylinders = dev->size_bytes>>9;
 
 	pr_err("%s: Create disk dev_id %i size  %lu sectors_num %u "
-			"hardsect_size %i heads %u sectors %u cylinders %u\n", __func__,
-			uniq_id, dev->size_bytes, dev->sectors_num, dev->hardsect_size,
-			dev->geo.heads, dev->geo.sectors, dev->geo.cylinders);
+			"hardsect_size %i heads %u sectors %u cylinders %u segments %i "
+			"queues %i\n", __func__, uniq_id, dev->size_bytes,
+			dev->sectors_num, dev->hardsect_size, dev->geo.heads,
+			dev->geo.sectors, dev->geo.cylinders,
+			dev->queues[0].segments != NULL, dev->queues_num);
 
 	dev->read_only = read_only;
 	dev->dev_id = uniq_id;
 
-	init_waitqueue_head(&dev->request_event);
-
 	disk = dev->gdisk = alloc_disk(VCA_BLK_MINORS);
 	if (!disk) {
 		pr_err("%s: alloc_disk failure\n", __func__);
@@ -969,10 +1340,24 @@ vcablk_disk_create(struct vcablk_dev* fdev, int uniq_id, size_t size, bool read_
 		goto err;
 	}
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,1,16) || LINUX_VERSION_CODE == KERNEL_VERSION(4,18,0) // the blk_status_t actually appeared in 4.13.x
-	disk->queue = dev->queue = blk_mq_init_sq_queue(&dev->tag_set, &_mq_ops,
-											BLKDEV_MAX_RQ,
-											BLK_MQ_F_SHOULD_MERGE); // BLKDEV_MAX_RQ is not a true limitation; quepe_depth may be set bigger here
+#ifdef VCABLK_BLK_MQ
+	dev->tag_set.ops = &_mq_ops;
+	dev->tag_set.nr_hw_queues = dev->queues_num;
+	dev->tag_set.queue_depth = BLKDEV_MAX_RQ; // BLKDEV_MAX_RQ is not a true limitation; quepe_depth may be set bigger here
+	dev->tag_set.numa_node = NUMA_NO_NODE;
+	/* Requests of hardware queue are put to ring under its mutex */
+	dev->tag_set.flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_BLOCKING;
+	dev->tag_set.driver_data = dev;
+	err = blk_mq_alloc_tag_set(&dev->tag_set);
+	if (err) {
+		pr_err("%s: Can not allocate tag set %i\n", __func__, err);
+		dev->tag_set.tags = NULL;
+		goto err;
+	}
+	dev->queue = blk_mq_init_queue(&dev->tag_set);
+	if (IS_ERR(dev->queue))
+		dev->queue = NULL;
+	disk->queue = dev->queue;
 #else
 	disk->queue = dev->queue = blk_init_queue(vcablk_disk_request_fn, &dev->lock);
 #endif
@@ -982,8 +1367,18 @@ vcablk_disk_create(struct vcablk_dev* fdev, int uniq_id, size_t size, bool read_
 		goto err;
 	}
 
+#ifdef VCABLK_BLK_MQ
+	vcablk_disk_declare_affinity(dev);
+#endif
+
 	blk_queue_logical_block_size(dev->queue, dev->hardsect_size);
 	blk_queue_dma_alignment(dev->queue, 511);
+	if (dev->queues[0].segments) {
+		/* Request up to a full segment table goes in a single ring entry */
+		blk_queue_max_segments(dev->queue, VCABLK_MAX_SEGMENTS);
+		blk_queue_max_hw_sectors(dev->queue,
+				VCABLK_MAX_SEGMENTS << (PAGE_SHIFT - SECTOR_SHIFT));
+	}
 	dev->queue->queuedata = dev;
 
 	disk->major = vcablk_major;
@@ -1000,15 +1395,11 @@ vcablk_disk_create(struct vcablk_dev* fdev, int uniq_id, size_t size, bool read_
 		goto err;
 	}
 
-	INIT_WORK(&dev->request_completion_work, vcablk_disk_request_completion_handler);
-
-	dev->request_ring = ring_req;
-	dev->request_ring_alloc = ring_req->last_add;
-	dev->completion_ring = completion_ring;
-	dev->request_db = request_db;
-
 	dev->gdisk_started = false;
 
+#ifndef VCABLK_BLK_MQ
+	init_waitqueue_head(&dev->request_event);
+
 	//MOVED TO START
 	dev->request_thread = kthread_create(vcablk_disk_make_request_thread, dev,
 			disk->disk_name);
@@ -1021,6 +1412,7 @@ vcablk_disk_create(struct vcablk_dev* fdev, int uniq_id, size_t size, bool read_
 	}
 
 	wake_up_process(dev->request_thread);
+#endif /* VCABLK_BLK_MQ */
 	return dev;
 err:
 	vcablk_disk_destroy(dev);
@@ -1044,11 +1436,13 @@ vcablk_disk_start(struct vcablk_disk *dev)
 		goto exit;
 	}
 
+#ifndef VCABLK_BLK_MQ
 	if (!dev->request_thread) {
 		pr_err("%s: Bdev id %i thread not created\n", __func__, dev->dev_id);
 			err = -EINVAL;
 			goto err;
 	}
+#endif /* VCABLK_BLK_MQ */
 
 	if (dev->gdisk_started) {
 		pr_err("%s: Bdev id %i working\n", __func__, dev->dev_id);
@@ -31,6 +31,7 @@
 #ifndef __VCA_BLK_DISK_H__
 #define __VCA_BLK_DISK_H__
 #include <linux/bio.h>
+#include <linux/log2.h>
 #include "../vcablk_common/vcablk_common.h"
 
 /* Minimal queue sizes */
@@ -44,7 +45,9 @@
 
 /* From kernel 4.14 or upper BIO_MAX_PAGES is bigger that earlier expected 256,
  * limits max request bio parts to 256 not working, so requests are executed
- * in split parts during send to backend .*/
+ * in split parts during send to backend. Backend with segment tables gets
+ * parts of VCABLK_MAX_SEGMENTS pages, so a request within queue limits is
+ * sent as a single ring entry .*/
 #define VCABLK_BIO_SPLIT_SIZE		32
 #define VCABLK_BIO_CTX_POOL_SIZE	32
 //Max request per split part VCABLK_BIO_SPLIT_SIZE(bvec) + 2 sync + up to pow of 2
@@ -64,24 +67,39 @@
 #endif
 
 
+#if VCABLK_BIO_SPLIT_SIZE > VCABLK_MAX_SEGMENTS
+#error "Split part of request does not fit in segment table"
+#endif
+
 #if VCABLK_QUEUE_REQUESTS_NUMS < (VCABLK_BIO_SPLIT_SIZE + 2)
 #error "Too small request ring to prepare all task request + max 2 sync"
 #endif
 
+/* Request ring entries are divided between hardware queues */
+#if (VCABLK_QUEUE_REQUESTS_NUMS / VCABLK_MAX_QUEUES) < (VCABLK_BIO_SPLIT_SIZE + 2)
+#error "Too small request ring of hardware queue to prepare all task request + max 2 sync"
+#endif
+
+#define VCABLK_QUEUE_REQUESTS_NUMS_PER_QUEUE(queues_num) \
+	rounddown_pow_of_two(VCABLK_QUEUE_REQUESTS_NUMS / (queues_num))
+
 struct vcablk_disk;
 struct vcablk_dev;
 
 int vcablk_disk_init(struct vcablk_dev* bd);
 void vcablk_disk_exit(void);
 
+int vcablk_disk_queues_num(int queues_max);
 struct vcablk_disk* vcablk_disk_create(struct vcablk_dev* fdev, int uniq_id, size_t size,
-			bool read_only, struct vcablk_ring *ring_req, struct vcablk_ring *completion_ring,
-			int done_db_local, int request_db);
+			bool read_only, int queues_num, struct vcablk_ring **rings_req,
+			struct vcablk_ring **completion_rings, int *done_dbs_local,
+			int *request_dbs);
 int vcablk_disk_start(struct vcablk_disk *dev);
 
 int vcablk_disk_stop(struct vcablk_disk *dev, bool force);
 int vcablk_disk_destroy(struct vcablk_disk *dev);
-struct vcablk_ring * vcablk_disk_get_rings_req(struct vcablk_disk *dev);
-struct vcablk_ring * vcablk_disk_get_rings_ack(struct vcablk_disk *dev);
+int vcablk_disk_get_queues_num(struct vcablk_disk *dev);
+struct vcablk_ring * vcablk_disk_get_rings_req(struct vcablk_disk *dev, int queue_id);
+struct vcablk_ring * vcablk_disk_get_rings_ack(struct vcablk_disk *dev, int queue_id);
 
 #endif /* __VCA_BLK_DISK_H__ */
@@ -377,9 +377,8 @@ vcablk_bcknd_ftb_work(struct work_struct *work)
 					response->command_ack = 0;
 
 					if (!err)
-						err = vcablk_bcknd_disk_start(bckd, response->done_db,
-							response->request_ring, response->request_ring_size,
-							response->completion_ring, response->completion_ring_size);
+						err = vcablk_bcknd_disk_start(bckd,
+							response->queues_num, response->queues);
 
 					if (!err) {
 						/* Backend have to be ready, and can not wait on
@@ -436,6 +435,7 @@ int vcablk_bcknd_add_to_devpage(struct vcablk_bcknd_dev *bdev,
 		struct vcablk_dev_page *dev_page, struct vcablk_bcknd_disk *bckd)
 {
 	int disk_id;
+	int queue, queues_max;
 
 	if (!dev_page) {
 		pr_err("%s %s: Wait for dev_page!!!\n", __func__, bdev->dev_name);
@@ -474,8 +474,11 @@ int vcablk_bcknd_add_to_devpage(struct vcablk_bcknd_dev *bdev,
 	dev_page->devs[disk_id].size_bytes =
 			vcablk_media_size(vcablk_bcknd_disk_get_media(bckd));
 
-	dev_page->devs[disk_id].request_db =
-			vcablk_bcknd_disk_prepare_request_db(bckd);
+	queues_max = vcablk_bcknd_disk_get_queues_max(bckd);
+	dev_page->devs[disk_id].queues_max = queues_max;
+	for (queue = 0; queue < queues_max; ++queue)
+		dev_page->devs[disk_id].request_db[queue] =
+				vcablk_bcknd_disk_prepare_request_db(bckd, queue);
 	wmb();
 	dev_page->devs[disk_id].command = CMD_CREATE;
 	wmb();
@@ -535,6 +538,9 @@ static long vcablk_bcknd_ioctl (struct file *file, unsigned int cmd,
 				} else {
 					desc->mode = VCABLK_DISK_MODE_READ_WRITE;
 				}
+				desc->flags = vcablk_media_direct(
+						vcablk_bcknd_disk_get_media(bckd)) ?
+						VCABLK_DISK_FLAG_DIRECT : 0;
 				desc->size = vcablk_media_size(
 						vcablk_bcknd_disk_get_media(bckd));
 				desc->state =  vcablk_bcknd_disk_get_state(bckd);
@@ -572,7 +578,8 @@ static long vcablk_bcknd_ioctl (struct file *file, unsigned int cmd,
 					desc->type, desc->mode, desc->size, desc->file_path);
 
 			if (desc->type == VCABLK_DISK_TYPE_FILE ||
-					desc->type == VCABLK_DISK_TYPE_MEMORY) {
+					desc->type == VCABLK_DISK_TYPE_MEMORY ||
+					desc->type == VCABLK_DISK_TYPE_BDEV) {
 				err = vcablk_bcknd_create(bdev, desc);
 				if (err || !bdev->device_array[desc->disk_id]) {
 					pr_err("%s %s: Can not create device "
@@ -711,6 +718,8 @@ vcablk_bcknd_open_dev_page(struct vcablk_bcknd_dev * bdev,
 
 	dev_page_map->notify_backend_db = bdev->ftb_db;
 	dev_page_map->reinit_dev_page = 0;
+	dev_page_map->features_backend =
+			dev_page_map->features_frontend & VCABLK_FEATURE_SEGMENTS;
 	dev_page_map->valid_magic_bcknd = VCA_BLK_BCKND_MAGIC;
 	wmb();
 
@@ -26,6 +26,8 @@
 #include <linux/dmaengine.h>
 #include <linux/delay.h>
 #include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/highmem.h>
 
 #ifdef TEST_BUILD
 #include "vcablk_test_hw_ops.h"
@@ -48,21 +50,40 @@
 
 /* Previously vcalbk_bcknd_disk::transfer_buffer_pool had 259 preallocated transfer parameters (transfer_parameter_t),
  * with one DMA memory page for each transfer param.
- * Those DMA pages are scarce resource. Fortunately, for disk-based (as opposed to ram-based) vcablk disks
- * we could greatly decrease the number of DMA pages (tested for as low as 4 pages) without significant drop
- * of performance. For simplicity, this number is a bit higher to accomodate also ramdisks without separate
- * handling. (Ramdisk tests were not done yet).
- *
- * Currently transfer_buffer_pool size is small.
- * When given request needs more than VCABLK_TRANSFER_RING_SIZE pages,
+ * Those DMA pages are scarce resource, so the pool is small and its size,
+ * the transfer depth, is set by vcablk_bcknd_transfer_depth.
+ * When given request needs more pages than transfer depth,
  * it simply waits (on vcablk_bcknd_get_transfer_param() call)
  * for previously used page to be returned to pool.
- * Performance is kept because disk speed is the bottleneck.
- * (only one DMA transfer is physically active at the moment)
  *
- * transfer_ring stores exactly the same buffers as transfer_buffer_pool, so these two are of equal size now.
+ * Every buffer taken from the pool is a stage of pipeline: media reads of
+ * following buffers run while DMA of previous ones is queued on the channel,
+ * and DMA completions are reaped by transfer thread from
+ * vca_bcknd_callback_dma(). So transfer depth is number of buffers in
+ * flight over media and DMA together.
+ *
+ * transfer_ring and media_ring store exactly the same buffers as transfer_buffer_pool,
+ * so all three are of equal size and rings are never full.
  */
-#define VCABLK_TRANSFER_RING_SIZE		16
+#define VCABLK_TRANSFER_DEPTH_DEFAULT		16
+#define VCABLK_TRANSFER_DEPTH_MIN		2
+#define VCABLK_TRANSFER_DEPTH_MAX		256
+
+static ushort vcablk_bcknd_transfer_depth = VCABLK_TRANSFER_DEPTH_DEFAULT;
+module_param(vcablk_bcknd_transfer_depth, ushort, S_IRUGO);
+MODULE_PARM_DESC(vcablk_bcknd_transfer_depth, "Number of transfer buffers of "
+		"one vca block device in flight over media and DMA, rounded up "
+		"to power of 2");
+
+static bool vcablk_bcknd_zero_copy = false;
+module_param(vcablk_bcknd_zero_copy, bool, S_IRUGO);
+MODULE_PARM_DESC(vcablk_bcknd_zero_copy, "DMA straight from page cache pages "
+		"of file disks when transfer fits in one page, otherwise use "
+		"bounce buffer. Memory disks always do");
+
+static ushort vcablk_bcknd_max_queues = VCABLK_MAX_QUEUES;
+module_param(vcablk_bcknd_max_queues, ushort, S_IRUGO);
+MODULE_PARM_DESC(vcablk_bcknd_max_queues, "Maximum number of ring pairs of one vca block device");
 
 #define TIMEOUT_POOL_POP_MS		30000 /* quite huge because of disk over network could be used */
 #define TIMEOUT_END_THREADS_MS		10000
@@ -80,10 +101,13 @@ typedef struct {
 
 typedef struct {
 	struct vcablk_bcknd_disk *bckd;
+	struct vcablk_bcknd_queue *queue;
 	unsigned long sector;
 	unsigned long nsec;
 	void *remapped;
+	void *device;		/* Card memory of this part */
 	int response_cookie;
+	int err;		/* Media error of this part */
 	bool is_write;
 	bool do_flush;
 } callback_param_t;
@@ -93,8 +117,51 @@ typedef struct {
 	vcablk_buffer buffer;
 	/* Keep to close waiting callback before deinit DMA engine. */
 	struct dma_async_tx_descriptor *tx;
+	/* Asynchronous media transfer, reaped in order of media_ring */
+	struct vcablk_media_iocb iocb;
+	bool media_done;
+	/* Media page used instead of buffer, NULL for bounce buffer */
+	struct page *page;
+	unsigned int page_offset;
+	dma_addr_t page_da;
 } transfer_parameters_t;
 
+/*
+ * Request and completion ring pair of frontend queue,
+ * served by own thread.
+ */
+struct vcablk_bcknd_queue {
+	struct vcablk_bcknd_disk *bckd;
+	int id;
+
+	/* Request IRQ */
+	int request_db;
+	void *request_irq;
+	struct task_struct *request_process_thread;
+	wait_queue_head_t request_wq;
+
+	spinlock_t send_resp_lock; /* vcablk_bcknd_disk_send_response lock */
+
+	/* Access to front page */
+	int done_db;
+	struct vcablk_ring *request_ring;
+	__u16 request_ring_nums;
+	struct vcablk_ring *completion_ring;
+	__u16 completion_ring_num_elems;
+
+	__u16 request_last_used;
+
+	/* Parts taken from transfer_buffer_pool and not finished yet */
+	atomic_t parts_inflight;
+
+	/* Error of not last part of request to send with response,
+	 * separately for read and write */
+	int transfer_error[2];
+
+	struct vcablk_request request_buff[VCABLK_MAX_PARTS_PER_REQUEST];
+	struct vcablk_segment segment_buff[VCABLK_MAX_SEGMENTS];
+};
+
 /*
  * The internal representation of our bcknd device.
  */
@@ -108,37 +175,33 @@ struct vcablk_bcknd_disk {
 
 	wait_queue_head_t probe_queue;
 
-	/* Request IRQ */
-	int request_db;
-	void *request_irq;
-	struct task_struct *request_process_thread;
-	wait_queue_head_t request_wq;
 	wait_queue_head_t threads_exit_wq;
 	atomic_t threads_count;
 
+	/* Ring pairs, queues_num of queues_max started */
+	int queues_max;
+	int queues_num;
+	struct vcablk_bcknd_queue *queues[VCABLK_MAX_QUEUES];
+
 	/* DMA callback handling */
 	struct task_struct *transfer_thread; /* DMA callback consumer */
 	wait_queue_head_t   transfer_wq;
 	struct vcablk_ring *transfer_ring;
+	spinlock_t transfer_ring_lock; /* transfer_ring producers lock */
 
-	spinlock_t send_resp_lock; /* vcablk_bcknd_disk_send_response lock */
-
-	/* Access to front page */
-	int done_db;
-	struct vcablk_ring *request_ring;
-	__u16 request_ring_nums;
-	struct vcablk_ring *completion_ring;
-	__u16 completion_ring_num_elems;
+	/* Asynchronous media transfers, finished in order of submission */
+	struct vcablk_ring *media_ring;
+	spinlock_t media_ring_lock; /* media_ring producers lock */
+	struct work_struct media_reap_work;
+	struct workqueue_struct *media_reap_wq; /* Reap may sync media */
 
 	/* hw access */
 	struct plx_blockio_hw_ops* hw_ops;
 	wait_queue_head_t ioremap_wq;
 
-	__u16 request_last_used;
-
-	struct vcablk_request request_buff[VCABLK_MAX_PARTS_PER_REQUEST];
-
 	vcablk_pool_t *transfer_buffer_pool;
+	__u16 transfer_depth; /* Size of transfer_buffer_pool and rings */
+	spinlock_t transfer_buffer_pool_lock; /* Shared by all queues */
 	wait_queue_head_t transfer_buffer_pool_wq;
 
 };
@@ -220,25 +283,26 @@ error:
 }
 
 static int
-vcablk_bcknd_disk_send_response(struct vcablk_bcknd_disk *bckd,
+vcablk_bcknd_disk_send_response(struct vcablk_bcknd_queue *queue,
 		__u16 cookie, int ret)
 {
-	struct vcablk_ring *completion_ring = (struct vcablk_ring *)bckd->completion_ring;
+	struct vcablk_bcknd_disk *bckd = queue->bckd;
+	struct vcablk_ring *completion_ring = (struct vcablk_ring *)queue->completion_ring;
 	__u16 last_add;
 	struct vcablk_completion *ack;
 	int sleep_counter = 200; /* Wait 2 seconds */
 	int err = 0;
 	unsigned long lock_flags;
 
-	spin_lock_irqsave(&bckd->send_resp_lock, lock_flags);
+	spin_lock_irqsave(&queue->send_resp_lock, lock_flags);
 	last_add = completion_ring->last_add;
 
 	while (VCA_RB_BUFF_FULL(last_add, completion_ring->last_used,
-			bckd->completion_ring_num_elems)) {
+			queue->completion_ring_num_elems)) {
 		if (--sleep_counter <= 0) {
 			printk(KERN_ERR "%s: ERROR Timeout Ack ring full! cookie %u, ret %i "
 					"num_elems %u completion_ring->last_add %u last_use %u last_add %u\n",
-					__func__, cookie, ret, bckd->completion_ring_num_elems, completion_ring->last_add,
+					__func__, cookie, ret, queue->completion_ring_num_elems, completion_ring->last_add,
 					completion_ring->last_used, last_add);
 			err = -EIO;
 			goto exit;
@@ -248,26 +312,118 @@ vcablk_bcknd_disk_send_response(struct vcablk_bcknd_disk *bckd,
 
 	pr_debug("%s:  cookie %u, ret %i \n", __func__, cookie, ret);
 
-	ack = VCABLK_RB_GET_COMPLETION(last_add, bckd->completion_ring_num_elems, completion_ring->elems);
+	ack = VCABLK_RB_GET_COMPLETION(last_add, queue->completion_ring_num_elems, completion_ring->elems);
 	/* Write to ACK buffer */
 	iowrite8((__s8)ret, &ack->ret);
 	iowrite16(cookie, &ack->cookie);
 	wmb();
-	last_add = VCA_RB_COUNTER_ADD(last_add, 1, bckd->completion_ring_num_elems);
+	last_add = VCA_RB_COUNTER_ADD(last_add, 1, queue->completion_ring_num_elems);
 	iowrite16(last_add, &completion_ring->last_add);
 	wmb();
 
 	/* Send IRQ done */
-	bckd->hw_ops->send_intr(bckd->bdev->mdev.parent, bckd->done_db);
+	bckd->hw_ops->send_intr(bckd->bdev->mdev.parent, queue->done_db);
 
 exit:
-	spin_unlock_irqrestore(&bckd->send_resp_lock, lock_flags);
+	spin_unlock_irqrestore(&queue->send_resp_lock, lock_flags);
 	return err;
 }
 
+static void vcablk_bcknd_media_submit(transfer_parameters_t *dma_args);
+
+/*
+ * Use media page for transfer instead of bounce buffer, when media can
+ * give page holding whole transfer. Pages of a memory disk live as long as
+ * the media, page cache pages only on request of vcablk_bcknd_zero_copy.
+ */
+static void vcablk_bcknd_get_media_page(struct vcablk_bcknd_disk *bckd,
+		transfer_parameters_t *dma_args)
+{
+	callback_param_t *data = &dma_args->callback_param;
+	struct dma_chan *dma_ch = bckd->bdev->dma_ch;
+	struct page *page;
+	unsigned int offset;
+
+	dma_args->page = NULL;
+	if (!vcablk_bcknd_zero_copy && !vcablk_media_memory(bckd->media))
+		return;
+
+	page = vcablk_media_get_page(bckd->media, data->sector, data->nsec,
+			data->is_write, &offset);
+	if (!page)
+		return;
+
+	if (dma_ch) {
+		dma_args->page_da = dma_map_page(dma_ch->device->dev, page, offset,
+				data->nsec << SECTOR_SHIFT,
+				data->is_write ? DMA_FROM_DEVICE : DMA_TO_DEVICE);
+		if (dma_mapping_error(dma_ch->device->dev, dma_args->page_da)) {
+			vcablk_media_put_page(bckd->media, page);
+			return;
+		}
+	}
+	dma_args->page = page;
+	dma_args->page_offset = offset;
+}
+
+static void vcablk_bcknd_put_media_page(struct vcablk_bcknd_disk *bckd,
+		transfer_parameters_t *dma_args)
+{
+	callback_param_t *data = &dma_args->callback_param;
+	struct dma_chan *dma_ch = bckd->bdev->dma_ch;
+
+	if (!dma_args->page)
+		return;
+
+	if (dma_ch)
+		dma_unmap_page(dma_ch->device->dev, dma_args->page_da,
+				data->nsec << SECTOR_SHIFT,
+				data->is_write ? DMA_FROM_DEVICE : DMA_TO_DEVICE);
+	vcablk_media_put_page(bckd->media, dma_args->page);
+	dma_args->page = NULL;
+}
+
+static void vcablk_bcknd_put_transfer_param(transfer_parameters_t *dma_args)
+{
+	struct vcablk_bcknd_disk *bckd = dma_args->callback_param.bckd;
+
+	atomic_dec(&dma_args->callback_param.queue->parts_inflight);
+	spin_lock(&bckd->transfer_buffer_pool_lock);
+	vcablk_pool_push(bckd->transfer_buffer_pool, dma_args);
+	spin_unlock(&bckd->transfer_buffer_pool_lock);
+	wake_up(&bckd->transfer_buffer_pool_wq);
+}
+
+/*
+ * Send response after last part of request, and release transfer buffer.
+ */
+static void vca_bcknd_finish_transfer(transfer_parameters_t *dma_args)
+{
+	callback_param_t *data = &dma_args->callback_param;
+	struct vcablk_bcknd_queue *queue = data->queue;
+	int err = data->err;
+
+	if (data->response_cookie >= 0) {
+		/* Parts of request finish in order, so error of any previous part
+		 * belongs to this request */
+		if (!err)
+			err = queue->transfer_error[data->is_write];
+		queue->transfer_error[data->is_write] = 0;
+
+		/* TODO: consider proper flush, not just sync */
+		if (!err && data->do_flush)
+			err = vcablk_media_sync(data->bckd->media);
+		vcablk_bcknd_disk_send_response(queue, data->response_cookie, err);
+	} else if (err) {
+		queue->transfer_error[data->is_write] = err;
+	}
+
+	vcablk_bcknd_put_media_page(data->bckd, dma_args);
+	vcablk_bcknd_put_transfer_param(dma_args);
+}
+
 static void vca_bcknd_complete_transfer(transfer_parameters_t *dma_args)
 {
-	int err = 0;
 	callback_param_t *data = &dma_args->callback_param;
 	vcablk_buffer *buffer = &dma_args->buffer;
 	pr_debug("%s: buffer:%p, sector:%lu, response_cookie:%i, do_flush:%i, is_write:%i",
@@ -276,22 +432,21 @@ static void vca_bcknd_complete_transfer(transfer_parameters_t *dma_args)
 
 	dma_args->tx = NULL;
 
-	if (data->is_write) {
-		err = vcablk_media_transfer(data->bckd->media, data->sector, data->nsec, buffer->buffer, 1);
-		if (err)
+	/* DMA into media page already wrote data */
+	if (data->is_write && !dma_args->page) {
+		if (vcablk_media_is_async(data->bckd->media)) {
+			/* Finished by media reap, after write */
+			vcablk_bcknd_media_submit(dma_args);
+			return;
+		}
+
+		data->err = vcablk_media_transfer(data->bckd->media, data->sector, data->nsec, buffer->buffer, 1);
+		if (data->err)
 			printk(KERN_ERR "%s: Can not write data buffer, after DMA write: sector: %lu",
 				__func__, data->sector);
 	}
 
-	if (data->response_cookie >= 0) {
-		/* TODO: consider proper flush, not just sync */
-		if (!err && data->do_flush)
-			err = vcablk_media_sync(data->bckd->media);
-		vcablk_bcknd_disk_send_response(data->bckd, data->response_cookie, err);
-	}
-
-	vcablk_pool_push(data->bckd->transfer_buffer_pool, dma_args);
-	wake_up(&data->bckd->transfer_buffer_pool_wq);
+	vca_bcknd_finish_transfer(dma_args);
 }
 
 static void vca_bcknd_callback_dma(void *arg)
@@ -302,6 +457,7 @@ static void vca_bcknd_callback_dma(void *arg)
 	struct vcablk_ring *ring = bckd->transfer_ring;
 	vcablk_buffer *buffer = &dma_args->buffer;
 	__u16 size, last_add, last_used;
+	unsigned long lock_flags;
 
 	if (data->remapped) {
 		bckd->bdev->hw_ops->iounmap(bckd->bdev->mdev.parent, data->remapped);
@@ -315,10 +471,12 @@ static void vca_bcknd_callback_dma(void *arg)
 		return;
 	}
 
+	spin_lock_irqsave(&bckd->transfer_ring_lock, lock_flags);
 	size = ring->num_elems;
 	last_add = READ_ONCE(ring->last_add);
 	last_used = READ_ONCE(ring->last_used);
 	if (unlikely(VCA_RB_BUFF_FULL(last_add, last_used, size))) {
+		spin_unlock_irqrestore(&bckd->transfer_ring_lock, lock_flags);
 		pr_err("%s: ring buffer is full!, it is unhandled error, resource leak will occur\n", __func__);
 		return;
 	}
@@ -331,6 +489,7 @@ static void vca_bcknd_callback_dma(void *arg)
 	((transfer_parameters_t **) ring->elems)[VCA_RB_COUNTER_TO_IDX(last_add, size)] = dma_args;
 	smp_wmb();
 	WRITE_ONCE(ring->last_add, VCA_RB_COUNTER_ADD(last_add, 1, size));
+	spin_unlock_irqrestore(&bckd->transfer_ring_lock, lock_flags);
 	wake_up(&bckd->transfer_wq);
 	pr_debug("%s: enqueued\n", __func__);
 }
@@ -340,7 +499,9 @@ static transfer_parameters_t
 {
 	transfer_parameters_t *result = NULL;
 	while(result == NULL) {
+		spin_lock(&bckd->transfer_buffer_pool_lock);
 		result = vcablk_pool_pop(bckd->transfer_buffer_pool, NULL);
+		spin_unlock(&bckd->transfer_buffer_pool_lock);
 		if (result != NULL) {
 			BUG_ON(result->tx);
 			break;
@@ -380,29 +541,39 @@ vcablk_bcknd_transfer_device(struct vcablk_bcknd_disk *bckd,
 {
 	int ret = 0;
 	bool write = transfer_params->callback_param.is_write;
+	/* Host side of transfer, media page or bounce buffer */
+	dma_addr_t host_da = transfer_params->page ? transfer_params->page_da :
+			transfer_params->buffer.buffer_phys_da;
 
 	if (!bckd->bdev->dma_ch) {
 		/* MEMCPY */
+		void *host = transfer_params->buffer.buffer;
+
+		if (transfer_params->page)
+			host = kmap(transfer_params->page) +
+					transfer_params->page_offset;
 		if (write) {
-			memcpy_fromio(transfer_params->buffer.buffer, remapped, bytes);
+			memcpy_fromio(host, remapped, bytes);
 		} else {
-			memcpy_toio(remapped, transfer_params->buffer.buffer, bytes);
+			memcpy_toio(remapped, host, bytes);
 			wmb();
 			ioread8(remapped + bytes -1);
 		}
+		if (transfer_params->page)
+			kunmap(transfer_params->page);
 		vca_bcknd_callback_dma(transfer_params);
 	} else {
 #ifdef BLOCKIO_FORCE_DMA_SYNC
 		/* DMA SYNC */
 		if (write) {
 			ret = vcablk_bcknd_dma_sync(bckd->bdev->dma_ch,
-					transfer_params->buffer.buffer_phys_da,
+					host_da,
 					bckd->bdev->hw_ops->bar_va_to_pa(bckd->bdev->mdev.parent, remapped),
 					bytes);
 		} else {
 			ret = vcablk_bcknd_dma_sync(bckd->bdev->dma_ch,
 					bckd->bdev->hw_ops->bar_va_to_pa(bckd->bdev->mdev.parent, remapped),
-					transfer_params->buffer.buffer_phys_da,
+					host_da,
 					bytes);
 		}
 
@@ -417,13 +588,13 @@ vcablk_bcknd_transfer_device(struct vcablk_bcknd_disk *bckd,
 
 		if (write) {
 			dma_cookie = vcablk_bcknd_dma_async(bckd->bdev->dma_ch,
-					transfer_params->buffer.buffer_phys_da,
+					host_da,
 					bckd->bdev->hw_ops->bar_va_to_pa(bckd->bdev->mdev.parent, remapped),
 					bytes, vca_bcknd_callback_dma, transfer_params, &transfer_params->tx);
 		} else {
 			dma_cookie = vcablk_bcknd_dma_async(bckd->bdev->dma_ch,
 					bckd->bdev->hw_ops->bar_va_to_pa(bckd->bdev->mdev.parent, remapped),
-					transfer_params->buffer.buffer_phys_da,
+					host_da,
 					bytes, vca_bcknd_callback_dma, transfer_params, &transfer_params->tx);
 		}
 
@@ -438,7 +609,107 @@ vcablk_bcknd_transfer_device(struct vcablk_bcknd_disk *bckd,
 	return ret;
 }
 
-int vcablk_bcknd_transfer(struct vcablk_bcknd_disk *bckd,
+static void vca_bcknd_callback_media(struct vcablk_media_iocb *iocb, int ret)
+{
+	transfer_parameters_t *dma_args =
+			container_of(iocb, transfer_parameters_t, iocb);
+	struct vcablk_bcknd_disk *bckd = dma_args->callback_param.bckd;
+
+	if (ret) {
+		printk(KERN_ERR "%s: Media transfer error %i Backend %i sector %lu "
+				"write %i\n", __func__, ret, bckd->bcknd_id,
+				dma_args->callback_param.sector,
+				dma_args->callback_param.is_write);
+		dma_args->callback_param.err = ret;
+	}
+	smp_wmb();
+	WRITE_ONCE(dma_args->media_done, true);
+	queue_work(bckd->media_reap_wq, &bckd->media_reap_work);
+}
+
+/*
+ * Start media transfer of single buffer. Media transfers finish in any order,
+ * but are reaped in order of submission, so response is send after all
+ * parts of request.
+ */
+static void vcablk_bcknd_media_submit(transfer_parameters_t *dma_args)
+{
+	callback_param_t *data = &dma_args->callback_param;
+	struct vcablk_bcknd_disk *bckd = data->bckd;
+	struct vcablk_ring *ring = bckd->media_ring;
+	__u16 size, last_add;
+	unsigned long lock_flags;
+
+	dma_args->media_done = false;
+
+	spin_lock_irqsave(&bckd->media_ring_lock, lock_flags);
+	size = ring->num_elems;
+	last_add = ring->last_add;
+	/* Ring is as big as transfer_buffer_pool */
+	BUG_ON(VCA_RB_BUFF_FULL(last_add, READ_ONCE(ring->last_used), size));
+	((transfer_parameters_t **) ring->elems)[VCA_RB_COUNTER_TO_IDX(last_add, size)] = dma_args;
+	smp_wmb();
+	WRITE_ONCE(ring->last_add, VCA_RB_COUNTER_ADD(last_add, 1, size));
+	spin_unlock_irqrestore(&bckd->media_ring_lock, lock_flags);
+
+	if (data->err) {
+		/* Do not write data of failed DMA */
+		vca_bcknd_callback_media(&dma_args->iocb, data->err);
+		return;
+	}
+
+	if (dma_args->page) {
+		/* Data already in media page, only keep order of reap */
+		vca_bcknd_callback_media(&dma_args->iocb, 0);
+		return;
+	}
+
+	vcablk_media_transfer_async(bckd->media, &dma_args->iocb, data->sector,
+			data->nsec, dma_args->buffer.buffer, data->is_write,
+			vca_bcknd_callback_media);
+}
+
+static void vcablk_bcknd_media_reap(struct work_struct *work)
+{
+	struct vcablk_bcknd_disk *bckd =
+			container_of(work, struct vcablk_bcknd_disk, media_reap_work);
+	struct vcablk_ring *ring = bckd->media_ring;
+	transfer_parameters_t *dma_args;
+	callback_param_t *data;
+	__u16 size = ring->num_elems;
+	__u16 last_used = ring->last_used;
+	int ret;
+
+	while (last_used != READ_ONCE(ring->last_add)) {
+		smp_rmb();
+		dma_args = ((transfer_parameters_t **) ring->elems)[VCA_RB_COUNTER_TO_IDX(last_used, size)];
+		if (!READ_ONCE(dma_args->media_done))
+			break;
+		smp_rmb();
+		last_used = VCA_RB_COUNTER_ADD(last_used, 1, size);
+		WRITE_ONCE(ring->last_used, last_used);
+
+		data = &dma_args->callback_param;
+		if (data->is_write) {
+			vca_bcknd_finish_transfer(dma_args);
+			continue;
+		}
+
+		/* Read finished, send data to card. Data of failed read is sent
+		 * too, to keep order of DMA callbacks, error goes with response. */
+		ret = vcablk_bcknd_transfer_device(bckd, dma_args, data->device,
+				data->nsec << SECTOR_SHIFT);
+		if (ret) {
+			printk(KERN_ERR "%s: DMA transfer error %i Backend %i "
+					"response_cookie %i.\n", __func__, ret,
+					bckd->bcknd_id, data->response_cookie);
+			data->err = ret;
+			vca_bcknd_callback_dma(dma_args);
+		}
+	}
+}
+
+int vcablk_bcknd_transfer(struct vcablk_bcknd_queue *queue,
 		unsigned long sector,
 		unsigned long sectors_num,
 		__u64 phys_buff,
@@ -446,6 +717,7 @@ int vcablk_bcknd_transfer(struct vcablk_bcknd_disk *bckd,
 		int response_cookie,
 		bool do_flush)
 {
+	struct vcablk_bcknd_disk *bckd = queue->bckd;
 	int ret = 0;
 	uintptr_t offset_ptr;
 	void *remapped = vcablk_bcknd_ioremap(bckd, phys_buff, sectors_num << SECTOR_SHIFT);
@@ -483,21 +755,35 @@ int vcablk_bcknd_transfer(struct vcablk_bcknd_disk *bckd,
 			transfer_params->callback_param.remapped = NULL;
 			transfer_params->callback_param.do_flush = false;
 		}
+		atomic_inc(&queue->parts_inflight);
 		transfer_params->callback_param.bckd = bckd;
+		transfer_params->callback_param.queue = queue;
 		transfer_params->callback_param.sector = sector;
 		transfer_params->callback_param.nsec = nsec;
 		transfer_params->callback_param.is_write = write;
+		transfer_params->callback_param.device = (void *) offset_ptr;
+		transfer_params->callback_param.err = 0;
+		vcablk_bcknd_get_media_page(bckd, transfer_params);
 
 		pr_debug("%s: phys_buff: %llu, sectors_num: %lu, nsec: %lu, bytes: %lu,"
 				" write: %i, response_cookie %i", __func__, phys_buff,
 				sectors_num, nsec, bytes, write,
 				transfer_params->callback_param.response_cookie);
 
-		if (!write) {
+		if (!write && vcablk_media_is_async(bckd->media)) {
+			/* DMA is started by media reap, after read */
+			vcablk_bcknd_media_submit(transfer_params);
+			sector += nsec;
+			offset_ptr += bytes;
+			continue;
+		}
+
+		if (!write && !transfer_params->page) {
 			ret = vcablk_media_transfer(bckd->media, sector, nsec,
 					transfer_params->buffer.buffer, write);
 			if (ret) {
 				printk(KERN_ERR "%s: error in vcablk_media_transfer: %d", __func__, ret);
+				vcablk_bcknd_put_transfer_param(transfer_params);
 				break;
 			}
 		}
@@ -509,6 +795,8 @@ int vcablk_bcknd_transfer(struct vcablk_bcknd_disk *bckd,
 			printk(KERN_ERR "%s: DMA transfer error %i Backend %i "
 					"response_cookie %i.\n",
 					__func__, ret, bckd->bcknd_id, response_cookie);
+			vcablk_bcknd_put_media_page(bckd, transfer_params);
+			vcablk_bcknd_put_transfer_param(transfer_params);
 			break;
 		}
 
@@ -517,16 +805,91 @@ int vcablk_bcknd_transfer(struct vcablk_bcknd_disk *bckd,
 	}
 
 	if (ret) {
-		/* When exit with error, some started transfer by DMA can still
-		 * work in background! */
-		printk(KERN_ERR "%s: DMA transfer error in background! ret %i\n",
+		/* Parts started before the failed one still read media or DMA
+		 * into remapped, no new part of this queue comes meanwhile. */
+		printk(KERN_ERR "%s: transfer error %i, waiting for started parts\n",
 				__func__, ret);
+		if (!wait_event_timeout(bckd->transfer_buffer_pool_wq,
+				!atomic_read(&queue->parts_inflight),
+				msecs_to_jiffies(TIMEOUT_POOL_POP_MS))) {
+			printk(KERN_ERR "%s: parts of Backend %i queue %i not "
+					"finished, mapping left\n", __func__,
+					bckd->bcknd_id, queue->id);
+			return ret;
+		}
 		bckd->bdev->hw_ops->iounmap(bckd->bdev->mdev.parent, remapped);
 		wake_up_all(&bckd->ioremap_wq);
 	}
 	return ret;
 }
 
+/*
+ * Transfer all segments from table of single request,
+ * response is send after last segment.
+ */
+static int
+vcablk_bcknd_transfer_segments(struct vcablk_bcknd_queue *queue,
+		struct vcablk_request *request,
+		int write,
+		int response_cookie,
+		bool do_flush)
+{
+	struct vcablk_bcknd_disk *bckd = queue->bckd;
+	struct vcablk_segment *segments = queue->segment_buff;
+	size_t table_size = request->segments_num * sizeof(struct vcablk_segment);
+	unsigned long sector = request->sector;
+	__u64 sectors_num = 0;
+	void *remapped;
+	__u16 id;
+	int ret = 0;
+
+	if (!request->segments_num || request->segments_num > VCABLK_MAX_SEGMENTS) {
+		printk(KERN_ERR "%s: Invalid number of segments %u, cookie %u\n",
+				__func__, request->segments_num, request->cookie);
+		return -EIO;
+	}
+
+	remapped = vcablk_bcknd_ioremap(bckd, request->phys_buff, table_size);
+	if (!remapped) {
+		printk(KERN_ERR "%s: Can not remap segment table: phys_buff %llu, "
+				"segments %u\n", __func__, request->phys_buff,
+				request->segments_num);
+		return -EIO;
+	}
+	memcpy_fromio(segments, remapped, table_size);
+	bckd->bdev->hw_ops->iounmap(bckd->bdev->mdev.parent, remapped);
+	wake_up_all(&bckd->ioremap_wq);
+
+	for (id = 0; id < request->segments_num; ++id)
+		sectors_num += segments[id].sectors_num;
+	if (sectors_num != request->sectors_num) {
+		printk(KERN_ERR "%s: Segments cover %llu sectors, expected %llu, "
+				"cookie %u\n", __func__, sectors_num,
+				request->sectors_num, request->cookie);
+		return -EIO;
+	}
+
+	for (id = 0; id < request->segments_num; ++id) {
+		bool last = (id + 1 == request->segments_num);
+
+		pr_debug("%s: cookie %u segment %i/%i sector %lu, sectors %u, "
+			"physBuff 0x%p\n", __func__, request->cookie, id,
+			request->segments_num, sector, segments[id].sectors_num,
+			(void*)segments[id].phys_buff);
+
+		ret = vcablk_bcknd_transfer(queue, sector,
+				segments[id].sectors_num,
+				segments[id].phys_buff,
+				write,
+				last ? response_cookie : -1,
+				last ? do_flush : false);
+		if (ret)
+			break;
+		sector += segments[id].sectors_num;
+	}
+	return ret;
+}
+
 enum disk_state
 vcablk_bcknd_disk_get_state(struct vcablk_bcknd_disk *bckd)
 {
@@ -589,6 +952,8 @@ vcablk_bcknd_disk_request_get_info(struct vcablk_bcknd_disk *bckd,
 	switch (*out_type) {
 	case REQUEST_READ:
 	case REQUEST_WRITE:
+	case REQUEST_READ_SEGMENTS:
+	case REQUEST_WRITE_SEGMENTS:
 	case REQUEST_SYNC:
 		break;
 	default:
@@ -647,9 +1012,10 @@ vcablk_bcknd_disk_request_get_info(struct vcablk_bcknd_disk *bckd,
 }
 
 static int
-vcablk_bcknd_disk_request(struct vcablk_bcknd_disk *bckd,
+vcablk_bcknd_disk_request(struct vcablk_bcknd_queue *queue,
 		struct vcablk_request *request_buff, __u16 size)
 {
+	struct vcablk_bcknd_disk *bckd = queue->bckd;
 	int err = 0;
 	struct vcablk_request *request;
 	__u16 req_cookie = 0;
@@ -672,7 +1038,7 @@ vcablk_bcknd_disk_request(struct vcablk_bcknd_disk *bckd,
 	if (err)
 		goto send_response;
 
-	write = (req_type == REQUEST_WRITE);
+	write = (req_type == REQUEST_WRITE || req_type == REQUEST_WRITE_SEGMENTS);
 
 	pr_debug("%s: cookie %u, requests %i, sector %lu, sectors %lu,"
 				" req_type %i, syncb %i, synca %i\n", __func__, req_cookie, size,
@@ -705,8 +1071,17 @@ vcablk_bcknd_disk_request(struct vcablk_bcknd_disk *bckd,
 			do_flush = sync_after;
 		}
 
-		err = vcablk_bcknd_transfer(
-						bckd,
+		if (req_type == REQUEST_READ_SEGMENTS ||
+				req_type == REQUEST_WRITE_SEGMENTS)
+			err = vcablk_bcknd_transfer_segments(
+						queue,
+						request,
+						write,
+						response_cookie,
+						do_flush);
+		else
+			err = vcablk_bcknd_transfer(
+						queue,
 						request->sector,
 						request->sectors_num,
 						request->phys_buff,
@@ -724,7 +1099,7 @@ vcablk_bcknd_disk_request(struct vcablk_bcknd_disk *bckd,
 
 	if (err) {
 send_response:
-		vcablk_bcknd_disk_send_response(bckd, req_cookie, err);
+		vcablk_bcknd_disk_send_response(queue, req_cookie, err);
 	}
 
 	return err;
@@ -733,21 +1108,21 @@ send_response:
 /* Get next single request form requests ring.
  * RETURN: Number of elements in request, if not request then return 0*/
 static __u16
-vcablk_bcknd_disk_get_next_request(struct vcablk_bcknd_disk *bckd,
+vcablk_bcknd_disk_get_next_request(struct vcablk_bcknd_queue *queue,
 		struct vcablk_request *request_buff)
 {
-	struct vcablk_ring *ring_req = bckd->request_ring;
+	struct vcablk_ring *ring_req = queue->request_ring;
 	__u16 size = 0;
 	__u16 last_add = ring_req->last_add;
-	__u16 last_used = bckd->request_last_used;
+	__u16 last_used = queue->request_last_used;
 	__u16 cookie = 0;
 
 	if (last_used != last_add) {
 		for (;last_used != last_add && size < VCABLK_MAX_PARTS_PER_REQUEST;
-			last_used = VCA_RB_COUNTER_ADD(last_used, 1, bckd->request_ring_nums)) {
+			last_used = VCA_RB_COUNTER_ADD(last_used, 1, queue->request_ring_nums)) {
 
 			/* Copy remote request to local buffer. */
-			struct vcablk_request *request_remote = VCABLK_RB_GET_REQUEST(last_used, bckd->request_ring_nums, ring_req->elems);
+			struct vcablk_request *request_remote = VCABLK_RB_GET_REQUEST(last_used, queue->request_ring_nums, ring_req->elems);
 			struct vcablk_request *request_local = request_buff + size;
 			memcpy_fromio(request_local, request_remote, sizeof(struct vcablk_request));
 			rmb();
@@ -771,8 +1146,8 @@ vcablk_bcknd_disk_get_next_request(struct vcablk_bcknd_disk *bckd,
 		}
 
 		/* First clean request ring, before execute response! */
-		bckd->request_last_used = last_used;
-		iowrite16(last_used, &bckd->request_ring->last_used);
+		queue->request_last_used = last_used;
+		iowrite16(last_used, &queue->request_ring->last_used);
 	}
 	return size;
 }
@@ -780,17 +1155,19 @@ vcablk_bcknd_disk_get_next_request(struct vcablk_bcknd_disk *bckd,
 static int
 vcablk_bcknd_disk_make_request_thread(void *data)
 {
-	struct vcablk_bcknd_disk *bckd = data;
-	struct vcablk_ring *ring_req = bckd->request_ring;
-	struct vcablk_request *request_buff = bckd->request_buff;
+	struct vcablk_bcknd_queue *queue = data;
+	struct vcablk_bcknd_disk *bckd = queue->bckd;
+	struct vcablk_ring *ring_req = queue->request_ring;
+	struct vcablk_request *request_buff = queue->request_buff;
 	__u16 request_size;
 	__u16 last_add;
 
-	pr_debug("%s: Thread start dev_id %i\n", __func__, bckd->bcknd_id);
+	pr_debug("%s: Thread start dev_id %i queue %i\n", __func__,
+			bckd->bcknd_id, queue->id);
 
 	while (!kthread_should_stop()) {
-		wait_event_interruptible(bckd->request_wq,
-				ring_req->last_add != bckd->request_last_used ||
+		wait_event_interruptible(queue->request_wq,
+				ring_req->last_add != queue->request_last_used ||
 				kthread_should_stop());
 
 		if (bckd->state != DISK_STATE_OPEN || kthread_should_stop()) {
@@ -800,19 +1177,20 @@ vcablk_bcknd_disk_make_request_thread(void *data)
 		}
 
 		/*
-		 * Finish all available requests in ring, before check bckd->request_wq
+		 * Finish all available requests in ring, before check queue->request_wq
 		 * to not stack on queue.Can not pool on ring_req->last_add and finish
 		 * all incoming requests, to avoid OS report: lock CPU.
 		 * */
 		last_add = ring_req->last_add;
-		while (last_add != bckd->request_last_used && !kthread_should_stop()) {
-			request_size = vcablk_bcknd_disk_get_next_request(bckd, request_buff);
+		while (last_add != queue->request_last_used && !kthread_should_stop()) {
+			request_size = vcablk_bcknd_disk_get_next_request(queue, request_buff);
 			if (request_size)
-				vcablk_bcknd_disk_request(bckd, request_buff, request_size);
+				vcablk_bcknd_disk_request(queue, request_buff, request_size);
 		}
 	}
 
-	pr_debug("%s: Thread STOP dev_id %i\n", __func__, bckd->bcknd_id);
+	pr_debug("%s: Thread STOP dev_id %i queue %i\n", __func__,
+			bckd->bcknd_id, queue->id);
 	atomic_dec(&bckd->threads_count);
 	wake_up(&bckd->threads_exit_wq);
 
@@ -823,18 +1201,19 @@ vcablk_bcknd_disk_make_request_thread(void *data)
 static irqreturn_t
 vcablk_bcknd_disk_request_irq(int irq, void *data)
 {
-	struct vcablk_bcknd_disk *bckd = (struct vcablk_bcknd_disk *)data;
+	struct vcablk_bcknd_queue *queue = (struct vcablk_bcknd_queue *)data;
 
-	if (bckd) {
+	if (queue) {
+		struct vcablk_bcknd_disk *bckd = queue->bckd;
 		if (bckd->state == DISK_STATE_OPEN) {
-			wake_up(&bckd->request_wq);
+			wake_up(&queue->request_wq);
 		} else {
 			pr_err("%s: Ignore Request IRQ %i dev not ready\n",
 					__func__, bckd->bcknd_id);
 		}
 
 		bckd->hw_ops->ack_interrupt(bckd->bdev->mdev.parent,
-				bckd->request_db);
+				queue->request_db);
 	} else {
 		pr_err("%s: unknown IRQ \n", __func__);
 	}
@@ -884,16 +1263,33 @@ exit:
 	return ret;
 }
 
+static void vcablk_bcknd_disk_media_drain(struct vcablk_bcknd_disk *bckd)
+{
+	if (!bckd->media_ring)
+		return;
+
+	vcablk_media_drain(bckd->media);
+	flush_work(&bckd->media_reap_work);
+}
+
 static void vcablk_bcknd_disk_end_threads(struct vcablk_bcknd_disk *bckd)
 {
 	int ret, start, timeout = msecs_to_jiffies(TIMEOUT_END_THREADS_MS);
+	int i;
 
 	pr_debug("%s id=%i\n", __func__, bckd->bcknd_id);
-	if (bckd->request_process_thread) {
-		kthread_stop(bckd->request_process_thread);
-		bckd->request_process_thread = NULL;
-		wake_up(&bckd->request_wq);
+	for (i = 0; i < bckd->queues_max; ++i) {
+		struct vcablk_bcknd_queue *queue = bckd->queues[i];
+		if (queue->request_process_thread) {
+			kthread_stop(queue->request_process_thread);
+			queue->request_process_thread = NULL;
+			wake_up(&queue->request_wq);
+		}
 	}
+
+	/* Reads of stopped requests still use transfer thread */
+	vcablk_bcknd_disk_media_drain(bckd);
+
 	if (bckd->transfer_thread) {
 		kthread_stop(bckd->transfer_thread);
 		bckd->transfer_thread = NULL;
@@ -912,35 +1308,58 @@ static void vcablk_bcknd_disk_end_threads(struct vcablk_bcknd_disk *bckd)
 		pr_err("%s: some (%i) threads are still running after timeout\n",
 			__func__, atomic_read(&bckd->threads_count));
 
+	/* Writes started by transfer thread */
+	vcablk_bcknd_disk_media_drain(bckd);
+	if (bckd->media_ring) {
+		kfree(bckd->media_ring);
+		bckd->media_ring = NULL;
+	}
+	if (bckd->media_reap_wq) {
+		destroy_workqueue(bckd->media_reap_wq);
+		bckd->media_reap_wq = NULL;
+	}
+
 	if (bckd->transfer_ring) {
 		kfree(bckd->transfer_ring);
 		bckd->transfer_ring = NULL;
 	}
 }
 
-void
-vcablk_bcknd_disk_stop(struct vcablk_bcknd_disk *bckd)
+static void
+vcablk_bcknd_queue_stop(struct vcablk_bcknd_queue *queue)
 {
-	pr_debug("%s stop %i\n", __func__, bckd->bcknd_id);
+	struct vcablk_bcknd_disk *bckd = queue->bckd;
 
-	vcablk_bcknd_disk_end_threads(bckd);
-
-	if (bckd->request_db >= 0) {
-		bckd->hw_ops->free_irq(bckd->bdev->mdev.parent, bckd->request_irq, bckd);
-		bckd->request_db = -1;
-		bckd->request_irq = NULL;
+	if (queue->request_irq) {
+		bckd->hw_ops->free_irq(bckd->bdev->mdev.parent, queue->request_irq, queue);
+		queue->request_irq = NULL;
 	}
-	bckd->done_db = -1;
+	queue->request_db = -1;
+	queue->done_db = -1;
 
-	if (bckd->request_ring) {
-		bckd->bdev->hw_ops->iounmap(bckd->bdev->mdev.parent, bckd->request_ring);
-		bckd->request_ring = NULL;
+	if (queue->request_ring) {
+		bckd->bdev->hw_ops->iounmap(bckd->bdev->mdev.parent, queue->request_ring);
+		queue->request_ring = NULL;
 	}
-	if (bckd->completion_ring) {
-		bckd->bdev->hw_ops->iounmap(bckd->bdev->mdev.parent,bckd->completion_ring);
-		bckd->completion_ring = NULL;
+	if (queue->completion_ring) {
+		bckd->bdev->hw_ops->iounmap(bckd->bdev->mdev.parent, queue->completion_ring);
+		queue->completion_ring = NULL;
 		/* some mappings freed, but there should be no user waiting on ioremap_wq */
 	}
+}
+
+void
+vcablk_bcknd_disk_stop(struct vcablk_bcknd_disk *bckd)
+{
+	int i;
+
+	pr_debug("%s stop %i\n", __func__, bckd->bcknd_id);
+
+	vcablk_bcknd_disk_end_threads(bckd);
+
+	for (i = 0; i < bckd->queues_max; ++i)
+		vcablk_bcknd_queue_stop(bckd->queues[i]);
+	bckd->queues_num = 0;
 
 	bckd->state = DISK_STATE_CREATE;
 }
@@ -948,9 +1367,14 @@ vcablk_bcknd_disk_stop(struct vcablk_bcknd_disk *bckd)
 void
 vcablk_bcknd_disk_destroy(struct vcablk_bcknd_disk *bckd)
 {
+	int i;
+
 	pr_info("%s start %i\n", __func__, bckd->bcknd_id);
 	vcablk_bcknd_disk_stop(bckd);
 
+	for (i = 0; i < bckd->queues_max; ++i)
+		kfree(bckd->queues[i]);
+
 	vcablk_bcknd_buffer_deinit(bckd->transfer_buffer_pool, bckd->bdev->dma_ch);
 
 	if (bckd->media) {
@@ -977,6 +1401,7 @@ vcablk_bcknd_disk_create(struct vcablk_bcknd_dev *bdev,
 	struct vcablk_bcknd_disk *bckd = NULL;
 	bool read_only;
 	size_t size_bytes;
+	int i;
 
 	pr_debug(KERN_ERR "%s disk_id %i\n", __func__, desc->disk_id);
 
@@ -997,19 +1422,50 @@ vcablk_bcknd_disk_create(struct vcablk_bcknd_dev *bdev,
 		goto exit;
 	}
 
+	/* Rings need power of 2 size */
+	bckd->transfer_depth = roundup_pow_of_two(clamp_t(unsigned int,
+			vcablk_bcknd_transfer_depth, VCABLK_TRANSFER_DEPTH_MIN,
+			VCABLK_TRANSFER_DEPTH_MAX));
+	if (bckd->transfer_depth != vcablk_bcknd_transfer_depth)
+		pr_warn("%s: vcablk_bcknd_transfer_depth %u not a power of 2 in "
+				"[%u-%u], using %u\n", __func__,
+				vcablk_bcknd_transfer_depth,
+				VCABLK_TRANSFER_DEPTH_MIN, VCABLK_TRANSFER_DEPTH_MAX,
+				bckd->transfer_depth);
+
 	/* -1 because arg is incremented by one within vcablk_pool_init(), which we want to avoid here */
-	bckd->transfer_buffer_pool = vcablk_pool_init(VCABLK_TRANSFER_RING_SIZE - 1, sizeof(transfer_parameters_t));
+	bckd->transfer_buffer_pool = vcablk_pool_init(bckd->transfer_depth - 1, sizeof(transfer_parameters_t));
 	if (bckd->transfer_buffer_pool == NULL) {
 		printk(KERN_ERR "%s: Can not allocate memory poll size %lu\n", __func__,
-				VCABLK_TRANSFER_RING_SIZE * sizeof(transfer_parameters_t));
+				bckd->transfer_depth * sizeof(transfer_parameters_t));
 		err = -ENOMEM;
 		goto exit;
 	}
 	init_waitqueue_head(&bckd->transfer_buffer_pool_wq);
+	spin_lock_init(&bckd->transfer_buffer_pool_lock);
+
+	bckd->queues_max = clamp_t(int, vcablk_bcknd_max_queues, 1, VCABLK_MAX_QUEUES);
+	for (i = 0; i < bckd->queues_max; ++i) {
+		struct vcablk_bcknd_queue *queue =
+				kzalloc(sizeof (struct vcablk_bcknd_queue), GFP_KERNEL);
+		if (!queue) {
+			pr_err("%s: Can not allocate queue size %lu\n", __func__,
+					sizeof (struct vcablk_bcknd_queue));
+			err = -ENOMEM;
+			goto exit;
+		}
+		queue->bckd = bckd;
+		queue->id = i;
+		queue->request_db = -1;
+		queue->done_db = -1;
+		init_waitqueue_head(&queue->request_wq);
+		spin_lock_init(&queue->send_resp_lock);
+		atomic_set(&queue->parts_inflight, 0);
+		bckd->queues[i] = queue;
+	}
 
 	bckd->bdev = bdev;
 	bckd->hw_ops = bdev->hw_ops;
-	bckd->request_db = -1;
 	bckd->bcknd_id = desc->disk_id;
 	bckd->state = DISK_STATE_CREATE;
 	read_only = (desc->mode == VCABLK_DISK_MODE_READ_ONLY);
@@ -1031,10 +1487,14 @@ vcablk_bcknd_disk_create(struct vcablk_bcknd_dev *bdev,
 
 	if (desc->type == VCABLK_DISK_TYPE_FILE) {
 		bckd->media = vcablk_media_create_file(size_bytes,
-				desc->file_path, read_only);
+				desc->file_path, read_only,
+				desc->flags & VCABLK_DISK_FLAG_DIRECT);
 	} else if (desc->type == VCABLK_DISK_TYPE_MEMORY) {
 		bckd->media = vcablk_media_create_memory(size_bytes,
 				desc->file_path, read_only);
+	} else if (desc->type == VCABLK_DISK_TYPE_BDEV) {
+		bckd->media = vcablk_media_create_bdev(size_bytes,
+				desc->file_path, read_only);
 	}
 	if (IS_ERR(bckd->media)) {
 		pr_err("%s: open file failure, type %i\n",
@@ -1051,10 +1511,11 @@ vcablk_bcknd_disk_create(struct vcablk_bcknd_dev *bdev,
 		goto err;
 	}
 
-	init_waitqueue_head(&bckd->request_wq);
 	init_waitqueue_head(&bckd->probe_queue);
 	init_waitqueue_head(&bckd->threads_exit_wq);
-	spin_lock_init(&bckd->send_resp_lock);
+	spin_lock_init(&bckd->transfer_ring_lock);
+	spin_lock_init(&bckd->media_ring_lock);
+	INIT_WORK(&bckd->media_reap_work, vcablk_bcknd_media_reap);
 
 	return bckd;
 
@@ -1066,29 +1527,40 @@ err:
 		bckd->media = NULL;
 	}
 exit:
-	if (bckd)
+	if (bckd) {
+		for (i = 0; i < VCABLK_MAX_QUEUES; ++i)
+			kfree(bckd->queues[i]);
 		kfree(bckd->transfer_buffer_pool);
+	}
 	kfree(bckd);
 	return  ERR_PTR(err);
 }
 
 int
-vcablk_bcknd_disk_prepare_request_db(struct vcablk_bcknd_disk *bckd)
+vcablk_bcknd_disk_get_queues_max(struct vcablk_bcknd_disk *bckd)
+{
+	return bckd->queues_max;
+}
+
+int
+vcablk_bcknd_disk_prepare_request_db(struct vcablk_bcknd_disk *bckd, int queue_id)
 {
-	pr_debug("%s: dev_id %i!!!\n", __func__, bckd->bcknd_id);
+	struct vcablk_bcknd_queue *queue = bckd->queues[queue_id];
 
-	if (bckd->request_db >= 0) {
+	pr_debug("%s: dev_id %i queue %i!!!\n", __func__, bckd->bcknd_id, queue_id);
+
+	if (queue->request_db >= 0) {
 		pr_err("%s: Disk ID %i Previous doorbell %i not released!\n",
-						__func__, bckd->bcknd_id, bckd->request_db);
+						__func__, bckd->bcknd_id, queue->request_db);
 	}
 
-	bckd->request_db = bckd->bdev->hw_ops->next_db(bckd->bdev->mdev.parent);
-	if (bckd->request_db < 0) {
+	queue->request_db = bckd->bdev->hw_ops->next_db(bckd->bdev->mdev.parent);
+	if (queue->request_db < 0) {
 		pr_err("%s: Disk with ID %i Can not get doorbell\n",
 				__func__, bckd->bcknd_id);
 	}
 
-	return bckd->request_db;
+	return queue->request_db;
 }
 
 /* alloc ring and fill fields
@@ -1115,75 +1587,150 @@ static struct vcablk_ring *vcablk_bcknd_alloc_transfer_ring(__u16 elems)
 	return ring;
 }
 
-int
-vcablk_bcknd_disk_start(struct vcablk_bcknd_disk *bckd, int done_db,
-		__u64 request_ring_ph, __u64 request_ring_size,
-		__u64 completion_ring_ph, __u64 completion_ring_size)
+/*
+ * CPUs of the node the card is attached to, all CPUs when it is unknown.
+ */
+static const struct cpumask *
+vcablk_bcknd_node_cpus(struct vcablk_bcknd_disk *bckd)
+{
+	int node = dev_to_node(bckd->bdev->mdev.parent);
+
+	if (node == NUMA_NO_NODE || !cpumask_weight(cpumask_of_node(node)))
+		return cpu_online_mask;
+	return cpumask_of_node(node);
+}
+
+/*
+ * CPU running the request thread of a queue. Queues of all disks are
+ * spread over the node, one CPU each.
+ */
+static int
+vcablk_bcknd_queue_cpu(struct vcablk_bcknd_queue *queue)
+{
+	struct vcablk_bcknd_disk *bckd = queue->bckd;
+	const struct cpumask *mask = vcablk_bcknd_node_cpus(bckd);
+	unsigned int n = (bckd->bcknd_id * bckd->queues_max + queue->id) %
+			cpumask_weight(mask);
+	int cpu;
+
+	for_each_cpu(cpu, mask)
+		if (!n--)
+			break;
+	return cpu;
+}
+
+static int
+vcablk_bcknd_queue_start(struct vcablk_bcknd_queue *queue,
+		struct vcablk_queue_response *response)
 {
+	struct vcablk_bcknd_disk *bckd = queue->bckd;
 	int err = 0;
-	pr_debug("%s: dev_id %i!!!\n", __func__, bckd->bcknd_id);
-	if (bckd->state != DISK_STATE_CREATE) {
-		pr_err("%s: Can not run thread, unexpected state %i!!!\n",
-				__func__, bckd->state);
-		err = -EIO;
-		goto exit;
-	}
+	int cpu;
 
-	if (bckd->request_db < 0) {
-		pr_err("%s: Disk with ID %i Incorrect doorbell\n",
-				__func__, bckd->bcknd_id);
-		err = -EBUSY;
-		goto exit;
+	if (queue->request_db < 0) {
+		pr_err("%s: Disk with ID %i queue %i Incorrect doorbell\n",
+				__func__, bckd->bcknd_id, queue->id);
+		return -EBUSY;
 	}
 
-	init_waitqueue_head(&bckd->ioremap_wq);
-	bckd->request_ring = vcablk_bcknd_ioremap(bckd, request_ring_ph, request_ring_size);
-	if (!bckd->request_ring) {
+	queue->request_ring = vcablk_bcknd_ioremap(bckd, response->request_ring,
+			response->request_ring_size);
+	if (!queue->request_ring) {
 		pr_err("%s: error remapping request ring\n", __func__);
-		err = -EIO;
-		goto err;
+		return -EIO;
 	}
 
-	bckd->completion_ring = vcablk_bcknd_ioremap(bckd, completion_ring_ph, completion_ring_size);
-	if (!bckd->completion_ring) {
+	queue->completion_ring = vcablk_bcknd_ioremap(bckd, response->completion_ring,
+			response->completion_ring_size);
+	if (!queue->completion_ring) {
 		pr_err("%s: error remapping request ring\n", __func__);
-		err = -EIO;
-		goto err;
+		return -EIO;
 	}
 
-	if (!is_power_of_2(bckd->request_ring->num_elems)
-			|| !is_power_of_2(bckd->completion_ring->num_elems)) {
+	if (!is_power_of_2(queue->request_ring->num_elems)
+			|| !is_power_of_2(queue->completion_ring->num_elems)) {
 			pr_err("%s: Rings request and ack size need be power of 2 "
 					"ring_request_num %u completion_ring_num %u\n",
-					__func__, bckd->request_ring->num_elems,
-					bckd->completion_ring->num_elems);
-		err = -EIO;
-		goto err;
+					__func__, queue->request_ring->num_elems,
+					queue->completion_ring->num_elems);
+		return -EIO;
 	}
 
-	bckd->request_ring_nums = bckd->request_ring->num_elems;
-	bckd->completion_ring_num_elems = bckd->completion_ring->num_elems;
-	bckd->done_db = done_db;
-	bckd->request_last_used = bckd->request_ring->last_used;
+	queue->request_ring_nums = queue->request_ring->num_elems;
+	queue->completion_ring_num_elems = queue->completion_ring->num_elems;
+	queue->done_db = response->done_db;
+	queue->request_last_used = queue->request_ring->last_used;
+	queue->transfer_error[0] = 0;
+	queue->transfer_error[1] = 0;
 
-	pr_debug( "%s: Register on db %i blockdev %i\n", __func__,
-			bckd->request_db, bckd->bcknd_id);
+	pr_debug( "%s: Register on db %i blockdev %i queue %i\n", __func__,
+			queue->request_db, bckd->bcknd_id, queue->id);
 
-	bckd->request_irq = bckd->hw_ops->request_irq(
+	queue->request_irq = bckd->hw_ops->request_irq(
 			bckd->bdev->mdev.parent,
 			vcablk_bcknd_disk_request_irq, "vcablk_disk_request_irq",
-			bckd, bckd->request_db);
+			queue, queue->request_db);
+
+	if (IS_ERR(queue->request_irq)) {
+		queue->request_irq = NULL;
+		return -EIO;
+	}
+
+	queue->request_process_thread = kthread_create(
+			vcablk_bcknd_disk_make_request_thread,
+			queue, "vcablk_task_request");
+	if (IS_ERR(queue->request_process_thread)) {
+		err = (int) PTR_ERR(queue->request_process_thread);
+		queue->request_process_thread = NULL;
+		return err;
+	}
+
+	/* Request doorbell wakes the thread, steer it to the thread's CPU */
+	cpu = vcablk_bcknd_queue_cpu(queue);
+	set_cpus_allowed_ptr(queue->request_process_thread, cpumask_of(cpu));
+	if (bckd->hw_ops->set_irq_affinity)
+		bckd->hw_ops->set_irq_affinity(bckd->bdev->mdev.parent,
+				queue->request_db, cpumask_of(cpu));
+
+	return err;
+}
+
+int
+vcablk_bcknd_disk_start(struct vcablk_bcknd_disk *bckd, int queues_num,
+		struct vcablk_queue_response *responses)
+{
+	int err = 0;
+	int i;
 
-	if (IS_ERR(bckd->request_irq)) {
-		bckd->request_irq = NULL;
+	pr_debug("%s: dev_id %i queues %i!!!\n", __func__, bckd->bcknd_id, queues_num);
+	if (bckd->state != DISK_STATE_CREATE) {
+		pr_err("%s: Can not run thread, unexpected state %i!!!\n",
+				__func__, bckd->state);
 		err = -EIO;
-		goto err;
+		goto exit;
+	}
+
+	if (queues_num < 1 || queues_num > bckd->queues_max) {
+		pr_err("%s: Disk with ID %i Incorrect number of queues %i\n",
+				__func__, bckd->bcknd_id, queues_num);
+		err = -EINVAL;
+		goto exit;
 	}
 
+	init_waitqueue_head(&bckd->ioremap_wq);
 	init_waitqueue_head(&bckd->transfer_wq);
 
+	for (i = 0; i < queues_num; ++i) {
+		err = vcablk_bcknd_queue_start(bckd->queues[i], responses + i);
+		if (err) {
+			pr_err("%s: Can not start queue %i err=%i\n", __func__, i, err);
+			goto err;
+		}
+	}
+	bckd->queues_num = queues_num;
+
 	if (bckd->bdev->dma_ch) {
-		bckd->transfer_ring = vcablk_bcknd_alloc_transfer_ring(VCABLK_TRANSFER_RING_SIZE);
+		bckd->transfer_ring = vcablk_bcknd_alloc_transfer_ring(bckd->transfer_depth);
 		if (!bckd->transfer_ring) {
 			pr_err("%s: Can not alloc transfer_ring\n", __func__);
 			err = -EAGAIN;
@@ -1195,53 +1742,69 @@ vcablk_bcknd_disk_start(struct vcablk_bcknd_disk *bckd, int done_db,
 		if (IS_ERR(bckd->transfer_thread)) {
 			err = (int) PTR_ERR(bckd->transfer_thread);
 			bckd->transfer_thread = NULL;
+			pr_err("%s: Can not create thread err=%i\n", __func__, err);
+			err = -EAGAIN;
+			goto err;
 		}
+		/* Woken by DMA completions, stays next to the card */
+		set_cpus_allowed_ptr(bckd->transfer_thread,
+				vcablk_bcknd_node_cpus(bckd));
 	} else {
 		pr_err("%s: Use MEMCPY\n", __func__);
 	}
 
-	bckd->request_process_thread = kthread_create(
-			vcablk_bcknd_disk_make_request_thread,
-			bckd, "vcablk_task_request");
-	if (IS_ERR(bckd->request_process_thread)) {
-		err = (int) PTR_ERR(bckd->request_process_thread);
-		bckd->request_process_thread = NULL;
-	}
-
-	if (err) {
-		pr_err("%s: Can not create thread err=%i\n", __func__, err);
-		err = -EAGAIN;
-		goto err_irq;
+	if (vcablk_media_is_async(bckd->media)) {
+		/* Same size as transfer_buffer_pool, never full */
+		bckd->media_ring = vcablk_bcknd_alloc_transfer_ring(bckd->transfer_depth);
+		if (!bckd->media_ring) {
+			pr_err("%s: Can not alloc media_ring\n", __func__);
+			err = -ENOMEM;
+			goto err;
+		}
+		/* Not the system one, reap syncs media for flush requests */
+		bckd->media_reap_wq = alloc_workqueue("vcablk_reap%d",
+				WQ_UNBOUND | WQ_MEM_RECLAIM, 1, bckd->bcknd_id);
+		if (!bckd->media_reap_wq) {
+			pr_err("%s: Can not alloc media reap work queue\n", __func__);
+			err = -ENOMEM;
+			goto err;
+		}
 	}
 
 	bckd->state = DISK_STATE_OPEN;
-	atomic_inc(&bckd->threads_count);
-	wake_up_process(bckd->request_process_thread);
+	for (i = 0; i < queues_num; ++i) {
+		atomic_inc(&bckd->threads_count);
+		wake_up_process(bckd->queues[i]->request_process_thread);
+	}
 	if (bckd->transfer_thread) {
 		atomic_inc(&bckd->threads_count);
 		wake_up_process(bckd->transfer_thread);
 	}
 	goto exit;
 
-err_irq:
-	vcablk_bcknd_disk_end_threads(bckd);
-
-	if (bckd->request_db >= 0)
-		bckd->hw_ops->free_irq(bckd->bdev->mdev.parent, bckd->request_irq, bckd);
-
 err:
-	bckd->request_db = -1;
-	bckd->request_irq = NULL;
-	bckd->done_db = -1;
-
-	if (bckd->request_ring) {
-		bckd->bdev->hw_ops->iounmap(bckd->bdev->mdev.parent, bckd->request_ring);
-		bckd->request_ring = NULL;
+	/* Threads not woken up yet, stop them before free irq and rings */
+	for (i = 0; i < bckd->queues_max; ++i) {
+		struct vcablk_bcknd_queue *queue = bckd->queues[i];
+		if (queue->request_process_thread) {
+			kthread_stop(queue->request_process_thread);
+			queue->request_process_thread = NULL;
+		}
+		vcablk_bcknd_queue_stop(queue);
+	}
+	if (bckd->transfer_thread) {
+		kthread_stop(bckd->transfer_thread);
+		bckd->transfer_thread = NULL;
 	}
-	if (bckd->completion_ring) {
-		bckd->bdev->hw_ops->iounmap(bckd->bdev->mdev.parent,bckd->completion_ring);
-		bckd->completion_ring = NULL;
+	kfree(bckd->transfer_ring);
+	bckd->transfer_ring = NULL;
+	kfree(bckd->media_ring);
+	bckd->media_ring = NULL;
+	if (bckd->media_reap_wq) {
+		destroy_workqueue(bckd->media_reap_wq);
+		bckd->media_reap_wq = NULL;
 	}
+	bckd->queues_num = 0;
 
 exit:
 	return err;
@@ -23,13 +23,14 @@
 #include "vcablk_bcknd_ioctl.h"
 struct vcablk_bcknd_dev;
 struct vcablk_bcknd_disk;
+struct vcablk_queue_response;
 
 struct vcablk_bcknd_disk* vcablk_bcknd_disk_create(struct vcablk_bcknd_dev *bdev,
 		struct vcablk_disk_open_desc *desc);
-int vcablk_bcknd_disk_prepare_request_db(struct vcablk_bcknd_disk *bckd);
-int vcablk_bcknd_disk_start(struct vcablk_bcknd_disk *bckd, int done_db,
-		__u64 request_ring_ph, __u64 request_ring_size,
-		__u64 completion_ring_ph, __u64 completion_ring_size);
+int vcablk_bcknd_disk_get_queues_max(struct vcablk_bcknd_disk *bckd);
+int vcablk_bcknd_disk_prepare_request_db(struct vcablk_bcknd_disk *bckd, int queue_id);
+int vcablk_bcknd_disk_start(struct vcablk_bcknd_disk *bckd, int queues_num,
+		struct vcablk_queue_response *responses);
 void vcablk_bcknd_disk_stop(struct vcablk_bcknd_disk *bckd);
 void vcablk_bcknd_disk_destroy(struct vcablk_bcknd_disk *bckd);
 
@@ -47,6 +47,7 @@ enum VCABLK_DISK_TYPE {
 	VCABLK_DISK_TYPE_UNINIT = 0x0,
 	VCABLK_DISK_TYPE_FILE= 0x1,
 	VCABLK_DISK_TYPE_MEMORY = 0x2,
+	VCABLK_DISK_TYPE_BDEV = 0x3,
 };
 
 enum {
@@ -54,6 +55,11 @@ enum {
 	VCABLK_DISK_MODE_READ_WRITE = 0x2
 };
 
+enum {
+	/* Open file with O_DIRECT, bypass host page cache */
+	VCABLK_DISK_FLAG_DIRECT = 0x1,
+};
+
 enum disk_state {
 	DISK_STATE_CREATE = 0x0,
 	DISK_STATE_OPEN = 0x2,
@@ -64,6 +70,7 @@ struct vcablk_disk_info_desc {
 	__u8 exist;
 	__u8 type;
 	__u8 mode;
+	__u8 flags;
 	__u64 size;
 	__u8 state;
 	char file_path[PATH_MAX];
@@ -74,6 +81,7 @@ struct vcablk_disk_open_desc {
 	__u16 disk_id;
 	__u8 type;
 	__u8 mode;
+	__u8 flags;
 	__u64 size;
 	char file_path[PATH_MAX];
 } __attribute__ ((aligned(8)));
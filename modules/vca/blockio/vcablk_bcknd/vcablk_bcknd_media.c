@@ -23,21 +23,46 @@
  * Intel VCA Block IO driver.
  *
  */
+#include <linux/module.h>
 #include <linux/blkdev.h>
 #include <linux/vmalloc.h>
+#include <linux/pagemap.h>
 #include <linux/version.h>
 #include "vcablk_common/vcablk_common.h"
 #include "vcablk_bcknd_media.h"
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+#	define MEDIA_FILE_ITER
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 14, 0)
+#	define BIO_FORMAT_SECTOR
+#endif
+
+/* kernel_read() and kernel_write() take kernel buffers, set_fs() is gone */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 14, 20)
+#	define MEDIA_SET_FS
+#endif
+
+static ushort vcablk_bcknd_media_queue_depth = 16;
+module_param(vcablk_bcknd_media_queue_depth, ushort, S_IRUGO);
+MODULE_PARM_DESC(vcablk_bcknd_media_queue_depth, "Number of file and block "
+		"device disk transfers in flight, 0 keeps synchronous file "
+		"transfers");
+
 static struct file*
 file_open(const char* path, int flags, int rights)
 {
 	struct file* file = NULL;
+#ifdef MEDIA_SET_FS
 	mm_segment_t old_fs;
 	old_fs = get_fs();
 	set_fs(KERNEL_DS);
+#endif
 	file = filp_open(path, flags | O_LARGEFILE, rights);
+#ifdef MEDIA_SET_FS
 	set_fs(old_fs);
+#endif
 	return file;
 }
 
@@ -51,17 +76,17 @@ static int
 file_read(struct file* file, unsigned long long offset, unsigned char* data,
 		unsigned int size)
 {
-	mm_segment_t old_fs;
 	int ret;
+#ifdef MEDIA_SET_FS
+	mm_segment_t old_fs;
 
 	old_fs = get_fs();
 	set_fs(KERNEL_DS);
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 20)
-	ret = kernel_read(file, data, size, &offset);
-#else
 	ret = vfs_read(file, data, size, &offset);
-#endif
 	set_fs(old_fs);
+#else
+	ret = kernel_read(file, data, size, &offset);
+#endif
 	return ret;
 }
 
@@ -69,17 +94,17 @@ static int
 file_write(struct file* file, unsigned long long offset, unsigned char* data,
 		unsigned int size)
 {
-	mm_segment_t old_fs;
 	int ret;
+#ifdef MEDIA_SET_FS
+	mm_segment_t old_fs;
 
 	old_fs = get_fs();
 	set_fs(KERNEL_DS);
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 20)
-	ret = kernel_write(file, data, size, &offset);
-#else
 	ret = vfs_write(file, data, size, &offset);
-#endif
 	set_fs(old_fs);
+#else
+	ret = kernel_write(file, data, size, &offset);
+#endif
 	return ret;
 }
 
@@ -105,14 +130,93 @@ media_transfer_mem(struct vcablk_media *media, unsigned long sector,
 	}
 
 	if (write) {
-		memcpy_toio(media->data.memory + offset, buffer, nbytes);
+		memcpy(media->data.memory + offset, buffer, nbytes);
 	} else {
-		memcpy_toio(buffer, media->data.memory + offset, nbytes);
+		memcpy(buffer, media->data.memory + offset, nbytes);
+	}
+
+	return 0;
+}
+
+#ifdef MEDIA_FILE_ITER
+/*
+ * Pick file for transfer, O_DIRECT file when offset, length and buffer are
+ * aligned, otherwise page cache of bounce file. Direct I/O flushes and
+ * invalidates cached pages of its range, so both views stay coherent.
+ */
+static struct file*
+media_file_pick(struct vcablk_media *media, unsigned long offset,
+		unsigned long nbytes, char *buffer)
+{
+	if (!media->direct)
+		return media->data.file;
+
+	if ((offset | nbytes | (unsigned long)buffer) & (media->direct_align - 1))
+		return media->bounce_file;
+
+	return media->data.file;
+}
+
+/*
+ * Describe buffer by its pages, direct I/O of older kernels can not get
+ * pages of kvec iterator.
+ */
+static int
+media_file_iter(struct iov_iter *iter, struct bio_vec *bvec, char *buffer,
+		unsigned long nbytes, int write)
+{
+	unsigned long done = 0;
+	int nr = 0;
+
+	while (done < nbytes) {
+		unsigned int off = offset_in_page(buffer + done);
+		unsigned int len = min_t(unsigned long, PAGE_SIZE - off,
+				nbytes - done);
+
+		if (nr == VCABLK_MEDIA_BVECS)
+			return -EINVAL;
+
+		bvec[nr].bv_page = virt_to_page(buffer + done);
+		bvec[nr].bv_offset = off;
+		bvec[nr].bv_len = len;
+		done += len;
+		++nr;
 	}
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 20, 0)
+	iov_iter_bvec(iter, write ? WRITE : READ, bvec, nr, nbytes);
+#else
+	iov_iter_bvec(iter, ITER_BVEC | (write ? WRITE : READ), bvec, nr, nbytes);
+#endif
 	return 0;
 }
 
+/*
+ * Handle an I/O request for file opened with O_DIRECT.
+ */
+static ssize_t
+media_file_direct_rw(struct vcablk_media *media, unsigned long offset,
+		unsigned long nbytes, char *buffer, int write)
+{
+	struct file *file = media_file_pick(media, offset, nbytes, buffer);
+	struct bio_vec bvec[VCABLK_MEDIA_BVECS];
+	struct iov_iter iter;
+	struct kiocb kiocb;
+	int err;
+
+	err = media_file_iter(&iter, bvec, buffer, nbytes, write);
+	if (err)
+		return err;
+
+	init_sync_kiocb(&kiocb, file);
+	kiocb.ki_pos = offset;
+
+	if (write)
+		return call_write_iter(file, &kiocb, &iter);
+	return call_read_iter(file, &kiocb, &iter);
+}
+#endif /* MEDIA_FILE_ITER */
+
 /*
  * Handle an I/O request for file.
  */
@@ -133,7 +237,21 @@ media_transfer_file(struct vcablk_media *media, unsigned long sector,
 	if (write) {
 		if (media->read_only)
 			return -EACCES;
+	}
 
+#ifdef MEDIA_FILE_ITER
+	if (media->direct) {
+		nbytesdone = media_file_direct_rw(media, offset, nbytes, buffer,
+				write);
+		if (nbytesdone < 0) {
+			pr_err("%s: %s ERROR %li sector %lu nsect %lu write %i\n",
+					media->file_path, __func__, nbytesdone,
+					sector, nsect, write);
+			return nbytesdone;
+		}
+	} else
+#endif /* MEDIA_FILE_ITER */
+	if (write) {
 		nbytesdone = file_write(file, offset, buffer, nbytes);
 	} else {
 		nbytesdone = file_read(file, offset, buffer, nbytes);
@@ -147,6 +265,345 @@ media_transfer_file(struct vcablk_media *media, unsigned long sector,
 	return 0;
 }
 
+/*
+ * Finish asynchronous transfer and release its place in queue.
+ */
+static void
+media_iocb_end(struct vcablk_media_iocb *iocb, long ret)
+{
+	struct vcablk_media *media = iocb->media;
+	unsigned long nbytes = iocb->nsect << SECTOR_SHIFT;
+	int err = 0;
+
+	if (ret < 0) {
+		pr_err("%s: %s ERROR %li sector %lu nsect %lu write %i\n",
+				media->file_path, __func__, ret, iocb->sector,
+				iocb->nsect, iocb->write);
+		err = ret;
+	} else if (!likely(nbytes == ret)) {
+		pr_err("%s: %s ERROR nbytes %lu nbytesdone %li\n",
+				media->file_path, __func__, nbytes, ret);
+		err = -EIO;
+	}
+
+	iocb->complete(iocb, err);
+
+	atomic_dec(&media->inflight);
+	wake_up(&media->inflight_wq);
+}
+
+#ifdef MEDIA_FILE_ITER
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 16, 0)
+static void
+media_file_ki_complete(struct kiocb *kiocb, long ret)
+#else
+static void
+media_file_ki_complete(struct kiocb *kiocb, long ret, long ret2)
+#endif
+{
+	media_iocb_end(container_of(kiocb, struct vcablk_media_iocb, kiocb), ret);
+}
+#endif /* MEDIA_FILE_ITER */
+
+static void
+media_file_submit_work(struct work_struct *work)
+{
+	struct vcablk_media_iocb *iocb =
+			container_of(work, struct vcablk_media_iocb, work);
+	struct vcablk_media *media = iocb->media;
+	unsigned long nbytes = iocb->nsect << SECTOR_SHIFT;
+	ssize_t ret;
+#ifdef MEDIA_FILE_ITER
+	struct file *file = media_file_pick(media, iocb->sector << SECTOR_SHIFT,
+			nbytes, iocb->buffer);
+	struct kiocb *kiocb = &iocb->kiocb;
+	struct iov_iter iter;
+
+	ret = media_file_iter(&iter, iocb->bvec, iocb->buffer, nbytes,
+			iocb->write);
+	if (ret) {
+		media_iocb_end(iocb, ret);
+		return;
+	}
+
+	init_sync_kiocb(kiocb, file);
+	kiocb->ki_pos = iocb->sector << SECTOR_SHIFT;
+	/* Not sync kiocb, file can finish it later by ki_complete */
+	kiocb->ki_complete = media_file_ki_complete;
+
+	if (iocb->write)
+		ret = call_write_iter(file, kiocb, &iter);
+	else
+		ret = call_read_iter(file, kiocb, &iter);
+
+	if (ret == -EIOCBQUEUED)
+		return;
+#else /* MEDIA_FILE_ITER */
+	ret = media->transfer(media, iocb->sector, iocb->nsect, iocb->buffer,
+			iocb->write);
+	if (!ret)
+		ret = nbytes;
+#endif /* MEDIA_FILE_ITER */
+	media_iocb_end(iocb, ret);
+}
+
+/*
+ * Queue an asynchronous I/O request for file.
+ */
+static void
+media_transfer_file_async(struct vcablk_media_iocb *iocb)
+{
+	struct vcablk_media *media = iocb->media;
+	unsigned long offset = iocb->sector << SECTOR_SHIFT;
+	unsigned long nbytes = iocb->nsect << SECTOR_SHIFT;
+
+	if ((offset + nbytes) > media->size_bytes) {
+		pr_notice("Beyond-end write (%ld %ld)\n", offset, nbytes);
+		media_iocb_end(iocb, -EIO);
+		return;
+	}
+
+	if (iocb->write && media->read_only) {
+		media_iocb_end(iocb, -EACCES);
+		return;
+	}
+
+	INIT_WORK(&iocb->work, media_file_submit_work);
+	queue_work(media->wq, &iocb->work);
+}
+
+/*
+ * Start asynchronous transfer, wait if queue_depth transfers already
+ * in flight. Complete function is called always, also on error.
+ */
+void
+vcablk_media_transfer_async(struct vcablk_media *media,
+		struct vcablk_media_iocb *iocb, unsigned long sector,
+		unsigned long nsect, char *buffer, int write,
+		vcablk_media_complete_t complete)
+{
+	iocb->media = media;
+	iocb->sector = sector;
+	iocb->nsect = nsect;
+	iocb->buffer = buffer;
+	iocb->write = write;
+	iocb->complete = complete;
+
+	wait_event(media->inflight_wq, atomic_add_unless(&media->inflight, 1,
+			media->queue_depth));
+	media->transfer_async(iocb);
+}
+
+/*
+ * Wait for all asynchronous transfers in flight.
+ */
+void
+vcablk_media_drain(struct vcablk_media *media)
+{
+	if (!media || !media->transfer_async)
+		return;
+
+	wait_event(media->inflight_wq, !atomic_read(&media->inflight));
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 3, 0)
+static void
+media_bdev_end_io(struct bio *bio)
+#else
+static void
+media_bdev_end_io(struct bio *bio, int err)
+#endif
+{
+	struct vcablk_media_iocb *iocb = bio->bi_private;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 13, 0)
+	int err = blk_status_to_errno(bio->bi_status);
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(4, 3, 0)
+	int err = bio->bi_error;
+#endif
+
+	bio_put(bio);
+	media_iocb_end(iocb, err ? err : (long)(iocb->nsect << SECTOR_SHIFT));
+}
+
+/*
+ * Submit an asynchronous I/O request for block device, bio points
+ * directly to transfer buffer.
+ */
+static void
+media_transfer_bdev_async(struct vcablk_media_iocb *iocb)
+{
+	struct vcablk_media *media = iocb->media;
+	unsigned long offset = iocb->sector << SECTOR_SHIFT;
+	unsigned long nbytes = iocb->nsect << SECTOR_SHIFT;
+	unsigned long done = 0;
+	struct bio *bio;
+
+	if ((offset + nbytes) > media->size_bytes) {
+		pr_notice("Beyond-end write (%ld %ld)\n", offset, nbytes);
+		media_iocb_end(iocb, -EIO);
+		return;
+	}
+
+	if (iocb->write && media->read_only) {
+		media_iocb_end(iocb, -EACCES);
+		return;
+	}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+	bio = bio_alloc(media->data.bdev, VCABLK_MEDIA_BVECS,
+			iocb->write ? REQ_OP_WRITE : REQ_OP_READ, GFP_NOIO);
+#else
+	bio = bio_alloc(GFP_NOIO, VCABLK_MEDIA_BVECS);
+#endif
+	if (!bio) {
+		media_iocb_end(iocb, -ENOMEM);
+		return;
+	}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+	/* device and operation are set by bio_alloc() */
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0)
+	bio_set_dev(bio, media->data.bdev);
+#else
+	bio->bi_bdev = media->data.bdev;
+#endif
+#ifdef BIO_FORMAT_SECTOR
+	bio->bi_iter.bi_sector = iocb->sector;
+#else
+	bio->bi_sector = iocb->sector;
+#endif
+	bio->bi_end_io = media_bdev_end_io;
+	bio->bi_private = iocb;
+
+	while (done < nbytes) {
+		char *buffer = iocb->buffer + done;
+		unsigned int off = offset_in_page(buffer);
+		unsigned int len = min_t(unsigned long, PAGE_SIZE - off,
+				nbytes - done);
+
+		if (bio_add_page(bio, virt_to_page(buffer), len, off) != len) {
+			pr_err("%s: %s can not add page, sector %lu nsect %lu\n",
+					__func__, media->file_path, iocb->sector,
+					iocb->nsect);
+			bio_put(bio);
+			media_iocb_end(iocb, -EIO);
+			return;
+		}
+		done += len;
+	}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+	submit_bio(bio);
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(4, 10, 0)
+	bio->bi_opf = iocb->write ? REQ_OP_WRITE : REQ_OP_READ;
+	submit_bio(bio);
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0)
+	bio_set_op_attrs(bio, iocb->write ? REQ_OP_WRITE : REQ_OP_READ, 0);
+	submit_bio(bio);
+#else
+	submit_bio(iocb->write ? WRITE : READ, bio);
+#endif
+}
+
+/*
+ * Synchronous transfer of block device waits for asynchronous one.
+ */
+struct media_bdev_wait {
+	struct vcablk_media_iocb iocb;
+	struct completion done;
+	int err;
+};
+
+static void
+media_bdev_wait_complete(struct vcablk_media_iocb *iocb, int err)
+{
+	struct media_bdev_wait *wait =
+			container_of(iocb, struct media_bdev_wait, iocb);
+
+	wait->err = err;
+	complete(&wait->done);
+}
+
+/*
+ * Handle an I/O request for block device.
+ */
+static int
+media_transfer_bdev(struct vcablk_media *media, unsigned long sector,
+		unsigned long nsect, char *buffer, int write)
+{
+	struct media_bdev_wait wait;
+
+	init_completion(&wait.done);
+	vcablk_media_transfer_async(media, &wait.iocb, sector, nsect, buffer,
+			write, media_bdev_wait_complete);
+	wait_for_completion(&wait.done);
+	return wait.err;
+}
+
+/*
+ * Get page of storage holding whole transfer, to DMA without bounce buffer.
+ * NULL when transfer has to go through bounce buffer. File gives only
+ * uptodate page cache pages for read, writes go through file system.
+ * A page cache page is given locked, so it is neither truncated nor
+ * written until vcablk_media_put_page(). A page already locked goes
+ * through bounce buffer, not to wait for I/O in progress.
+ */
+struct page*
+vcablk_media_get_page(struct vcablk_media *media, unsigned long sector,
+		unsigned long nsect, int write, unsigned int *page_offset)
+{
+	unsigned long offset = sector << SECTOR_SHIFT;
+	unsigned long nbytes = nsect << SECTOR_SHIFT;
+	struct page *page;
+
+	if ((offset + nbytes) > media->size_bytes ||
+			offset_in_page(offset) + nbytes > PAGE_SIZE)
+		return NULL;
+
+	if (write && media->read_only)
+		return NULL;
+
+	switch (media->type) {
+	case VCABLK_DISK_TYPE_MEMORY:
+		/* vmalloc area is page aligned and lives as long as media */
+		page = vmalloc_to_page(media->data.memory + offset);
+		break;
+	case VCABLK_DISK_TYPE_FILE:
+		if (write || media->direct)
+			return NULL;
+		page = find_get_page(media->data.file->f_mapping,
+				offset >> PAGE_SHIFT);
+		if (!page)
+			return NULL;
+		if (!trylock_page(page)) {
+			put_page(page);
+			return NULL;
+		}
+		/* Truncated or invalidated before it was locked */
+		if (page->mapping != media->data.file->f_mapping ||
+				!PageUptodate(page)) {
+			unlock_page(page);
+			put_page(page);
+			return NULL;
+		}
+		break;
+	default:
+		return NULL;
+	}
+
+	*page_offset = offset_in_page(offset);
+	return page;
+}
+
+void
+vcablk_media_put_page(struct vcablk_media *media, struct page *page)
+{
+	if (media->type == VCABLK_DISK_TYPE_FILE) {
+		unlock_page(page);
+		put_page(page);
+	}
+}
+
 /*
  * Handle an sync I/O request for memory.
  */
@@ -162,6 +619,7 @@ media_sync_mem(struct vcablk_media *media)
 static int
 media_sync_file(struct vcablk_media *media)
 {
+	/* Bounce file shares inode, its dirty pages are synced too */
 	return file_sync(media->data.file);
 }
 
@@ -177,29 +635,119 @@ media_create(size_t size_bytes, const char *file_path, bool read_only)
 	if (!media)
 		return NULL;
 	memset (media, 0, sizeof(struct vcablk_media));
+	atomic_set(&media->inflight, 0);
+	init_waitqueue_head(&media->inflight_wq);
 	media->size_bytes = size_bytes;
 	media->read_only = read_only;
 	strncpy(media->file_path, file_path, sizeof(media->file_path)-1);
 	return media;
 }
 
+static void
+media_file_init_async(struct vcablk_media *media)
+{
+	if (!vcablk_bcknd_media_queue_depth)
+		return;
+
+#ifdef MEDIA_FILE_ITER
+	if (!media->data.file->f_op->read_iter ||
+			!media->data.file->f_op->write_iter) {
+		pr_info("%s: %s file without iterators, use synchronous "
+				"transfers\n", __func__, media->file_path);
+		return;
+	}
+#endif /* MEDIA_FILE_ITER */
+
+	media->wq = alloc_workqueue("vcablk_media", WQ_UNBOUND | WQ_MEM_RECLAIM,
+			vcablk_bcknd_media_queue_depth);
+	if (!media->wq) {
+		pr_warn("%s: %s can not allocate work queue, use synchronous "
+				"transfers\n", __func__, media->file_path);
+		return;
+	}
+	media->queue_depth = vcablk_bcknd_media_queue_depth;
+	media->transfer_async = media_transfer_file_async;
+}
+
+/*
+ * Handle an sync I/O request for block device.
+ */
+static int
+media_sync_bdev(struct vcablk_media *media)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 17, 0)
+	return blkdev_issue_flush(media->data.bdev);
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(5, 12, 0)
+	return blkdev_issue_flush(media->data.bdev, GFP_KERNEL);
+#else
+	return blkdev_issue_flush(media->data.bdev, GFP_KERNEL, NULL);
+#endif
+}
+
+/*
+ * Logical block size of device under file, O_DIRECT transfers need to be
+ * aligned to it.
+ */
+static unsigned int
+media_file_direct_align(struct file *file)
+{
+	struct inode *inode = file_inode(file);
+	struct block_device *bdev = S_ISBLK(inode->i_mode) ?
+			I_BDEV(inode) : inode->i_sb->s_bdev;
+
+	if (bdev)
+		return bdev_logical_block_size(bdev);
+	return 1 << SECTOR_SHIFT;
+}
+
+static int
+media_file_init_direct(struct vcablk_media *media)
+{
+#ifdef MEDIA_FILE_ITER
+	int flags = media->read_only ? O_RDONLY : O_RDWR;
+
+	media->bounce_file = file_open(media->file_path, flags, 0);
+	if (IS_ERR(media->bounce_file)) {
+		int err = PTR_ERR(media->bounce_file);
+		media->bounce_file = NULL;
+		return err;
+	}
+
+	media->direct_align = media_file_direct_align(media->data.file);
+	pr_info("%s: %s direct I/O aligned to %u bytes\n", __func__,
+			media->file_path, media->direct_align);
+	return 0;
+#else /* MEDIA_FILE_ITER */
+	return -EOPNOTSUPP;
+#endif /* MEDIA_FILE_ITER */
+}
+
 struct vcablk_media*
 vcablk_media_create_file(size_t size_bytes, const char *file_path,
-		bool read_only)
+		bool read_only, bool direct)
 {
 	struct vcablk_media *const media = media_create(size_bytes, file_path, read_only);
 	if (media) {
 		int err;
-		pr_debug("%s: file disk %s \n", __func__, file_path);
+		pr_debug("%s: file disk %s direct %i\n", __func__, file_path,
+				direct);
 		media->type = VCABLK_DISK_TYPE_FILE;
+		media->direct = direct;
 		media->data.file = file_open(media->file_path,
-				media->read_only?O_RDONLY:O_RDWR, 0);
+				(media->read_only?O_RDONLY:O_RDWR) |
+				(direct?O_DIRECT:0), 0);
 		if (!IS_ERR(media->data.file)) {
-			media->transfer = media_transfer_file;
-			media->sync = media_sync_file;
-			return media;
+			err = direct ? media_file_init_direct(media) : 0;
+			if (!err) {
+				media->transfer = media_transfer_file;
+				media->sync = media_sync_file;
+				media_file_init_async(media);
+				return media;
+			}
+			file_close(media->data.file);
+		} else {
+			err = PTR_ERR(media->data.file);
 		}
-		err = PTR_ERR(media->data.file);
 		pr_err("%s: open file failure %s %i\n", __func__, file_path, err);
 		vfree(media);
 		return ERR_PTR(err);
@@ -228,6 +776,117 @@ vcablk_media_create_memory(size_t size_bytes,const char *file_path,
 	return ERR_PTR(ENOMEM);
 }
 
+/*
+ * Open block device storage exclusively, media is the holder.
+ */
+static int
+media_bdev_open(struct vcablk_media *media)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+	blk_mode_t mode = BLK_OPEN_READ;
+
+	if (!media->read_only)
+		mode |= BLK_OPEN_WRITE;
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 9, 0)
+	media->bdev_file = bdev_file_open_by_path(media->file_path, mode,
+			media, NULL);
+	if (IS_ERR(media->bdev_file)) {
+		int err = PTR_ERR(media->bdev_file);
+		media->bdev_file = NULL;
+		return err;
+	}
+	media->data.bdev = file_bdev(media->bdev_file);
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	media->bdev_handle = bdev_open_by_path(media->file_path, mode,
+			media, NULL);
+	if (IS_ERR(media->bdev_handle)) {
+		int err = PTR_ERR(media->bdev_handle);
+		media->bdev_handle = NULL;
+		return err;
+	}
+	media->data.bdev = media->bdev_handle->bdev;
+#else
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+	media->data.bdev = blkdev_get_by_path(media->file_path, mode,
+			media, NULL);
+#else
+	media->bdev_mode = FMODE_READ | FMODE_EXCL;
+	if (!media->read_only)
+		media->bdev_mode |= FMODE_WRITE;
+	media->data.bdev = blkdev_get_by_path(media->file_path,
+			media->bdev_mode, media);
+#endif
+	if (IS_ERR(media->data.bdev)) {
+		int err = PTR_ERR(media->data.bdev);
+		media->data.bdev = NULL;
+		return err;
+	}
+#endif
+	return 0;
+}
+
+static void
+media_bdev_close(struct vcablk_media *media)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 9, 0)
+	fput(media->bdev_file);
+	media->bdev_file = NULL;
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	bdev_release(media->bdev_handle);
+	media->bdev_handle = NULL;
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+	blkdev_put(media->data.bdev, media);
+#else
+	blkdev_put(media->data.bdev, media->bdev_mode);
+#endif
+	media->data.bdev = NULL;
+}
+
+struct vcablk_media*
+vcablk_media_create_bdev(size_t size_bytes, const char *file_path,
+		bool read_only)
+{
+	struct vcablk_media *const media = media_create(size_bytes, file_path, read_only);
+	loff_t bdev_size;
+	int err;
+
+	if (!media)
+		return ERR_PTR(-ENOMEM);
+
+	pr_debug("%s: block device disk %s\n", __func__, file_path);
+	err = media_bdev_open(media);
+	if (err) {
+		pr_err("%s: open block device failure %s %i\n", __func__,
+				file_path, err);
+		vfree(media);
+		return ERR_PTR(err);
+	}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 16, 0)
+	bdev_size = bdev_nr_bytes(media->data.bdev);
+#else
+	bdev_size = i_size_read(media->data.bdev->bd_inode);
+#endif
+	if (size_bytes > bdev_size ||
+			bdev_logical_block_size(media->data.bdev) > (1 << SECTOR_SHIFT)) {
+		pr_err("%s: %s size %zu exceeds device size %lld or logical "
+				"block size %u is not supported\n", __func__,
+				file_path, size_bytes, bdev_size,
+				bdev_logical_block_size(media->data.bdev));
+		media_bdev_close(media);
+		vfree(media);
+		return ERR_PTR(-EINVAL);
+	}
+
+	media->type = VCABLK_DISK_TYPE_BDEV;
+	media->transfer = media_transfer_bdev;
+	media->sync = media_sync_bdev;
+	media->transfer_async = media_transfer_bdev_async;
+	media->queue_depth = vcablk_bcknd_media_queue_depth ?: 1;
+	return media;
+}
+
 void
 vcablk_media_destroy(struct vcablk_media *media)
 {
@@ -243,12 +902,27 @@ vcablk_media_destroy(struct vcablk_media *media)
 		break;
 	}
 	case VCABLK_DISK_TYPE_FILE: {
+		if (media->wq) {
+			vcablk_media_drain(media);
+			destroy_workqueue(media->wq);
+			media->wq = NULL;
+		}
+		if (media->bounce_file) {
+			file_close(media->bounce_file);
+			media->bounce_file = NULL;
+		}
 		if (media->data.file) {
 			file_close(media->data.file);
 			media->data.file = 0;
 		}
 		break;
 	}
+	case VCABLK_DISK_TYPE_BDEV: {
+		vcablk_media_drain(media);
+		if (media->data.bdev)
+			media_bdev_close(media);
+		break;
+	}
 	case VCABLK_DISK_TYPE_UNINIT:
 	default:
 		break;
@@ -270,6 +944,18 @@ vcablk_media_read_only(const struct vcablk_media *media)
 	return media->read_only;
 }
 
+bool
+vcablk_media_direct(const struct vcablk_media *media)
+{
+	return media->direct;
+}
+
+bool
+vcablk_media_memory(const struct vcablk_media *media)
+{
+	return media->type == VCABLK_DISK_TYPE_MEMORY;
+}
+
 const char*
 vcablk_media_file_path(const struct vcablk_media *media)
 {
@@ -27,21 +27,58 @@
 #define __VCABLK_BACKEND_MEDIA_H__
 
 #include <linux/limits.h>
+#include <linux/fs.h>
+#include <linux/uio.h>
+#include <linux/blk_types.h>
+#include <linux/workqueue.h>
+#include <linux/wait.h>
+#include <linux/atomic.h>
+#include <linux/version.h>
 #include "vcablk_bcknd_ioctl.h"
 
+struct vcablk_media_iocb;
+
+/* Page aligned buffer of PAGE_SIZE fits in one, any other in two pages */
+#define VCABLK_MEDIA_BVECS 2
+
+typedef void (*vcablk_media_complete_t)(struct vcablk_media_iocb *iocb, int ret);
+
 /*
  * vcablk_media - Storage to keep data in backend
  *
  * @read_only: Storage is read only.
+ * @direct: File opened with O_DIRECT, host page cache bypassed.
+ * @direct_align: Offset and length alignment required by O_DIRECT.
+ * @bounce_file: Same file opened without O_DIRECT, for transfers not aligned
+ *	to direct_align.
+ * @bdev_mode: Mode block device storage was opened with, before 6.5.
+ * @bdev_handle: Exclusive open of block device storage, 6.7 and 6.8.
+ * @bdev_file: Exclusive open of block device storage, since 6.9.
  * @size_bytes: Size of device in bytes.
  * @file_path: Path to file if storage based on file, or name of storage.
  * @type: Type of storage device.
  * @transfer: Pointer to specific function transfer for storage device.
  * @sync: Pointer to specific function sync for storage device.
+ * @transfer_async: Pointer to specific function asynchronous transfer for
+ *	storage device, NULL if storage support only synchronous transfer.
+ * @queue_depth: Max asynchronous transfers in flight.
+ * @inflight: Asynchronous transfers in flight.
+ * @inflight_wq: Wait queue for asynchronous transfer to finish.
+ * @wq: Work queue to submit asynchronous transfers.
  * @data: Specific container on data for storage device.
  */
 struct vcablk_media {
 	bool read_only;
+	bool direct;
+	unsigned int direct_align;
+	struct file *bounce_file;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 9, 0)
+	struct file *bdev_file;
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	struct bdev_handle *bdev_handle;
+#elif LINUX_VERSION_CODE < KERNEL_VERSION(6, 5, 0)
+	fmode_t bdev_mode;
+#endif
 	size_t size_bytes;
 	char file_path[PATH_MAX];
 	enum VCABLK_DISK_TYPE type;
@@ -51,12 +88,45 @@ struct vcablk_media {
 
 	int (*sync)(struct vcablk_media *media);
 
+	void (*transfer_async)(struct vcablk_media_iocb *iocb);
+	int queue_depth;
+	atomic_t inflight;
+	wait_queue_head_t inflight_wq;
+	struct workqueue_struct *wq;
+
 	union {
 		u8 *memory;
 		struct file *file;
+		struct block_device *bdev;
 	} data;
 };
 
+/*
+ * vcablk_media_iocb - Asynchronous transfer of storage device
+ *
+ * @media: Storage of transfer.
+ * @sector: First sector of transfer.
+ * @nsect: Number of sectors to transfer.
+ * @buffer: Buffer of data to transfer.
+ * @write: Transfer direction.
+ * @complete: Called when transfer finish, can be called from IRQ context.
+ * @bvec: Pages of buffer for file iterator.
+ * @kiocb: File I/O control block.
+ * @work: Submission of transfer in media work queue.
+ */
+struct vcablk_media_iocb {
+	struct vcablk_media *media;
+	unsigned long sector;
+	unsigned long nsect;
+	char *buffer;
+	int write;
+	vcablk_media_complete_t complete;
+
+	struct bio_vec bvec[VCABLK_MEDIA_BVECS];
+	struct kiocb kiocb;
+	struct work_struct work;
+};
+
 #define vcablk_media_sync(media) \
 	media->sync(media)
 #define vcablk_media_transfer(media, sector, nsect, buffer, write ) \
@@ -66,11 +136,30 @@ struct vcablk_media * vcablk_media_create_memory(size_t size_bytes,
 		const char *file_path, bool read_only);
 
 struct vcablk_media *vcablk_media_create_file(size_t size_bytes,
+		const char *file_path, bool read_only, bool direct);
+
+struct vcablk_media *vcablk_media_create_bdev(size_t size_bytes,
 		const char *file_path, bool read_only);
 
+#define vcablk_media_is_async(media) \
+	(media->transfer_async != NULL)
+
+void vcablk_media_transfer_async(struct vcablk_media *media,
+		struct vcablk_media_iocb *iocb, unsigned long sector,
+		unsigned long nsect, char *buffer, int write,
+		vcablk_media_complete_t complete);
+void vcablk_media_drain(struct vcablk_media *media);
+
+struct page *vcablk_media_get_page(struct vcablk_media *media,
+		unsigned long sector, unsigned long nsect, int write,
+		unsigned int *page_offset);
+void vcablk_media_put_page(struct vcablk_media *media, struct page *page);
+
 void vcablk_media_destroy(struct vcablk_media *media);
 size_t vcablk_media_size(const struct vcablk_media *media);
 bool vcablk_media_read_only(const struct vcablk_media *media);
+bool vcablk_media_direct(const struct vcablk_media *media);
+bool vcablk_media_memory(const struct vcablk_media *media);
 const char *vcablk_media_file_path(const struct vcablk_media *media);
 
 #endif /* __VCABLK_BACKEND_MEDIA_H__ */
@@ -20,7 +20,7 @@
 #ifndef __VCA_BLK_TYPE_H__
 #define __VCA_BLK_TYPE_H__
 
-#define VCA_BLK_VERSION  0x04
+#define VCA_BLK_VERSION  0x05
 
 #if defined(_MSC_VER)
 #define VCA_ALIGNED_PREFIX(_N)  __declspec(align(_N))
@@ -37,6 +37,18 @@ typedef u64 pci_addr;
 #define REQUEST_READ 1
 #define REQUEST_WRITE 2
 #define REQUEST_SYNC 3
+/* Data described by a segment table, see struct vcablk_segment */
+#define REQUEST_READ_SEGMENTS 4
+#define REQUEST_WRITE_SEGMENTS 5
+
+/* Features negotiated through vcablk_dev_page */
+#define VCABLK_FEATURE_SEGMENTS (1<<0)
+
+/* Max segments in table of one request */
+#define VCABLK_MAX_SEGMENTS 256
+
+/* Max request/completion ring pairs of one device */
+#define VCABLK_MAX_QUEUES 8
 
 #ifndef READ_ONCE
 #define READ_ONCE(x) ACCESS_ONCE(x)
@@ -56,6 +68,16 @@ vcablk_request {
 	/* Request type */
 	__u16 cookie;
 	__u8 request_type;
+
+	/* For REQUEST_*_SEGMENTS phys_buff is address of table with
+	 * segments_num elements, sector and sectors_num cover all of them. */
+	__u16 segments_num;
+} VCA_ALIGNED_POSTFIX(VOP_BLK_ALIGNMENT);
+
+struct VCA_ALIGNED_PREFIX(VOP_BLK_ALIGNMENT)
+vcablk_segment {
+	__u64 phys_buff;
+	__u32 sectors_num;
 } VCA_ALIGNED_POSTFIX(VOP_BLK_ALIGNMENT);
 
 struct VCA_ALIGNED_PREFIX(VOP_BLK_ALIGNMENT)
@@ -93,10 +115,7 @@ vcablk_ring {
 } VCA_ALIGNED_POSTFIX(VOP_BLK_ALIGNMENT);
 
 struct VCA_ALIGNED_PREFIX(VOP_BLK_ALIGNMENT)
-vcablk_device_response {
-	__u8 command_ack;
-	__u32 status;
-
+vcablk_queue_response {
 	int done_db;
 
 	__u64 request_ring;
@@ -105,6 +124,16 @@ vcablk_device_response {
 	__u64 completion_ring_size;
 } VCA_ALIGNED_POSTFIX(VOP_BLK_ALIGNMENT);
 
+struct VCA_ALIGNED_PREFIX(VOP_BLK_ALIGNMENT)
+vcablk_device_response {
+	__u8 command_ack;
+	__u32 status;
+
+	/* Ring pairs created by frontend, not more than queues_max */
+	__u32 queues_num;
+	struct vcablk_queue_response queues[VCABLK_MAX_QUEUES];
+} VCA_ALIGNED_POSTFIX(VOP_BLK_ALIGNMENT);
+
 struct VCA_ALIGNED_PREFIX(VOP_BLK_ALIGNMENT)
 vcablk_device_ctrl {
 	__u8 command; //Set by bcknd when configuration of dev block change
@@ -113,7 +142,9 @@ vcablk_device_ctrl {
 	__u64 size_bytes;
 	__u8 read_only;
 
-	int request_db;
+	/* Ring pairs backend can serve, each with own request doorbell */
+	__u32 queues_max;
+	int request_db[VCABLK_MAX_QUEUES];
 
 	/* response filled by frontend in response to command */
 	struct vcablk_device_response response;
@@ -139,7 +170,8 @@ vcablk_dev_page {
 	char name[VCA_FRONTEND_NAME_SIZE];
 	__u32 valid_magic_bcknd;
 	__u32 flags_events;
-	__u32 reserved[2];
+	__u32 features_frontend; /* VCABLK_FEATURE_* supported by frontend */
+	__u32 features_backend;  /* VCABLK_FEATURE_* accepted by backend */
 
 	/* Generic Backend*/
 	__u32 num_devices;  /*Max to add for frontend*/
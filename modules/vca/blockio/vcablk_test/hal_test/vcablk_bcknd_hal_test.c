@@ -133,6 +133,7 @@ static void vcablk_bcknd_create_test_ram_disk(struct vcablk_bcknd_dev* bdev)
 			desc->disk_id = diskid;
 			strcpy(desc->file_path, "RAM DISK");
 			desc->mode = VCABLK_DISK_MODE_READ_WRITE;
+			desc->flags = 0;
 			desc->size = 10 * 1024 * 512	/* How big the drive is */;
 			desc->type = VCABLK_DISK_TYPE_MEMORY;
 			ret = vcablk_bcknd_create(bdev, desc);
@@ -125,6 +125,7 @@ int disk_open(int fd_dev, int id, char *file_path, bool readonly, bool ramdisk)
 	disk.disk_id = id;
 	disk.type = ramdisk?VCABLK_DISK_TYPE_MEMORY:VCABLK_DISK_TYPE_FILE;
 	disk.mode = readonly?VCABLK_DISK_MODE_READ_ONLY:VCABLK_DISK_MODE_READ_WRITE;
+	disk.flags = 0;
 
 	err = ioctl(fd_dev, VCA_BLK_GET_DISKS_MAX, &numbers);
 	if (err < 0) {
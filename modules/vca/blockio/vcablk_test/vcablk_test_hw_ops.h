@@ -22,6 +22,7 @@
 #define __VCA_BLK_TEST_HW_OPS_H__
 
 #include <linux/irqreturn.h>
+#include <linux/cpumask.h>
 
 struct plx_blockio_hw_ops {
         int (*next_db)(struct device *dev);
@@ -30,6 +31,8 @@ struct plx_blockio_hw_ops {
                         const char *name, void *data, int intr_src);
         void (*free_irq)(struct device *dev,
                         struct vca_irq *cookie, void *data);
+	int (*set_irq_affinity)(struct device *dev, int intr_src,
+			const struct cpumask *mask);
         void (*ack_interrupt)(struct device *dev, int num);
         void (*send_intr)(struct device *dev, int db);
         void __iomem * (*ioremap)(struct device *dev,
@@ -100,6 +100,12 @@ struct vca_csm_driver {
  * @get_net_config: gets network configuration
  * @set_net_config_windows: sets network configuration for Windows
  * @get_net_config_windows: gets network configuration for Windows
+ * @lbp_register_image: keeps a boot image in the driver, returns its id
+ * @lbp_unregister_image: drops an image registered before through the file
+ * @lbp_release_images: drops images registered through a file being closed
+ * @lbp_boot_ramdisk_image: boots the node from a registered image
+ * @lbp_boot_ramdisk_stream: boots the node from an image read from a file
+ * @lbp_get_phase_times: reads time spent in each LBP phase
  */
 struct vca_csm_hw_ops {
 	int (*start)(struct vca_csm_device *cdev, int id);
@@ -129,6 +135,19 @@ struct vca_csm_hw_ops {
 
 	enum vca_lbp_retval (*lbp_boot_ramdisk)(struct vca_csm_device *cdev,
 		void __user * img, size_t img_size);
+	enum vca_lbp_retval (*lbp_register_image)(struct vca_csm_device *cdev,
+		struct file *owner, const char *name, void __user * img,
+		size_t img_size, u32 *id);
+	enum vca_lbp_retval (*lbp_unregister_image)(struct vca_csm_device *cdev,
+		struct file *owner, u32 id);
+	void (*lbp_release_images)(struct vca_csm_device *cdev,
+		struct file *owner);
+	enum vca_lbp_retval (*lbp_boot_ramdisk_image)(
+		struct vca_csm_device *cdev, u32 id);
+	enum vca_lbp_retval (*lbp_boot_ramdisk_stream)(
+		struct vca_csm_device *cdev, int fd, size_t img_size);
+	enum vca_lbp_retval (*lbp_get_phase_times)(struct vca_csm_device *cdev,
+		struct vca_csm_ioctl_phase_times *times);
 	enum vca_lbp_retval (*lbp_boot_blkdisk)(struct vca_csm_device *cdev);
 	enum vca_lbp_retval (*lbp_boot_from_usb)(struct vca_csm_device *cdev);
 	enum vca_lbp_retval (*lbp_handshake)(struct vca_csm_device *cdev);
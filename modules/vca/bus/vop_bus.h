@@ -28,6 +28,7 @@
  */
 #include <linux/dmaengine.h>
 #include <linux/irqreturn.h>
+#include <linux/cpumask.h>
 
 struct vop_device_id {
 	u32 device;
@@ -83,6 +84,8 @@ struct vop_driver {
  * @next_db: Obtain the next available doorbell.
  * @request_irq: Request an interrupt on a particular doorbell.
  * @free_irq: Free an interrupt requested previously.
+ * @set_irq_affinity: Declare CPUs running the consumer of a doorbell, its
+ *		interrupt is steered to them. NULL mask drops the declaration.
  * @ack_interrupt: acknowledge an interrupt in the ISR.
  * @get_dp: Get access to the virtio device page used to add/remove/configure
  *		virtio devices. Depending on bridge side this is either local memory
@@ -92,6 +95,10 @@ struct vop_driver {
  * @send_intr: Send an interrupt to the peer node on a specified doorbell.
  * @ioremap: Map a buffer with the specified DMA address and length.
  * @iounmap: Unmap a buffer previously mapped.
+ * @ioremap_window: Reserve a long lived mapping of a large buffer pool, its
+ *		buffers are then addressed at fixed offsets. Returns NULL when
+ *		no space is left, callers fall back to @ioremap.
+ * @iounmap_window: Release a mapping taken with @ioremap_window.
  * @dma_filter: The DMA filter function to use for obtaining access to
  *		a DMA channel on the peer node.
  * @is_link_side: Return true if code runs on the link side of PCI bridge.
@@ -103,12 +110,18 @@ struct vop_hw_ops {
 			const char *name, void *data, int intr_src);
 	void (*free_irq)(struct vop_device *vpdev,
 			struct vca_irq *cookie, void *data);
+	int (*set_irq_affinity)(struct vop_device *vpdev, int intr_src,
+			const struct cpumask *mask);
 	void (*ack_interrupt)(struct vop_device *vpdev, int num);
 	void * (*get_dp)(struct vop_device *vpdev);
 	void (*send_intr)(struct vop_device *vpdev, int db);
 	void __iomem * (*ioremap)(struct vop_device *vpdev,
 			dma_addr_t pa, size_t len);
 	void (*iounmap)(struct vop_device *vpdev, void __iomem *va);
+	void __iomem * (*ioremap_window)(struct vop_device *vpdev,
+			dma_addr_t pa, size_t len);
+	void (*iounmap_window)(struct vop_device *vpdev, void __iomem *va,
+			size_t len);
 	void (*set_net_dev_state)(struct vop_device *vpdev, bool state);
 	void (*get_card_and_cpu_id)(struct vop_device *vdev,
 		u8 *out_card_id, u8 *out_cpu_id);
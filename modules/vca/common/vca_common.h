@@ -363,6 +363,9 @@ enum vca_lbp_retval {
 	LBP_SIZE
 };
 
+/* Length of the name identifying a boot image registered in the driver */
+#define VCA_LBP_IMAGE_NAME_LEN 256
+
 enum plx_eep_retval {
 	PLX_EEP_STATUS_OK = 0,
 	PLX_EEP_INTERNAL_ERROR,
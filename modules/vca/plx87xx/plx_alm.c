@@ -25,6 +25,9 @@
 
 #include<linux/slab.h>
 #include<linux/pci.h>
+#include<linux/bitmap.h>
+#include<linux/rcupdate.h>
+#include<linux/interval_tree_generic.h>
 
 /* Not use in release version, from performance reasons. */
 //#define DEBUG_ALM_CHECK
@@ -37,6 +40,41 @@
 
 #define ALUT_UNMAP_LAZY
 
+/*
+ * Free segments kept by evicting cached mappings ahead of need, as segments
+ * of a mapping released with lockless lookups enabled are reused only after
+ * a grace period.
+ */
+#define PLX_ALM_FREE_LOW(mngr)	((mngr)->windows_base / 8)
+
+/*
+ * Part of A-LUT segments reserved for windows, see plx_ioremap_window(),
+ * the rest is left for mappings on demand.
+ */
+#define PLX_ALM_WINDOWS_SHARE	2
+
+/*
+ * Value of the counter of a mapping without users. Such mapping may be
+ * only revived or released with alm_lock held, references above it are
+ * taken and dropped lockless.
+ */
+#ifdef ALUT_UNMAP_LAZY
+#define PLX_ALM_REF_IDLE	1
+#else
+#define PLX_ALM_REF_IDLE	0
+#endif /* ALUT_UNMAP_LAZY */
+
+/*
+ * Mapped blocks are kept in an interval tree keyed by the translated
+ * address range, so a request already covered by a mapping is found in
+ * O(log n). Free segments are tracked in used_map.
+ */
+#define PLX_ALM_START(entry)	((entry)->value)
+#define PLX_ALM_LAST(entry)	((entry)->last)
+
+INTERVAL_TREE_DEFINE(struct plx_alm_arr_entry, rb, u64, subtree_last,
+		     PLX_ALM_START, PLX_ALM_LAST, static inline, plx_alm_it)
+
 /*
  * plx_alm_entries_dmesg - print to dmesg output from check A-LUT entries.
  *
@@ -64,7 +102,7 @@ static void plx_alm_entries_dmesg(struct plx_alm* alm, struct pci_dev* pdev,
 		dev_err(&pdev->dev,"[%02x] to:%016llx ref_cnt:%x start:%x segments_count:%x\n",
 			/* ID */                id,
 			/* to */                alm->entries[id].value,
-			/* ref_cnt*/            alm->entries[id].counter,
+			/* ref_cnt*/            atomic_read(&alm->entries[id].counter),
 			/* start */             alm->entries[id].start,
 			/* segments_count */    alm->entries[id].segments_count);
 	}
@@ -85,10 +123,14 @@ static inline int plx_alm_check(struct plx_alm* alm, struct pci_dev* pdev)
 	u32 j;
 	u16 segments;
 	while(i < alm->segments_num) {
-		if (alm->entries[i].counter == 0) {
+		/* A retired block has no users but keeps its segments */
+		if (atomic_read(&alm->entries[i].counter) == 0 &&
+		    !(test_bit(i, alm->used_map) &&
+		      alm->entries[i].segments_count)) {
 			/* Check empty entry */
 			if (alm->entries[i].segments_count != 0 ||
-					alm->entries[i].start != 0 || alm->entries[i].value != 0) {
+					alm->entries[i].start != 0 || alm->entries[i].value != 0 ||
+					test_bit(i, alm->used_map)) {
 				dev_err(&pdev->dev, "A-LUT: Invalid segment: [%02x]\n", i);
 				plx_alm_entries_dmesg(alm, pdev, i, 1);
 				err = -EINVAL;
@@ -118,8 +160,8 @@ static inline int plx_alm_check(struct plx_alm* alm, struct pci_dev* pdev)
 		}
 
 		for(j = i; j < i + segments;++j) {
-			if (alm->entries[j].start != i ||
-				((j != i) && ( alm->entries[j].counter != 0 ||
+			if (alm->entries[j].start != i || !test_bit(j, alm->used_map) ||
+				((j != i) && (atomic_read(&alm->entries[j].counter) != 0 ||
 						alm->entries[j].segments_count != 0))) {
 				dev_err(&pdev->dev, "A-LUT: Detect Invalid block parent "
 						"%02x: id: [%02x]\n", i, j);
@@ -152,25 +194,50 @@ int plx_alm_init(struct plx_alm* mngr,
 
 	mngr->segments_num = segments_num;
 	mngr->segment_size = aper_len / mngr->segments_num;
-
-	mngr->entries = (struct plx_alm_arr_entry*)kzalloc(
-		sizeof(struct plx_alm_arr_entry) * mngr->segments_num, 0);
-	
-	if (!mngr->entries) {
+	mngr->windows_base = mngr->segments_num -
+		mngr->segments_num / PLX_ALM_WINDOWS_SHARE;
+
+	/* Called before the manager is reachable by users, may sleep */
+	mngr->entries = kcalloc(mngr->segments_num,
+				sizeof(struct plx_alm_arr_entry), GFP_KERNEL);
+	mngr->used_map = kcalloc(BITS_TO_LONGS(mngr->segments_num),
+				 sizeof(unsigned long), GFP_KERNEL);
+	mngr->fast_hits = alloc_percpu(u64);
+	mngr->mappings = PLX_ALM_RB_ROOT;
+	INIT_LIST_HEAD(&mngr->lru);
+	mngr->cached = 0;
+	mngr->hits = mngr->misses = mngr->evictions = 0;
+	seqcount_init(&mngr->seq);
+	INIT_LIST_HEAD(&mngr->retired);
+	mngr->retired_num = 0;
+	mngr->generation = 0;
+
+	if (!mngr->entries || !mngr->used_map || !mngr->fast_hits) {
 		dev_info(&pdev->dev, "Could not allocate memory for a_lut_array!\n");
-		rc = -ENOMEM;
+		kfree(mngr->entries);
+		kfree(mngr->used_map);
+		free_percpu(mngr->fast_hits);
+		mngr->entries = NULL;
+		mngr->used_map = NULL;
+		mngr->fast_hits = NULL;
+		mngr->segments_num = 0;
+		mngr->windows_base = 0;
+		return -ENOMEM;
 	}
 
 	dev_info(&pdev->dev,
 		"A-LUT manager initialized!"
-		"aper len: %llx, segments_num: %x, segment_size: %llx\n",
-		aper_len, mngr->segments_num, mngr->segment_size);
+		"aper len: %llx, segments_num: %x, segment_size: %llx, "
+		"windows_base: %x\n",
+		aper_len, mngr->segments_num, mngr->segment_size,
+		mngr->windows_base);
 
 #ifdef DEBUG_ALM_CHECK
 	dev_err(&pdev->dev, "A-LUT manager DEBUG MODE: DEBUG_ALM_CHECK!\n");
 #endif
 
 	plx_alm_check(mngr, pdev);
+	WRITE_ONCE(mngr->lockless, PLX_ALM_LOCKLESS);
 	return rc;
 }
 
@@ -179,14 +246,30 @@ int plx_alm_init(struct plx_alm* mngr,
  *
  * @mngr: pointer to plx_a_lut_manager instance
  *
+ * Lockless lookups have to be stopped by clearing @mngr->lockless and
+ * waiting for a grace period before.
+ *
  * RETURNS: nothing
  */
 void plx_alm_release(struct plx_alm* mngr, struct pci_dev *pdev)
 {
 	plx_alm_check(mngr, pdev);
+	WARN_ON(mngr->lockless);
 	kfree(mngr->entries);
+	kfree(mngr->used_map);
+	free_percpu(mngr->fast_hits);
+	mngr->entries = NULL;
+	mngr->used_map = NULL;
+	mngr->fast_hits = NULL;
+	mngr->mappings = PLX_ALM_RB_ROOT;
+	INIT_LIST_HEAD(&mngr->lru);
+	mngr->cached = 0;
+	INIT_LIST_HEAD(&mngr->retired);
+	mngr->retired_num = 0;
+	mngr->generation++;
 	mngr->segments_num = 0;
 	mngr->segment_size = 0;
+	mngr->windows_base = 0;
 }
 
 /*
@@ -209,43 +292,325 @@ static inline void clear_entries(struct plx_alm_arr_entry * entries,
  *
  * @mngr: pointer to plx_a_lut_manager instance
  *
+ * Lockless lookups have to be stopped by clearing @mngr->lockless and
+ * waiting for a grace period before, they could walk the cleared nodes.
+ *
  * RETURNS: nothing
  */
 void plx_alm_reset(struct plx_alm* mngr, struct pci_dev *pdev)
 {
 	plx_alm_check(mngr, pdev);
+	WARN_ON(mngr->lockless);
+	write_seqcount_begin(&mngr->seq);
 	clear_entries(mngr->entries, 0, mngr->segments_num);
+	bitmap_zero(mngr->used_map, mngr->segments_num);
+	mngr->mappings = PLX_ALM_RB_ROOT;
+	write_seqcount_end(&mngr->seq);
+	INIT_LIST_HEAD(&mngr->lru);
+	mngr->cached = 0;
+	INIT_LIST_HEAD(&mngr->retired);
+	mngr->retired_num = 0;
+	mngr->generation++;
+}
+
+/*
+ * plx_alm_find - find a mapping translating the whole requested range
+ *
+ * @mngr: pointer to plx_a_lut_manager instance
+ * @addr_masked: first translated address, aligned to the segment size
+ * @segments: number of segments of the request
+ *
+ * RETURNS: first entry of the mapping or NULL
+ */
+static struct plx_alm_arr_entry *plx_alm_find(struct plx_alm *mngr,
+		u64 addr_masked, u32 segments)
+{
+	u64 last = addr_masked + segments * mngr->segment_size - 1;
+	struct plx_alm_arr_entry *entry;
+
+	for (entry = plx_alm_it_iter_first(&mngr->mappings, addr_masked,
+					   addr_masked);
+	     entry;
+	     entry = plx_alm_it_iter_next(entry, addr_masked, addr_masked)) {
+		if (entry->last >= last)
+			return entry;
+	}
+	return NULL;
+}
+
+/*
+ * plx_alm_map - create a mapping in free segments
+ *
+ * @mngr: pointer to plx_a_lut_manager instance
+ * @start: id of the first segment
+ * @addr_masked: first translated address, aligned to the segment size
+ * @segments: number of segments
+ *
+ * The mapping is not visible to lookups until plx_alm_publish().
+ *
+ * RETURNS: nothing
+ */
+static void plx_alm_map(struct plx_alm *mngr, u32 start, u64 addr_masked,
+		u32 segments)
+{
+	struct plx_alm_arr_entry *entry = &mngr->entries[start];
+	u32 i;
+
+	entry->value = addr_masked;
+	entry->segments_count = segments;
+	entry->last = addr_masked + segments * mngr->segment_size - 1;
+	for (i = 0; i < segments; i++)
+		mngr->entries[start + i].start = start;
+	bitmap_set(mngr->used_map, start, segments);
+	INIT_LIST_HEAD(&entry->lru);
+}
+
+/**
+ * plx_alm_publish() - make a new mapping visible to lookups
+ * @mngr: pointer to plx_a_lut_manager instance
+ * @segment_id: first segment of the mapping returned by plx_alm_add_entry()
+ *
+ * Called with alm_lock held, once the hardware translation is programmed.
+ *
+ * */
+void plx_alm_publish(struct plx_alm *mngr, u32 segment_id)
+{
+	struct plx_alm_arr_entry *entry = &mngr->entries[segment_id];
+
+	write_seqcount_begin(&mngr->seq);
+	plx_alm_it_insert(entry, &mngr->mappings);
+	write_seqcount_end(&mngr->seq);
+}
+
+/*
+ * plx_alm_ref_live - take a reference on a mapping which has users
+ *
+ * @entry: first entry of the mapping
+ *
+ * RETURNS: false if the mapping is idle or released
+ */
+static inline bool plx_alm_ref_live(struct plx_alm_arr_entry *entry)
+{
+	int old, cnt = atomic_read(&entry->counter);
+
+	do {
+		if (cnt <= PLX_ALM_REF_IDLE)
+			return false;
+		old = cnt;
+		cnt = atomic_cmpxchg(&entry->counter, old, old + 1);
+	} while (cnt != old);
+	return true;
+}
+
+/**
+ * plx_alm_get_fast() - reuse an existing mapping without alm_lock
+ * @mngr: pointer to plx_a_lut_manager instance
+ * @addr: DMA address to access memory
+ * @size: size of allocation
+ *
+ * Only a mapping which already has users is taken, a miss, an idle mapping
+ * or a concurrent update of the tree sends the caller to
+ * plx_alm_add_entry().
+ *
+ * RETURNS: 0 with a reference taken, -EAGAIN without a reference or
+ * -ESTALE when a reference was taken on a mapping replaced after lookup,
+ * which must be dropped by the caller.
+ * @out_segment_id: id of a segment in A-LUT array translating @addr or
+	first segment of the stale mapping
+ *
+ * */
+int plx_alm_get_fast(struct plx_alm *mngr, dma_addr_t addr, size_t size,
+		u32 *out_segment_id)
+{
+	struct plx_alm_arr_entry *entry;
+	u64 translation_mask, addr_masked;
+	u32 segments, start;
+	unsigned int seq;
+	int rc = -EAGAIN;
+
+	rcu_read_lock();
+	if (!READ_ONCE(mngr->lockless) || !size)
+		goto out;
+
+	translation_mask = mngr->segment_size - 1;
+	addr_masked = addr & ~translation_mask;
+	segments = (u32)DIV_ROUND_UP((addr & translation_mask) + size,
+		mngr->segment_size);
+
+	seq = read_seqcount_begin(&mngr->seq);
+	entry = plx_alm_find(mngr, addr_masked, segments);
+	if (!entry || read_seqcount_retry(&mngr->seq, seq))
+		goto out;
+
+	if (!plx_alm_ref_live(entry))
+		goto out;
+
+	/*
+	 * A referenced mapping can not change any more, but it could be
+	 * released and created again after the lookup.
+	 */
+	start = entry - mngr->entries;
+	if (read_seqcount_retry(&mngr->seq, seq)) {
+		*out_segment_id = start;
+		rc = -ESTALE;
+		goto out;
+	}
+
+	*out_segment_id = start +
+		(u32)((addr_masked - entry->value) / mngr->segment_size);
+	this_cpu_inc(*mngr->fast_hits);
+	rc = 0;
+out:
+	rcu_read_unlock();
+	return rc;
+}
+
+/**
+ * plx_alm_put_fast() - drop a reference without alm_lock
+ * @mngr: pointer to plx_a_lut_manager instance
+ * @segment_id: id of an A-LUT segment
+ *
+ * RETURNS: false if this is the last user of the mapping, which has to be
+ * dropped by plx_alm_del_entry().
+ *
+ * */
+bool plx_alm_put_fast(struct plx_alm *mngr, u32 segment_id)
+{
+	struct plx_alm_arr_entry *entry;
+	bool ret = false;
+
+	rcu_read_lock();
+	if (READ_ONCE(mngr->lockless)) {
+		entry = &mngr->entries[READ_ONCE(mngr->entries[segment_id].start)];
+		ret = atomic_add_unless(&entry->counter, -1,
+				PLX_ALM_REF_IDLE + 1);
+	}
+	rcu_read_unlock();
+	return ret;
+}
+
+/*
+ * plx_alm_hits - number of requests served by an existing mapping
+ *
+ * @mngr: pointer to plx_a_lut_manager instance
+ *
+ * RETURNS: sum of locked and lockless hits
+ */
+u64 plx_alm_hits(struct plx_alm *mngr)
+{
+	u64 hits = mngr->hits;
+	int cpu;
+
+	if (mngr->fast_hits)
+		for_each_possible_cpu(cpu)
+			hits += *per_cpu_ptr(mngr->fast_hits, cpu);
+	return hits;
+}
+
+/*
+ * plx_alm_free_extents - report fragmentation of free segments
+ *
+ * @mngr: pointer to plx_a_lut_manager instance
+ *
+ * RETURNS:
+ * @out_free: number of free segments
+ * @out_extents: number of runs of free segments
+ * @out_largest: segments in the largest run
+ */
+void plx_alm_free_extents(struct plx_alm *mngr, u32 *out_free,
+		u32 *out_extents, u32 *out_largest)
+{
+	u32 begin, end;
+
+	*out_free = *out_extents = *out_largest = 0;
+	for (begin = find_first_zero_bit(mngr->used_map, mngr->segments_num);
+	     begin < mngr->segments_num;
+	     begin = find_next_zero_bit(mngr->used_map, mngr->segments_num,
+					end)) {
+		end = find_next_bit(mngr->used_map, mngr->segments_num, begin);
+		*out_free += end - begin;
+		*out_extents += 1;
+		*out_largest = max(*out_largest, end - begin);
+	}
+}
+
+/*
+ * plx_alm_retired - number of mappings waiting for a grace period
+ *
+ * @mngr: pointer to plx_a_lut_manager instance
+ *
+ * Called with alm_lock held. The caller waits for a grace period and
+ * passes the results to plx_alm_reclaim().
+ *
+ * RETURNS: number of retired mappings
+ * @out_generation: generation of the retired list
+ */
+u32 plx_alm_retired(struct plx_alm *mngr, u32 *out_generation)
+{
+	*out_generation = mngr->generation;
+	return mngr->retired_num;
+}
+
+/*
+ * plx_alm_reclaim - free segments of mappings retired a grace period ago
+ *
+ * @mngr: pointer to plx_a_lut_manager instance
+ * @num: number of oldest retired mappings to free
+ * @generation: generation returned by plx_alm_retired()
+ *
+ * Called with alm_lock held. Mappings retired later stay on the list, all
+ * of them are gone if the manager was reset meanwhile.
+ *
+ * RETURNS: nothing
+ */
+void plx_alm_reclaim(struct plx_alm *mngr, u32 num, u32 generation)
+{
+	struct plx_alm_arr_entry *entry;
+	u32 start;
+
+	if (generation != mngr->generation)
+		return;
+
+	while (num-- && !list_empty(&mngr->retired)) {
+		entry = list_first_entry(&mngr->retired,
+					 struct plx_alm_arr_entry, lru);
+		list_del(&entry->lru);
+		mngr->retired_num--;
+		start = entry - mngr->entries;
+		bitmap_clear(mngr->used_map, start, entry->segments_count);
+		clear_entries(mngr->entries, start, entry->segments_count);
+	}
 }
 
 #ifdef ALUT_UNMAP_LAZY
 /**
- * plx_alm_cleanup_unused_entry() - clean entry in A-LUT array if not used
+ * plx_alm_evict_lru() - release the least recently used cached entry
  * @mngr: pointer to plx_a_lut_manager instance
  * @pdev: The PCIe device
+ * @begin: first segment of the pool to make space in
+ * @end: segment after the pool
  *
- * Work only with ALUT_UNMAP_LAZY, Cleanup unused entries to
- * prepare places for new allocations.
+ * Work only with ALUT_UNMAP_LAZY, entries not used any more stay mapped
+ * until space is needed for new allocations.
  *
- * RETURNS: number of released entries.
+ * RETURNS: false if there is no cached entry in the pool.
  *
  * */
-static int plx_alm_cleanup_unused_entry(struct plx_alm* mngr,
-		struct pci_dev* pdev)
+static bool plx_alm_evict_lru(struct plx_alm* mngr, struct pci_dev* pdev,
+		u32 begin, u32 end)
 {
-	u32 nums = 0;
-	u32 i = 0;
+	struct plx_alm_arr_entry *entry;
 	u32 ignore;
 
-	dev_dbg(&pdev->dev, "Cleanup A-LUT segments\n");
-	while (i < mngr->segments_num) {
-		/* With alut lazy for counter 1 entry is not used*/
-		if (mngr->entries[i].counter == 1) {
-			plx_alm_del_entry(mngr, pdev, i, &ignore, &ignore);
-			++nums;
-		}
-		++i;
+	list_for_each_entry(entry, &mngr->lru, lru) {
+		if (entry->start < begin || entry->start >= end)
+			continue;
+		dev_dbg(&pdev->dev, "Evict A-LUT segment %x\n", entry->start);
+		plx_alm_del_entry(mngr, pdev, entry->start, &ignore, &ignore);
+		mngr->evictions++;
+		return true;
 	}
-	return nums;
+	return false;
 }
 #endif /* ALUT_UNMAP_LAZY */
 
@@ -255,112 +620,102 @@ static int plx_alm_cleanup_unused_entry(struct plx_alm* mngr,
  * @pdev: The PCIe device
  * @addr: DMA address to access memory
  * @size: size of allocation
+ * @window: take segments from the pool reserved for windows
  *
  * This function allows other side of NTB to access address @addr by adding
- * a lookup entry to A LUT array.
+ * a lookup entry to A LUT array. A request already covered by an existing
+ * mapping reuses it, whichever pool it is in.
  *
- * RETURNS: 
+ * RETURNS: 0 on success, -EEXIST if an existing mapping is reused, -EAGAIN
+ * if segments are only available after retired mappings are reclaimed or
+ * -ENOMEM
  * @out_segment_id: id of a segment in A-LUT array this
 	allocation is to be written
  * @out_segments_num: number of continous segments to be written in A-LUT array
  *
  * */
 int plx_alm_add_entry(struct plx_alm* mngr,
-		struct pci_dev* pdev, dma_addr_t addr, size_t size,
+		struct pci_dev* pdev, dma_addr_t addr, size_t size, bool window,
 		u32 *out_segment_id, u32 * out_segments_num)
 {
-	int i = 0;
 	int rc = 0;
+	u32 begin = window ? mngr->windows_base : 0;
+	u32 end = window ? mngr->segments_num : mngr->windows_base;
 
 	u64 translation_mask = (u64)mngr->segment_size - 1;
 	dma_addr_t addr_masked = addr & ~translation_mask;
 	u64 offset_in_segment = addr & translation_mask;
 	u32 segments = (u32)DIV_ROUND_UP(offset_in_segment + size,
 		mngr->segment_size);
-	u32 free_slots = 0;
-	u32 match = -1;
+	struct plx_alm_arr_entry *entry;
+	unsigned long match;
 	u64 idx = 0;
 
 	PLX_ALM_CHECK(mngr, pdev);
 
-	if (!size || size > mngr->segment_size * mngr->segments_num) {
-		dev_err(&pdev->dev, "request for allocation %s\n",
-			!size ? "with zero size" : "too big for translation");
+	if (!size || size > mngr->segment_size * (end - begin)) {
+		/* Window not fitting its pool is mapped on demand instead */
+		if (!size || !window)
+			dev_err(&pdev->dev, "request for allocation %s\n",
+				!size ? "with zero size" : "too big for translation");
 		rc = -ENOMEM;
 		goto finish;
 	}
 
-	while (i < mngr->segments_num) {
-		idx = 0;
-
-		/* check if there is enough of free consecutive blocks
-		 * to store this mapping */
-		if (mngr->entries[i].counter == 0) {
-			if (match == -1) {
-				free_slots++;
-				if (free_slots == segments)
-					match = i - segments + 1;
-			}
-			i++;
-		}
-		else {
-			free_slots = 0;
-
-			/* we're in the first block of some mapping - check
-			 * if new mapping can be embedded into this one */
-			if(addr_masked >= mngr->entries[i].value)
-			{
-				idx = (addr_masked - mngr->entries[i].value)
-					  / mngr->segment_size;
-				if (idx < mngr->segments_num &&
-				    idx + segments <=
-					mngr->entries[i].segments_count) {
-					match = i;
-					break;
-				}
-				else {
-					idx = 0;
-				}
-			}
-
-			i += mngr->entries[i].segments_count;
-		}
-	}
-
-	if (match != -1) {
-		if (mngr->entries[match].counter == 0) {
-			mngr->entries[match].value = addr_masked;
-			mngr->entries[match].segments_count = segments;
-			for(i=0; i<segments; i++)
-				mngr->entries[match + i].start = match;
-		}
-		else {
-			rc = -EEXIST;
-		}
-
+	/* check if new mapping can be embedded into an existing one */
+	entry = plx_alm_find(mngr, addr_masked, segments);
+	if (entry) {
+		match = entry->start;
+		idx = (addr_masked - entry->value) / mngr->segment_size;
+		rc = -EEXIST;
+		mngr->hits++;
 #ifdef ALUT_UNMAP_LAZY
-		if (!mngr->entries[match].counter) {
-			/* For lazy unmap, counter 1 is keep to alut not used,
-			 * and can be cleanup.
-			 * For first used allocation increment counter to 2. */
-			mngr->entries[match].counter = 1;
+		if (atomic_read(&entry->counter) == PLX_ALM_REF_IDLE) {
+			/* Cached entry is used again */
+			list_del_init(&entry->lru);
+			mngr->cached--;
 		}
 #endif /* ALUT_UNMAP_LAZY */
-		mngr->entries[match].counter++;
-
 	} else {
-
+		/* find enough of free consecutive blocks to store this mapping */
+		while ((match = bitmap_find_next_zero_area(mngr->used_map,
+				end, begin, segments, 0)) >= end) {
 #ifdef ALUT_UNMAP_LAZY
-		if (plx_alm_cleanup_unused_entry(mngr, pdev)) {
-			return plx_alm_add_entry(mngr, pdev, addr, size, out_segment_id,
-					out_segments_num);
-		}
+			if (plx_alm_evict_lru(mngr, pdev, begin, end))
+				continue;
 #endif /* ALUT_UNMAP_LAZY */
 
-		dev_err(&pdev->dev, "out of A-LUT segments\n");
-		rc = -ENOMEM;
-		goto finish;
+			/* Segments being reclaimed may satisfy a retry */
+			if (mngr->retired_num) {
+				rc = -EAGAIN;
+				goto finish;
+			}
+			if (!window)
+				dev_err(&pdev->dev, "out of A-LUT segments\n");
+			rc = -ENOMEM;
+			goto finish;
+		}
+		mngr->misses++;
+		plx_alm_map(mngr, match, addr_masked, segments);
+		entry = &mngr->entries[match];
+
+		/* For lazy unmap, counter 1 is keep to alut not used,
+		 * and can be cleanup.
+		 * For first used allocation increment counter to 2.
+		 * Barrier orders the counter after the seq update of a release
+		 * of these segments, see plx_alm_get_fast(). */
+		smp_wmb();
+		atomic_set(&entry->counter, PLX_ALM_REF_IDLE);
+
+#ifdef ALUT_UNMAP_LAZY
+		while (!window && mngr->lockless &&
+		       mngr->windows_base - bitmap_weight(mngr->used_map,
+				mngr->windows_base) < PLX_ALM_FREE_LOW(mngr) &&
+		       plx_alm_evict_lru(mngr, pdev, 0, mngr->windows_base))
+			;
+#endif /* ALUT_UNMAP_LAZY */
 	}
+	atomic_inc(&entry->counter);
 
 	*out_segment_id = (u32)match + (u32)idx;
 	*out_segments_num = segments;
@@ -376,6 +731,9 @@ finish:
  * @pdev: The PCIe device
  * @segment_id: id of an A-LUT segment
  *
+ * A mapping released while lockless lookups are enabled is only taken out
+ * of the tree, its segments are retired until plx_alm_reclaim().
+ *
  * RETURNS:
  * @out_segment_id: id of a starting segment,
  from which we need to start clearing
@@ -386,18 +744,44 @@ void plx_alm_del_entry(struct plx_alm* mngr, struct pci_dev* pdev, u32 segment_i
 					   u32 * out_segment_id, u32 * out_segments_num)
 {
 	u32 start_id = mngr->entries[segment_id].start;
+	int counter;
 
 	PLX_ALM_CHECK(mngr, pdev);
-	BUG_ON(mngr->entries[start_id].counter == 0);
+	BUG_ON(atomic_read(&mngr->entries[start_id].counter) == 0);
 
-	mngr->entries[start_id].counter--;
+	/* Lockless users may change the counter concurrently */
+	counter = atomic_dec_return(&mngr->entries[start_id].counter);
 
-	if (mngr->entries[start_id].counter == 0) {
+#ifdef ALUT_UNMAP_LAZY
+	if (counter == PLX_ALM_REF_IDLE) {
+		/* Last user gone, keep the mapping cached */
+		list_add_tail(&mngr->entries[start_id].lru, &mngr->lru);
+		mngr->cached++;
+	}
+#endif /* ALUT_UNMAP_LAZY */
+
+	if (counter == 0) {
 		u32 segments = mngr->entries[start_id].segments_count;
 
+		if (!list_empty(&mngr->entries[start_id].lru)) {
+			list_del(&mngr->entries[start_id].lru);
+			mngr->cached--;
+		}
+
 		*out_segment_id = start_id;
 		*out_segments_num = segments;
-		clear_entries(mngr->entries, start_id, segments);
+		write_seqcount_begin(&mngr->seq);
+		plx_alm_it_remove(&mngr->entries[start_id], &mngr->mappings);
+		if (mngr->lockless) {
+			/* Lookups may still walk the node, keep it intact */
+			list_add_tail(&mngr->entries[start_id].lru,
+				      &mngr->retired);
+			mngr->retired_num++;
+		} else {
+			bitmap_clear(mngr->used_map, start_id, segments);
+			clear_entries(mngr->entries, start_id, segments);
+		}
+		write_seqcount_end(&mngr->seq);
 	}
 	PLX_ALM_CHECK(mngr, pdev);
 }
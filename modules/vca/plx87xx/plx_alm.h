@@ -25,22 +25,64 @@
 #define _PLX_ALM_H_
 
 #include <linux/dmaengine.h>
+#include <linux/rbtree.h>
+#include <linux/seqlock.h>
+#include <linux/percpu.h>
+#include <linux/version.h>
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0)
+#define plx_alm_rb_root		rb_root_cached
+#define PLX_ALM_RB_ROOT		RB_ROOT_CACHED
+#else
+#define plx_alm_rb_root		rb_root
+#define PLX_ALM_RB_ROOT		RB_ROOT
+#endif
+
+/*
+ * Lookups walk the interval tree without alm_lock only where rbtree
+ * updates are latch safe: since 4.2 rotations and erases publish child
+ * pointers with WRITE_ONCE and never form a loop, so a walk racing with
+ * an update ends and the seqcount catches a wrong result. Older kernels
+ * take alm_lock for every lookup.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 2, 0)
+#define PLX_ALM_LOCKLESS	true
+#else
+#define PLX_ALM_LOCKLESS	false
+#endif
+
+#ifndef READ_ONCE
+#define READ_ONCE(x) ACCESS_ONCE(x)
+#endif
+#ifndef WRITE_ONCE
+#define WRITE_ONCE(x, val) ( ACCESS_ONCE(x) = (val) )
+#endif
 
 /**
  * struct alm_arr_entry -  a single entry in A-LUT array.
  *
  * @value: value of translation bits
- * @counter: number of allocations that this entry contains.
+ * @counter: number of allocations that this entry contains, users holding
+	a mapping may take and drop references without alm_lock
  * @segments_count: number of continous segments that this entry contains ie.
 	if segment size is 1MB and someone wants to allocate 4MB ,
 	then the segment count would be 4
  * @start: id of first segment in this block
+ * @rb: node in the interval tree of mappings, first segment of a block only
+ * @last: last address translated by the block
+ * @subtree_last: interval tree augmentation, max @last in the subtree
+ * @lru: node in the list of cached mappings no longer used, or in the
+	list of retired mappings
  */
 struct plx_alm_arr_entry {
 	u64 value;
-	u16 counter;
+	atomic_t counter;
 	u16 segments_count;
 	u16 start;
+	struct rb_node rb;
+	u64 last;
+	u64 subtree_last;
+	struct list_head lru;
 };
 
 /**
@@ -48,12 +90,43 @@ struct plx_alm_arr_entry {
  *
  * @segments_num: number of entries the A-LUT will manage.
  * @segment_size: size of a single segment in A-LUT
+ * @windows_base: first segment of the pool reserved for long lived windows,
+	mappings on demand use only the segments below
  * @entries: pointer to an array containing A-LUT entries
+ * @used_map: bitmap of segments belonging to a mapping
+ * @mappings: interval tree of mapped blocks keyed by translated address
+ * @lru: cached mappings without users, least recently used first
+ * @cached: number of mappings in @lru
+ * @hits: requests served by an existing mapping
+ * @misses: requests which needed a new mapping
+ * @evictions: cached mappings released to make space
+ * @fast_hits: per CPU count of requests served without alm_lock
+ * @seq: bumped around every change of @mappings, lets lockless lookups
+	detect a concurrent update
+ * @lockless: lookups without alm_lock allowed, cleared before release
+ * @retired: released mappings lockless lookups may still walk, oldest
+	first, their segments are reused after a grace period
+ * @retired_num: number of mappings in @retired
+ * @generation: bumped by plx_alm_reset(), invalidates a pending reclaim
  */
 struct plx_alm {
 	u32 segments_num;
 	u64 segment_size;
+	u32 windows_base;
 	struct plx_alm_arr_entry * entries;
+	unsigned long *used_map;
+	struct plx_alm_rb_root mappings;
+	struct list_head lru;
+	u32 cached;
+	u64 hits;
+	u64 misses;
+	u64 evictions;
+	u64 __percpu *fast_hits;
+	seqcount_t seq;
+	bool lockless;
+	struct list_head retired;
+	u32 retired_num;
+	u32 generation;
 };
 
 int plx_alm_init(struct plx_alm*, struct pci_dev*, int segments_num, u64 aper_len);
@@ -61,8 +134,18 @@ void plx_alm_release(struct plx_alm*, struct pci_dev*);
 void plx_alm_reset(struct plx_alm*, struct pci_dev*);
 
 int plx_alm_add_entry(struct plx_alm*, struct pci_dev*, dma_addr_t addr,
-					  size_t size, u32 *out_segment_id, u32 *out_segments_num);
+					  size_t size, bool window, u32 *out_segment_id,
+					  u32 *out_segments_num);
 void plx_alm_del_entry(struct plx_alm*, struct pci_dev*, u32 segment_id,
 					  u32 * out_segment_id, u32 *out_segments_num);
+int plx_alm_get_fast(struct plx_alm*, dma_addr_t addr, size_t size,
+					  u32 *out_segment_id);
+bool plx_alm_put_fast(struct plx_alm*, u32 segment_id);
+void plx_alm_publish(struct plx_alm*, u32 segment_id);
+u64 plx_alm_hits(struct plx_alm*);
+u32 plx_alm_retired(struct plx_alm*, u32 *out_generation);
+void plx_alm_reclaim(struct plx_alm*, u32 num, u32 generation);
+void plx_alm_free_extents(struct plx_alm*, u32 *out_free, u32 *out_extents,
+					  u32 *out_largest);
 
 #endif
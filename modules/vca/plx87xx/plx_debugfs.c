@@ -23,6 +23,7 @@
 #include <linux/pci.h>
 #include <linux/seq_file.h>
 #include <linux/delay.h>
+#include <linux/math64.h>
 
 #ifdef VCA_IN_KERNEL_BUILD
 #include <linux/vca_dev_common.h>
@@ -63,23 +64,24 @@ static int plx_msi_irq_info_show(struct seq_file *s, void *pos)
 		struct pci_dev, dev);
 
 	if (pci_dev_msi_enabled(pdev)) {
-		entry = 0;
-		vector = pdev->irq;
-
-		seq_printf(s, "%s %-10d %s %-10d\n",
-			   "IRQ:", vector, "Entry:", entry);
-
-		seq_printf(s, "%-10s", "offset:");
-		for (j = (PLX_NUM_OFFSETS - 1); j >= 0; j--)
-			seq_printf(s, "%4d ", j);
-		seq_puts(s, "\n");
-
-		seq_printf(s, "%-10s", "count:");
-		for (j = (PLX_NUM_OFFSETS - 1); j >= 0; j--)
-			seq_printf(s, "%4d ",
-				   (xdev->irq_info.plx_msi_map[entry] &
-				   BIT(j)) ? 1 : 0);
-		seq_puts(s, "\n\n");
+		for (entry = 0; entry < xdev->irq_info.num_vectors; entry++) {
+			vector = xdev->irq_info.vectors[entry].irq;
+
+			seq_printf(s, "%s %-10d %s %-10d\n",
+				   "IRQ:", vector, "Entry:", entry);
+
+			seq_printf(s, "%-10s", "offset:");
+			for (j = (PLX_NUM_OFFSETS - 1); j >= 0; j--)
+				seq_printf(s, "%4d ", j);
+			seq_puts(s, "\n");
+
+			seq_printf(s, "%-10s", "count:");
+			for (j = (PLX_NUM_OFFSETS - 1); j >= 0; j--)
+				seq_printf(s, "%4d ",
+					   (xdev->irq_info.plx_msi_map[entry] &
+					   BIT(j)) ? 1 : 0);
+			seq_puts(s, "\n\n");
+		}
 	} else {
 		seq_puts(s, "MSI/MSIx interrupts not enabled\n");
 	}
@@ -732,14 +734,33 @@ static int plx_alm_show(struct seq_file *s, void *pos)
 	struct plx_device *xdev = s->private;
 	struct plx_alm *alm = &xdev->a_lut_manager;
 	unsigned int i;
-
+	u64 hits, misses, evictions;
+	u32 cached, free, extents, largest;
+
+	spin_lock(&xdev->alm_lock);
+	hits = plx_alm_hits(alm);
+	misses = alm->misses;
+	evictions = alm->evictions;
+	cached = alm->cached;
+	if (alm->used_map)
+		plx_alm_free_extents(alm, &free, &extents, &largest);
+	else
+		free = extents = largest = 0;
+	spin_unlock(&xdev->alm_lock);
+
+	seq_printf(s, "hits:%llu misses:%llu hit_rate:%llu%% evictions:%llu cached:%u\n",
+		   hits, misses,
+		   hits + misses ? div64_u64(hits * 100, hits + misses) : 0,
+		   evictions, cached);
+	seq_printf(s, "free segments:%u extents:%u largest:%u\n",
+		   free, extents, largest);
 	seq_printf(s, "current mappings: bits:%016llx\n", ~((u64)alm->segment_size - 1));
 	for (i=0; i<alm->segments_num; i++) {
 		seq_printf(s, "[%02x] from:%p to:%016llx ref_cnt:%x start:%x segments_count:%x\n",
 			/* ID */                i,
 			/*from*/                (char*)xdev->aper.va + i * alm->segment_size,
 			/* to */                alm->entries[i].value,
-			/* ref_cnt*/            alm->entries[i].counter,
+			/* ref_cnt*/            atomic_read(&alm->entries[i].counter),
 			/* start */             alm->entries[i].start,
 			/* segments_count */    alm->entries[i].segments_count);
 	}
@@ -760,6 +781,42 @@ static const struct file_operations alm_ops = {
 	.release = single_release
 };
 
+static int plx_lbp_phases_show(struct seq_file *s, void *pos)
+{
+	struct plx_device *xdev = s->private;
+	struct plx_lbp_phase_stats stats;
+	int i;
+
+	/* LBP runs on the host side of production cards only */
+	if (!xdev->lbp_lock)
+		return 0;
+
+	seq_printf(s, "%-12s %10s %12s %12s %12s %10s %10s\n", "phase",
+		   "count", "last_us", "max_us", "avg_us", "wakeups", "polls");
+	for (i = 0; i < PLX_LBP_PHASES; i++) {
+		plx_lbp_phase_stats(xdev, i, &stats);
+		seq_printf(s, "%-12s %10llu %12llu %12llu %12llu %10llu %10llu\n",
+			   plx_lbp_phase_name(i), stats.count, stats.last_us,
+			   stats.max_us,
+			   stats.count ? div64_u64(stats.total_us, stats.count) : 0,
+			   stats.wakeups, stats.polls);
+	}
+	return 0;
+}
+
+static int plx_lbp_phases_debug_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, plx_lbp_phases_show, inode->i_private);
+}
+
+static const struct file_operations lbp_phases_ops = {
+	.owner   = THIS_MODULE,
+	.open    = plx_lbp_phases_debug_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release
+};
+
 static irqreturn_t plx_test_db(int irq, void *data)
 {
 	u64 i = (u64)data;
@@ -1023,6 +1080,9 @@ void plx_create_debug_dir(struct plx_device *xdev)
 
 	debugfs_create_file("alm_state", 0444, xdev->dbg_dir, xdev,
 			    &alm_ops);
+
+	debugfs_create_file("lbp_phases", 0444, xdev->dbg_dir, xdev,
+			    &lbp_phases_ops);
 	{
 		static struct file_operations const ops= { .read= plx_read_eeprom0, .open= plx_open, .owner= THIS_MODULE};
 		struct dentry*const d= debugfs_create_file( "eeprom", 0440, xdev->dbg_dir, xdev, &ops);
@@ -28,6 +28,7 @@
 #include <linux/dmaengine.h>
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/workqueue.h>
 #ifdef VCA_IN_KERNEL_BUILD
 #include <linux/vop_bus.h>
 #include <linux/vca_csm_bus.h>
@@ -41,6 +42,7 @@
 #include "plx_intr.h"
 #include "plx_alm.h"
 #include "plx_lbp.h"
+#include "plx_lbp_image.h"
 #include "../common/vca_dev_common.h"
 /**
  * struct plx_device -  VCA device information for each card.
@@ -66,6 +68,8 @@
  * @intr_reg_base: Interrupt register base offset
  * @peer_intr_reg_base: Remote Interrupt register base offset
  * @dma_ch - DMA channel
+ * @dma_blk_ch - DMA channel of the blockio backend, may be dma_ch
+ * @dma_lbp_ch - DMA channel of LBP ramdisk upload, may be dma_ch
  * @vpdev: Virtio over PCIe device on the VOP virtual bus.
  * @scdev: SCIF device on the SCIF virtual bus.
  * @vca_csm_dev: VCA_CSM device on the VCA_CSM bus
@@ -74,6 +78,8 @@
  * @vca_csa_dev: VCA_CSA device on VCA_CSA bus
  * @spinlock: Spinlock for locking critical sections with I/O to A-LUT
  * @a_lut_manager: For managing entries in A-LUT
+ * @alm_reclaim_work: frees A-LUT segments of released mappings once no
+ *	lockless lookup can see them
  * @card_id: Id of a card that this device is on
  * @card_type: Type of VCA card in this device
  * $mmio_lock: mutex for protecting mmio's
@@ -136,6 +142,8 @@ struct plx_device {
 	u32 intr_reg_base;
 	u32 peer_intr_reg_base;
 	struct dma_chan *dma_ch;
+	struct dma_chan *dma_blk_ch;
+	struct dma_chan *dma_lbp_ch;
 	struct vop_device *vpdev;
 	struct vca_csm_device *vca_csm_dev;
 	struct vca_mgr_device *vca_mgr_dev;
@@ -143,6 +151,7 @@ struct plx_device {
 	struct vca_csa_device *vca_csa_dev;
 	spinlock_t alm_lock;
 	struct plx_alm a_lut_manager;
+	struct work_struct alm_reclaim_work;
 
 	bool hs_done;
 	struct vca_irq *hs_irq;
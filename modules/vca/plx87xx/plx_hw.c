@@ -24,6 +24,7 @@
 #include <linux/firmware.h>
 #include <linux/completion.h>
 #include <linux/delay.h>
+#include <linux/rcupdate.h>
 
 
 #include "../common/vca_common.h"
@@ -522,6 +523,57 @@ plx_a_lut_clear(struct plx_device* xdev, u32 offset)
 	}
 }
 
+/*
+ * plx_a_lut_reset - clear A-LUT entries of a manager in use
+ *
+ * @xdev: pointer to plx_device instance
+ *
+ * Lockless lookups are stopped for the reset, they could walk the cleared
+ * entries otherwise.
+ *
+ * RETURNS: nothing
+ */
+void plx_a_lut_reset(struct plx_device *xdev)
+{
+	spin_lock(&xdev->alm_lock);
+	WRITE_ONCE(xdev->a_lut_manager.lockless, false);
+	spin_unlock(&xdev->alm_lock);
+
+	synchronize_rcu();
+
+	spin_lock(&xdev->alm_lock);
+	plx_a_lut_clear(xdev, xdev->a_lut_array_base);
+	if (xdev->a_lut_manager.entries)
+		WRITE_ONCE(xdev->a_lut_manager.lockless, PLX_ALM_LOCKLESS);
+	spin_unlock(&xdev->alm_lock);
+}
+
+/*
+ * plx_alm_reclaim_work - free segments of released A-LUT mappings
+ *
+ * Mappings released before the grace period are reclaimed, the ones
+ * released meanwhile queue the work again.
+ */
+static void plx_alm_reclaim_work(struct work_struct *work)
+{
+	struct plx_device *xdev = container_of(work, struct plx_device,
+					       alm_reclaim_work);
+	u32 retired, generation;
+
+	spin_lock(&xdev->alm_lock);
+	retired = plx_alm_retired(&xdev->a_lut_manager, &generation);
+	spin_unlock(&xdev->alm_lock);
+	if (!retired)
+		return;
+
+	/* Wait for lockless lookups which could still see the mappings */
+	synchronize_rcu();
+
+	spin_lock(&xdev->alm_lock);
+	plx_alm_reclaim(&xdev->a_lut_manager, retired, generation);
+	spin_unlock(&xdev->alm_lock);
+}
+
 /*
  * _plx_configure_a_lut - enable A-LUT
  *
@@ -632,6 +684,7 @@ int plx_hw_init(struct plx_device *xdev, struct pci_dev *pdev)
 	unsigned alut_ports = 0;
 
 	spin_lock_init(&xdev->alm_lock);
+	INIT_WORK(&xdev->alm_reclaim_work, plx_alm_reclaim_work);
 	dev_dbg(&pdev->dev, "Device: %04x\n", xdev->pdev->device);
 	switch(xdev->pdev->device) {
 	case 0x2954:	xdev->port_id = 0; xdev->link_side =0; break;
@@ -722,8 +775,7 @@ int plx_hw_init(struct plx_device *xdev, struct pci_dev *pdev)
 		    xdev->reg_base, xdev->reg_base_peer, xdev->port_id, xdev->a_lut,
 		    xdev->a_lut_peer);
 
-	spin_lock(&xdev->alm_lock);
-
+	/* No users of A-LUT yet, so the manager may allocate memory unlocked */
 	rc = plx_alm_init(&xdev->a_lut_manager, xdev->pdev,
 			alut_segments, xdev->aper.len);
 
@@ -732,8 +784,6 @@ int plx_hw_init(struct plx_device *xdev, struct pci_dev *pdev)
 		xdev->a_lut_manager.segment_size, xdev->a_lut_manager.segments_num,
 		alut_ports);
 
-	spin_unlock(&xdev->alm_lock);
-
 	return rc;
 }
 
@@ -747,6 +797,14 @@ int plx_hw_init(struct plx_device *xdev, struct pci_dev *pdev)
 void
 plx_hw_deinit(struct plx_device *xdev)
 {
+	spin_lock(&xdev->alm_lock);
+	WRITE_ONCE(xdev->a_lut_manager.lockless, false);
+	spin_unlock(&xdev->alm_lock);
+
+	/* Wait for lockless lookups still walking the A-LUT entries */
+	synchronize_rcu();
+	cancel_work_sync(&xdev->alm_reclaim_work);
+
 	spin_lock(&xdev->alm_lock);
 	plx_alm_release(&xdev->a_lut_manager, xdev->pdev);
 	spin_unlock(&xdev->alm_lock);
@@ -756,9 +814,11 @@ plx_hw_deinit(struct plx_device *xdev)
  * plx_add_lut_entry() - add entry to A LUT array
  * @xdev: pointer to plx_device instance
  * @addr: DMA address to access memory
+ * @window: map in the A-LUT pool reserved for windows
  *
  * This function allows other side of NTB to access address @addr by adding
- * a lookup entry to A LUT array.
+ * a lookup entry to A LUT array. An address already translated by a mapping
+ * in use is served without alm_lock.
  *
  * RETURNS: DMA addres to be used by the other side of NTB to access
  * @dma_addr.
@@ -766,7 +826,7 @@ plx_hw_deinit(struct plx_device *xdev)
  * */
 int
 plx_add_a_lut_entry(struct plx_device *xdev, dma_addr_t addr, size_t size,
-			dma_addr_t *addr_out)
+			bool window, dma_addr_t *addr_out)
 {
 	u32 lower_re_map_offset;
 	u32 higher_re_map_offset;
@@ -780,11 +840,19 @@ plx_add_a_lut_entry(struct plx_device *xdev, dma_addr_t addr, size_t size,
 	u32 segments_num;
 	u32 segment_id;
 	u32 last_permission_reg = 0;
+	bool reclaim;
+
+	err = plx_alm_get_fast(&xdev->a_lut_manager, addr, size, &segment_id);
+	if (!err)
+		goto translated;
+	if (err == -ESTALE)
+		plx_del_a_lut_entry(xdev,
+			segment_id * (u64)xdev->a_lut_manager.segment_size);
 
 	spin_lock(&xdev->alm_lock);
 
 	err = plx_alm_add_entry(&xdev->a_lut_manager, xdev->pdev, addr,
-		size, &segment_id, &segments_num);
+		size, window, &segment_id, &segments_num);
 	if (err && err != -EEXIST) {
 		goto failed;
 	}
@@ -826,9 +894,16 @@ plx_add_a_lut_entry(struct plx_device *xdev, dma_addr_t addr, size_t size,
 		 **/
 		if (last_permission_reg)
 			plx_mmio_read(&xdev->mmio, last_permission_reg);
+
+		plx_alm_publish(&xdev->a_lut_manager, segment_id);
 	}
+	/* Cached mappings evicted to keep segments free */
+	reclaim = xdev->a_lut_manager.retired_num;
 	spin_unlock(&xdev->alm_lock);
+	if (reclaim)
+		schedule_work(&xdev->alm_reclaim_work);
 
+translated:
 	*addr_out = segment_id * (u64)xdev->a_lut_manager.segment_size +
 		(addr & translation_mask);
 
@@ -843,6 +918,11 @@ plx_add_a_lut_entry(struct plx_device *xdev, dma_addr_t addr, size_t size,
 
 failed:
 	spin_unlock(&xdev->alm_lock);
+	if (err == -EAGAIN) {
+		dev_dbg(&xdev->pdev->dev, "%s A-LUT segments being reclaimed\n",
+			__func__);
+		schedule_work(&xdev->alm_reclaim_work);
+	}
 	return -ENOMEM;
 }
 
@@ -870,6 +950,9 @@ void plx_del_a_lut_entry(struct plx_device *xdev, dma_addr_t addr)
 			return;
 	}
 
+	if (plx_alm_put_fast(&xdev->a_lut_manager, segment_id))
+		return;
+
 	spin_lock(&xdev->alm_lock);
 
 	plx_alm_del_entry(&xdev->a_lut_manager, xdev->pdev, segment_id,
@@ -891,6 +974,9 @@ void plx_del_a_lut_entry(struct plx_device *xdev, dma_addr_t addr)
 	}
 
 	spin_unlock(&xdev->alm_lock);
+
+	if (segments_num && PLX_ALM_LOCKLESS)
+		schedule_work(&xdev->alm_reclaim_work);
 }
 
 /**
@@ -1064,7 +1150,7 @@ void __iomem * plx_ioremap(struct plx_device *xdev, dma_addr_t pa, size_t len)
 		__func__, (u64) pa, (u32) len);
 
 	if (xdev->a_lut) {
-		if (plx_add_a_lut_entry(xdev, pa, len, &pa_out)) {
+		if (plx_add_a_lut_entry(xdev, pa, len, false, &pa_out)) {
 			dev_err(&xdev->pdev->dev,
 				"cannot map pa in ALUT\n");
 			return NULL;
@@ -1103,6 +1189,58 @@ void plx_iounmap(struct plx_device *xdev, void __iomem *va)
 }
 EXPORT_SYMBOL_GPL(plx_iounmap);
 
+/**
+ * plx_ioremap_window() - reserve a long lived mapping of a large region
+ * @xdev: pointer to plx_device instance
+ * @pa: first address of the region
+ * @len: length of the region
+ *
+ * The window is mapped in a pool of A-LUT segments reserved for windows,
+ * mappings on demand never take them, and stays mapped until
+ * plx_iounmap_window(). A consumer registering a buffer pool once may address
+ * its buffers at fixed offsets from the returned pointer, without any A-LUT
+ * work per request. Mappings on demand inside the window reuse it without
+ * alm_lock. Consumers should fall back to plx_ioremap() when the pool is
+ * too small for the region.
+ *
+ * RETURNS: pointer to mapped memory or NULL.
+ */
+void __iomem *plx_ioremap_window(struct plx_device *xdev, dma_addr_t pa,
+	size_t len)
+{
+	dma_addr_t pa_out;
+
+	if (!xdev->a_lut)
+		return plx_ioremap(xdev, pa, len);
+
+	if (plx_add_a_lut_entry(xdev, pa, len, true, &pa_out)) {
+		dev_dbg(&xdev->pdev->dev,
+			"%s no A-LUT window space for 0x%llx len 0x%llx\n",
+			__func__, (u64)pa, (u64)len);
+		return NULL;
+	}
+
+	dev_dbg(&xdev->pdev->dev, "%s window pa 0x%llx len 0x%llx at 0x%llx\n",
+		__func__, (u64)pa, (u64)len, (u64)pa_out);
+	return xdev->aper.va + pa_out;
+}
+EXPORT_SYMBOL_GPL(plx_ioremap_window);
+
+/**
+ * plx_iounmap_window() - release a window reserved by plx_ioremap_window()
+ * @xdev: pointer to plx_device instance
+ * @va: pointer returned by plx_ioremap_window()
+ * @len: length of the region passed to plx_ioremap_window()
+ *
+ * RETURNS: none.
+ */
+void plx_iounmap_window(struct plx_device *xdev, void __iomem *va,
+	size_t len)
+{
+	plx_iounmap(xdev, va);
+}
+EXPORT_SYMBOL_GPL(plx_iounmap_window);
+
 /**
  * plx_link_width() -returns the width of link(0 - default value, link down, but in case of power button value is undefined)
  * @xdev: pointer to plx_device instance
@@ -248,13 +248,18 @@ void plx_send_intr(struct plx_device *xdev, int doorbell);
 u32 plx_ack_interrupt(struct plx_device *xdev);
 bool plx_dma_filter(struct dma_chan *chan, void *param);
 int plx_add_a_lut_entry(struct plx_device *xdev, dma_addr_t addr_in,
-	size_t size, dma_addr_t* addr_out);
+	size_t size, bool window, dma_addr_t* addr_out);
 void plx_del_a_lut_entry(struct plx_device *xdev, dma_addr_t addr);
 void plx_a_lut_clear(struct plx_device* xdev, u32 offset);
+void plx_a_lut_reset(struct plx_device *xdev);
 void plx_a_lut_peer_enable(struct plx_device *xdev);
 
 void __iomem * plx_ioremap(struct plx_device *xdev, dma_addr_t pa, size_t len);
 void plx_iounmap(struct plx_device *xdev, void __iomem *va);
+void __iomem *plx_ioremap_window(struct plx_device *xdev, dma_addr_t pa,
+	size_t len);
+void plx_iounmap_window(struct plx_device *xdev, void __iomem *va,
+	size_t len);
 
 u32 plx_link_width(struct plx_device *xdev);
 u32 plx_link_status(struct plx_device *xdev);
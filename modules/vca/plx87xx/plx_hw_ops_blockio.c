@@ -50,6 +50,14 @@ static void __plx_free_irq(struct device *dev,
 	return plx_free_irq(xdev, cookie, data);
 }
 
+static int __plx_set_irq_affinity(struct device *dev, int intr_src,
+				  const struct cpumask *mask)
+{
+	struct plx_device *xdev = dev_to_xdev(dev);
+
+	return plx_irq_set_consumer_affinity(xdev, intr_src, mask);
+}
+
 static void __plx_ack_interrupt(struct device *dev, int num)
 {
 }
@@ -93,6 +101,22 @@ static void __plx_iounmap(struct device *dev, void __iomem *va)
 	plx_iounmap(xdev, va);
 }
 
+static void __iomem *__plx_ioremap_window(struct device *dev,
+				   dma_addr_t pa, size_t len)
+{
+	struct plx_device *xdev = dev_to_xdev(dev);
+
+	return plx_ioremap_window(xdev, pa, len);
+}
+
+static void __plx_iounmap_window(struct device *dev, void __iomem *va,
+				   size_t len)
+{
+	struct plx_device *xdev = dev_to_xdev(dev);
+
+	plx_iounmap_window(xdev, va, len);
+}
+
 dma_addr_t __bar_va_to_pa(struct device *dev, void __iomem *va)
 {
 	struct plx_device *xdev = dev_to_xdev(dev);
@@ -175,12 +199,15 @@ static void __stop_network_traffic(struct device *dev)
 struct plx_blockio_hw_ops blockio_hw_ops  = {
 	.request_irq = __plx_request_irq,
 	.free_irq = __plx_free_irq,
+	.set_irq_affinity = __plx_set_irq_affinity,
 	.ack_interrupt = __plx_ack_interrupt,
 	.next_db = __plx_next_db,
 	.get_dp = __plx_get_dp,
 	.send_intr = __plx_send_intr,
 	.ioremap = __plx_ioremap,
 	.iounmap = __plx_iounmap,
+	.ioremap_window = __plx_ioremap_window,
+	.iounmap_window = __plx_iounmap_window,
 	.set_net_dev_state = __plx_set_net_dev_state,
 	.get_card_and_cpu_id =  _plx_vop_get_card_and_cpu_id,
 	.is_link_side = __is_link_side,
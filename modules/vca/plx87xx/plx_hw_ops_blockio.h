@@ -23,6 +23,7 @@
 #define _PLX_HWOPS_BLOCKIO_H_
 
 #include <linux/irqreturn.h>
+#include <linux/cpumask.h>
 
 struct plx_blockio_hw_ops {
         int (*next_db)(struct device *dev);
@@ -31,12 +32,18 @@ struct plx_blockio_hw_ops {
                         const char *name, void *data, int intr_src);
         void (*free_irq)(struct device *dev,
                         struct vca_irq *cookie, void *data);
+	int (*set_irq_affinity)(struct device *dev, int intr_src,
+			const struct cpumask *mask);
         void (*ack_interrupt)(struct device *dev, int num);
         void * (*get_dp)(struct device *dev);
         void (*send_intr)(struct device *dev, int db);
         void __iomem * (*ioremap)(struct device *dev,
                         dma_addr_t pa, size_t len);
         void (*iounmap)(struct device *dev, void __iomem *va);
+	void __iomem * (*ioremap_window)(struct device *dev,
+			dma_addr_t pa, size_t len);
+	void (*iounmap_window)(struct device *dev, void __iomem *va,
+			size_t len);
         void (*set_net_dev_state)(struct device *dev, bool state);
         void (*get_card_and_cpu_id)(struct device *dev,
                 u8 *out_card_id, u8 *out_cpu_id);
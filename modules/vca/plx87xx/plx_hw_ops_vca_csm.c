@@ -279,6 +279,63 @@ static enum vca_lbp_retval _plx_lbp_boot_ramdisk(struct vca_csm_device *cdev,
 	return plx_lbp_boot_ramdisk(xdev, img, img_size);
 }
 
+static enum vca_lbp_retval _plx_lbp_register_image(struct vca_csm_device *cdev,
+ struct file *owner, const char *name, void __user * img, size_t img_size,
+ u32 *id)
+{
+	struct plx_device *xdev = vca_csmdev_to_xdev(cdev);
+
+	return plx_lbp_image_register(xdev, owner, name, img, img_size, id);
+}
+
+static enum vca_lbp_retval _plx_lbp_unregister_image(struct vca_csm_device *cdev,
+ struct file *owner, u32 id)
+{
+	return plx_lbp_image_unregister(owner, id);
+}
+
+static void _plx_lbp_release_images(struct vca_csm_device *cdev,
+ struct file *owner)
+{
+	plx_lbp_image_release_owner(owner);
+}
+
+static enum vca_lbp_retval _plx_lbp_boot_ramdisk_image(
+ struct vca_csm_device *cdev, u32 id)
+{
+	struct plx_device *xdev = vca_csmdev_to_xdev(cdev);
+	enum vca_lbp_retval ret;
+
+	ret = set_mac_addr(xdev);
+	if (ret != LBP_STATE_OK) {
+		return ret;
+	}
+
+	return plx_lbp_boot_ramdisk_image(xdev, id);
+}
+
+static enum vca_lbp_retval _plx_lbp_boot_ramdisk_stream(
+ struct vca_csm_device *cdev, int fd, size_t img_size)
+{
+	struct plx_device *xdev = vca_csmdev_to_xdev(cdev);
+	enum vca_lbp_retval ret;
+
+	ret = set_mac_addr(xdev);
+	if (ret != LBP_STATE_OK) {
+		return ret;
+	}
+
+	return plx_lbp_boot_ramdisk_stream(xdev, fd, img_size);
+}
+
+static enum vca_lbp_retval _plx_lbp_get_phase_times(
+ struct vca_csm_device *cdev, struct vca_csm_ioctl_phase_times *times)
+{
+	struct plx_device *xdev = vca_csmdev_to_xdev(cdev);
+
+	return plx_lbp_get_phase_times(xdev, times);
+}
+
 static enum vca_lbp_retval _plx_lbp_boot_blkdisk(struct vca_csm_device *cdev)
 {
 	struct plx_device *xdev = vca_csmdev_to_xdev(cdev);
@@ -549,6 +606,12 @@ struct vca_csm_hw_ops vca_csm_plx_hw_ops = {
 	.get_cpu_num = _plx_get_cpu_num,
 	.get_meminfo = _plx_get_meminfo,
 	.lbp_boot_ramdisk = _plx_lbp_boot_ramdisk,
+	.lbp_register_image = _plx_lbp_register_image,
+	.lbp_unregister_image = _plx_lbp_unregister_image,
+	.lbp_release_images = _plx_lbp_release_images,
+	.lbp_boot_ramdisk_image = _plx_lbp_boot_ramdisk_image,
+	.lbp_boot_ramdisk_stream = _plx_lbp_boot_ramdisk_stream,
+	.lbp_get_phase_times = _plx_lbp_get_phase_times,
 	.lbp_boot_blkdisk = _plx_lbp_boot_blkdisk,
 	.lbp_boot_from_usb = _plx_lbp_boot_from_usb,
 	.lbp_handshake = _plx_lbp_handshake,
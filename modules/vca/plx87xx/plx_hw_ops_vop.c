@@ -49,6 +49,14 @@ static void __plx_free_irq(struct vop_device *vpdev,
 	return plx_free_irq(xdev, cookie, data);
 }
 
+static int __plx_set_irq_affinity(struct vop_device *vpdev, int intr_src,
+				  const struct cpumask *mask)
+{
+	struct plx_device *xdev = vpdev_to_xdev(vpdev);
+
+	return plx_irq_set_consumer_affinity(xdev, intr_src, mask);
+}
+
 static void __plx_ack_interrupt(struct vop_device *vpdev, int num)
 {
 }
@@ -92,6 +100,22 @@ static void __plx_iounmap(struct vop_device *vpdev, void __iomem *va)
 	plx_iounmap(xdev, va);
 }
 
+static void __iomem *__plx_ioremap_window(struct vop_device *vpdev,
+				   dma_addr_t pa, size_t len)
+{
+	struct plx_device *xdev = vpdev_to_xdev(vpdev);
+
+	return plx_ioremap_window(xdev, pa, len);
+}
+
+static void __plx_iounmap_window(struct vop_device *vpdev, void __iomem *va,
+				   size_t len)
+{
+	struct plx_device *xdev = vpdev_to_xdev(vpdev);
+
+	plx_iounmap_window(xdev, va, len);
+}
+
 static void __plx_set_net_dev_state(struct vop_device *vpdev, bool state)
 {
 	struct plx_device *xdev = vpdev_to_xdev(vpdev);
@@ -118,12 +142,15 @@ static bool __is_link_side(struct vop_device *vpdev)
 struct vop_hw_ops vop_hw_ops = {
 	.request_irq = __plx_request_irq,
 	.free_irq = __plx_free_irq,
+	.set_irq_affinity = __plx_set_irq_affinity,
 	.ack_interrupt = __plx_ack_interrupt,
 	.next_db = __plx_next_db,
 	.get_dp = __plx_get_dp,
 	.send_intr = __plx_send_intr,
 	.ioremap = __plx_ioremap,
 	.iounmap = __plx_iounmap,
+	.ioremap_window = __plx_ioremap_window,
+	.iounmap_window = __plx_iounmap_window,
 	.set_net_dev_state = __plx_set_net_dev_state,
 	.get_card_and_cpu_id =  _plx_vop_get_card_and_cpu_id,
 	.is_link_side = __is_link_side
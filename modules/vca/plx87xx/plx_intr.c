@@ -20,48 +20,106 @@
  */
 #include <linux/pci.h>
 #include <linux/interrupt.h>
+#include <linux/module.h>
+#include <linux/rculist.h>
+#include <linux/cpu.h>
+#include <linux/topology.h>
+#include <linux/version.h>
 
 #include "plx_device.h"
 #include "plx_hw.h"
 
-static irqreturn_t plx_thread_fn(int irq, void *dev)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 9, 0)
+#	define PLX_INTR_CPU_NOTIF
+#endif
+
+static int msix_vectors;
+module_param(msix_vectors, int, 0444);
+MODULE_PARM_DESC(msix_vectors, "Number of MSI-X vectors to spread doorbells "
+	"over, below 2 uses a single vector");
+
+static const char * const plx_irq_affinity_policies[] = {
+	[PLX_IRQ_AFFINITY_CONSUMER] = "consumer",
+	[PLX_IRQ_AFFINITY_SIBLINGS] = "siblings",
+	[PLX_IRQ_AFFINITY_NODE] = "node",
+};
+
+/*
+ * plx_offset_vector - vector serving an interrupt offset
+ *
+ * @xdev: pointer to the plx_device instance
+ * @offset: interrupt offset
+ */
+static struct plx_intr_vector *
+plx_offset_vector(struct plx_device *xdev, int offset)
 {
-	struct plx_device *xdev = dev;
-	struct plx_intr_info *intr_info = xdev->intr_info;
 	struct plx_irq_info *irq_info = &xdev->irq_info;
+	int idx = (offset - xdev->intr_info->intr_start_idx) /
+		irq_info->db_per_vector;
+
+	return &irq_info->vectors[clamp(idx, 0, irq_info->num_vectors - 1)];
+}
+
+static irqreturn_t plx_thread_fn(int irq, void *data)
+{
+	struct plx_intr_vector *vec = data;
+	struct plx_irq_info *irq_info = &vec->xdev->irq_info;
 	struct plx_intr_cb *intr_cb;
-	struct pci_dev *pdev = container_of(&xdev->pdev->dev,
-					    struct pci_dev, dev);
+	unsigned long pending = xchg(&vec->mask, 0);
 	int i;
 
-	spin_lock(&irq_info->plx_thread_lock);
-	for (i = intr_info->intr_start_idx;
-			i < intr_info->intr_len; i++)
-		if (test_and_clear_bit(i, &irq_info->mask)) {
-			list_for_each_entry(intr_cb, &irq_info->cb_list[i],
-					    list)
-				if (intr_cb->thread_fn)
-					intr_cb->thread_fn(pdev->irq,
-							 intr_cb->data);
-		}
-	spin_unlock(&irq_info->plx_thread_lock);
+	rcu_read_lock();
+	for_each_set_bit(i, &pending, PLX_NUM_OFFSETS)
+		list_for_each_entry_rcu(intr_cb, &irq_info->cb_list[i], list)
+			if (intr_cb->thread_fn)
+				intr_cb->thread_fn(vec->irq, intr_cb->data);
+	rcu_read_unlock();
 	return IRQ_HANDLED;
 }
 
+/*
+ * plx_intr_demux - call handlers of doorbells served by a vector
+ *
+ * @vec: the vector
+ * @mask: doorbells of @vec which fired
+ *
+ * Callback lists are walked under RCU, so dispatch takes no lock.
+ */
+static void plx_intr_demux(struct plx_intr_vector *vec, u32 mask)
+{
+	struct plx_irq_info *irq_info = &vec->xdev->irq_info;
+	struct plx_intr_cb *intr_cb;
+	unsigned long pending = mask;
+	int i;
+
+	rcu_read_lock();
+	for_each_set_bit(i, &pending, PLX_NUM_OFFSETS) {
+		list_for_each_entry_rcu(intr_cb, &irq_info->cb_list[i], list)
+			if (intr_cb->handler)
+				intr_cb->handler(vec->irq, intr_cb->data);
+		set_bit(i, &vec->mask);
+	}
+	rcu_read_unlock();
+}
+
 /**
  * plx_interrupt - Generic interrupt handler for
- * MSI and INTx based interrupts.
+ * MSI-X, MSI and INTx based interrupts.
+ *
+ * Doorbells of the vector are handled here. Doorbells of other vectors
+ * found in the acked mask are passed to them, in case the doorbell is
+ * not routed to its own vector.
  */
-static irqreturn_t plx_interrupt(int irq, void *dev)
+static irqreturn_t plx_interrupt(int irq, void *data)
 {
-	struct plx_device *xdev = dev;
-	struct plx_intr_info *intr_info = xdev->intr_info;
+	struct plx_intr_vector *vec = data;
+	struct plx_device *xdev = vec->xdev;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 16, 0)
 	struct plx_irq_info *irq_info = &xdev->irq_info;
-	struct plx_intr_cb *intr_cb;
-	struct pci_dev *pdev = container_of(&xdev->pdev->dev,
-					    struct pci_dev, dev);
-	u32 mask;
+	struct plx_intr_vector *other;
 	int i;
+#endif
+	u32 mask;
 
 	mask = plx_ack_interrupt(xdev);
 
@@ -75,27 +133,109 @@ static irqreturn_t plx_interrupt(int irq, void *dev)
 		return IRQ_HANDLED;
 	}
 
-	spin_lock(&irq_info->plx_intr_lock);
-	for (i = intr_info->intr_start_idx;
-			i < intr_info->intr_len; i++)
-		if (mask & BIT(i)) {
-
-			dev_dbg(&xdev->pdev->dev, "%s bit %d in mask set\n", __func__, i);
-			list_for_each_entry(intr_cb, &irq_info->cb_list[i],
-					    list)
-				if (intr_cb->handler) {
-					dev_dbg(&xdev->pdev->dev, "%s calling cb handler\n",
-						__func__);
-					intr_cb->handler(pdev->irq,
-							 intr_cb->data);
-				} else {
-					dev_dbg(&xdev->pdev->dev, "%s no cb handler\n", __func__);
-				}
+	if (mask & vec->db_mask)
+		plx_intr_demux(vec, mask & vec->db_mask);
 
-			set_bit(i, &irq_info->mask);
-		}
-	spin_unlock(&irq_info->plx_intr_lock);
-	return IRQ_WAKE_THREAD;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 16, 0)
+	for (i = 0; (mask & ~vec->db_mask) && i < irq_info->num_vectors; i++) {
+		other = &irq_info->vectors[i];
+		if (other == vec || !(mask & other->db_mask))
+			continue;
+		plx_intr_demux(other, mask & other->db_mask);
+		irq_wake_thread(other->irq, other);
+	}
+#endif
+
+	return (mask & vec->db_mask) ? IRQ_WAKE_THREAD : IRQ_HANDLED;
+}
+
+static const struct cpumask *plx_sibling_mask(int cpu)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 1, 0)
+	return topology_sibling_cpumask(cpu);
+#else
+	return topology_thread_cpumask(cpu);
+#endif
+}
+
+/*
+ * plx_irq_node_spread - CPU of the node owning the PCI bus for a vector
+ *
+ * @xdev: pointer to the plx_device instance
+ * @mask: mask to fill
+ * @idx: index of the vector
+ * @dead_cpu: CPU going offline, or -1
+ *
+ * A single vector gets all CPUs of the node, more vectors are spread one
+ * per CPU.
+ */
+static void plx_irq_node_spread(struct plx_device *xdev, struct cpumask *mask,
+				int idx, int dead_cpu)
+{
+	/* Same node assumption as in plx_irq_set_affinity_node_hint() */
+	int node = (xdev->pdev->bus->number > 0x7f) ? 1 : 0;
+	int cpu, n;
+
+	cpumask_and(mask, cpumask_of_node(node), cpu_online_mask);
+	if (dead_cpu >= 0)
+		cpumask_clear_cpu(dead_cpu, mask);
+	if (cpumask_empty(mask)) {
+		cpumask_copy(mask, cpu_online_mask);
+		if (dead_cpu >= 0)
+			cpumask_clear_cpu(dead_cpu, mask);
+	}
+	if (xdev->irq_info.num_vectors < 2 || cpumask_empty(mask))
+		return;
+
+	n = idx % cpumask_weight(mask);
+	for_each_cpu(cpu, mask)
+		if (!n--)
+			break;
+	cpumask_clear(mask);
+	cpumask_set_cpu(cpu, mask);
+}
+
+/*
+ * plx_irq_apply_affinity - steer vectors by the affinity policy
+ *
+ * @xdev: pointer to the plx_device instance
+ * @dead_cpu: CPU going offline to be left out, or -1
+ *
+ * A vector follows the CPUs declared by consumers of its doorbells, so its
+ * threaded handler runs next to the threads it wakes up. Vectors with no
+ * declared consumer fall back to CPUs of the node. cb_mutex needs to be held.
+ */
+static void plx_irq_apply_affinity(struct plx_device *xdev, int dead_cpu)
+{
+	struct plx_irq_info *irq_info = &xdev->irq_info;
+	struct plx_intr_vector *vec;
+	unsigned long db_mask;
+	int i, db, cpu, rc;
+
+	for (i = 0; i < irq_info->num_vectors; i++) {
+		vec = &irq_info->vectors[i];
+		db_mask = vec->db_mask;
+		cpumask_clear(vec->affinity);
+		if (irq_info->affinity_policy != PLX_IRQ_AFFINITY_NODE)
+			for_each_set_bit(db, &db_mask, PLX_NUM_OFFSETS)
+				cpumask_or(vec->affinity, vec->affinity,
+					   irq_info->consumer_mask[db]);
+		/* Siblings only add CPUs already covered by this walk */
+		if (irq_info->affinity_policy == PLX_IRQ_AFFINITY_SIBLINGS)
+			for_each_cpu(cpu, vec->affinity)
+				cpumask_or(vec->affinity, vec->affinity,
+					   plx_sibling_mask(cpu));
+		cpumask_and(vec->affinity, vec->affinity, cpu_online_mask);
+		if (dead_cpu >= 0)
+			cpumask_clear_cpu(dead_cpu, vec->affinity);
+		if (cpumask_empty(vec->affinity))
+			plx_irq_node_spread(xdev, vec->affinity, i, dead_cpu);
+
+		rc = irq_set_affinity_hint(vec->irq, vec->affinity);
+		if (rc)
+			dev_warn(&xdev->pdev->dev, "%s affinity error: %d\n",
+				 vec->name, rc);
+	}
 }
 
 /* Return the interrupt offset from the index. Index is 0 based. */
@@ -126,7 +266,6 @@ static int plx_register_intr_callback(struct plx_device *xdev,
 			   void *data)
 {
 	struct plx_intr_cb *intr_cb, *existing_cb;
-	unsigned long flags;
 	int rc;
 	int name_len;
 
@@ -154,8 +293,7 @@ static int plx_register_intr_callback(struct plx_device *xdev,
 		}
 	}
 
-	spin_lock(&xdev->irq_info.plx_thread_lock);
-	spin_lock_irqsave(&xdev->irq_info.plx_intr_lock, flags);
+	mutex_lock(&xdev->irq_info.cb_mutex);
 	if (!list_empty(&xdev->irq_info.cb_list[idx])) {
 		dev_warn(&xdev->pdev->dev,"Interrupt %d shared\n", idx);
 		if(name)
@@ -170,9 +308,8 @@ static int plx_register_intr_callback(struct plx_device *xdev,
 		}
 
 	}
-	list_add_tail(&intr_cb->list, &xdev->irq_info.cb_list[idx]);
-	spin_unlock_irqrestore(&xdev->irq_info.plx_intr_lock, flags);
-	spin_unlock(&xdev->irq_info.plx_thread_lock);
+	list_add_tail_rcu(&intr_cb->list, &xdev->irq_info.cb_list[idx]);
+	mutex_unlock(&xdev->irq_info.cb_mutex);
 
 	return intr_cb->cb_id; // ignore KW: "Possible memory leak. Dynamic memory stored in 'intr_cb' allocated through function 'kmalloc' can be lost". The allocated 'intr_cb' structure has been stored in kernel list with 'list_add_tail()' and is accessible with 'list_entry()' macro. It is freed later by 'plx_unregister_intr_callback()'
 ida_fail:
@@ -186,61 +323,125 @@ ida_fail:
  *
  * @xdev: pointer to the plx_device instance
  * @idx: The callback structure id to be unregistered.
+ * Waits until the callback is not running anywhere, so it may sleep.
  * Return the source id that was unregistered or PLX_NUM_OFFSETS if no
  * such callback handler was found.
  */
 static u8 plx_unregister_intr_callback(struct plx_device *xdev, u32 idx)
 {
-	struct list_head *pos, *tmp;
 	struct plx_intr_cb *intr_cb;
-	unsigned long flags;
 	int i;
 
-	spin_lock(&xdev->irq_info.plx_thread_lock);
-	spin_lock_irqsave(&xdev->irq_info.plx_intr_lock, flags);
+	mutex_lock(&xdev->irq_info.cb_mutex);
 	for (i = 0;  i < PLX_NUM_OFFSETS; i++) {
-		list_for_each_safe(pos, tmp, &xdev->irq_info.cb_list[i]) {
-			intr_cb = list_entry(pos, struct plx_intr_cb, list);
+		list_for_each_entry(intr_cb, &xdev->irq_info.cb_list[i], list) {
 			if (intr_cb->cb_id == idx) {
-				list_del(pos);
+				list_del_rcu(&intr_cb->list);
+				/* Last consumer of the doorbell is gone */
+				if (list_empty(&xdev->irq_info.cb_list[i])) {
+					cpumask_clear(
+						xdev->irq_info.consumer_mask[i]);
+					plx_irq_apply_affinity(xdev, -1);
+				}
+				mutex_unlock(&xdev->irq_info.cb_mutex);
+
+				/* Wait for handlers still using the callback */
+				synchronize_rcu();
 				ida_simple_remove(&xdev->irq_info.cb_ida,
 						  intr_cb->cb_id);
 				if (intr_cb->name)
 					kfree(intr_cb->name);
 				kfree(intr_cb);
-				spin_unlock_irqrestore(
-					&xdev->irq_info.plx_intr_lock, flags);
-				spin_unlock(&xdev->irq_info.plx_thread_lock);
 				return i;
 			}
 		}
 	}
-	spin_unlock_irqrestore(&xdev->irq_info.plx_intr_lock, flags);
-	spin_unlock(&xdev->irq_info.plx_thread_lock);
+	mutex_unlock(&xdev->irq_info.cb_mutex);
 	return PLX_NUM_OFFSETS;
 }
 
+static void plx_free_affinity_masks(struct plx_irq_info *irq_info)
+{
+	int i;
+
+	for (i = 0; i < PLX_NUM_OFFSETS; i++)
+		free_cpumask_var(irq_info->consumer_mask[i]);
+	for (i = 0; i < irq_info->num_vectors; i++)
+		free_cpumask_var(irq_info->vectors[i].affinity);
+}
+
+static int plx_alloc_affinity_masks(struct plx_irq_info *irq_info)
+{
+	int i, j;
+
+	for (i = 0; i < PLX_NUM_OFFSETS; i++)
+		if (!zalloc_cpumask_var(&irq_info->consumer_mask[i],
+					GFP_KERNEL))
+			goto err_consumer;
+	for (j = 0; j < irq_info->num_vectors; j++)
+		if (!zalloc_cpumask_var(&irq_info->vectors[j].affinity,
+					GFP_KERNEL))
+			goto err_vector;
+	return 0;
+err_vector:
+	while (j--)
+		free_cpumask_var(irq_info->vectors[j].affinity);
+err_consumer:
+	while (i--)
+		free_cpumask_var(irq_info->consumer_mask[i]);
+	return -ENOMEM;
+}
+
 /**
  * plx_setup_callbacks - Initialize data structures needed
  * to handle callbacks.
  *
  * @xdev: pointer to plx_device instance
+ * @num_vectors: number of interrupt vectors to spread doorbells over
  */
-static int plx_setup_callbacks(struct plx_device *xdev)
+static int plx_setup_callbacks(struct plx_device *xdev, int num_vectors)
 {
+	struct plx_irq_info *irq_info = &xdev->irq_info;
+	struct plx_intr_vector *vec;
 	int i;
 
-	xdev->irq_info.cb_list = kmalloc_array(PLX_NUM_OFFSETS,
-					       sizeof(*xdev->irq_info.cb_list),
+	irq_info->cb_list = kmalloc_array(PLX_NUM_OFFSETS,
+					       sizeof(*irq_info->cb_list),
 					       GFP_KERNEL);
-	if (!xdev->irq_info.cb_list)
+	irq_info->vectors = kcalloc(num_vectors, sizeof(*irq_info->vectors),
+				    GFP_KERNEL);
+	if (!irq_info->cb_list || !irq_info->vectors) {
+		kfree(irq_info->cb_list);
+		kfree(irq_info->vectors);
+		irq_info->cb_list = NULL;
+		irq_info->vectors = NULL;
 		return -ENOMEM;
+	}
+
+	irq_info->num_vectors = num_vectors;
+	irq_info->db_per_vector = DIV_ROUND_UP(xdev->intr_info->intr_len,
+					       num_vectors);
+	if (plx_alloc_affinity_masks(irq_info)) {
+		kfree(irq_info->cb_list);
+		kfree(irq_info->vectors);
+		irq_info->cb_list = NULL;
+		irq_info->vectors = NULL;
+		irq_info->num_vectors = 0;
+		return -ENOMEM;
+	}
+	for (i = 0; i < num_vectors; i++) {
+		vec = &irq_info->vectors[i];
+		vec->xdev = xdev;
+		snprintf(vec->name, sizeof(vec->name), "plx-db%d", i);
+	}
 
 	for (i = 0; i < PLX_NUM_OFFSETS; i++)
-		INIT_LIST_HEAD(&xdev->irq_info.cb_list[i]);
-	ida_init(&xdev->irq_info.cb_ida);
-	spin_lock_init(&xdev->irq_info.plx_intr_lock);
-	spin_lock_init(&xdev->irq_info.plx_thread_lock);
+		INIT_LIST_HEAD(&irq_info->cb_list[i]);
+	for (i = xdev->intr_info->intr_start_idx;
+			i < xdev->intr_info->intr_len; i++)
+		plx_offset_vector(xdev, i)->db_mask |= BIT(i);
+	mutex_init(&irq_info->cb_mutex);
+	ida_init(&irq_info->cb_ida);
 	return 0;
 }
 
@@ -252,29 +453,30 @@ static int plx_setup_callbacks(struct plx_device *xdev)
  */
 static void plx_release_callbacks(struct plx_device *xdev)
 {
-	unsigned long flags;
 	struct list_head *pos, *tmp;
 	struct plx_intr_cb *intr_cb;
 	int i;
 
-	spin_lock(&xdev->irq_info.plx_thread_lock);
-	spin_lock_irqsave(&xdev->irq_info.plx_intr_lock, flags);
+	/* Interrupts are freed already, no reader is left */
+	mutex_lock(&xdev->irq_info.cb_mutex);
 	for (i = 0; i < PLX_NUM_OFFSETS; i++) {
-		if (list_empty(&xdev->irq_info.cb_list[i]))
-			break;
-
 		list_for_each_safe(pos, tmp, &xdev->irq_info.cb_list[i]) {
 			intr_cb = list_entry(pos, struct plx_intr_cb, list);
 			list_del(pos);
 			ida_simple_remove(&xdev->irq_info.cb_ida,
 					  intr_cb->cb_id);
+			kfree(intr_cb->name);
 			kfree(intr_cb);
 		}
 	}
-	spin_unlock_irqrestore(&xdev->irq_info.plx_intr_lock, flags);
-	spin_unlock(&xdev->irq_info.plx_thread_lock);
+	mutex_unlock(&xdev->irq_info.cb_mutex);
 	ida_destroy(&xdev->irq_info.cb_ida);
+	plx_free_affinity_masks(&xdev->irq_info);
 	kfree(xdev->irq_info.cb_list);
+	kfree(xdev->irq_info.vectors);
+	xdev->irq_info.cb_list = NULL;
+	xdev->irq_info.vectors = NULL;
+	xdev->irq_info.num_vectors = 0;
 }
 
 /**
@@ -302,14 +504,15 @@ static int plx_setup_msi(struct plx_device *xdev, struct pci_dev *pdev)
 		goto err_nomem1;
 	}
 
-	rc = plx_setup_callbacks(xdev);
+	rc = plx_setup_callbacks(xdev, 1);
 	if (rc) {
 		dev_err(&pdev->dev, "Error setting up callbacks\n");
 		goto err_nomem2;
 	}
 
+	xdev->irq_info.vectors[0].irq = pdev->irq;
 	rc = request_threaded_irq(pdev->irq, plx_interrupt, plx_thread_fn,
-				  0, "plx-msi", xdev);
+				  0, "plx-msi", &xdev->irq_info.vectors[0]);
 	if (rc) {
 		dev_err(&pdev->dev, "Error allocating MSI interrupt\n");
 		goto err_irq_req_fail;
@@ -326,6 +529,90 @@ err_nomem1:
 	return rc;
 }
 
+/**
+ * plx_setup_msix - Initializes MSI-X interrupts, doorbells are split
+ * in groups of consecutive doorbells, each served by its own vector.
+ *
+ * @xdev: pointer to plx_device instance
+ * @pdev: PCI device structure
+ *
+ * RETURNS: An appropriate -ERRNO error value on error, or zero for success.
+ */
+static int plx_setup_msix(struct plx_device *xdev, struct pci_dev *pdev)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 16, 0)
+	struct plx_irq_info *irq_info = &xdev->irq_info;
+	struct plx_intr_vector *vec;
+	int num_vectors = min_t(int, msix_vectors, xdev->intr_info->intr_len);
+	int rc, i;
+
+	if (num_vectors < 2)
+		return -EINVAL;
+
+	irq_info->msix_entries = kcalloc(num_vectors,
+		sizeof(*irq_info->msix_entries), GFP_KERNEL);
+	if (!irq_info->msix_entries)
+		return -ENOMEM;
+
+	for (i = 0; i < num_vectors; i++)
+		irq_info->msix_entries[i].entry = i;
+
+	rc = pci_enable_msix_range(pdev, irq_info->msix_entries, 2,
+				   num_vectors);
+	if (rc < 0) {
+		dev_dbg(&pdev->dev, "Error enabling MSI-X. rc = %d\n", rc);
+		goto err_nomem1;
+	}
+	num_vectors = rc;
+
+	irq_info->plx_msi_map = kcalloc(num_vectors, sizeof(u32), GFP_KERNEL);
+	if (!irq_info->plx_msi_map) {
+		rc = -ENOMEM;
+		goto err_nomem2;
+	}
+
+	rc = plx_setup_callbacks(xdev, num_vectors);
+	if (rc) {
+		dev_err(&pdev->dev, "Error setting up callbacks\n");
+		goto err_nomem3;
+	}
+
+	for (i = 0; i < num_vectors; i++) {
+		vec = &irq_info->vectors[i];
+		vec->irq = irq_info->msix_entries[i].vector;
+		rc = request_threaded_irq(vec->irq, plx_interrupt,
+					  plx_thread_fn, 0, vec->name, vec);
+		if (rc) {
+			dev_err(&pdev->dev, "Error allocating MSI-X interrupt %d\n",
+				i);
+			goto err_irq_req_fail;
+		}
+	}
+
+	dev_info(&pdev->dev, "MSI-X irq setup, %d vectors, %d doorbells each\n",
+		 num_vectors, irq_info->db_per_vector);
+	return 0;
+err_irq_req_fail:
+	while (i--) {
+		vec = &irq_info->vectors[i];
+		free_irq(vec->irq, vec);
+	}
+	plx_release_callbacks(xdev);
+err_nomem3:
+	kfree(irq_info->plx_msi_map);
+	irq_info->plx_msi_map = NULL;
+err_nomem2:
+	pci_disable_msix(pdev);
+err_nomem1:
+	kfree(irq_info->msix_entries);
+	irq_info->msix_entries = NULL;
+	return rc;
+#else
+	/* Doorbells routed to other vector can not be passed to it */
+	return -EINVAL;
+#endif
+}
+
 /**
  * plx_setup_intx - Initializes legacy interrupts.
  *
@@ -340,24 +627,27 @@ static int plx_setup_intx(struct plx_device *xdev, struct pci_dev *pdev)
 
 	/* Enable intx */
 	pci_intx(pdev, 1);
-	rc = plx_setup_callbacks(xdev);
+	rc = plx_setup_callbacks(xdev, 1);
 	if (rc) {
 		dev_err(&pdev->dev, "Error setting up callbacks\n");
 		goto err_nomem;
 	}
 
+	xdev->irq_info.vectors[0].irq = pdev->irq;
 	rc = request_threaded_irq(pdev->irq, plx_interrupt, plx_thread_fn,
-				  IRQF_SHARED, "plx-intx", xdev);
+				  IRQF_SHARED, "plx-intx", &xdev->irq_info.vectors[0]);
 	if (rc)
 		goto err;
 
 	rc = plx_irq_set_affinity_node_hint(pdev);
 
         if (rc)
-            goto err;
+            goto err_irq;
 
 	dev_dbg(&pdev->dev, "intx irq setup\n");
 	return 0;
+err_irq:
+	free_irq(pdev->irq, &xdev->irq_info.vectors[0]);
 err:
 	plx_release_callbacks(xdev);
 err_nomem:
@@ -432,7 +722,7 @@ plx_request_threaded_irq(struct plx_device *xdev,
 	cb_id = plx_register_intr_callback(xdev, offset, handler,
 					     thread_fn, name, data);
 	if (cb_id >= 0) {
-		entry = 0;
+		entry = plx_offset_vector(xdev, offset) - xdev->irq_info.vectors;
 		if (pci_dev_msi_enabled(pdev))
 			xdev->irq_info.plx_msi_map[entry] |= (1 << offset);
 		cookie = entry | cb_id << COOKIE_ID_SHIFT;
@@ -451,6 +741,10 @@ plx_request_threaded_irq(struct plx_device *xdev,
  * @data: private data specified by the calling function during the
  * plx_request_threaded_irq
  *
+ * Waits for handlers still running the callback, must not be called from
+ * atomic context. Callers free @data right after, so the wait can not be
+ * deferred to an RCU callback.
+ *
  * returns: none.
  */
 void plx_free_irq(struct plx_device *xdev,
@@ -459,24 +753,206 @@ void plx_free_irq(struct plx_device *xdev,
 	u32 offset;
 	u32 entry;
 	u8 src_id;
-	unsigned int irq;
 	struct pci_dev *pdev = container_of(&xdev->pdev->dev,
 		struct pci_dev, dev);
 
+	might_sleep();
 	entry = GET_ENTRY((unsigned long)cookie);
 	offset = GET_OFFSET((unsigned long)cookie);
-	irq = pdev->irq;
 	src_id = plx_unregister_intr_callback(xdev, offset);
 	if (src_id >= PLX_NUM_OFFSETS) {
 		dev_warn(&xdev->pdev->dev, "Error unregistering callback\n");
 		return;
 	}
-	if (pci_dev_msi_enabled(pdev))
+	if (pci_dev_msi_enabled(pdev) && xdev->irq_info.plx_msi_map)
 		xdev->irq_info.plx_msi_map[entry] &= ~(BIT(src_id));
 	dev_dbg(&xdev->pdev->dev, "callback %d unregistered for src: %d\n",
 		offset, src_id);
 }
 
+/**
+ * plx_irq_set_consumer_affinity - declare CPUs consuming a doorbell
+ *
+ * @xdev: pointer to plx_device instance
+ * @intr_src: doorbell the consumer requested the irq on
+ * @mask: CPUs running threads woken by the doorbell, NULL to clear
+ *
+ * The vector serving the doorbell is steered to @mask, or to its core
+ * siblings, as selected by the irq_affinity_policy sysfs attribute.
+ * plx_next_db() hands doorbells out round-robin, so one may serve several
+ * consumers, declarations for a shared doorbell add up then. The
+ * declaration is dropped with the last callback of the doorbell.
+ *
+ * RETURNS: -EINVAL for a wrong doorbell, or zero for success.
+ */
+int plx_irq_set_consumer_affinity(struct plx_device *xdev, int intr_src,
+				  const struct cpumask *mask)
+{
+	struct plx_irq_info *irq_info = &xdev->irq_info;
+	u16 offset = plx_map_src_to_offset(xdev, intr_src);
+
+	if (offset >= PLX_NUM_OFFSETS)
+		return -EINVAL;
+
+	mutex_lock(&irq_info->cb_mutex);
+	if (mask && !list_is_singular(&irq_info->cb_list[offset]))
+		cpumask_or(irq_info->consumer_mask[offset],
+			   irq_info->consumer_mask[offset], mask);
+	else if (mask)
+		cpumask_copy(irq_info->consumer_mask[offset], mask);
+	else
+		cpumask_clear(irq_info->consumer_mask[offset]);
+	plx_irq_apply_affinity(xdev, -1);
+	mutex_unlock(&irq_info->cb_mutex);
+	return 0;
+}
+
+static ssize_t
+irq_affinity_policy_show(struct device *dev, struct device_attribute *attr,
+			 char *buf)
+{
+	struct plx_device *xdev = dev_get_drvdata(dev);
+	ssize_t len = 0;
+	int i;
+
+	if (!xdev)
+		return -EINVAL;
+
+	for (i = 0; i < PLX_IRQ_AFFINITY_POLICIES; i++)
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+			i == xdev->irq_info.affinity_policy ? "[%s] " : "%s ",
+			plx_irq_affinity_policies[i]);
+	buf[len - 1] = '\n';
+	return len;
+}
+
+static ssize_t
+irq_affinity_policy_store(struct device *dev, struct device_attribute *attr,
+			  const char *buf, size_t count)
+{
+	struct plx_device *xdev = dev_get_drvdata(dev);
+	int i;
+
+	if (!xdev)
+		return -EINVAL;
+
+	for (i = 0; i < PLX_IRQ_AFFINITY_POLICIES; i++)
+		if (sysfs_streq(buf, plx_irq_affinity_policies[i]))
+			break;
+	if (i == PLX_IRQ_AFFINITY_POLICIES)
+		return -EINVAL;
+
+	mutex_lock(&xdev->irq_info.cb_mutex);
+	xdev->irq_info.affinity_policy = i;
+	plx_irq_apply_affinity(xdev, -1);
+	mutex_unlock(&xdev->irq_info.cb_mutex);
+	return count;
+}
+static DEVICE_ATTR(irq_affinity_policy, S_IRUGO | S_IWUSR,
+		   irq_affinity_policy_show, irq_affinity_policy_store);
+
+/* One line per vector: name, irq and CPUs it is steered to */
+static ssize_t
+irq_affinity_show(struct device *dev, struct device_attribute *attr,
+		  char *buf)
+{
+	struct plx_device *xdev = dev_get_drvdata(dev);
+	struct plx_intr_vector *vec;
+	ssize_t len = 0;
+	int i;
+
+	if (!xdev)
+		return -EINVAL;
+
+	mutex_lock(&xdev->irq_info.cb_mutex);
+	for (i = 0; i < xdev->irq_info.num_vectors; i++) {
+		vec = &xdev->irq_info.vectors[i];
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 0, 0)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s %d %*pbl\n",
+				 vec->name, vec->irq,
+				 cpumask_pr_args(vec->affinity));
+#else
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s %d ",
+				 vec->name, vec->irq);
+		len += cpulist_scnprintf(buf + len, PAGE_SIZE - len,
+					 vec->affinity);
+		len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+#endif
+	}
+	mutex_unlock(&xdev->irq_info.cb_mutex);
+	return len;
+}
+static DEVICE_ATTR(irq_affinity, S_IRUGO, irq_affinity_show, NULL);
+
+#ifdef PLX_INTR_CPU_NOTIF
+static enum cpuhp_state plx_intr_cpuhp_state;
+
+static int plx_intr_cpu_online(unsigned int cpu, struct hlist_node *node)
+{
+	struct plx_irq_info *irq_info = hlist_entry_safe(node,
+		struct plx_irq_info, cpuhp_node);
+	struct plx_device *xdev = container_of(irq_info, struct plx_device,
+		irq_info);
+
+	mutex_lock(&irq_info->cb_mutex);
+	plx_irq_apply_affinity(xdev, -1);
+	mutex_unlock(&irq_info->cb_mutex);
+	return 0;
+}
+
+static int plx_intr_cpu_down_prep(unsigned int cpu, struct hlist_node *node)
+{
+	struct plx_irq_info *irq_info = hlist_entry_safe(node,
+		struct plx_irq_info, cpuhp_node);
+	struct plx_device *xdev = container_of(irq_info, struct plx_device,
+		irq_info);
+
+	mutex_lock(&irq_info->cb_mutex);
+	plx_irq_apply_affinity(xdev, cpu);
+	mutex_unlock(&irq_info->cb_mutex);
+	return 0;
+}
+#endif /* PLX_INTR_CPU_NOTIF */
+
+/*
+ * plx_intr_affinity_init - expose the affinity policy and follow CPU
+ * hotplug. Failures only leave the vectors where they were steered.
+ */
+static void plx_intr_affinity_init(struct plx_device *xdev)
+{
+	int rc;
+
+	mutex_lock(&xdev->irq_info.cb_mutex);
+	plx_irq_apply_affinity(xdev, -1);
+	mutex_unlock(&xdev->irq_info.cb_mutex);
+
+	rc = device_create_file(&xdev->pdev->dev, &dev_attr_irq_affinity_policy);
+	if (!rc)
+		rc = device_create_file(&xdev->pdev->dev, &dev_attr_irq_affinity);
+	if (rc)
+		dev_warn(&xdev->pdev->dev, "irq affinity sysfs error: %d\n", rc);
+
+#ifdef PLX_INTR_CPU_NOTIF
+	INIT_HLIST_NODE(&xdev->irq_info.cpuhp_node);
+	rc = cpuhp_state_add_instance_nocalls(plx_intr_cpuhp_state,
+					      &xdev->irq_info.cpuhp_node);
+	if (rc)
+		dev_warn(&xdev->pdev->dev, "irq affinity hotplug error: %d\n",
+			 rc);
+#endif
+}
+
+static void plx_intr_affinity_deinit(struct plx_device *xdev)
+{
+#ifdef PLX_INTR_CPU_NOTIF
+	if (!hlist_unhashed(&xdev->irq_info.cpuhp_node))
+		cpuhp_state_remove_instance_nocalls(plx_intr_cpuhp_state,
+			&xdev->irq_info.cpuhp_node);
+#endif
+	device_remove_file(&xdev->pdev->dev, &dev_attr_irq_affinity);
+	device_remove_file(&xdev->pdev->dev, &dev_attr_irq_affinity_policy);
+}
+
 /**
  * plx_setup_interrupts - Initializes interrupts.
  *
@@ -489,6 +965,11 @@ int plx_setup_interrupts(struct plx_device *xdev, struct pci_dev *pdev)
 {
 	int rc;
 
+	/* Spread doorbells over MSI-X vectors when requested */
+	rc = plx_setup_msix(xdev, pdev);
+	if (!rc)
+		goto done;
+
 	/*
 	 * Disable MSI for now as it is resulting in hangs while running
 	 * SCIF unit tests.
@@ -504,6 +985,7 @@ intx:
 		return rc;
 	}
 done:
+	plx_intr_affinity_init(xdev);
 	plx_enable_interrupts(xdev);
 	return 0;
 }
@@ -518,18 +1000,61 @@ done:
  */
 void plx_free_interrupts(struct plx_device *xdev, struct pci_dev *pdev)
 {
-	int rc;
+	struct plx_intr_vector *vec;
+	int rc, i;
 
 	plx_disable_interrupts(xdev);
-	if (pci_dev_msi_enabled(pdev)) {
-		free_irq(pdev->irq, xdev);
+	plx_intr_affinity_deinit(xdev);
+	if (xdev->irq_info.msix_entries) {
+		for (i = 0; i < xdev->irq_info.num_vectors; i++) {
+			vec = &xdev->irq_info.vectors[i];
+			irq_set_affinity_hint(vec->irq, NULL);
+			free_irq(vec->irq, vec);
+		}
 		kfree(xdev->irq_info.plx_msi_map);
+		xdev->irq_info.plx_msi_map = NULL;
+		pci_disable_msix(pdev);
+		kfree(xdev->irq_info.msix_entries);
+		xdev->irq_info.msix_entries = NULL;
+	} else if (pci_dev_msi_enabled(pdev)) {
+		irq_set_affinity_hint(pdev->irq, NULL);
+		free_irq(pdev->irq, &xdev->irq_info.vectors[0]);
+		kfree(xdev->irq_info.plx_msi_map);
+		xdev->irq_info.plx_msi_map = NULL;
 		pci_disable_msi(pdev);
 	} else {
 		rc = plx_irq_clean_affinity_node_hint (pdev);
 		if (rc)
 			dev_err(&xdev->pdev->dev, "free irq affinity error: %i\n", rc);
-		free_irq(pdev->irq, xdev);
+		free_irq(pdev->irq, &xdev->irq_info.vectors[0]);
 	}
 	plx_release_callbacks(xdev);
 }
+
+/**
+ * plx_intr_module_init - register CPU hotplug callbacks re-steering
+ * doorbell vectors of all devices.
+ *
+ * RETURNS: An appropriate -ERRNO error value on error, or zero for success.
+ */
+int plx_intr_module_init(void)
+{
+#ifdef PLX_INTR_CPU_NOTIF
+	int rc;
+
+	rc = cpuhp_setup_state_multi(CPUHP_AP_ONLINE_DYN, "vca/plx87xx:online",
+				     plx_intr_cpu_online,
+				     plx_intr_cpu_down_prep);
+	if (rc < 0)
+		return rc;
+	plx_intr_cpuhp_state = rc;
+#endif
+	return 0;
+}
+
+void plx_intr_module_exit(void)
+{
+#ifdef PLX_INTR_CPU_NOTIF
+	cpuhp_remove_multi_state(plx_intr_cpuhp_state);
+#endif
+}
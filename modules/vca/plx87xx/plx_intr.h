@@ -24,6 +24,9 @@
 #include <linux/bitops.h>
 #include <linux/interrupt.h>
 #include <linux/idr.h>
+#include <linux/mutex.h>
+#include <linux/cpumask.h>
+#include <linux/version.h>
 
 #define PLX_NUM_OFFSETS 32
 /**
@@ -39,27 +42,76 @@ struct plx_intr_info {
 	u16 intr_len;
 };
 
+/* Forward declaration */
+struct plx_device;
+
+/**
+ * enum plx_irq_affinity_policy - where doorbell vectors are steered
+ *
+ * @PLX_IRQ_AFFINITY_CONSUMER: CPUs declared by consumers of the doorbells,
+ *	node CPUs when no consumer declared any. The default.
+ * @PLX_IRQ_AFFINITY_SIBLINGS: as @PLX_IRQ_AFFINITY_CONSUMER, extended by
+ *	core siblings of the declared CPUs.
+ * @PLX_IRQ_AFFINITY_NODE: CPUs of the node owning the PCI bus.
+ */
+enum plx_irq_affinity_policy {
+	PLX_IRQ_AFFINITY_CONSUMER,
+	PLX_IRQ_AFFINITY_SIBLINGS,
+	PLX_IRQ_AFFINITY_NODE,
+	PLX_IRQ_AFFINITY_POLICIES
+};
+
+/**
+ * struct plx_intr_vector - interrupt vector serving a group of doorbells
+ *
+ * @xdev: pointer to plx_device instance
+ * @irq: Linux irq number of the vector.
+ * @db_mask: doorbells served by this vector.
+ * @mask: Mask used by the thread fn to call the underlying thread fns.
+ * @name: name of the irq.
+ * @affinity: affinity hint of the vector, set by the affinity policy.
+ */
+struct plx_intr_vector {
+	struct plx_device *xdev;
+	unsigned int irq;
+	u32 db_mask;
+	unsigned long mask;
+	char name[16];
+	cpumask_var_t affinity;
+};
+
 /**
  * struct plx_irq_info - OS specific irq information
  *
  * @next_avail_src: next available doorbell that can be assigned.
- * @plx_msi_map: The MSI/MSI-x mapping information.
+ * @plx_msi_map: The MSI/MSI-x mapping information, doorbells registered
+ *		 on each vector.
  * @cb_ida: callback ID allocator to track the callbacks registered.
- * @plx_intr_lock: spinlock to protect the interrupt callback list.
- * @plx_thread_lock: spinlock to protect the thread callback list.
- *		   This lock is used to protect against thread_fn while
- *		   plx_intr_lock is used to protect against interrupt handler.
- * @cb_list: Array of callback lists one for each source.
- * @mask: Mask used by the main thread fn to call the underlying thread fns.
+ * @cb_list: Array of callback lists one for each source, walked under RCU
+ *	     by the interrupt handlers.
+ * @cb_mutex: serializes changes of @cb_list.
+ * @msix_entries: MSI-X entries, NULL when MSI-X is not used.
+ * @vectors: interrupt vectors, one for MSI and INTx.
+ * @num_vectors: number of @vectors.
+ * @db_per_vector: number of consecutive doorbells served by one vector.
+ * @consumer_mask: CPUs running consumers of each source, empty if not
+ *		   declared. Protected by @cb_mutex.
+ * @affinity_policy: enum plx_irq_affinity_policy of the vectors.
+ * @cpuhp_node: node in CPU hotplug state instances.
  */
 struct plx_irq_info {
 	int next_avail_src;
 	u32 *plx_msi_map;
 	struct ida cb_ida;
-	spinlock_t plx_intr_lock;
-	spinlock_t plx_thread_lock;
 	struct list_head *cb_list;
-	unsigned long mask;
+	struct mutex cb_mutex;
+	struct msix_entry *msix_entries;
+	struct plx_intr_vector *vectors;
+	int num_vectors;
+	int db_per_vector;
+	cpumask_var_t consumer_mask[PLX_NUM_OFFSETS];
+	int affinity_policy;
+	struct hlist_node cpuhp_node;
 };
 
 /**
@@ -80,9 +132,6 @@ struct plx_intr_cb {
 	char *name;
 };
 
-/* Forward declaration */
-struct plx_device;
-
 int plx_next_db(struct plx_device *xdev);
 struct vca_irq *
 plx_request_threaded_irq(struct plx_device *xdev,
@@ -92,6 +141,10 @@ void plx_free_irq(struct plx_device *xdev,
 		  struct vca_irq *cookie, void *data);
 int plx_setup_interrupts(struct plx_device *xdev, struct pci_dev *pdev);
 void plx_free_interrupts(struct plx_device *xdev, struct pci_dev *pdev);
+int plx_irq_set_consumer_affinity(struct plx_device *xdev, int intr_src,
+				  const struct cpumask *mask);
+int plx_intr_module_init(void);
+void plx_intr_module_exit(void);
 
 /**
  * plx_irq_set_affinity_node_hint -
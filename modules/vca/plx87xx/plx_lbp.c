@@ -27,7 +27,13 @@
 #include <linux/ktime.h>
 #include <linux/mutex.h>
 #include <linux/dma-mapping.h>
+#include <linux/scatterlist.h>
 #include <linux/uaccess.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/wait.h>
+#include <linux/fs.h>
+#include <linux/file.h>
 
 #include "plx_device.h"
 #include "plx_hw.h"
@@ -87,6 +93,8 @@ static irqreturn_t plx_lbp_interrupt_handler(int irq, void *dev)
 	struct plx_device *xdev = dev;
 	struct plx_lbp_i7_ready i7_ready;
 	complete_all(&xdev->lbp.card_wait);
+	atomic_inc(&xdev->lbp.doorbells);
+	wake_up_all(&xdev->lbp.state_wq);
 	i7_ready.value = plx_read_spad( xdev, PLX_LBP_SPAD_i7_READY);
 	if ((PLX_LBP_i7_AFTER_REBOOT | PLX_LBP_i7_UP) == i7_ready.ready)
 		 plx_reboot_notify();
@@ -104,6 +112,9 @@ int plx_lbp_init(struct plx_device *xdev)
 	dev_info(&xdev->pdev->dev, "%s entering\n", __func__);
 
 	init_completion(&xdev->lbp.card_wait);
+	init_waitqueue_head(&xdev->lbp.state_wq);
+	atomic_set(&xdev->lbp.doorbells, 0);
+	spin_lock_init(&xdev->lbp.stats_lock);
 
 	if (xdev->link_side) {
 		dev_dbg(&xdev->pdev->dev,
@@ -149,17 +160,126 @@ void plx_lbp_deinit(struct plx_device *xdev)
 }
 
 
-#define lbp_wait_event(event, timeout_ms)  do \
+static const char * const plx_lbp_phase_names[PLX_LBP_PHASES] = {
+	[PLX_LBP_PHASE_BIOS_UP] = "bios_up",
+	[PLX_LBP_PHASE_READY] = "ready",
+	[PLX_LBP_PHASE_MAP_RAMDISK] = "map_ramdisk",
+	[PLX_LBP_PHASE_UPLOAD] = "upload",
+	[PLX_LBP_PHASE_BOOT] = "boot",
+	[PLX_LBP_PHASE_FLASH] = "flash",
+	[PLX_LBP_PHASE_CMD] = "cmd",
+};
+
+const char *plx_lbp_phase_name(enum plx_lbp_phase phase)
+{
+	if (phase >= PLX_LBP_PHASES)
+		return "unknown";
+	return plx_lbp_phase_names[phase];
+}
+
+/* account a phase which started at @start and ended now */
+static void plx_lbp_phase_account(struct plx_device *xdev,
+	enum plx_lbp_phase phase, ktime_t start, unsigned int wakeups,
+	unsigned int polls)
+{
+	struct plx_lbp_phase_stats *stats = &xdev->lbp.phases[phase];
+	u64 us = ktime_to_us(ktime_sub(ktime_get(), start));
+
+	spin_lock(&xdev->lbp.stats_lock);
+	stats->count++;
+	stats->last_start_ns = ktime_to_ns(start);
+	stats->last_us = us;
+	stats->max_us = max(stats->max_us, us);
+	stats->total_us += us;
+	stats->wakeups += wakeups;
+	stats->polls += polls;
+	spin_unlock(&xdev->lbp.stats_lock);
+}
+
+void plx_lbp_phase_stats(struct plx_device *xdev, enum plx_lbp_phase phase,
+ struct plx_lbp_phase_stats *stats)
+{
+	spin_lock(&xdev->lbp.stats_lock);
+	*stats = xdev->lbp.phases[phase];
+	spin_unlock(&xdev->lbp.stats_lock);
+}
+
+/*
+ * plx_lbp_get_phase_times - copy phase timing for user space, the start of
+ * the last run of each phase lets vcactl place it on its own boot timeline
+ */
+enum vca_lbp_retval plx_lbp_get_phase_times(struct plx_device *xdev,
+ struct vca_csm_ioctl_phase_times *times)
+{
+	struct plx_lbp_phase_stats stats;
+	struct vca_lbp_phase_time *time;
+	int i;
+
+	BUILD_BUG_ON(PLX_LBP_PHASES > VCA_LBP_PHASES_MAX);
+
+	for (i = 0; i < PLX_LBP_PHASES; i++) {
+		plx_lbp_phase_stats(xdev, i, &stats);
+		time = &times->phases[i];
+		strncpy(time->name, plx_lbp_phase_name(i),
+			sizeof(time->name) - 1);
+		time->count = stats.count;
+		time->last_start_ns = stats.last_start_ns;
+		time->last_us = stats.last_us;
+		time->max_us = stats.max_us;
+		time->total_us = stats.total_us;
+	}
+	times->nr_phases = PLX_LBP_PHASES;
+	return LBP_STATE_OK;
+}
+
+/*
+ * Poll interval doubles up to the max while no doorbell comes. The max is
+ * kept short, with a BIOS not ringing the doorbell it adds to each phase.
+ */
+#define PLX_LBP_POLL_MIN_MS 1
+#define PLX_LBP_POLL_MAX_MS 4
+
+/*
+ * lbp_wait_event - wait until @event is true, sets err to 0 or -ETIME
+ *
+ * Waiters sleep on the LBP doorbell and re-read the scratchpads when the
+ * card rings it. BIOS versions changing state without a doorbell are
+ * caught by polling in growing intervals. The deadline is as long as the
+ * msleep(1) loop it replaces used to wait, timeouts tuned for the cards
+ * stay valid. Each interval is accounted as a wakeup when the doorbell
+ * rang during it and as a poll otherwise, whether @event became true or
+ * not.
+ */
+#define lbp_wait_event(xdev, phase, event, timeout_ms)  do \
 { \
-	unsigned int to = timeout_ms;  \
-	err = -ETIME; \
-	while (to--) { \
-		msleep(1); \
-		if (event) { \
-			err = 0; \
-			break ; \
+	ktime_t __start = ktime_get(); \
+	unsigned long __deadline = jiffies + \
+		(timeout_ms) * (msecs_to_jiffies(1) + 1); \
+	unsigned int __poll_ms = PLX_LBP_POLL_MIN_MS; \
+	unsigned int __wakeups = 0, __polls = 0; \
+	int __doorbells; \
+	long __slice, __done; \
+	err = 0; \
+	while (!(event)) { \
+		if (time_after_eq(jiffies, __deadline)) { \
+			err = -ETIME; \
+			break; \
 		} \
+		__slice = min_t(long, msecs_to_jiffies(__poll_ms), \
+				__deadline - jiffies); \
+		__doorbells = atomic_read(&(xdev)->lbp.doorbells); \
+		__done = wait_event_timeout((xdev)->lbp.state_wq, (event), \
+					    max(__slice, 1L)); \
+		if (atomic_read(&(xdev)->lbp.doorbells) != __doorbells) \
+			__wakeups++; \
+		else \
+			__polls++; \
+		if (__done) \
+			break; \
+		__poll_ms = min_t(unsigned int, __poll_ms * 2, \
+				  PLX_LBP_POLL_MAX_MS); \
 	} \
+	plx_lbp_phase_account(xdev, phase, __start, __wakeups, __polls); \
 } while(0)
 
 
@@ -187,11 +307,13 @@ int plx_lbp_wait_for_i7_up(struct plx_device *xdev, unsigned int timeout_ms)
 {
 	u32 i7_ready;
 	int err;
+	ktime_t start = ktime_get();
 
 	dev_dbg(&xdev->pdev->dev, "%s entering\n", __func__);
 
 	err = wait_for_completion_interruptible_timeout(&xdev->lbp.card_wait,
 		msecs_to_jiffies(timeout_ms));
+	plx_lbp_phase_account(xdev, PLX_LBP_PHASE_BIOS_UP, start, err > 0, 0);
 
 	if (err < 0) {
 		dev_info(&xdev->pdev->dev, "%s wait interrupted\n",__func__);
@@ -218,17 +340,17 @@ exit:
 
 static
 int plx_lbp_wait_for_i7_state(struct plx_device *xdev, unsigned int state,
-				unsigned int timeout)
+				unsigned int timeout, enum plx_lbp_phase phase)
 {
 	unsigned int ready;
 	int err;
 
 	if (state == 0)
-		lbp_wait_event(
+		lbp_wait_event(xdev, phase,
 			(ready = plx_lbp_get_i7_status(xdev).ready) == state,
 			timeout);
 	else
-		lbp_wait_event(
+		lbp_wait_event(xdev, phase,
 			(ready = plx_lbp_get_i7_status(xdev).ready) & state,
 			timeout);
 
@@ -262,7 +384,7 @@ int plx_lbp_wait_for_i7_cmd_consumed(struct plx_device *xdev,
 
 	dev_dbg(&xdev->pdev->dev, "%s entering\n", __func__);
 
-	lbp_wait_event(
+	lbp_wait_event(xdev, PLX_LBP_PHASE_CMD,
 		(i7_cmd = plx_lbp_get_i7_cmd(xdev).cmd) == PLX_LBP_CMD_INVALID,
 		timeout_ms);
 
@@ -370,7 +492,8 @@ enum vca_lbp_retval plx_lbp_handshake(struct plx_device *xdev)
 
 	/* 6. wait for card to acknowledge */
 	err = plx_lbp_wait_for_i7_state(xdev, PLX_LBP_i7_READY,
-		xdev->lbp.parameters.i7_irq_timeout_ms);
+		xdev->lbp.parameters.i7_irq_timeout_ms,
+		PLX_LBP_PHASE_READY);
 	if (err < 0)
 		err = -LBP_CMD_TIMEOUT;
 exit:
@@ -395,115 +518,479 @@ exit:
 	}
 }
 
-static int vca_lbp_sync_dma(struct plx_device *xdev, dma_addr_t dst,
+/*
+ * vca_lbp_submit_dma - queue a copy on the LBP DMA channel, transfers
+ * start right away and complete in submission order.
+ *
+ * Return dma_cookie_t, check error by dma_submit_error(cookie)
+ */
+static dma_cookie_t vca_lbp_submit_dma(struct plx_device *xdev, dma_addr_t dst,
 		dma_addr_t src, size_t len)
 {
-	int err = 0;
+	dma_cookie_t cookie;
 	struct dma_device *ddev;
 	struct dma_async_tx_descriptor *tx;
-	struct dma_chan *dma_ch = xdev->dma_ch;
+	struct dma_chan *dma_ch = xdev->dma_lbp_ch;
 
 	if (!dma_ch) {
 		pr_err("%s: no DMA channel available\n", __func__);
-		err = -EBUSY;
+		cookie = -EBUSY;
 		goto error;
 	}
 	ddev = dma_ch->device;
 	tx = ddev->device_prep_dma_memcpy(dma_ch, dst, src, len,
 		DMA_PREP_FENCE);
 	if (!tx) {
-		err = -ENOMEM;
+		cookie = -ENOMEM;
 		goto error;
-	} else {
-		dma_cookie_t cookie;
-
-		cookie = tx->tx_submit(tx);
-		if (dma_submit_error(cookie)) {
-			err = -ENOMEM;
-			goto error;
-		}
-		err = dma_sync_wait(dma_ch, cookie);
 	}
+	cookie = tx->tx_submit(tx);
+	if (dma_submit_error(cookie))
+		goto error;
+	dma_async_issue_pending(dma_ch);
 error:
-	if (err)
+	if (dma_submit_error(cookie))
 		dev_err(&xdev->pdev->dev, "%s %d err %d\n",
-			__func__, __LINE__, err);
+			__func__, __LINE__, cookie);
+	return cookie;
+}
+
+/* Chunks of the image in flight, mapping of the next overlaps transfers */
+#define LBP_DMA_INFLIGHT 3
+#define LBP_DMA_CHUNK_PAGES (LBP_DMA_BUFFER_SIZE / PAGE_SIZE + 1)
+
+/*
+ * struct plx_lbp_dma_share - ramdisk uploads sharing a DMA device
+ *
+ * Nodes of a card upload through the same DMA engine. Uploads submit
+ * chunks by turns, one may only be a pipeline of chunks ahead of the
+ * slowest, so a node booted first does not monopolize the engine.
+ *
+ * @device: DMA device the uploads go through
+ * @list: node in plx_lbp_shares
+ * @uploads: uploads in progress
+ * @lock: protects @uploads and their byte counts
+ * @wq: uploads waiting for their turn
+ */
+struct plx_lbp_dma_share {
+	struct dma_device *device;
+	struct list_head list;
+	struct list_head uploads;
+	spinlock_t lock;
+	wait_queue_head_t wq;
+};
+
+/*
+ * struct plx_lbp_upload - upload taking turns on a DMA share
+ *
+ * @list: node in plx_lbp_dma_share.uploads
+ * @bytes: bytes submitted since the upload joined
+ */
+struct plx_lbp_upload {
+	struct list_head list;
+	u64 bytes;
+};
+
+static LIST_HEAD(plx_lbp_shares);
+static DEFINE_MUTEX(plx_lbp_shares_lock);
+
+/* least bytes submitted by uploads of the share, share lock held */
+static u64 plx_lbp_share_min_bytes(struct plx_lbp_dma_share *share)
+{
+	struct plx_lbp_upload *upload;
+	u64 least = ~0ULL;
+
+	list_for_each_entry(upload, &share->uploads, list)
+		least = min(least, upload->bytes);
+	return least;
+}
+
+static struct plx_lbp_dma_share *plx_lbp_share_join(struct dma_chan *dma_ch,
+	struct plx_lbp_upload *upload)
+{
+	struct plx_lbp_dma_share *share;
+
+	mutex_lock(&plx_lbp_shares_lock);
+	list_for_each_entry(share, &plx_lbp_shares, list)
+		if (share->device == dma_ch->device)
+			goto found;
+
+	share = kzalloc(sizeof(*share), GFP_KERNEL);
+	if (!share) {
+		/* uploads without a share just do not take turns */
+		mutex_unlock(&plx_lbp_shares_lock);
+		return NULL;
+	}
+	share->device = dma_ch->device;
+	INIT_LIST_HEAD(&share->uploads);
+	spin_lock_init(&share->lock);
+	init_waitqueue_head(&share->wq);
+	list_add(&share->list, &plx_lbp_shares);
+found:
+	spin_lock(&share->lock);
+	/* Start level with the others, no credit for the time not uploading */
+	upload->bytes = list_empty(&share->uploads) ? 0 :
+		plx_lbp_share_min_bytes(share);
+	list_add_tail(&upload->list, &share->uploads);
+	spin_unlock(&share->lock);
+	mutex_unlock(&plx_lbp_shares_lock);
+	return share;
+}
+
+static void plx_lbp_share_leave(struct plx_lbp_dma_share *share,
+	struct plx_lbp_upload *upload)
+{
+	if (!share)
+		return;
+
+	mutex_lock(&plx_lbp_shares_lock);
+	spin_lock(&share->lock);
+	list_del(&upload->list);
+	spin_unlock(&share->lock);
+	if (list_empty(&share->uploads)) {
+		list_del(&share->list);
+		kfree(share);
+	} else {
+		wake_up_all(&share->wq);
+	}
+	mutex_unlock(&plx_lbp_shares_lock);
+}
+
+static bool plx_lbp_share_my_turn(struct plx_lbp_dma_share *share,
+	struct plx_lbp_upload *upload)
+{
+	bool turn;
+
+	spin_lock(&share->lock);
+	turn = upload->bytes <= plx_lbp_share_min_bytes(share) +
+		LBP_DMA_INFLIGHT * LBP_DMA_BUFFER_SIZE;
+	spin_unlock(&share->lock);
+	return turn;
+}
+
+/*
+ * plx_lbp_share_turn - wait until the upload is not ahead of the others,
+ * then account a chunk of @len bytes to it
+ */
+static void plx_lbp_share_turn(struct plx_lbp_dma_share *share,
+	struct plx_lbp_upload *upload, u32 len)
+{
+	if (!share)
+		return;
+
+	wait_event(share->wq, plx_lbp_share_my_turn(share, upload));
+	spin_lock(&share->lock);
+	upload->bytes += len;
+	spin_unlock(&share->lock);
+	wake_up_all(&share->wq);
+}
+
+/*
+ * struct plx_lbp_chunk - chunk of the image being copied to the ramdisk
+ *
+ * @offset: offset of the chunk in the image
+ * @len: length of the chunk
+ * @remapped: ramdisk chunk in the aperture
+ * @buff: bounce buffer, used when the image can not be pinned
+ * @buff_da: DMA address of @buff
+ * @pages: pages of the image pinned for the chunk
+ * @nr_pages: number of @pages pinned, 0 when the chunk is bounced
+ * @sgt: @pages mapped for DMA
+ * @cookie: last DMA descriptor of the chunk, 0 when the chunk is idle
+ */
+struct plx_lbp_chunk {
+	u64 offset;
+	u32 len;
+	void __iomem *remapped;
+	void *buff;
+	dma_addr_t buff_da;
+	struct page **pages;
+	int nr_pages;
+	struct sg_table sgt;
+	dma_cookie_t cookie;
+};
+
+/*
+ * plx_lbp_chunk_pin - pin chunk of the user image and map it for DMA
+ *
+ * RETURNS: zero on success, or an error when the chunk has to be bounced.
+ */
+static int plx_lbp_chunk_pin(struct device *dma_dev,
+	struct plx_lbp_chunk *chunk, void __user *img)
+{
+	unsigned long start = (unsigned long)img + chunk->offset;
+	unsigned int first = offset_in_page(start);
+	int nr_pages = DIV_ROUND_UP(first + chunk->len, PAGE_SIZE);
+	int pinned, i;
+
+	if (!chunk->pages)
+		return -ENOMEM;
+
+	pinned = get_user_pages_fast(start & PAGE_MASK, nr_pages, 0,
+				     chunk->pages);
+	if (pinned < nr_pages)
+		goto err_put;
+
+	if (sg_alloc_table_from_pages(&chunk->sgt, chunk->pages, nr_pages,
+				      first, chunk->len, GFP_KERNEL))
+		goto err_put;
+
+	chunk->sgt.nents = dma_map_sg(dma_dev, chunk->sgt.sgl,
+				      chunk->sgt.orig_nents, DMA_TO_DEVICE);
+	if (!chunk->sgt.nents) {
+		sg_free_table(&chunk->sgt);
+		goto err_put;
+	}
+	chunk->nr_pages = nr_pages;
+	return 0;
+
+err_put:
+	for (i = 0; i < pinned; i++)
+		put_page(chunk->pages[i]);
+	return -EFAULT;
+}
+
+/*
+ * plx_lbp_chunk_release - wait for DMA of the chunk and release its
+ * source and ramdisk mapping
+ *
+ * RETURNS: zero on success, or DMA status when the transfer failed.
+ */
+static int plx_lbp_chunk_release(struct plx_device *xdev,
+	struct device *dma_dev, struct plx_lbp_chunk *chunk, bool window)
+{
+	int err = 0;
+	int i;
+
+	if (chunk->cookie)
+		err = dma_sync_wait(xdev->dma_lbp_ch, chunk->cookie);
+	chunk->cookie = 0;
+
+	if (chunk->nr_pages) {
+		dma_unmap_sg(dma_dev, chunk->sgt.sgl, chunk->sgt.orig_nents,
+			     DMA_TO_DEVICE);
+		sg_free_table(&chunk->sgt);
+		for (i = 0; i < chunk->nr_pages; i++)
+			put_page(chunk->pages[i]);
+		chunk->nr_pages = 0;
+	}
+
+	if (chunk->remapped && !window)
+		plx_iounmap(xdev, chunk->remapped);
+	chunk->remapped = NULL;
 	return err;
 }
 
+/*
+ * plx_lbp_chunk_submit - queue DMA of a chunk, one descriptor for each
+ * contiguous segment of the pinned pages or one for the bounce buffer
+ */
+static int plx_lbp_chunk_submit(struct plx_device *xdev,
+	struct plx_lbp_chunk *chunk, dma_addr_t chunk_dst)
+{
+	struct scatterlist *sg;
+	dma_cookie_t cookie;
+	int i;
+
+	if (!chunk->nr_pages) {
+		cookie = vca_lbp_submit_dma(xdev, chunk_dst, chunk->buff_da,
+					    chunk->len);
+	} else {
+		for_each_sg(chunk->sgt.sgl, sg, chunk->sgt.nents, i) {
+			cookie = vca_lbp_submit_dma(xdev, chunk_dst,
+				sg_dma_address(sg), sg_dma_len(sg));
+			if (dma_submit_error(cookie))
+				break;
+			/*
+			 * Segments complete in order, waiting for the last
+			 * one submitted keeps the pages until all are done
+			 * even when a later segment fails.
+			 */
+			chunk->cookie = cookie;
+			chunk_dst += sg_dma_len(sg);
+		}
+	}
+	if (dma_submit_error(cookie))
+		return cookie;
+	chunk->cookie = cookie;
+	return 0;
+}
+
+/*
+ * plx_lbp_bounce_alloc - prepare intermediate buffers to be used as DMA
+ * source when the image can not be pinned. All are of the size of the first
+ * one, fewer buffers only mean fewer chunks in flight.
+ *
+ * RETURNS: zero on success, or -ENOMEM. Buffers allocated before an error
+ * are released by plx_lbp_bounce_free() as well.
+ */
+static int plx_lbp_bounce_alloc(struct plx_device *xdev,
+	struct device *dma_dev, struct plx_lbp_chunk *chunks, int *inflight,
+	u32 *size)
+{
+	u32 temp_buff_size;
+	u32 temp_buff_pages_order;
+	int i;
+
+	temp_buff_size = LBP_DMA_BUFFER_SIZE;
+	temp_buff_pages_order = get_order(temp_buff_size);
+	chunks[0].buff = (void *)__get_free_pages(GFP_KERNEL, temp_buff_pages_order);
+	if (!chunks[0].buff) {
+		/* Try allocate Once page */
+		temp_buff_size = PAGE_SIZE;
+		temp_buff_pages_order = get_order(temp_buff_size);
+		dev_info(&xdev->pdev->dev, "%s temp buffer switching to smaller size %d", __func__, temp_buff_size);
+		chunks[0].buff = (void *)__get_free_pages(GFP_KERNEL, temp_buff_pages_order);
+	}
+
+	if (!chunks[0].buff) {
+		dev_err(&xdev->pdev->dev, "%s: cannot alloc temporary buffer\n", __func__);
+		return -ENOMEM;
+	}
+	*size = temp_buff_size;
+
+	for (i = 1; i < *inflight; i++) {
+		chunks[i].buff = (void *)__get_free_pages(GFP_KERNEL,
+			temp_buff_pages_order);
+		if (!chunks[i].buff)
+			break;
+	}
+	*inflight = i;
+
+	for (i = 0; dma_dev && i < *inflight; i++) {
+		chunks[i].pages = kmalloc_array(LBP_DMA_CHUNK_PAGES,
+			sizeof(*chunks[i].pages), GFP_KERNEL);
+		chunks[i].buff_da = dma_map_single(dma_dev, chunks[i].buff,
+			temp_buff_size, DMA_TO_DEVICE);
+		if (dma_mapping_error(dma_dev, chunks[i].buff_da)) {
+			dev_err(&xdev->pdev->dev, "%s: cannot DMA mapping temporary buffer\n", __func__);
+			chunks[i].buff_da = 0;
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
+static void plx_lbp_bounce_free(struct device *dma_dev,
+	struct plx_lbp_chunk *chunks, int inflight, u32 temp_buff_size)
+{
+	u32 temp_buff_pages_order = get_order(temp_buff_size);
+	int i;
+
+	for (i = 0; temp_buff_size && i < inflight; i++) {
+		if (chunks[i].buff_da)
+			dma_unmap_single(dma_dev, chunks[i].buff_da,
+					 temp_buff_size, DMA_TO_DEVICE);
+		kfree(chunks[i].pages);
+		free_pages((unsigned long)chunks[i].buff, temp_buff_pages_order);
+	}
+}
+
+/*
+ * plx_lbp_chunk_read - fill a bounce buffer from the image file, a pipe
+ * returns data in pieces so read until the buffer is full
+ *
+ * RETURNS: zero on success, -ENODATA when the file ends early, or the read
+ * error.
+ */
+static int plx_lbp_chunk_read(struct file *file, void *buff, u32 len,
+	loff_t *pos)
+{
+	ssize_t ret;
+
+	while (len) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0)
+		ret = kernel_read(file, buff, len, pos);
+#else
+		ret = kernel_read(file, *pos, buff, len);
+		if (ret > 0)
+			*pos += ret;
+#endif
+		if (ret < 0)
+			return ret;
+		if (!ret)
+			return -ENODATA;
+		buff += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/*
+ * plx_lbp_send_ramdisk - copy image to the ramdisk of the node, the image is
+ * taken from user memory @img, registered @image or read from @file
+ */
 static enum vca_lbp_retval plx_lbp_send_ramdisk(struct plx_device *xdev,
- void __user * img, size_t img_size)
+ void __user * img, struct plx_lbp_image *image, struct file *file,
+ size_t img_size)
 {
 	int err;
+	int ret;
 	size_t alloc_size;
 	u32 i7_error;
 	u64 ramdisk_ph;
-	void* temp_buff;
-	dma_addr_t temp_buff_da = 0;
-	u32 temp_buff_size;
-	u32 temp_buff_pages_order;
+	u32 temp_buff_size = 0;
 	u64 offset;
 	u32 chunk_size;
 	struct plx_lbp_i7_cmd cmd_map_ramdisk;
-	void* remapped = NULL;
+	void __iomem *window = NULL;
 	dma_addr_t chunk_dst;
+	struct dma_chan *dma_ch = xdev->dma_lbp_ch;
+	struct device *dma_dev = NULL;
+	struct plx_lbp_chunk chunks[LBP_DMA_INFLIGHT];
+	struct plx_lbp_chunk *chunk;
+	struct plx_lbp_dma_share *share = NULL;
+	struct plx_lbp_upload upload;
+	const dma_addr_t *seg_da = NULL;
+	ktime_t upload_start;
+	bool uploading = false;
+	loff_t pos = 0;
+	int inflight = LBP_DMA_INFLIGHT;
+	int next = 0;
+	int i;
 	cmd_map_ramdisk.cmd = PLX_LBP_CMD_MAP_RAMDISK;
 	cmd_map_ramdisk.param = PLX_LBP_PARAM_BAR23;
 
 	dev_dbg(&xdev->pdev->dev, "%s entering\n", __func__);
 
-	if (xdev->dma_ch
 #ifdef FORCE_USE_MEMCPY
-        && 0
+	dma_ch = NULL;
 #endif
-	) {
+	if (dma_ch) {
 		dev_dbg(&xdev->pdev->dev, "%s: LBP Copy image by DMA \n", __func__);
+		dma_dev = dma_ch->device->dev;
 	} else {
 		dev_warn(&xdev->pdev->dev, "%s: LBP Copy image by MEMCPY \n", __func__);
+		/* CPU copy is synchronous, nothing to overlap */
+		inflight = 1;
 	}
 
 	if (xdev->a_lut) {
 		plx_a_lut_peer_enable(xdev);
 	}
 
+	memset(chunks, 0, sizeof(chunks));
+
 	if (plx_lbp_get_i7_status(xdev).ready != PLX_LBP_i7_READY) {
 		dev_err(&xdev->pdev->dev, "%s card not ready \n", __func__);
 		err = -LBP_INTERNAL_ERROR;
 		goto exit_no_mem;
 	}
 
-	/* prepare intermediate buffer to be used as DMA source */
-	temp_buff_size = LBP_DMA_BUFFER_SIZE;
-	temp_buff_pages_order = get_order(temp_buff_size);
-	temp_buff= (void *)__get_free_pages(GFP_KERNEL | GFP_DMA, temp_buff_pages_order);
-	if (!temp_buff) {
-		/* Try allocate Once page */
-		temp_buff_size = PAGE_SIZE;
-		temp_buff_pages_order = get_order(temp_buff_size);
-		dev_info(&xdev->pdev->dev, "%s temp buffer switching to smaller size %d", __func__, temp_buff_size);
-		temp_buff= (void *)__get_free_pages(GFP_KERNEL | GFP_DMA, temp_buff_pages_order);
-	}
-
-	if (!temp_buff) {
-		dev_err(&xdev->pdev->dev, "%s: cannot alloc temporary buffer\n", __func__);
-		err = -LBP_INTERNAL_ERROR;
-		goto exit_no_mem;
-	}
-
-	if (xdev->dma_ch
-#ifdef FORCE_USE_MEMCPY
-        && 0
-#endif
-        ){
-		temp_buff_da = dma_map_single(xdev->dma_ch->device->dev,
-				temp_buff, temp_buff_size, DMA_TO_DEVICE);
-		if ((err = dma_mapping_error(xdev->dma_ch->device->dev, temp_buff_da))) {
-			dev_err(&xdev->pdev->dev, "%s: cannot DMA mapping temporary buffer\n", __func__);
-			temp_buff_da = 0;
+	if (image) {
+		/* registered image is the DMA source itself, nothing to bounce */
+		temp_buff_size = PLX_LBP_IMAGE_SEG_SIZE;
+		if (dma_dev && !(seg_da = plx_lbp_image_map(image, dma_dev))) {
 			err = -LBP_INTERNAL_ERROR;
-			goto exit;
+			goto exit_no_mem;
 		}
+	} else if (plx_lbp_bounce_alloc(xdev, dma_dev, chunks, &inflight,
+					&temp_buff_size)) {
+		err = -LBP_INTERNAL_ERROR;
+		goto exit;
 	}
+	dev_dbg(&xdev->pdev->dev, "%s: %d chunks of %u bytes in flight\n",
+		__func__, inflight, temp_buff_size);
 
 	/* write allocation size to DATA spad - size is represented in
 	 * 1024*1024 bytes */
@@ -517,7 +1004,8 @@ static enum vca_lbp_retval plx_lbp_send_ramdisk(struct plx_device *xdev,
 	/* wait for the card */
 	err = plx_lbp_wait_for_i7_state(xdev,
 			PLX_LBP_i7_DONE | PLX_LBP_i7_ANY_ERROR,
-			xdev->lbp.parameters.i7_alloc_timeout_ms);
+			xdev->lbp.parameters.i7_alloc_timeout_ms,
+			PLX_LBP_PHASE_MAP_RAMDISK);
 	if (err < 0) {
 		dev_err(&xdev->pdev->dev, "%s error during ramdisk mapping:" \
 			       " %d card ready: %x\n", __func__, err,
@@ -534,57 +1022,105 @@ static enum vca_lbp_retval plx_lbp_send_ramdisk(struct plx_device *xdev,
 	ramdisk_ph <<= 32ULL;
 	ramdisk_ph += plx_read_spad(xdev, PLX_LBP_SPAD_DATA_LOW);
 
-	/* copy image to ramdisk */
+	/* map the whole ramdisk once if A-LUT has space, else chunk by chunk */
+	window = plx_ioremap_window(xdev, ramdisk_ph, img_size);
+
+	if (dma_ch)
+		share = plx_lbp_share_join(dma_ch, &upload);
+
+	/*
+	 * Copy image to ramdisk. A chunk slot is reused once its DMA is done,
+	 * so pinning and remapping the next chunks overlap transfers of the
+	 * previous ones.
+	 */
+	upload_start = ktime_get();
+	uploading = true;
 	offset = 0;
 	chunk_size = temp_buff_size;
 	while(offset < img_size) {
+		chunk = &chunks[next];
+		next = (next + 1) % inflight;
 
-		if(img_size - offset < chunk_size) {
-			chunk_size = (img_size - offset);
-		}
-
-		/* copy chunk of the image to intermediate buffer */
-		if(copy_from_user(temp_buff, img + offset, chunk_size)) {
-			dev_err(&xdev->pdev->dev, "%s copy_from_user failed! \n", __func__);
+		if (plx_lbp_chunk_release(xdev, dma_dev, chunk, window)) {
+			dev_err(&xdev->pdev->dev, "%s: DMA to ramdisk failed!\n", __func__);
 			err = -LBP_INTERNAL_ERROR;
 			goto exit;
 		}
-		wmb();
+
+		if(img_size - offset < chunk_size) {
+			chunk_size = (img_size - offset);
+		}
+		chunk->offset = offset;
+		chunk->len = chunk_size;
 
 		/* recalculate ramdisk address inside of NTB aperture or remap a-lut */
-		remapped = plx_ioremap(xdev, ramdisk_ph + offset, chunk_size);
-		if (!remapped) {
+		if (window)
+			chunk->remapped = window + offset;
+		else
+			chunk->remapped = plx_ioremap(xdev, ramdisk_ph + offset, chunk_size);
+		if (!chunk->remapped) {
 			dev_err(&xdev->pdev->dev, "%s: ioremap failed!\n", __func__);
 			err = -LBP_INTERNAL_ERROR;
 			goto exit;
 		}
-		chunk_dst = (u64)xdev->aper.pa + (remapped - xdev->aper.va);
+		chunk_dst = (u64)xdev->aper.pa + (chunk->remapped - xdev->aper.va);
 		dev_dbg(&xdev->pdev->dev, "%s: remapped %p, chunk_dst %llx, ramdisk_ph "
-			"%llx, offset %llx, temp_buff %p, chunk_size %x\n", __func__,
-			remapped, chunk_dst, ramdisk_ph, offset, temp_buff, chunk_size);
+			"%llx, offset %llx, chunk_size %x\n", __func__,
+			chunk->remapped, chunk_dst, ramdisk_ph, offset, chunk_size);
+
+		/*
+		 * DMA straight from the registered or pinned image, else through
+		 * the bounce buffer. A file is read straight into the bounce
+		 * buffer while previous chunks are still in flight.
+		 */
+		if (image) {
+			chunk->buff = image->segs[offset / PLX_LBP_IMAGE_SEG_SIZE];
+			if (seg_da)
+				chunk->buff_da = seg_da[offset / PLX_LBP_IMAGE_SEG_SIZE];
+		} else if (file) {
+			ret = plx_lbp_chunk_read(file, chunk->buff, chunk_size, &pos);
+			if (ret) {
+				dev_err(&xdev->pdev->dev, "%s reading image at %llx "
+					"failed: %d\n", __func__, offset, ret);
+				err = ret == -ENODATA ? -LBP_BAD_PARAMETER_VALUE :
+					-LBP_INTERNAL_ERROR;
+				goto exit;
+			}
+			wmb();
+			if (dma_dev)
+				dma_sync_single_for_device(dma_dev,
+					chunk->buff_da, chunk_size,
+					DMA_TO_DEVICE);
+		} else if (!dma_dev || plx_lbp_chunk_pin(dma_dev, chunk, img)) {
+			/* copy chunk of the image to intermediate buffer */
+			if(copy_from_user(chunk->buff, img + offset, chunk_size)) {
+				dev_err(&xdev->pdev->dev, "%s copy_from_user failed! \n", __func__);
+				err = -LBP_INTERNAL_ERROR;
+				goto exit;
+			}
+			wmb();
+			if (dma_dev)
+				dma_sync_single_for_device(dma_dev,
+					chunk->buff_da, chunk_size,
+					DMA_TO_DEVICE);
+		}
 
-		/* Copy chunk of the image from intermediate buffer to ramdisk */
-		if (xdev->dma_ch
-#ifdef FORCE_USE_MEMCPY
-				&& 0
-#endif
-		) {
+		/* Copy chunk of the image to ramdisk */
+		if (dma_dev) {
 			/* DMA path*/
-			dev_dbg(&xdev->pdev->dev, "%s: Copy chunk by DMA \n", __func__);
-			err = vca_lbp_sync_dma(xdev, chunk_dst, temp_buff_da, chunk_size);
+			dev_dbg(&xdev->pdev->dev, "%s: Copy chunk by DMA%s\n",
+				__func__, chunk->nr_pages ? "" : " bounced");
+			plx_lbp_share_turn(share, &upload, chunk_size);
+			err = plx_lbp_chunk_submit(xdev, chunk, chunk_dst);
 		} else {
 			/* MEMCPY path*/
 			dev_dbg(&xdev->pdev->dev, "%s: Copy chunk by MEMCPY \n", __func__);
-			memcpy_toio(remapped, temp_buff, chunk_size);
+			memcpy_toio(chunk->remapped, chunk->buff, chunk_size);
 			wmb();
-			ioread8((void *)((uintptr_t)remapped + chunk_size - 1));
+			ioread8((void *)((uintptr_t)chunk->remapped + chunk_size - 1));
 			err = 0;
 		}
 
-		/* unmap a-lut */
-		plx_iounmap(xdev, remapped);
-		remapped = NULL;
-
 		if (err) {
 			dev_err(&xdev->pdev->dev, "%s: DMA to ramdisk failed!\n", __func__);
 			err = -LBP_INTERNAL_ERROR;
@@ -593,14 +1129,44 @@ static enum vca_lbp_retval plx_lbp_send_ramdisk(struct plx_device *xdev,
 		offset += chunk_size;
 	}
 
+	/*
+	 * A stream longer than img_size means the size given by the caller
+	 * was wrong, do not boot a truncated image
+	 */
+	if (file) {
+		char extra;
+
+		ret = plx_lbp_chunk_read(file, &extra, sizeof(extra), &pos);
+		if (ret != -ENODATA) {
+			dev_err(&xdev->pdev->dev, "%s: image stream %s after %zu "
+				"bytes\n", __func__,
+				ret ? "failed" : "does not end", img_size);
+			err = ret ? -LBP_INTERNAL_ERROR : -LBP_BAD_PARAMETER_VALUE;
+		}
+	}
+
 exit:
-	if (xdev->dma_ch && temp_buff_da) {
-		dma_unmap_single(xdev->dma_ch->device->dev,
-					temp_buff_da, temp_buff_size,
-					DMA_TO_DEVICE);
-		temp_buff_da = 0;
+	plx_lbp_share_leave(share, &upload);
+
+	/* Drain chunks in flight before their buffers go away */
+	for (i = 0; i < inflight; i++) {
+		ret = plx_lbp_chunk_release(xdev, dma_dev, &chunks[i], window);
+		if (ret && err >= 0) {
+			dev_err(&xdev->pdev->dev, "%s: DMA to ramdisk failed!\n", __func__);
+			err = -LBP_INTERNAL_ERROR;
+		}
 	}
-	free_pages((unsigned long)temp_buff, temp_buff_pages_order);
+
+	if (uploading && err >= 0)
+		plx_lbp_phase_account(xdev, PLX_LBP_PHASE_UPLOAD, upload_start,
+				      0, 0);
+
+	if (window)
+		plx_iounmap_window(xdev, window, img_size);
+
+	/* segments of a registered image stay with the image */
+	if (!image)
+		plx_lbp_bounce_free(dma_dev, chunks, inflight, temp_buff_size);
 
 exit_no_mem:
 	if (err < 0)
@@ -633,7 +1199,8 @@ static enum vca_lbp_retval plx_lbp_unmap_ramdisk(struct plx_device *xdev)
 	/* 2] wait for the card to acknowledge */
 	err = plx_lbp_wait_for_i7_state(xdev,
 			PLX_LBP_i7_READY | PLX_LBP_i7_ANY_ERROR,
-			xdev->lbp.parameters.i7_cmd_timeout_ms);
+			xdev->lbp.parameters.i7_cmd_timeout_ms,
+			PLX_LBP_PHASE_CMD);
 	if (err < 0) {
 		dev_err(&xdev->pdev->dev, "%s error during unmapping ramdisk: " \
 				"%d\n", __func__, err);
@@ -657,8 +1224,9 @@ static enum vca_lbp_retval plx_lbp_unmap_ramdisk(struct plx_device *xdev)
 bool plx_request_dma_chan(struct plx_device *xdev);
 #endif
 
-enum vca_lbp_retval plx_lbp_boot_ramdisk(struct plx_device *xdev,
- void __user * img, size_t img_size)
+static enum vca_lbp_retval __plx_lbp_boot_ramdisk(struct plx_device *xdev,
+ void __user * img, struct plx_lbp_image *image, struct file *file,
+ size_t img_size)
 {
 	int err;
 	u32 i7_error;
@@ -678,7 +1246,7 @@ enum vca_lbp_retval plx_lbp_boot_ramdisk(struct plx_device *xdev,
 	dev_dbg(&xdev->pdev->dev, "%s entering\n", __func__);
 
 	/* 1] copy image to ramdisk */
-	err = plx_lbp_send_ramdisk(xdev, img, img_size);
+	err = plx_lbp_send_ramdisk(xdev, img, image, file, img_size);
 	if (err != LBP_STATE_OK) {
 		mutex_unlock(xdev->lbp_lock);
 		return (enum vca_lbp_retval)err;
@@ -690,7 +1258,8 @@ enum vca_lbp_retval plx_lbp_boot_ramdisk(struct plx_device *xdev,
 	/* 3] wait for the card to acknowledge */
 	err = plx_lbp_wait_for_i7_state(xdev,
 			PLX_LBP_i7_BOOTING | PLX_LBP_i7_OS_READY | PLX_LBP_i7_ANY_ERROR,
-			xdev->lbp.parameters.i7_cmd_timeout_ms);
+			xdev->lbp.parameters.i7_cmd_timeout_ms,
+			PLX_LBP_PHASE_BOOT);
 	if (err < 0) {
 		dev_err(&xdev->pdev->dev, "%s error during ramdisk booting: " \
 				"%d\n", __func__, err);
@@ -719,6 +1288,61 @@ exit:
 	return LBP_STATE_OK;
 }
 
+enum vca_lbp_retval plx_lbp_boot_ramdisk(struct plx_device *xdev,
+ void __user * img, size_t img_size)
+{
+	return __plx_lbp_boot_ramdisk(xdev, img, NULL, NULL, img_size);
+}
+
+/*
+ * plx_lbp_boot_ramdisk_image - boot from an image registered before,
+ * nothing is copied from user space
+ */
+enum vca_lbp_retval plx_lbp_boot_ramdisk_image(struct plx_device *xdev, u32 id)
+{
+	struct plx_lbp_image *image;
+	enum vca_lbp_retval ret;
+
+	image = plx_lbp_image_get(id);
+	if (!image) {
+		dev_dbg(&xdev->pdev->dev, "%s: no boot image %u\n", __func__, id);
+		return LBP_BAD_PARAMETER_VALUE;
+	}
+
+	ret = __plx_lbp_boot_ramdisk(xdev, NULL, image, NULL, image->size);
+	plx_lbp_image_put(image);
+	return ret;
+}
+
+/*
+ * plx_lbp_boot_ramdisk_stream - boot from an image of known size read from
+ * a file descriptor of the caller, e.g. a pipe from a decompressor, so the
+ * image does not have to be kept anywhere in full
+ */
+enum vca_lbp_retval plx_lbp_boot_ramdisk_stream(struct plx_device *xdev,
+ int fd, size_t img_size)
+{
+	struct file *file;
+	enum vca_lbp_retval ret;
+
+	if (!img_size)
+		return LBP_BAD_PARAMETER_VALUE;
+
+	file = fget(fd);
+	if (!file) {
+		dev_dbg(&xdev->pdev->dev, "%s: bad file descriptor %d\n",
+			__func__, fd);
+		return LBP_BAD_PARAMETER_VALUE;
+	}
+
+	if (file->f_mode & FMODE_READ)
+		ret = __plx_lbp_boot_ramdisk(xdev, NULL, NULL, file, img_size);
+	else
+		ret = LBP_BAD_PARAMETER_VALUE;
+	fput(file);
+	return ret;
+}
+
 static void plx_lbp_blkio_set_devpage(struct plx_device *xdev)
 {
 	u64 blkio_dp_ph;
@@ -773,7 +1397,8 @@ enum vca_lbp_retval plx_lbp_boot_blkdisk(struct plx_device *xdev)
 	/* 3] wait for the card to acknowledge */
 	err = plx_lbp_wait_for_i7_state(xdev,
 			PLX_LBP_i7_BOOTING_BLOCK_IO | PLX_LBP_i7_OS_READY | PLX_LBP_i7_ANY_ERROR,
-			xdev->lbp.parameters.i7_cmd_timeout_ms);
+			xdev->lbp.parameters.i7_cmd_timeout_ms,
+			PLX_LBP_PHASE_BOOT);
 	if (err < 0) {
 		dev_err(&xdev->pdev->dev, "%s error during blkdisk booting: " \
 				"%d\n", __func__, err);
@@ -818,7 +1443,7 @@ static enum vca_lbp_retval plx_lbp_flash(struct plx_device *xdev,
 		flash_timeout = xdev->lbp.parameters.i7_cmd_timeout_ms;
 
 	/* 1] copy image to ramdisk */
-	err = plx_lbp_send_ramdisk(xdev, file, file_size);
+	err = plx_lbp_send_ramdisk(xdev, file, NULL, NULL, file_size);
 	if (err != LBP_STATE_OK)
 		return (enum vca_lbp_retval)err;
 
@@ -828,7 +1453,8 @@ static enum vca_lbp_retval plx_lbp_flash(struct plx_device *xdev,
 	/* 3] wait for the card to start flashing */
 	err = plx_lbp_wait_for_i7_state(xdev,
 		PLX_LBP_i7_FLASHING | PLX_LBP_i7_ANY_ERROR,
-		xdev->lbp.parameters.i7_cmd_timeout_ms);
+		xdev->lbp.parameters.i7_cmd_timeout_ms,
+		PLX_LBP_PHASE_CMD);
 	if (err < 0) {
 		dev_err(&xdev->pdev->dev, "%s error before %s: " \
 			"%d\n", __func__,
@@ -843,11 +1469,12 @@ static enum vca_lbp_retval plx_lbp_flash(struct plx_device *xdev,
 	err = plx_lbp_wait_for_i7_state(xdev,
 			PLX_LBP_i7_DONE | PLX_LBP_i7_ANY_ERROR,
 #if OLD_BIOS
-			300000); /* can take long, now about 10 minutes,
+			300000, /* can take long, now about 10 minutes,
 						but need measurements */
 #else
-			flash_timeout);
+			flash_timeout,
 #endif
+			PLX_LBP_PHASE_FLASH);
 
 	if (err < 0) {
 		dev_err(&xdev->pdev->dev, "%s error during %s: " \
@@ -973,7 +1600,8 @@ enum vca_lbp_retval plx_lbp_boot_from_usb(struct plx_device * xdev)
 
 	err = plx_lbp_wait_for_i7_state(xdev,
 			PLX_LBP_i7_BOOTING | PLX_LBP_i7_ANY_ERROR,
-			xdev->lbp.parameters.i7_cmd_timeout_ms);
+			xdev->lbp.parameters.i7_cmd_timeout_ms,
+			PLX_LBP_PHASE_BOOT);
 	if (err < 0) {
 		dev_err(&xdev->pdev->dev, "%s error during booting from usb: " \
 				"%d\n", __func__, err);
@@ -1299,7 +1927,8 @@ enum vca_lbp_retval plx_lbp_get_mac_addr(struct plx_device *xdev,
 
 	err = plx_lbp_wait_for_i7_state(xdev,
 			PLX_LBP_i7_READY,
-			xdev->lbp.parameters.i7_cmd_timeout_ms);
+			xdev->lbp.parameters.i7_cmd_timeout_ms,
+			PLX_LBP_PHASE_CMD);
 	if (err < 0) {
 		dev_err(&xdev->pdev->dev, "%s error waiting for card ready: " \
 			"%d\n", __func__, err);
@@ -1377,7 +2006,8 @@ enum vca_lbp_retval plx_lbp_set_time(struct plx_device *xdev)
 
 	err = plx_lbp_wait_for_i7_state(xdev,
 			PLX_LBP_i7_READY,
-			xdev->lbp.parameters.i7_cmd_timeout_ms);
+			xdev->lbp.parameters.i7_cmd_timeout_ms,
+			PLX_LBP_PHASE_CMD);
 	if (err < 0) {
 		dev_err(&xdev->pdev->dev, "%s error waiting for card ready: " \
 			"%d\n", __func__, err);
@@ -1461,7 +2091,8 @@ bool plx_lbp_clear_error(struct plx_device *xdev)
 
 	err = plx_lbp_wait_for_i7_state(xdev,
 			PLX_LBP_i7_READY,
-			xdev->lbp.parameters.i7_cmd_timeout_ms);
+			xdev->lbp.parameters.i7_cmd_timeout_ms,
+			PLX_LBP_PHASE_CMD);
 	if (err < 0) {
 		dev_err(&xdev->pdev->dev, "%s error waiting for card ready: " \
 			"%d\n", __func__, err);
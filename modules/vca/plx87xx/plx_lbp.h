@@ -22,14 +22,67 @@
 
 #define PLX_USE_CPU_DMA 1
 
+#include <linux/wait.h>
+#include <linux/spinlock.h>
+
 #include "plx_lbp_ifc.h"
 #define PLX_LBP_PROTOCOL_VERSION_CURRENT PLX_LBP_PROTOCOL_VERSION_2_0
 
 #include "../common/vca_common.h"
 
+struct vca_csm_ioctl_phase_times;
+
+/*
+ * enum plx_lbp_phase - stages of the LBP protocol timed by the host
+ *
+ * @PLX_LBP_PHASE_BIOS_UP: handshake doorbell from the BIOS
+ * @PLX_LBP_PHASE_READY: card acknowledging the handshake
+ * @PLX_LBP_PHASE_MAP_RAMDISK: card allocating the ramdisk
+ * @PLX_LBP_PHASE_UPLOAD: image copied to the ramdisk
+ * @PLX_LBP_PHASE_BOOT: card acknowledging a boot command
+ * @PLX_LBP_PHASE_FLASH: card flashing
+ * @PLX_LBP_PHASE_CMD: any other command
+ */
+enum plx_lbp_phase {
+	PLX_LBP_PHASE_BIOS_UP = 0,
+	PLX_LBP_PHASE_READY,
+	PLX_LBP_PHASE_MAP_RAMDISK,
+	PLX_LBP_PHASE_UPLOAD,
+	PLX_LBP_PHASE_BOOT,
+	PLX_LBP_PHASE_FLASH,
+	PLX_LBP_PHASE_CMD,
+	PLX_LBP_PHASES
+};
+
+/*
+ * struct plx_lbp_phase_stats - time spent in a phase
+ *
+ * @count: number of times the phase was entered
+ * @last_start_ns: monotonic clock the last one started at
+ * @last_us: duration of the last one
+ * @max_us: longest duration
+ * @total_us: sum of the durations
+ * @wakeups: wait intervals in which the LBP doorbell rang
+ * @polls: wait intervals which passed with no doorbell, ended by a timed
+ *	re-read of the scratchpads
+ */
+struct plx_lbp_phase_stats {
+	u64 count;
+	u64 last_start_ns;
+	u64 last_us;
+	u64 max_us;
+	u64 total_us;
+	u64 wakeups;
+	u64 polls;
+};
+
 struct plx_lbp {
 	struct vca_irq *irq;
 	struct completion card_wait;
+	wait_queue_head_t state_wq;
+	atomic_t doorbells; /* LBP doorbells received */
+	spinlock_t stats_lock;
+	struct plx_lbp_phase_stats phases[PLX_LBP_PHASES];
 	u32 i7_ddr_size_mb;
 
 	struct {
@@ -60,6 +113,9 @@ void plx_lbp_deinit(struct plx_device *xdev);
 enum vca_lbp_retval plx_lbp_handshake(struct plx_device *xdev);
 enum vca_lbp_retval plx_lbp_boot_ramdisk(struct plx_device *xdev,
  void __user * img, size_t img_size);
+enum vca_lbp_retval plx_lbp_boot_ramdisk_image(struct plx_device *xdev, u32 id);
+enum vca_lbp_retval plx_lbp_boot_ramdisk_stream(struct plx_device *xdev,
+ int fd, size_t img_size);
 enum vca_lbp_retval plx_lbp_boot_blkdisk(struct plx_device *xdev);
 enum vca_lbp_retval plx_lbp_flash_bios(struct plx_device *xdev,
  void __user * bios_file, size_t bios_file_size);
@@ -83,6 +139,11 @@ enum vca_lbp_retval plx_lbp_set_bios_param(struct plx_device *xdev,
  enum PLX_LBP_PARAM param, u64 value);
 enum vca_lbp_retval plx_lbp_get_bios_param(struct plx_device *xdev,
  enum PLX_LBP_PARAM param, u64 * value);
+const char *plx_lbp_phase_name(enum plx_lbp_phase phase);
+void plx_lbp_phase_stats(struct plx_device *xdev, enum plx_lbp_phase phase,
+ struct plx_lbp_phase_stats *stats);
+enum vca_lbp_retval plx_lbp_get_phase_times(struct plx_device *xdev,
+ struct vca_csm_ioctl_phase_times *times);
 const char * plx_lbp_flash_type_to_string(struct plx_device *xdev, enum plx_lbp_flash_type flash_type);
 
 void plx_lbp_reset_start(unsigned int card_id, unsigned int cpu_id);
@@ -0,0 +1,540 @@
+/*
+ * Intel VCA Software Stack (VCASS)
+ *
+ * Copyright(c) 2015-2017 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Intel PLX87XX VCA PCIe driver
+ *
+ * Registry of boot images kept in kernel memory. Booting many nodes from
+ * the same image copies it from user space once, every node is then fed
+ * by DMA straight from the registered segments.
+ */
+#include <linux/version.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h>
+#include <linux/dma-mapping.h>
+#include <linux/shrinker.h>
+
+#include "plx_device.h"
+#include "plx_lbp_image.h"
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 12, 0)
+/* Idle images are dropped under memory pressure */
+#define PLX_LBP_IMAGE_SHRINKER
+#endif
+
+#define PLX_LBP_IMAGE_SEG_ORDER get_order(PLX_LBP_IMAGE_SEG_SIZE)
+
+/*
+ * struct plx_lbp_image_map - segments of an image mapped for a DMA device
+ *
+ * @list: node in plx_lbp_image.maps
+ * @dev: device the segments are mapped for
+ * @da: DMA address of each segment
+ */
+struct plx_lbp_image_map {
+	struct list_head list;
+	struct device *dev;
+	dma_addr_t *da;
+};
+
+/*
+ * struct plx_lbp_image_owner - registration of an image through a file
+ *
+ * @list: node in plx_lbp_image.owners
+ * @file: file of the node device the image was registered through
+ */
+struct plx_lbp_image_owner {
+	struct list_head list;
+	struct file *file;
+};
+
+static LIST_HEAD(plx_lbp_images);
+/* protects plx_lbp_images, image ids and holders/users of each image */
+static DEFINE_MUTEX(plx_lbp_images_lock);
+static u32 plx_lbp_image_next_id = 1;
+
+static void plx_lbp_image_map_free(struct plx_lbp_image *image,
+	struct plx_lbp_image_map *map)
+{
+	unsigned int i;
+
+	list_del(&map->list);
+	for (i = 0; i < image->nr_segs; i++)
+		dma_unmap_single(map->dev, map->da[i],
+			PLX_LBP_IMAGE_SEG_SIZE, DMA_TO_DEVICE);
+	put_device(map->dev);
+	vfree(map->da);
+	kfree(map);
+}
+
+static void plx_lbp_image_free(struct plx_lbp_image *image)
+{
+	struct plx_lbp_image_map *map, *tmp;
+	struct plx_lbp_image_owner *owner, *next;
+	unsigned int i;
+
+	list_for_each_entry_safe(map, tmp, &image->maps, list)
+		plx_lbp_image_map_free(image, map);
+
+	list_for_each_entry_safe(owner, next, &image->owners, list) {
+		list_del(&owner->list);
+		kfree(owner);
+	}
+
+	for (i = 0; i < image->nr_segs; i++)
+		free_pages((unsigned long)image->segs[i],
+			   PLX_LBP_IMAGE_SEG_ORDER);
+	vfree(image->segs);
+	kfree(image);
+}
+
+/*
+ * plx_lbp_image_alloc - copy an image from user space to kernel segments
+ *
+ * Segments are allocated without retrying hard, a registration failing for
+ * lack of memory only means nodes are booted from user space as before.
+ *
+ * RETURNS: the image, or NULL on error.
+ */
+static struct plx_lbp_image *plx_lbp_image_alloc(const char *name,
+	void __user *img, size_t img_size)
+{
+	struct plx_lbp_image *image;
+	size_t offset, len;
+	unsigned int i;
+
+	image = kzalloc(sizeof(*image), GFP_KERNEL);
+	if (!image)
+		return NULL;
+	strncpy(image->name, name, sizeof(image->name) - 1);
+	image->size = img_size;
+	mutex_init(&image->maps_lock);
+	INIT_LIST_HEAD(&image->maps);
+	INIT_LIST_HEAD(&image->owners);
+
+	image->segs = vzalloc(DIV_ROUND_UP(img_size, PLX_LBP_IMAGE_SEG_SIZE) *
+			      sizeof(*image->segs));
+	if (!image->segs)
+		goto err;
+
+	for (offset = 0; offset < img_size; offset += len) {
+		i = image->nr_segs;
+		len = min_t(size_t, img_size - offset, PLX_LBP_IMAGE_SEG_SIZE);
+		image->segs[i] = (void *)__get_free_pages(GFP_KERNEL |
+			__GFP_NOWARN | __GFP_NORETRY, PLX_LBP_IMAGE_SEG_ORDER);
+		if (!image->segs[i])
+			goto err;
+		image->nr_segs++;
+		if (copy_from_user(image->segs[i], img + offset, len))
+			goto err;
+		cond_resched();
+	}
+	return image;
+
+err:
+	plx_lbp_image_free(image);
+	return NULL;
+}
+
+/* lock held */
+static struct plx_lbp_image *plx_lbp_image_find_name(const char *name,
+	size_t img_size)
+{
+	struct plx_lbp_image *image;
+
+	list_for_each_entry(image, &plx_lbp_images, list)
+		if (image->size == img_size && !strcmp(image->name, name))
+			return image;
+	return NULL;
+}
+
+/* lock held */
+static struct plx_lbp_image *plx_lbp_image_find(u32 id)
+{
+	struct plx_lbp_image *image;
+
+	list_for_each_entry(image, &plx_lbp_images, list)
+		if (image->id == id)
+			return image;
+	return NULL;
+}
+
+/* lock held, the image is freed by the caller once the lock is dropped */
+static bool plx_lbp_image_release(struct plx_lbp_image *image)
+{
+	if (image->holders || image->users)
+		return false;
+	list_del(&image->list);
+	return true;
+}
+
+/* lock held */
+static void plx_lbp_image_add_owner(struct plx_lbp_image *image,
+	struct plx_lbp_image_owner *owner)
+{
+	list_add_tail(&owner->list, &image->owners);
+	image->holders++;
+}
+
+/* lock held */
+static void plx_lbp_image_del_owner(struct plx_lbp_image *image,
+	struct plx_lbp_image_owner *owner)
+{
+	list_del(&owner->list);
+	kfree(owner);
+	image->holders--;
+}
+
+/*
+ * plx_lbp_image_register - keep a boot image in the driver
+ *
+ * An image already registered under the same name and size only gets
+ * another holder. The image is mapped for the DMA device of @xdev up
+ * front, other nodes behind the same device boot with no setup at all.
+ * The holder belongs to @owner and is dropped when it is closed, if it was
+ * not unregistered before.
+ */
+enum vca_lbp_retval plx_lbp_image_register(struct plx_device *xdev,
+ struct file *owner, const char *name, void __user * img, size_t img_size,
+ u32 *id)
+{
+	struct plx_lbp_image *image, *found;
+	struct plx_lbp_image_owner *holder;
+	struct dma_chan *dma_ch = xdev->dma_lbp_ch;
+
+	if (!img_size || !name[0])
+		return LBP_BAD_PARAMETER_VALUE;
+
+	holder = kzalloc(sizeof(*holder), GFP_KERNEL);
+	if (!holder)
+		return LBP_INTERNAL_ERROR;
+	holder->file = owner;
+
+	mutex_lock(&plx_lbp_images_lock);
+	image = plx_lbp_image_find_name(name, img_size);
+	if (image) {
+		plx_lbp_image_add_owner(image, holder);
+		list_move_tail(&image->list, &plx_lbp_images);
+		*id = image->id;
+		mutex_unlock(&plx_lbp_images_lock);
+		return LBP_STATE_OK;
+	}
+	mutex_unlock(&plx_lbp_images_lock);
+
+	/* copy without the lock, boots of other images go on meanwhile */
+	image = plx_lbp_image_alloc(name, img, img_size);
+	if (!image) {
+		dev_warn(&xdev->pdev->dev, "%s: cannot keep %zu bytes image %s\n",
+			 __func__, img_size, name);
+		kfree(holder);
+		return LBP_INTERNAL_ERROR;
+	}
+
+	mutex_lock(&plx_lbp_images_lock);
+	found = plx_lbp_image_find_name(name, img_size);
+	if (found) {
+		/* registered by another node in the meantime */
+		plx_lbp_image_add_owner(found, holder);
+		*id = found->id;
+		mutex_unlock(&plx_lbp_images_lock);
+		plx_lbp_image_free(image);
+		return LBP_STATE_OK;
+	}
+	do {
+		image->id = plx_lbp_image_next_id++;
+	} while (!image->id || plx_lbp_image_find(image->id));
+	plx_lbp_image_add_owner(image, holder);
+	image->users = 1;
+	list_add_tail(&image->list, &plx_lbp_images);
+	*id = image->id;
+	mutex_unlock(&plx_lbp_images_lock);
+
+	dev_info(&xdev->pdev->dev, "boot image %u registered: %s, %zu bytes\n",
+		 image->id, image->name, image->size);
+
+	if (dma_ch)
+		plx_lbp_image_map(image, dma_ch->device->dev);
+	plx_lbp_image_put(image);
+	return LBP_STATE_OK;
+}
+
+/*
+ * plx_lbp_image_unregister - drop a holder of a registered image
+ *
+ * Only a holder registered through @owner is dropped. The image is freed
+ * with its last holder, or after the boots still using it are done.
+ */
+enum vca_lbp_retval plx_lbp_image_unregister(struct file *owner, u32 id)
+{
+	struct plx_lbp_image *image;
+	struct plx_lbp_image_owner *holder;
+	bool release;
+
+	mutex_lock(&plx_lbp_images_lock);
+	image = plx_lbp_image_find(id);
+	if (!image)
+		goto err;
+	list_for_each_entry(holder, &image->owners, list)
+		if (holder->file == owner)
+			break;
+	if (&holder->list == &image->owners)
+		goto err;
+	plx_lbp_image_del_owner(image, holder);
+	release = plx_lbp_image_release(image);
+	mutex_unlock(&plx_lbp_images_lock);
+
+	if (release) {
+		pr_info("%s: boot image %u released\n", __func__, id);
+		plx_lbp_image_free(image);
+	}
+	return LBP_STATE_OK;
+
+err:
+	mutex_unlock(&plx_lbp_images_lock);
+	return LBP_BAD_PARAMETER_VALUE;
+}
+
+/*
+ * plx_lbp_image_release_owner - drop holders registered through a file
+ * being closed, e.g. by vcactl killed before it unregistered its images
+ */
+void plx_lbp_image_release_owner(struct file *owner)
+{
+	struct plx_lbp_image *image, *tmp;
+	struct plx_lbp_image_owner *holder, *next;
+	LIST_HEAD(released);
+
+	mutex_lock(&plx_lbp_images_lock);
+	list_for_each_entry_safe(image, tmp, &plx_lbp_images, list) {
+		list_for_each_entry_safe(holder, next, &image->owners, list)
+			if (holder->file == owner)
+				plx_lbp_image_del_owner(image, holder);
+		if (plx_lbp_image_release(image))
+			list_add(&image->list, &released);
+	}
+	mutex_unlock(&plx_lbp_images_lock);
+
+	list_for_each_entry_safe(image, tmp, &released, list) {
+		pr_info("%s: boot image %u released\n", __func__, image->id);
+		plx_lbp_image_free(image);
+	}
+}
+
+/*
+ * plx_lbp_image_get - take a registered image for a boot
+ *
+ * RETURNS: the image, or NULL when no image has the id, either never
+ * registered or already released.
+ */
+struct plx_lbp_image *plx_lbp_image_get(u32 id)
+{
+	struct plx_lbp_image *image;
+
+	mutex_lock(&plx_lbp_images_lock);
+	image = plx_lbp_image_find(id);
+	if (image && image->holders) {
+		image->users++;
+		list_move_tail(&image->list, &plx_lbp_images);
+	} else {
+		image = NULL;
+	}
+	mutex_unlock(&plx_lbp_images_lock);
+	return image;
+}
+
+void plx_lbp_image_put(struct plx_lbp_image *image)
+{
+	bool release;
+
+	mutex_lock(&plx_lbp_images_lock);
+	image->users--;
+	release = plx_lbp_image_release(image);
+	mutex_unlock(&plx_lbp_images_lock);
+
+	if (release)
+		plx_lbp_image_free(image);
+}
+
+/*
+ * plx_lbp_image_map - DMA addresses of the image segments for a device,
+ * segments are mapped on the first call for the device
+ *
+ * RETURNS: array of plx_lbp_image.nr_segs addresses, or NULL on error.
+ */
+const dma_addr_t *plx_lbp_image_map(struct plx_lbp_image *image,
+ struct device *dma_dev)
+{
+	struct plx_lbp_image_map *map;
+	unsigned int i;
+
+	mutex_lock(&image->maps_lock);
+	list_for_each_entry(map, &image->maps, list)
+		if (map->dev == dma_dev)
+			goto out;
+
+	map = kzalloc(sizeof(*map), GFP_KERNEL);
+	if (!map)
+		goto err;
+	map->da = vzalloc(image->nr_segs * sizeof(*map->da));
+	if (!map->da)
+		goto err_free_map;
+
+	for (i = 0; i < image->nr_segs; i++) {
+		map->da[i] = dma_map_single(dma_dev, image->segs[i],
+			PLX_LBP_IMAGE_SEG_SIZE, DMA_TO_DEVICE);
+		if (dma_mapping_error(dma_dev, map->da[i]))
+			goto err_unmap;
+	}
+	map->dev = get_device(dma_dev);
+	list_add(&map->list, &image->maps);
+out:
+	mutex_unlock(&image->maps_lock);
+	return map->da;
+
+err_unmap:
+	while (i--)
+		dma_unmap_single(dma_dev, map->da[i], PLX_LBP_IMAGE_SEG_SIZE,
+				 DMA_TO_DEVICE);
+	vfree(map->da);
+err_free_map:
+	kfree(map);
+err:
+	mutex_unlock(&image->maps_lock);
+	dev_err(dma_dev, "%s: cannot map boot image %u\n", __func__, image->id);
+	return NULL;
+}
+
+/*
+ * plx_lbp_image_unmap_dev - drop mappings of images for a DMA device whose
+ * channel is released. Images being booted are left mapped, their boot runs
+ * through another node holding the device, the mapping goes with the image
+ * or with that node. Next boots through the device map the image again.
+ */
+void plx_lbp_image_unmap_dev(struct device *dma_dev)
+{
+	struct plx_lbp_image *image;
+	struct plx_lbp_image_map *map, *tmp;
+
+	mutex_lock(&plx_lbp_images_lock);
+	list_for_each_entry(image, &plx_lbp_images, list) {
+		if (image->users)
+			continue;
+		mutex_lock(&image->maps_lock);
+		list_for_each_entry_safe(map, tmp, &image->maps, list)
+			if (map->dev == dma_dev)
+				plx_lbp_image_map_free(image, map);
+		mutex_unlock(&image->maps_lock);
+	}
+	mutex_unlock(&plx_lbp_images_lock);
+}
+
+#ifdef PLX_LBP_IMAGE_SHRINKER
+static unsigned long plx_lbp_image_count(struct shrinker *shrinker,
+	struct shrink_control *sc)
+{
+	struct plx_lbp_image *image;
+	unsigned long pages = 0;
+
+	if (!mutex_trylock(&plx_lbp_images_lock))
+		return 0;
+	list_for_each_entry(image, &plx_lbp_images, list)
+		if (!image->users)
+			pages += (unsigned long)image->nr_segs <<
+				PLX_LBP_IMAGE_SEG_ORDER;
+	mutex_unlock(&plx_lbp_images_lock);
+	return pages;
+}
+
+/*
+ * plx_lbp_image_scan - drop least recently used images not being booted,
+ * their ids become unknown and nodes boot from user space again
+ */
+static unsigned long plx_lbp_image_scan(struct shrinker *shrinker,
+	struct shrink_control *sc)
+{
+	struct plx_lbp_image *image, *tmp;
+	unsigned long freed = 0;
+	LIST_HEAD(dropped);
+
+	if (!mutex_trylock(&plx_lbp_images_lock))
+		return SHRINK_STOP;
+	list_for_each_entry_safe(image, tmp, &plx_lbp_images, list) {
+		if (freed >= sc->nr_to_scan)
+			break;
+		if (image->users)
+			continue;
+		list_move(&image->list, &dropped);
+		freed += (unsigned long)image->nr_segs <<
+			PLX_LBP_IMAGE_SEG_ORDER;
+	}
+	mutex_unlock(&plx_lbp_images_lock);
+
+	list_for_each_entry_safe(image, tmp, &dropped, list) {
+		pr_info("%s: boot image %u dropped under memory pressure\n",
+			__func__, image->id);
+		plx_lbp_image_free(image);
+	}
+	return freed;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+static struct shrinker *plx_lbp_image_shrinker;
+#else
+static struct shrinker plx_lbp_image_shrinker_s = {
+	.count_objects = plx_lbp_image_count,
+	.scan_objects = plx_lbp_image_scan,
+	.seeks = DEFAULT_SEEKS,
+};
+#endif
+#endif /* PLX_LBP_IMAGE_SHRINKER */
+
+int plx_lbp_image_module_init(void)
+{
+#ifdef PLX_LBP_IMAGE_SHRINKER
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	plx_lbp_image_shrinker = shrinker_alloc(0, "vca-lbp-image");
+	if (!plx_lbp_image_shrinker)
+		return -ENOMEM;
+	plx_lbp_image_shrinker->count_objects = plx_lbp_image_count;
+	plx_lbp_image_shrinker->scan_objects = plx_lbp_image_scan;
+	shrinker_register(plx_lbp_image_shrinker);
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+	return register_shrinker(&plx_lbp_image_shrinker_s, "vca-lbp-image");
+#else
+	return register_shrinker(&plx_lbp_image_shrinker_s);
+#endif
+#endif
+	return 0;
+}
+
+void plx_lbp_image_module_exit(void)
+{
+	struct plx_lbp_image *image, *tmp;
+
+#ifdef PLX_LBP_IMAGE_SHRINKER
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	shrinker_free(plx_lbp_image_shrinker);
+#else
+	unregister_shrinker(&plx_lbp_image_shrinker_s);
+#endif
+#endif
+	/* no boot is running once the devices are gone */
+	list_for_each_entry_safe(image, tmp, &plx_lbp_images, list) {
+		list_del(&image->list);
+		plx_lbp_image_free(image);
+	}
+}
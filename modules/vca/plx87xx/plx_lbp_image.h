@@ -0,0 +1,81 @@
+/*
+ * Intel VCA Software Stack (VCASS)
+ *
+ * Copyright(c) 2015-2017 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * Intel PLX87XX VCA PCIe driver
+ */
+#ifndef _PLX_LBP_IMAGE_H_
+#define _PLX_LBP_IMAGE_H_
+
+#include <linux/list.h>
+#include <linux/mutex.h>
+
+#include "../common/vca_common.h"
+
+/* Images are kept in segments of this size, one DMA transfer each */
+#define PLX_LBP_IMAGE_SEG_SIZE (1024*1024) /*1MB*/
+
+struct device;
+struct file;
+struct plx_device;
+
+/*
+ * struct plx_lbp_image - boot image kept in kernel memory
+ *
+ * Registered once, then booted on any node without another copy from user
+ * space. Segments are mapped for DMA by the first boot through a DMA device
+ * and the mapping is kept for the next nodes behind the same device.
+ *
+ * @list: node in the image registry, most recently used last
+ * @id: id handed out to user space
+ * @name: contents identification given on register
+ * @size: size of the image
+ * @nr_segs: number of @segs
+ * @segs: kernel addresses of the segments
+ * @holders: registrations not dropped yet
+ * @owners: file each registration was made through, dropped when it is
+ *	closed
+ * @users: boots in progress, an image in use is never freed
+ * @maps_lock: protects @maps
+ * @maps: DMA mappings of @segs, one for each DMA device used
+ */
+struct plx_lbp_image {
+	struct list_head list;
+	u32 id;
+	char name[VCA_LBP_IMAGE_NAME_LEN];
+	size_t size;
+	unsigned int nr_segs;
+	void **segs;
+	unsigned int holders;
+	struct list_head owners;
+	unsigned int users;
+	struct mutex maps_lock;
+	struct list_head maps;
+};
+
+enum vca_lbp_retval plx_lbp_image_register(struct plx_device *xdev,
+ struct file *owner, const char *name, void __user * img, size_t img_size,
+ u32 *id);
+enum vca_lbp_retval plx_lbp_image_unregister(struct file *owner, u32 id);
+void plx_lbp_image_release_owner(struct file *owner);
+void plx_lbp_image_unmap_dev(struct device *dma_dev);
+struct plx_lbp_image *plx_lbp_image_get(u32 id);
+void plx_lbp_image_put(struct plx_lbp_image *image);
+const dma_addr_t *plx_lbp_image_map(struct plx_lbp_image *image,
+ struct device *dma_dev);
+int plx_lbp_image_module_init(void);
+void plx_lbp_image_module_exit(void);
+#endif
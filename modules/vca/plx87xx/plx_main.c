@@ -255,6 +255,8 @@ plx_device_init(struct plx_device *xdev, struct pci_dev *pdev)
 	xdev->pdev = pdev;
 	xdev->irq_info.next_avail_src = 0;
 	xdev->dma_ch = NULL;
+	xdev->dma_blk_ch = NULL;
+	xdev->dma_lbp_ch = NULL;
 	mutex_init(&xdev->mmio_lock);
 	mutex_init(&xdev->reset_lock);
 	mutex_lock(&xdev->reset_lock);
@@ -282,6 +284,32 @@ static bool workaround_dma_filter(struct dma_chan *chan, struct device *dev)
 	}
 #endif
 
+static bool plx_dma_client_filter(struct dma_chan *chan, void *param)
+{
+	struct dma_chan *dma_ch = param;
+
+	return chan->device == dma_ch->device;
+}
+
+/*
+ * When plx87xx_dma arbitrates between client channels, blockio and LBP get
+ * their own channel next to the one used by vop. Otherwise all of them
+ * share xdev->dma_ch.
+ */
+static struct dma_chan *plx_request_dma_client_chan(struct plx_device *xdev,
+						    dma_cap_mask_t mask)
+{
+	struct dma_chan *chan = dma_request_channel(mask, plx_dma_client_filter,
+						    xdev->dma_ch);
+
+	if (chan) {
+		dev_dbg(&xdev->pdev->dev, "DMA client channel %s\n",
+			dma_chan_name(chan));
+		return chan;
+	}
+	return xdev->dma_ch;
+}
+
 /**
  * plx_request_dma_chan - Request DMA channel
  * @xdev: pointer to plx_device instance
@@ -291,6 +319,7 @@ static bool workaround_dma_filter(struct dma_chan *chan, struct device *dev)
 bool plx_request_dma_chan(struct plx_device *xdev)
 {
 	dma_cap_mask_t mask;
+	bool plx_dma = false;
 	dma_cap_zero(mask);
 	dma_cap_set(DMA_MEMCPY, mask);
 
@@ -300,11 +329,18 @@ bool plx_request_dma_chan(struct plx_device *xdev)
 	} else {
 		xdev->dma_ch = dma_request_channel(mask, plx_dma_filter,
 						   &xdev->pdev->dev);
+		plx_dma = !!xdev->dma_ch;
 	}
 #if PLX_USE_CPU_DMA
 	if( !xdev->dma_ch) // if not PLX DMA request CPU DMA
 		xdev->dma_ch = dma_request_channel( mask,(dma_filter_fn) workaround_dma_filter, &xdev->pdev->dev);
 #endif
+	xdev->dma_blk_ch = xdev->dma_ch;
+	xdev->dma_lbp_ch = xdev->dma_ch;
+	if (plx_dma) {
+		xdev->dma_blk_ch = plx_request_dma_client_chan(xdev, mask);
+		xdev->dma_lbp_ch = plx_request_dma_client_chan(xdev, mask);
+	}
 	if( xdev->dma_ch) {
 		int rc= sysfs_create_link( &xdev->pdev->dev.kobj, &xdev->dma_ch->device->dev->kobj, VCA_DMA_LINK_NAME);
 		if( rc) // VCA_DMA_PATH is used to show dma_hung status only.
@@ -325,6 +361,15 @@ bool plx_request_dma_chan(struct plx_device *xdev)
  */
 static void plx_free_dma_chan(struct plx_device *xdev)
 {
+	/* Registered boot images may be mapped for the LBP DMA device */
+	if (xdev->dma_lbp_ch)
+		plx_lbp_image_unmap_dev(xdev->dma_lbp_ch->device->dev);
+	if (xdev->dma_lbp_ch && xdev->dma_lbp_ch != xdev->dma_ch)
+		dma_release_channel(xdev->dma_lbp_ch);
+	xdev->dma_lbp_ch = NULL;
+	if (xdev->dma_blk_ch && xdev->dma_blk_ch != xdev->dma_ch)
+		dma_release_channel(xdev->dma_blk_ch);
+	xdev->dma_blk_ch = NULL;
 	if (xdev->dma_ch) {
 		sysfs_remove_link( &xdev->pdev->dev.kobj, VCA_DMA_LINK_NAME);
 		dma_release_channel(xdev->dma_ch);
@@ -424,7 +469,7 @@ static int plx_register_device(struct plx_device *xdev)
 
 		xdev->blockio.be_dev = vcablkebe_register(&xdev->pdev->dev,
 				&blockio_hw_ops,
-				xdev->dma_ch,
+				xdev->dma_blk_ch,
 				xdev->card_id,
 				plx_identify_cpu_id(xdev->pdev));
 
@@ -538,7 +583,7 @@ static irqreturn_t plx_deffered_rdp_init(int irq, void *dev)
 		return -EIO;
 	}
 
-	plx_a_lut_clear(xdev, xdev->a_lut_array_base);
+	plx_a_lut_reset(xdev);
 
 	rc = plx_rdp_init(xdev);
 
@@ -1260,12 +1305,28 @@ static int __init plx_init(void)
 	}
 	ida_init(&g_plx_ida);
 
+	ret = plx_intr_module_init();
+	if (ret) {
+		pr_err("plx_intr_module_init failed ret %d\n", ret);
+		goto cleanup_procfs;
+	}
+
+	ret = plx_lbp_image_module_init();
+	if (ret) {
+		pr_err("plx_lbp_image_module_init failed ret %d\n", ret);
+		goto cleanup_intr;
+	}
+
 	ret = pci_register_driver(&plx_driver);
 	if (ret) {
 		pr_err("pci_register_driver failed ret %d\n", ret);
-		goto cleanup_procfs;
+		goto cleanup_lbp_image;
 	}
 	return ret;
+cleanup_lbp_image:
+	plx_lbp_image_module_exit();
+cleanup_intr:
+	plx_intr_module_exit();
 cleanup_procfs:
 	plx_exit_procfs();
 cleanup_debugfs:
@@ -1277,6 +1338,8 @@ cleanup_debugfs:
 static void __exit plx_exit(void)
 {
 	pci_unregister_driver(&plx_driver);
+	plx_lbp_image_module_exit();
+	plx_intr_module_exit();
 	ida_destroy(&g_plx_ida);
 	plx_exit_debugfs();
 	plx_exit_procfs();
@@ -56,8 +56,13 @@ static int plx_dma_reg_seq_show(struct seq_file *s, void *pos)
 	seq_printf(s, "head %d tail %d hw %d space %d dma_hold_cnt %u\n",
 		   ch->head, ch->last_tail,
 		   plx_get_hw_last_desc(ch),
-		   plx_dma_ring_count(ch->head, ch->last_tail),
+		   plx_dma_ring_count(ch, ch->head, ch->last_tail),
 		   ch->dbg_dma_hold_cnt);
+	seq_printf(s, "ring size %u done %d cleanup batches %lu\n",
+		   ch->ring_size, ch->done_tail, ch->cleanup_batches);
+	seq_printf(s, "dma_hang %d recoveries %u failed cookies %d..%d\n",
+		   ch->dma_hang, ch->recoveries, ch->err_cookie_lo,
+		   ch->err_cookie_hi);
 	seq_printf(s, "PLX_DMA_GLOBAL_CONTROL(0x1F8) 0X%-10X\n",
 		   plx_dma_reg_read(plx_dma_dev, PLX_DMA_GLOBAL_CTL));
 	seq_printf(s, "PLX_DMA_DESC_RING_ADDR_LOW(0x14) 0X%-10X\n",
@@ -308,14 +313,14 @@ static int plx_dma_desc_ring_seq_show(struct seq_file *s, void *pos)
 	seq_printf(s, "head %d tail %d hw last %d hw next %d"
 		   " used %d space %d dma_hold_cnt %u\n", ch->head, ch->last_tail,
 		   plx_get_hw_last_desc(ch), plx_get_hw_next_desc(ch),
-		   plx_dma_ring_count(ch->last_tail, ch->head),
-		   plx_dma_ring_count(ch->head, ch->last_tail),
+		   plx_dma_ring_count(ch, ch->last_tail, ch->head),
+		   plx_dma_ring_count(ch, ch->head, ch->last_tail),
 		   ch->dbg_dma_hold_cnt);
 
 	if (!ch->desc_ring)
 		return 0;
 
-	for (i = 0; i < PLX_DMA_DESC_RX_SIZE; i++) {
+	for (i = 0; i < ch->ring_size; i++) {
 		desc = &ch->desc_ring[i];
 		src = (u64)desc->dw3 | ((u64)desc->dw1 & PLX_DESC_HALF_HIGH_MASK) << 16;
 		dst = (u64)desc->dw2 | (u64)(desc->dw1 & PLX_DESC_HALF_LOW_MASK) << 32;
@@ -366,7 +371,7 @@ static void dmatest_callback(void *arg)
 static int plx_dma_intr_test_seq_show(struct seq_file *s, void *pos)
 {
 	struct plx_dma_device *plx_dma_dev = s->private;
-	struct dma_chan *chan = &plx_dma_dev->plx_chan.chan;
+	struct dma_chan *chan = plx_dma_dbg_chan(plx_dma_dev);
 	struct dma_device *ddev;
 	struct dma_async_tx_descriptor *tx = NULL;
 	dma_cookie_t cookie;
@@ -502,7 +507,7 @@ static const struct file_operations plx_dma_dbg_trace_ops = {
 static int plx_dma_flush_seq_show(struct seq_file *s, void *pos)
 {
 	struct plx_dma_device *plx_dma_dev = s->private;
-	struct dma_chan *chan = &plx_dma_dev->plx_chan.chan;
+	struct dma_chan *chan = plx_dma_dbg_chan(plx_dma_dev);
 	struct dma_device *ddev = chan->device;
 	struct dma_async_tx_descriptor *tx = NULL;
 	DECLARE_WAIT_QUEUE_HEAD_ONSTACK(done_wait);
@@ -647,6 +652,25 @@ static const struct file_operations plx_dma_dump_regs_single_ops = {
 	.release = single_release
 };
 
+static int plx_dma_sched_seq_show(struct seq_file *s, void *pos)
+{
+	plx_dma_sched_debugfs_show(s, s->private);
+	return 0;
+}
+
+static int plx_dma_sched_debug_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, plx_dma_sched_seq_show, inode->i_private);
+}
+
+static const struct file_operations plx_dma_sched_ops = {
+	.owner   = THIS_MODULE,
+	.open    = plx_dma_sched_debug_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release
+};
+
 void plx_debugfs_init(struct plx_dma_device *plx_dma_dev)
 {
 	struct dma_device *dma_dev = &plx_dma_dev->dma_dev;
@@ -683,6 +707,10 @@ void plx_debugfs_init(struct plx_dma_device *plx_dma_dev)
 			debugfs_create_file("dump_regs_single", 0444,
 					    plx_dma_dev->dbg_dir, plx_dma_dev,
 					    &plx_dma_dump_regs_single_ops);
+			debugfs_create_file("sched", 0444,
+					    plx_dma_dev->dbg_dir, plx_dma_dev,
+					    &plx_dma_sched_ops);
+			plx_dma_bench_init(plx_dma_dev);
 		}
 	}
 }
@@ -17,8 +17,10 @@
  *
  * PLX87XX DMA driver
  */
+#include <linux/module.h>
 #include <linux/slab.h>
 #include <linux/delay.h>
+#include <linux/log2.h>
 #include <linux/pci.h>
 #include <linux/interrupt.h>
 #include <linux/version.h>
@@ -33,6 +35,30 @@ struct plx_debug *plx_dbg;
 int plx_dbg_count;
 #endif
 
+static unsigned int hang_timeout_ms = 2000;
+module_param(hang_timeout_ms, uint, 0644);
+MODULE_PARM_DESC(hang_timeout_ms, "Time without progress of the descriptor "
+		 "ring after which the channel is aborted and reinitialized "
+		 "(0 - disabled)");
+
+/* Watchdog runs per hang_timeout_ms */
+#define PLX_DMA_WD_PERIODS		4
+#define PLX_DMA_ABORT_TO_US		10000
+static unsigned int desc_ring_size = PLX_DMA_DESC_RX_SIZE;
+module_param(desc_ring_size, uint, 0444);
+MODULE_PARM_DESC(desc_ring_size, "Descriptors in the DMA ring, power of 2 "
+		 "up to " __stringify(PLX_DMA_DESC_RX_MAX));
+
+/* Consecutive failed recoveries after which PLX reset is required */
+#define PLX_DMA_RECOVER_RETRIES		3
+
+static inline unsigned long plx_dma_wd_period(void)
+{
+	unsigned int timeout = READ_ONCE(hang_timeout_ms);
+
+	return msecs_to_jiffies(timeout ? timeout / PLX_DMA_WD_PERIODS : 1000);
+}
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3, 0, 0)
 #define DMA_MIN_COOKIE	1
 #define DMA_MAX_COOKIE	INT_MAX
@@ -52,13 +78,21 @@ completed_cookie_container(struct dma_chan *chan)
 
 u32 plx_dma_reg_read(struct plx_dma_device *pdma, u32 offset)
 {
+#ifdef PLX_DMA_EMUL
+	return plx_dma_emul_reg_read(pdma, offset);
+#else
 	return ioread32(pdma->reg_base + offset);
+#endif
 }
 
 void plx_dma_reg_write(struct plx_dma_device *pdma,
 		       u32 offset, u32 value)
 {
+#ifdef PLX_DMA_EMUL
+	plx_dma_emul_reg_write(pdma, offset, value);
+#else
 	iowrite32(value, pdma->reg_base + offset);
+#endif
 }
 
 u32 plx_dma_ch_reg_read(struct plx_dma_chan *ch, u32 offset)
@@ -72,31 +106,30 @@ static void plx_dma_ch_reg_write(struct plx_dma_chan *ch,
 	plx_dma_reg_write(to_plx_dma_dev(ch), offset + ch->ch_base_addr, value);
 }
 
-static inline u32 plx_dma_ring_inc(u32 val)
+static inline u32 plx_dma_ring_inc(struct plx_dma_chan *ch, u32 val)
 {
-	return (val + 1) & (PLX_DMA_DESC_RX_SIZE - 1);
+	return (val + 1) & (ch->ring_size - 1);
 }
 
 static u32 desc_ring_da_to_index(struct plx_dma_chan *ch, dma_addr_t addr)
 {
-	return (addr / sizeof(struct plx_dma_desc)) &
-		(PLX_DMA_DESC_RX_SIZE - 1);
+	return (addr / sizeof(struct plx_dma_desc)) & (ch->ring_size - 1);
 }
 
-static inline u32 plx_dma_ring_dec(u32 val)
+static inline u32 plx_dma_ring_dec(struct plx_dma_chan *ch, u32 val)
 {
-	return val ? val - 1 : PLX_DMA_DESC_RX_SIZE - 1;
+	return val ? val - 1 : ch->ring_size - 1;
 }
 
 static inline void plx_dma_inc_head(struct plx_dma_chan *ch)
 {
-	ch->head = plx_dma_ring_inc(ch->head);
+	ch->head = plx_dma_ring_inc(ch, ch->head);
 }
 
 static int plx_dma_alloc_desc_ring(struct plx_dma_chan *ch)
 {
 	/* Desc size must be >= depth of ring + prefetch size + 1 */
-	u64 desc_ring_size = PLX_DMA_DESC_RX_SIZE * sizeof(*ch->desc_ring);
+	u64 desc_ring_size = ch->ring_size * sizeof(*ch->desc_ring);
 	struct device *dev = to_plx_dma_dev(ch)->dma_dev.dev;
 
 	BUILD_BUG_ON(sizeof(*ch->desc_ring) != 16);
@@ -112,7 +145,7 @@ static int plx_dma_alloc_desc_ring(struct plx_dma_chan *ch)
 
 	dev_dbg(dev, "DMA desc ring VA = %p PA 0x%llx size 0x%llx\n",
 		ch->desc_ring, ch->desc_ring_da, desc_ring_size);
-	ch->tx_array = vzalloc(PLX_DMA_DESC_RX_SIZE * sizeof(*ch->tx_array));
+	ch->tx_array = vzalloc(ch->ring_size * sizeof(*ch->tx_array));
 	if (!ch->tx_array)
 		goto tx_error;
 	return 0;
@@ -226,15 +259,14 @@ static void plx_dma_chan_set_desc_ring(struct plx_dma_chan *ch)
 			     ch->desc_ring_da & 0xffffffff);
 	plx_dma_ch_reg_write(ch, PLX_DMA_DESC_RING_ADDR_HIGH,
 			     (ch->desc_ring_da >> 32) & 0xffffffff);
-	plx_dma_ch_reg_write(ch, PLX_DMA_DESC_RING_SIZE, PLX_DMA_DESC_RX_SIZE);
+	plx_dma_ch_reg_write(ch, PLX_DMA_DESC_RING_SIZE, ch->ring_size);
 	/* Set up the next descriptor to the base of the descriptor ring */
 	plx_dma_ch_reg_write(ch, PLX_DMA_NEXT_DESC_ADDR_LOW,
 			     ch->desc_ring_da & 0xffffffff);
 }
 
-static inline void plx_dma_issue_pending(struct dma_chan *ch)
+void plx_dma_hw_issue_pending(struct plx_dma_chan *plx_ch)
 {
-	struct plx_dma_chan *plx_ch = to_plx_dma_chan(ch);
 	u32 ctrl_reg = plx_ch->ctrl_reg;
 
 	/* Clear any active status bits ([31,12,10:8]) */
@@ -246,13 +278,48 @@ static inline void plx_dma_issue_pending(struct dma_chan *ch)
 	plx_dma_ch_reg_write(plx_ch, PLX_DMA_CTRL_STATUS, ctrl_reg);
 }
 
-static void plx_dma_cleanup(struct plx_dma_chan *ch)
+static void plx_dma_issue_pending(struct dma_chan *ch)
 {
-	struct dma_async_tx_descriptor *tx;
-	u32 last_tail;
+	if (to_plx_dma_client(ch))
+		plx_dma_sched_run(chan_to_plx_dma_dev(ch));
+	else
+		plx_dma_hw_issue_pending(to_plx_dma_chan(ch));
+}
+
+/*
+ * Call the completion callback of a tx. Consumers using callback_result get
+ * the failed status, the others can check it with tx_status.
+ */
+void plx_dma_tx_callback(struct dma_async_tx_descriptor *tx, bool failed)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 9, 0)
+	if (tx->callback_result) {
+		struct dmaengine_result result = {
+			.result = failed ? DMA_TRANS_ABORTED : DMA_TRANS_NOERROR,
+			.residue = 0,
+		};
+
+		tx->callback_result(tx->callback_param, &result);
+		tx->callback_result = NULL;
+		tx->callback = NULL;
+		return;
+	}
+#endif
+	if (tx->callback) {
+		tx->callback(tx->callback_param);
+		tx->callback = NULL;
+	}
+}
+
+/*
+ * Find the end of the range of descriptors completed by the hardware,
+ * starting at done_tail. Called with cleanup_lock held.
+ */
+static u32 plx_dma_reap(struct plx_dma_chan *ch)
+{
+	u32 done_tail;
 	u32 cached_head;
 
-	spin_lock(&ch->cleanup_lock);
 	/*
 	 * Use a cached head rather than using ch->head directly, since a
 	 * different thread can be updating ch->head potentially leading to an
@@ -266,64 +333,100 @@ static void plx_dma_cleanup(struct plx_dma_chan *ch)
 	 */
 	smp_rmb();
 
-	for (last_tail = ch->last_tail; last_tail != cached_head;) {
-		/* Break out of the loop if this desc is not yet complete */
-		if (READ_ONCE(ch->desc_ring[last_tail].dw0) & PLX_DESC_VALID) {
+	for (done_tail = ch->done_tail; done_tail != cached_head;
+	     done_tail = plx_dma_ring_inc(ch, done_tail)) {
+		u32 last_hw_tail;
+
+		/* Write back clears the valid bit of completed descriptors */
+		if (!(READ_ONCE(ch->desc_ring[done_tail].dw0) & PLX_DESC_VALID))
+			continue;
+		/*
+		 * Read register by PCI, wait on write back from PLX Chip.
+		 * If interrupt received before finished transfer by PCI
+		 * packed with write back to the descriptor, cleanup and call
+		 * callback for some finished descriptors
+		 * can be missing (or wait to next DMA traffic).
+		 * To protect this issue Read by PCI register from PLX
+		 * to be shore that all write back packaged sent before received,
+		 * and check finish result again.
+		 */
+		last_hw_tail = plx_get_hw_last_desc(ch);
+		if (!(READ_ONCE(ch->desc_ring[done_tail].dw0) & PLX_DESC_VALID))
+			continue;
+		if (last_hw_tail == done_tail) {
 			/*
-			 * Read register by PCI, wait on write back from PLX Chip.
-			 * If interrupt received before finished transfer by PCI
-			 * packed with write back to the descriptor, cleanup and call
-			 * callback for some finished descriptors
-			 * can be missing (or wait to next DMA traffic).
-			 * To protect this issue Read by PCI register from PLX
-			 * to be shore that all write back packaged sent before received,
-			 * and check finish result again.
-			 */
-			u32 last_hw_tail =  plx_get_hw_last_desc(ch);
-			if (READ_ONCE(ch->desc_ring[last_tail].dw0) & PLX_DESC_VALID) {
-				if (last_hw_tail == last_tail) {
-					/*
-					 * When actual descriptor still not finished and this
-					 * is last descriptor fetch by HW, check that HW register
-					 * known that they still have scheduled work.
-					 * From unknown reason when run multiple small buffers
-					 * traffic, happens that HW not fetch correct next
-					 * descriptor and stop transfers.
-					 * To fix this issue, in the last undone descriptor
-					 * detect that HW still known that some work waiting.
-					 * If not set work in progress start transfer register again.
-					 **/
-					u32 ctrl_reg = plx_dma_ch_reg_read(ch, PLX_DMA_CTRL_STATUS);
-					if (!(ctrl_reg & PLX_DMA_CTRL_IN_PROGRESS)) {
-						struct plx_dma_device *plx_dma_dev = to_plx_dma_dev(ch);
-						struct device *dev = plx_dma_dev->dma_dev.dev;
-						dev_dbg(dev, "%s Detect DMA HW work in progress stopped!"
-								" ch->last_tail %u last_tail %u ctrl_reg 0x%x",
-								__func__, ch->last_tail, last_tail, ctrl_reg);
-						ch->dbg_dma_hold_cnt++;
-						plx_dma_issue_pending(&ch->chan);
-					}
-				}
-				break;
+			 * When actual descriptor still not finished and this
+			 * is last descriptor fetch by HW, check that HW register
+			 * known that they still have scheduled work.
+			 * From unknown reason when run multiple small buffers
+			 * traffic, happens that HW not fetch correct next
+			 * descriptor and stop transfers.
+			 * To fix this issue, in the last undone descriptor
+			 * detect that HW still known that some work waiting.
+			 * If not set work in progress start transfer register again.
+			 **/
+			u32 ctrl_reg = plx_dma_ch_reg_read(ch, PLX_DMA_CTRL_STATUS);
+			if (!(ctrl_reg & PLX_DMA_CTRL_IN_PROGRESS) &&
+			    !READ_ONCE(ch->recovering)) {
+				struct plx_dma_device *plx_dma_dev = to_plx_dma_dev(ch);
+				struct device *dev = plx_dma_dev->dma_dev.dev;
+				dev_dbg(dev, "%s Detect DMA HW work in progress stopped!"
+						" ch->last_tail %u done_tail %u ctrl_reg 0x%x",
+						__func__, ch->last_tail, done_tail, ctrl_reg);
+				ch->dbg_dma_hold_cnt++;
+				plx_dma_hw_issue_pending(ch);
 			}
 		}
+		break;
+	}
+	return done_tail;
+}
 
-		tx = &ch->tx_array[last_tail];
-		if (tx->cookie) {
-			BUG_ON(tx->cookie < DMA_MIN_COOKIE);
-			completed_cookie_container(tx->chan)->completed_cookie = tx->cookie;
-			tx->cookie = 0;
-			if (tx->callback) {
-				tx->callback(tx->callback_param);
-				tx->callback = NULL;
+/*
+ * Descriptors are reclaimed in batches: a pass finds the range completed by
+ * the hardware under cleanup_lock, runs the callbacks of the whole range
+ * without the lock and then frees it by moving last_tail. Only one context
+ * runs callbacks at a time so they are called in order, a cleanup racing
+ * with it only extends done_tail and leaves the range to the running one.
+ */
+static void plx_dma_cleanup(struct plx_dma_chan *ch)
+{
+	struct dma_async_tx_descriptor *tx;
+	u32 last_tail, done_tail;
+
+	spin_lock(&ch->cleanup_lock);
+	ch->done_tail = plx_dma_reap(ch);
+	if (ch->cleanup_busy) {
+		spin_unlock(&ch->cleanup_lock);
+		return;
+	}
+	ch->cleanup_busy = true;
+
+	while ((last_tail = ch->last_tail) != (done_tail = ch->done_tail)) {
+		spin_unlock(&ch->cleanup_lock);
+
+		for (; last_tail != done_tail;
+		     last_tail = plx_dma_ring_inc(ch, last_tail)) {
+			tx = &ch->tx_array[last_tail];
+			if (tx->cookie) {
+				BUG_ON(tx->cookie < DMA_MIN_COOKIE);
+				completed_cookie_container(tx->chan)->completed_cookie = tx->cookie;
+				tx->cookie = 0;
+				plx_dma_tx_callback(tx, false);
 			}
 		}
-		last_tail = plx_dma_ring_inc(last_tail);
+		ch->cleanup_batches++;
+
+		/* finish all completion callbacks before incrementing tail */
+		smp_mb();
+		spin_lock(&ch->cleanup_lock);
+		WRITE_ONCE(ch->last_tail, done_tail);
 	}
-	/* finish all completion callbacks before incrementing tail */
-	smp_mb();
-	ch->last_tail = last_tail;
+	ch->cleanup_busy = false;
 	spin_unlock(&ch->cleanup_lock);
+
+	/* Ring space was released, let queued client requests in */
+	plx_dma_sched_kick(to_plx_dma_dev(ch));
 }
 
 static void plx_dma_chan_setup(struct plx_dma_chan *ch)
@@ -339,6 +442,7 @@ static void plx_dma_chan_setup(struct plx_dma_chan *ch)
 
 	plx_dma_chan_set_desc_ring(ch);
 	ch->last_tail = 0;
+	ch->done_tail = 0;
 	ch->head = 0;
 	ch->cleanup = plx_dma_cleanup;
 	plx_dma_chan_unmask_intr(ch);
@@ -347,7 +451,7 @@ static void plx_dma_chan_setup(struct plx_dma_chan *ch)
 
 static void plx_dma_free_desc_ring(struct plx_dma_chan *ch)
 {
-	u64 desc_ring_size = PLX_DMA_DESC_RX_SIZE * sizeof(*ch->desc_ring);
+	u64 desc_ring_size = ch->ring_size * sizeof(*ch->desc_ring);
 	struct device *dev = to_plx_dma_dev(ch)->dma_dev.dev;
 
 	vfree(ch->tx_array);
@@ -408,17 +512,62 @@ static int plx_dma_chan_init(struct plx_dma_chan *ch)
 	return rc;
 }
 
+static void plx_dma_chan_release(struct plx_dma_chan *ch)
+{
+	plx_dma_disable_chan(ch);
+	plx_dma_chan_mask_intr(ch);
+	plx_dma_cleanup(ch);
+	plx_dma_free_desc_ring(ch);
+	plx_debug_destroy();
+}
+
+/*
+ * The hardware ring is shared by all channels of the device, it is set up
+ * by the first allocated channel and released with the last one. Channel
+ * allocation is serialized by the dmaengine core.
+ */
+int plx_dma_hw_get(struct plx_dma_device *plx_dma_dev)
+{
+	int rc;
+
+	if (plx_dma_dev->hw_users++)
+		return 0;
+
+	rc = plx_dma_chan_init(&plx_dma_dev->plx_chan);
+	if (rc) {
+		plx_dma_dev->hw_users--;
+		return rc;
+	}
+	schedule_delayed_work(&plx_dma_dev->plx_chan.hang_work,
+			      plx_dma_wd_period());
+	return 0;
+}
+
+void plx_dma_hw_put(struct plx_dma_device *plx_dma_dev)
+{
+	if (--plx_dma_dev->hw_users)
+		return;
+
+	cancel_delayed_work_sync(&plx_dma_dev->plx_chan.hang_work);
+	cancel_work_sync(&plx_dma_dev->sched_work);
+	plx_dma_chan_release(&plx_dma_dev->plx_chan);
+}
+
 static int plx_dma_alloc_chan_resources(struct dma_chan *ch)
 {
-	struct plx_dma_chan *plx_ch = to_plx_dma_chan(ch);
-	struct device *dev = plx_dma_ch_to_device(plx_ch);
-	int rc = plx_dma_chan_init(plx_ch);
+	struct plx_dma_client *client = to_plx_dma_client(ch);
+	struct plx_dma_device *plx_dma_dev = chan_to_plx_dma_dev(ch);
+	int rc;
+
+	if (client)
+		return plx_dma_client_alloc_resources(client);
 
+	rc = plx_dma_hw_get(plx_dma_dev);
 	if (rc) {
-		dev_err(dev, "%s ret %d\n", __func__, rc);
+		dev_err(plx_dma_dev->dma_dev.dev, "%s ret %d\n", __func__, rc);
 		return rc;
 	}
-	return PLX_DMA_DESC_RX_SIZE;
+	return plx_dma_dev->plx_chan.ring_size;
 }
 
 u32 plx_get_hw_last_desc(struct plx_dma_chan *ch)
@@ -439,13 +588,12 @@ u32 plx_get_hw_next_desc(struct plx_dma_chan *ch)
 
 static void plx_dma_free_chan_resources(struct dma_chan *ch)
 {
-	struct plx_dma_chan *plx_ch = to_plx_dma_chan(ch);
+	struct plx_dma_client *client = to_plx_dma_client(ch);
 
-	plx_dma_disable_chan(plx_ch);
-	plx_dma_chan_mask_intr(plx_ch);
-	plx_dma_cleanup(plx_ch);
-	plx_dma_free_desc_ring(plx_ch);
-	plx_debug_destroy();
+	if (client)
+		plx_dma_client_free_resources(client);
+	else
+		plx_dma_hw_put(chan_to_plx_dma_dev(ch));
 }
 
 /**
@@ -478,14 +626,24 @@ static enum dma_status
 plx_dma_is_tx_complete(struct dma_chan *ch, dma_cookie_t cookie,
 		  dma_cookie_t *last, dma_cookie_t *used)
 {
+	struct plx_dma_client *client = to_plx_dma_client(ch);
 	struct plx_dma_chan *plx_ch = to_plx_dma_chan(ch);
+	enum dma_status status;
+
+	if (client)
+		return plx_dma_client_tx_status(client, cookie, last, used);
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3, 13, 0)
 	if (DMA_SUCCESS != plx_dma_cookie_status(ch, cookie, last, used))
 #else
 	if (DMA_COMPLETE != plx_dma_cookie_status(ch, cookie, last, used))
 #endif
 		plx_dma_cleanup(plx_ch);
-	return plx_dma_cookie_status(ch, cookie, last, used);
+	status = plx_dma_cookie_status(ch, cookie, last, used);
+	if (status != DMA_IN_PROGRESS &&
+	    plx_dma_cookie_failed(cookie, plx_ch->err_cookie_lo,
+				  plx_ch->err_cookie_hi))
+		return DMA_ERROR;
+	return status;
 }
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 0, 0)
@@ -505,25 +663,31 @@ plx_dma_tx_status(struct dma_chan *ch, dma_cookie_t cookie,
 }
 #endif
 
+/*
+ * Called with prep_lock held, possibly from a completion callback of a
+ * running cleanup batch. The ring is never waited for here: when a batch
+ * in another context holds the reaped descriptors the prep fails with
+ * -EBUSY and the client resubmits once its completions come in.
+ */
 static int plx_dma_avail_desc_ring_space(struct plx_dma_chan *ch, int required)
 {
 	struct device *dev = plx_dma_ch_to_device(ch);
 	int count;
 
-	count = plx_dma_ring_count(ch->head, ch->last_tail);
+	count = plx_dma_ring_count(ch, ch->head, ch->last_tail);
 	if (count < required) {
 		dev_err(dev, "%s ::: %d %d %d %d\n", __func__, count, required,
 				ch->head, ch->last_tail);
 
-		plx_dma_issue_pending(&ch->chan);
+		plx_dma_hw_issue_pending(ch);
 		plx_dma_cleanup(ch);
-		count = plx_dma_ring_count(ch->head, ch->last_tail);
+		count = plx_dma_ring_count(ch, ch->head, ch->last_tail);
 	}
 
 	if (count < required) {
 		dev_info(dev, "%s count %d reqd %d head %d tail %d\n",
 			 __func__, count, required, ch->head, ch->last_tail);
-		return -ENOMEM;
+		return READ_ONCE(ch->cleanup_busy) ? -EBUSY : -ENOMEM;
 	}
 	return count;
 }
@@ -649,7 +813,7 @@ static inline struct dma_async_tx_descriptor *
 allocate_tx(struct plx_dma_chan *ch, unsigned long flags)
 {
 	/* index of the final desc which is or will be programmed */
-	u32 idx = flags ? ch->head : plx_dma_ring_dec(ch->head);
+	u32 idx = flags ? ch->head : plx_dma_ring_dec(ch, ch->head);
 	struct dma_async_tx_descriptor *tx = &ch->tx_array[idx];
 
 	dma_async_tx_descriptor_init(tx, &ch->chan);
@@ -658,13 +822,33 @@ allocate_tx(struct plx_dma_chan *ch, unsigned long flags)
 	return tx;
 }
 
+struct dma_async_tx_descriptor *
+plx_dma_hw_prep_memcpy(struct plx_dma_chan *plx_ch, dma_addr_t dma_dest,
+		       dma_addr_t dma_src, size_t len, unsigned long flags)
+{
+	struct device *dev = plx_dma_ch_to_device(plx_ch);
+	int result;
+
+	spin_lock(&plx_ch->prep_lock);
+	if (READ_ONCE(plx_ch->recovering)) {
+		spin_unlock(&plx_ch->prep_lock);
+		dev_dbg(dev, "%s channel recovery in progress\n", __func__);
+		return NULL;
+	}
+	result = plx_dma_prog_memcpy_desc(plx_ch, dma_src, dma_dest, len, flags);
+	if (result >= 0)
+		return allocate_tx(plx_ch, flags);
+
+	dev_err(dev, "Error enqueueing dma, error=%d\n", result);
+	spin_unlock(&plx_ch->prep_lock);
+	return NULL;
+}
+
 static struct dma_async_tx_descriptor *
 plx_dma_prep_memcpy_lock(struct dma_chan *ch, dma_addr_t dma_dest,
 			 dma_addr_t dma_src, size_t len, unsigned long flags)
 {
-	struct plx_dma_chan *plx_ch = to_plx_dma_chan(ch);
-	struct device *dev = plx_dma_ch_to_device(plx_ch);
-	int result;
+	struct plx_dma_client *client = to_plx_dma_client(ch);
 
 	if ((dma_src & PLX_DMA_ALIGN_MASK) ||
 		(dma_dest & PLX_DMA_ALIGN_MASK) ||
@@ -674,14 +858,12 @@ plx_dma_prep_memcpy_lock(struct dma_chan *ch, dma_addr_t dma_dest,
 				__func__, PLX_DMA_ALIGN_BYTES, dma_src, dma_dest, len);
 	}
 
-	spin_lock(&plx_ch->prep_lock);
-	result = plx_dma_prog_memcpy_desc(plx_ch, dma_src, dma_dest, len, flags);
-	if (result >= 0)
-		return allocate_tx(plx_ch, flags);
+	if (client)
+		return plx_dma_client_prep_memcpy(client, dma_dest, dma_src,
+						  len, flags);
 
-	dev_err(dev, "Error enqueueing dma, error=%d\n", result);
-	spin_unlock(&plx_ch->prep_lock);
-	return NULL;
+	return plx_dma_hw_prep_memcpy(to_plx_dma_chan(ch), dma_dest, dma_src,
+				      len, flags);
 }
 
 static struct dma_async_tx_descriptor *
@@ -698,6 +880,165 @@ static u32 plx_dma_ack_interrupt(struct plx_dma_chan *ch)
 	return intr_reg;
 }
 
+/**
+ * plx_dma_chan_recover - abort a hung channel and bring it back to work
+ * @ch: PLX DMA channel
+ *
+ * Descriptors completed before the hang are reported as usual. The ones
+ * still in the ring are completed with an error: callback_result gets
+ * DMA_TRANS_ABORTED and tx_status returns DMA_ERROR for their cookies.
+ * Requests queued on client channels and not started yet are kept and go
+ * to the reinitialized ring. Preps fail while the recovery runs.
+ */
+static void plx_dma_chan_recover(struct plx_dma_chan *ch)
+{
+	struct plx_dma_device *plx_dma_dev = to_plx_dma_dev(ch);
+	struct device *dev = plx_dma_ch_to_device(ch);
+	struct dma_async_tx_descriptor *tx;
+	dma_cookie_t err_lo = 0, err_hi = 0;
+	bool failing = false;
+	u32 ctrl_reg, last_tail;
+	int i;
+
+	dev_err(dev, "%s head %d tail %d hw %d ctrl 0x%x\n", __func__,
+		ch->head, ch->last_tail, plx_get_hw_last_desc(ch),
+		plx_dma_ch_reg_read(ch, PLX_DMA_CTRL_STATUS));
+
+	/* Fail new preps and wait for the ones in progress to be submitted */
+	WRITE_ONCE(ch->recovering, true);
+	spin_lock(&ch->prep_lock);
+	spin_unlock(&ch->prep_lock);
+
+	plx_dma_chan_mask_intr(ch);
+	plx_dma_ch_reg_write(ch, PLX_DMA_CTRL_STATUS,
+			     ch->ctrl_reg | PLX_DMA_CTRL_ABORT);
+	for (i = 0; i < PLX_DMA_ABORT_TO_US / 100; i++) {
+		ctrl_reg = plx_dma_ch_reg_read(ch, PLX_DMA_CTRL_STATUS);
+		if (ctrl_reg & PLX_DMA_CTRL_ABORT_DONE_STATUS)
+			break;
+		usleep_range(100, 200);
+	}
+	if (!(ctrl_reg & PLX_DMA_CTRL_ABORT_DONE_STATUS))
+		dev_err(dev, "%s abort timed out 0x%x\n", __func__, ctrl_reg);
+	plx_dma_ch_reg_write(ch, PLX_DMA_CTRL_STATUS,
+			     ch->ctrl_reg | PLX_DMA_CTRL_ABORT_DONE_STATUS);
+
+	spin_lock(&ch->cleanup_lock);
+	while (ch->cleanup_busy) {
+		spin_unlock(&ch->cleanup_lock);
+		usleep_range(10, 20);
+		spin_lock(&ch->cleanup_lock);
+	}
+	/* Report descriptors written back before the abort as done */
+	for (last_tail = ch->last_tail; last_tail != ch->head;
+	     last_tail = plx_dma_ring_inc(ch, last_tail)) {
+		if (READ_ONCE(ch->desc_ring[last_tail].dw0) & PLX_DESC_VALID)
+			break;
+		tx = &ch->tx_array[last_tail];
+		if (tx->cookie) {
+			completed_cookie_container(tx->chan)->completed_cookie =
+				tx->cookie;
+			tx->cookie = 0;
+			plx_dma_tx_callback(tx, false);
+		}
+	}
+
+	if (plx_dma_dev->num_clients)
+		plx_dma_sched_abort(plx_dma_dev);
+
+	/* And everything after the first unfinished one as failed */
+	for (; last_tail != ch->head; last_tail = plx_dma_ring_inc(ch, last_tail)) {
+		tx = &ch->tx_array[last_tail];
+		if (!tx->cookie)
+			continue;
+		if (!failing) {
+			failing = true;
+			err_lo = completed_cookie_container(tx->chan)->completed_cookie;
+		}
+		err_hi = tx->cookie;
+		completed_cookie_container(tx->chan)->completed_cookie = tx->cookie;
+		tx->cookie = 0;
+		plx_dma_tx_callback(tx, true);
+	}
+	if (failing) {
+		ch->err_cookie_lo = err_lo;
+		ch->err_cookie_hi = err_hi;
+	}
+	memset(ch->desc_ring, 0, ch->ring_size * sizeof(*ch->desc_ring));
+	smp_mb();
+	ch->last_tail = 0;
+	ch->done_tail = 0;
+	ch->head = 0;
+	spin_unlock(&ch->cleanup_lock);
+
+	plx_dma_ack_interrupt(ch);
+	ch->dma_hang = false;
+	plx_dma_chan_setup(ch);
+	ch->wd_tail = 0;
+	ch->wd_stalls = 0;
+	WRITE_ONCE(ch->recovering, false);
+
+	/* plx_dma_enable_chan() found the engine still in progress */
+	if (ch->dma_hang) {
+		if (++ch->recover_fails >= PLX_DMA_RECOVER_RETRIES)
+			dev_err(dev, "%s failed, PLX reset required\n", __func__);
+		return;
+	}
+
+	ch->recover_fails = 0;
+	ch->recoveries++;
+	dev_info(dev, "%s channel recovered, %d cookies failed\n", __func__,
+		 failing ? err_hi - err_lo : 0);
+
+	if (plx_dma_dev->num_clients)
+		plx_dma_sched_run(plx_dma_dev);
+}
+
+/*
+ * Watchdog of the descriptor ring. A ring not moving for hang_timeout_ms,
+ * or dma_hang reported by the interrupt thread, triggers a recovery.
+ */
+static void plx_dma_hang_work(struct work_struct *work)
+{
+	struct plx_dma_chan *ch = container_of(to_delayed_work(work),
+					       struct plx_dma_chan, hang_work);
+	u32 tail;
+
+	if (!READ_ONCE(hang_timeout_ms))
+		goto out;
+
+	if (ch->dma_hang) {
+		if (ch->recover_fails < PLX_DMA_RECOVER_RETRIES)
+			plx_dma_chan_recover(ch);
+		goto out;
+	}
+
+	if (READ_ONCE(ch->last_tail) == READ_ONCE(ch->head)) {
+		ch->wd_stalls = 0;
+		goto out;
+	}
+
+	/* Reap completions of a lost interrupt before judging progress */
+	plx_dma_cleanup(ch);
+	tail = READ_ONCE(ch->last_tail);
+	if (tail != ch->wd_tail || tail == READ_ONCE(ch->head)) {
+		ch->wd_tail = tail;
+		ch->wd_stalls = 0;
+		goto out;
+	}
+
+	/* The first stall may be a descriptor never issued, kick the engine */
+	if (!ch->wd_stalls++) {
+		plx_dma_hw_issue_pending(ch);
+	} else if (ch->wd_stalls >= PLX_DMA_WD_PERIODS) {
+		dev_err(plx_dma_ch_to_device(ch), "%s no progress for %u ms\n",
+			__func__, hang_timeout_ms);
+		plx_dma_chan_recover(ch);
+	}
+out:
+	schedule_delayed_work(&ch->hang_work, plx_dma_wd_period());
+}
+
 static irqreturn_t plx_dma_thread_fn(int irq, void *data)
 {
 	struct plx_dma_device *plx_dma_dev = ((struct plx_dma_device *)data);
@@ -741,6 +1082,17 @@ static irqreturn_t plx_dma_thread_fn(int irq, void *data)
 	return IRQ_HANDLED;
 }
 
+#ifdef PLX_DMA_EMUL
+static int plx_dma_setup_irq(struct plx_dma_device *plx_dma_dev)
+{
+	return plx_dma_emul_setup_irq(plx_dma_dev, plx_dma_thread_fn);
+}
+
+static inline void plx_dma_free_irq(struct plx_dma_device *plx_dma_dev)
+{
+	plx_dma_emul_free_irq(plx_dma_dev);
+}
+#else
 static irqreturn_t plx_dma_intr_handler(int irq, void *data)
 {
 	/* ((struct plx_dma_device *)data);*/
@@ -778,6 +1130,7 @@ static inline void plx_dma_free_irq(struct plx_dma_device *plx_dma_dev)
 	if (pci_dev_msi_enabled(pdev))
 		pci_disable_msi(pdev);
 }
+#endif /* PLX_DMA_EMUL */
 
 static int plx_dma_init(struct plx_dma_device *plx_dma_dev)
 {
@@ -792,8 +1145,16 @@ static int plx_dma_init(struct plx_dma_device *plx_dma_dev)
 	}
 	ch = &plx_dma_dev->plx_chan;
 	ch->ch_base_addr = 0x200;
+	ch->ring_size = rounddown_pow_of_two(clamp_t(unsigned int,
+						     desc_ring_size,
+						     PLX_DMA_DESC_RX_MIN,
+						     PLX_DMA_DESC_RX_MAX));
+	if (ch->ring_size != desc_ring_size)
+		dev_info(plx_dma_dev->dma_dev.dev, "%s desc_ring_size %u\n",
+			 __func__, ch->ring_size);
 	spin_lock_init(&ch->cleanup_lock);
 	spin_lock_init(&ch->prep_lock);
+	INIT_DELAYED_WORK(&ch->hang_work, plx_dma_hang_work);
 error:
 	return rc;
 }
@@ -807,6 +1168,7 @@ static int plx_register_dma_device(struct plx_dma_device *plx_dma_dev)
 {
 	struct dma_device *dma_dev = &plx_dma_dev->dma_dev;
 	struct plx_dma_chan *ch;
+	int i;
 
 	dma_cap_zero(dma_dev->cap_mask);
 
@@ -832,7 +1194,22 @@ static int plx_register_dma_device(struct plx_dma_device *plx_dma_dev)
 	ch->chan.cookie = DMA_MIN_COOKIE;
 	completed_cookie_container(&ch->chan)->completed_cookie = DMA_MIN_COOKIE;
 
-	list_add_tail(&ch->chan.device_node, &dma_dev->channels);
+	/*
+	 * With scheduling enabled only the client channels are exposed, the
+	 * hardware channel is driven by the scheduler.
+	 */
+	if (!plx_dma_dev->num_clients) {
+		list_add_tail(&ch->chan.device_node, &dma_dev->channels);
+		return dma_async_device_register(dma_dev);
+	}
+
+	for (i = 0; i < plx_dma_dev->num_clients; i++) {
+		struct dma_chan *chan = &plx_dma_dev->clients[i].chan;
+
+		chan->device = dma_dev;
+		list_add_tail(&chan->device_node, &dma_dev->channels);
+	}
+	dma_dev->chancnt = plx_dma_dev->num_clients;
 	return dma_async_device_register(dma_dev);
 }
 
@@ -841,30 +1218,40 @@ int plx_dma_probe(struct plx_dma_device *plx_dma_dev)
 	struct dma_device *dma_dev;
 	int rc = -EINVAL;
 
+	/* dma_dev->dev is set up by the bus glue */
 	dma_dev = &plx_dma_dev->dma_dev;
-	dma_dev->dev = &plx_dma_dev->pdev->dev;
 
 	/* PLX 87XX has one DMA channel per function */
 	dma_dev->chancnt = PLX_8733_NUM_CHAN;
 
-	plx_dma_dev->max_xfer_size = PLX_DESC_SIZE_MASK;
+	if (!plx_dma_dev->max_xfer_size)
+		plx_dma_dev->max_xfer_size = PLX_DESC_SIZE_MASK;
 
 	rc = plx_dma_init(plx_dma_dev);
 	if (rc) {
-		dev_err(&plx_dma_dev->pdev->dev,
+		dev_err(dma_dev->dev,
 			"%s %d rc %d\n", __func__, __LINE__, rc);
 		goto init_error;
 	}
 
+	rc = plx_dma_sched_init(plx_dma_dev);
+	if (rc) {
+		dev_err(dma_dev->dev,
+			"%s %d rc %d\n", __func__, __LINE__, rc);
+		goto sched_error;
+	}
+
 	rc = plx_register_dma_device(plx_dma_dev);
 	if (rc) {
-		dev_err(&plx_dma_dev->pdev->dev,
+		dev_err(dma_dev->dev,
 			"%s %d rc %d\n", __func__, __LINE__, rc);
 		goto reg_error;
 	}
 	plx_debugfs_init(plx_dma_dev);
 	return rc;
 reg_error:
+	plx_dma_sched_uninit(plx_dma_dev);
+sched_error:
 	plx_dma_uninit(plx_dma_dev);
 init_error:
 	return rc;
@@ -878,5 +1265,7 @@ static void plx_unregister_dma_device(struct plx_dma_device *plx_dma_dev)
 void plx_dma_remove(struct plx_dma_device *plx_dma_dev)
 {
 	plx_unregister_dma_device(plx_dma_dev);
+	plx_dma_bench_uninit(plx_dma_dev);
+	plx_dma_sched_uninit(plx_dma_dev);
 	plx_dma_uninit(plx_dma_dev);
 }
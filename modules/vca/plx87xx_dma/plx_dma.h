@@ -24,6 +24,8 @@
 #include <linux/seq_file.h>
 #include <linux/debugfs.h>
 #include <linux/version.h>
+#include <linux/interrupt.h>
+#include <linux/workqueue.h>
 
 extern struct dentry *plx_dma_dbg;
 
@@ -31,11 +33,15 @@ extern struct dentry *plx_dma_dbg;
 
 #define PLX_8733_NUM_CHAN	1
 #define PLX_DMA_DESC_RX_SIZE	(2 * 1024)
+/* Limits of the desc_ring_size module parameter */
+#define PLX_DMA_DESC_RX_MIN	64
+#define PLX_DMA_DESC_RX_MAX	(64 * 1024)
 #define PLX_DMA_ALIGN_SHIFT	6
 #define PLX_DMA_ALIGN_BYTES	(1 << (PLX_DMA_ALIGN_SHIFT))
 #define PLX_DMA_ALIGN_MASK	((PLX_DMA_ALIGN_BYTES) - 1)
 #define PLX_POLL_TIMEOUT	500000
 #define PLX_DMA_PAUSE_TO	0x05
+#define PLX_DMA_MAX_CLIENTS	4
 
 /* DMA Descriptor related flags */
 #define PLX_DESC_VALID		(1UL << 31)
@@ -147,22 +153,38 @@ struct plx_dma_desc {
  *
  * @ch_num: channel number
  * @last_tail: cached value of descriptor ring tail
+ * @done_tail: end of the descriptors found completed, callbacks of the
+ *	range from last_tail are pending
  * @head: index of next descriptor in desc_ring
+ * @ring_size: descriptors in desc_ring, power of 2
  * @chan: dma engine api channel
  * @desc_ring: dma descriptor ring
  * @desc_ring_da: DMA address of desc_ring
  * @ch_base_addr: MMIO base address for the channel
  * @ctrl_reg: Configuration bits in register PLX_DMA_CTRL_STATUS
  * @tx_array: array of async_tx
- * @cleanup_lock: lock held when processing completed tx
+ * @cleanup_lock: lock held when looking for completed tx
+ * @cleanup_busy: a cleanup is running callbacks of completed tx
+ * @cleanup_batches: cleanup passes which reclaimed descriptors
  * @prep_lock: lock held in prep_memcpy & released in tx_submit
  * @dma_hang: detected dma hang error
+ * @recovering: channel is being aborted and reinitialized
+ * @hang_work: watchdog checking progress of the descriptor ring
+ * @wd_tail: last_tail seen by the previous watchdog run
+ * @wd_stalls: watchdog runs without progress of last_tail
+ * @recover_fails: consecutive recoveries which failed to restart the engine
+ * @recoveries: successful hang recoveries
+ * @err_cookie_lo: cookies in (err_cookie_lo, err_cookie_hi] failed on
+ *	the last recovery
+ * @err_cookie_hi: see err_cookie_lo
  * @cleanup: cleanup function to move the SW tail upto HW the tail
  */
 struct plx_dma_chan {
 	int ch_num;
 	u32 last_tail;
+	u32 done_tail;
 	u32 head;
+	u32 ring_size;
 	struct dma_chan chan;
 	struct plx_dma_desc *desc_ring;
 	dma_addr_t desc_ring_da;
@@ -170,8 +192,18 @@ struct plx_dma_chan {
 	u32 ctrl_reg;
 	struct dma_async_tx_descriptor *tx_array;
 	spinlock_t cleanup_lock;
+	bool cleanup_busy;
+	unsigned long cleanup_batches;
 	spinlock_t prep_lock;
 	bool dma_hang;
+	bool recovering;
+	struct delayed_work hang_work;
+	u32 wd_tail;
+	u32 wd_stalls;
+	u32 recover_fails;
+	u32 recoveries;
+	dma_cookie_t err_cookie_lo;
+	dma_cookie_t err_cookie_hi;
 	bool dbg_flush;
 	u32 dbg_dma_hold_cnt;
 
@@ -182,6 +214,74 @@ struct plx_dma_chan {
 #endif
 };
 
+/*
+ * plx_dma_sched_req - request queued on a scheduled client channel
+ *
+ * @txd: async tx descriptor returned to the DMA consumer
+ * @list: entry on the client free list or pending queue
+ * @client: owning client channel
+ * @src: source address of the part not yet programmed to the ring
+ * @dst: destination address of the part not yet programmed to the ring
+ * @len: bytes not yet programmed to the ring
+ * @size: total size of the request
+ * @chunks: chunks programmed to the ring and not yet completed
+ * @queued: request still has chunks to be programmed
+ * @failed: chunks of the request were dropped by a channel recovery
+ */
+struct plx_dma_sched_req {
+	struct dma_async_tx_descriptor txd;
+	struct list_head list;
+	struct plx_dma_client *client;
+	dma_addr_t src;
+	dma_addr_t dst;
+	size_t len;
+	size_t size;
+	u32 chunks;
+	bool queued;
+	bool failed;
+};
+
+/*
+ * plx_dma_client - virtual DMA channel sharing the hardware ring
+ *
+ * @chan: dma engine api channel handed out to a DMA consumer
+ * @weight: share of the hardware ring relative to other clients
+ * @max_chunk: largest piece programmed to the ring at once
+ * @deficit: bytes the client may still program in this round
+ * @lock: lock held in prep_memcpy & released in tx_submit
+ * @free: unused requests
+ * @queue: submitted requests with chunks left to program
+ * @inflight: requests fully programmed and not yet completed
+ * @active: entry on the scheduler list of clients with queued work
+ * @reqs: request pool
+ * @pending: submitted requests not yet completed
+ * @bytes: bytes transferred, for debugfs
+ * @completed: requests completed, for debugfs
+ * @err_cookie_lo: cookies in (err_cookie_lo, err_cookie_hi] failed on
+ *	the last recovery of the hardware channel
+ * @err_cookie_hi: see err_cookie_lo
+ */
+struct plx_dma_client {
+	struct dma_chan chan;
+	u32 weight;
+	size_t max_chunk;
+	long deficit;
+	spinlock_t lock;
+	struct list_head free;
+	struct list_head queue;
+	struct list_head inflight;
+	struct list_head active;
+	struct plx_dma_sched_req *reqs;
+	atomic_t pending;
+	u64 bytes;
+	u64 completed;
+	dma_cookie_t err_cookie_lo;
+	dma_cookie_t err_cookie_hi;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 0, 0)
+	dma_cookie_t completed_cookie;
+#endif
+};
+
 /*
  * plx_dma_device - Per PLX DMA device driver specific data structures
  *
@@ -191,6 +291,14 @@ struct plx_dma_chan {
  * @plx_chan: Array of PLX DMA channels
  * @max_xfer_size: maximum transfer size per dma descriptor
  * @dbg_dir: debugfs directory
+ * @clients: client channels multiplexed onto plx_chan, NULL if disabled
+ * @num_clients: number of entries in clients
+ * @hw_users: allocated channels using the hardware ring
+ * @sched_lock: protects client queues and the scheduler state below
+ * @sched_active: clients with queued work, in round robin order
+ * @sched_inflight: chunks programmed to the ring and not yet completed
+ * @sched_work: runs the scheduler after a cleanup released ring space
+ * @bench: state of the debugfs DMA benchmark
  */
 struct plx_dma_device {
 	struct pci_dev *pdev;
@@ -199,6 +307,14 @@ struct plx_dma_device {
 	struct plx_dma_chan plx_chan;
 	size_t max_xfer_size;
 	struct dentry *dbg_dir;
+	struct plx_dma_client *clients;
+	int num_clients;
+	int hw_users;
+	spinlock_t sched_lock;
+	struct list_head sched_active;
+	u32 sched_inflight;
+	struct work_struct sched_work;
+	struct plx_dma_bench *bench;
 };
 
 static inline struct plx_dma_device *to_plx_dma_dev(struct plx_dma_chan *ch)
@@ -213,6 +329,25 @@ static inline struct plx_dma_chan *to_plx_dma_chan(struct dma_chan *ch)
 	return container_of(ch, struct plx_dma_chan, chan);
 }
 
+static inline struct plx_dma_device *chan_to_plx_dma_dev(struct dma_chan *ch)
+{
+	return container_of(ch->device, struct plx_dma_device, dma_dev);
+}
+
+/* Returns NULL for the hardware channel itself */
+static inline struct plx_dma_client *to_plx_dma_client(struct dma_chan *ch)
+{
+	if (ch == &chan_to_plx_dma_dev(ch)->plx_chan.chan)
+		return NULL;
+	return container_of(ch, struct plx_dma_client, chan);
+}
+
+/* Channel used by debugfs tests, the first client when scheduling */
+static inline struct dma_chan *plx_dma_dbg_chan(struct plx_dma_device *dev)
+{
+	return dev->num_clients ? &dev->clients[0].chan : &dev->plx_chan.chan;
+}
+
 static inline struct device *plx_dma_ch_to_device(struct plx_dma_chan *ch)
 {
 	return to_plx_dma_dev(ch)->dma_dev.dev;
@@ -223,12 +358,20 @@ static inline bool plx_get_dma_hang(struct plx_dma_chan *ch)
 	return ch->dma_hang;
 }
 
-static inline int plx_dma_ring_count(u32 head, u32 tail)
+/* Was the cookie failed by the last channel recovery */
+static inline bool plx_dma_cookie_failed(dma_cookie_t cookie,
+					 dma_cookie_t lo, dma_cookie_t hi)
+{
+	return lo != hi &&
+		dma_async_is_complete(cookie, lo, hi) == DMA_IN_PROGRESS;
+}
+
+static inline int plx_dma_ring_count(struct plx_dma_chan *ch, u32 head, u32 tail)
 {
 	int count;
 
 	if (head >= tail)
-		count = (tail - 0) + (PLX_DMA_DESC_RX_SIZE - head);
+		count = (tail - 0) + (ch->ring_size - head);
 	else
 		count = tail - head;
 	return count - 1;
@@ -243,6 +386,44 @@ u32 plx_dma_ch_reg_read(struct plx_dma_chan *ch, u32 offset);
 u32 plx_get_hw_last_desc(struct plx_dma_chan *ch);
 u32 plx_get_hw_next_desc(struct plx_dma_chan *ch);
 void plx_debugfs_init(struct plx_dma_device *plx_dma_dev);
+int plx_dma_hw_get(struct plx_dma_device *plx_dma_dev);
+void plx_dma_hw_put(struct plx_dma_device *plx_dma_dev);
+struct dma_async_tx_descriptor *
+plx_dma_hw_prep_memcpy(struct plx_dma_chan *ch, dma_addr_t dma_dest,
+		       dma_addr_t dma_src, size_t len, unsigned long flags);
+void plx_dma_hw_issue_pending(struct plx_dma_chan *ch);
+void plx_dma_tx_callback(struct dma_async_tx_descriptor *tx, bool failed);
+
+#ifdef PLX_DMA_EMUL
+/* plx_dma_emul/plx_dma_emul.c */
+u32 plx_dma_emul_reg_read(struct plx_dma_device *pdma, u32 offset);
+void plx_dma_emul_reg_write(struct plx_dma_device *pdma, u32 offset,
+			    u32 value);
+int plx_dma_emul_setup_irq(struct plx_dma_device *pdma,
+			   irq_handler_t thread_fn);
+void plx_dma_emul_free_irq(struct plx_dma_device *pdma);
+#endif
+
+/* plx_dma_sched.c */
+int plx_dma_sched_init(struct plx_dma_device *plx_dma_dev);
+void plx_dma_sched_uninit(struct plx_dma_device *plx_dma_dev);
+void plx_dma_sched_run(struct plx_dma_device *plx_dma_dev);
+void plx_dma_sched_kick(struct plx_dma_device *plx_dma_dev);
+void plx_dma_sched_abort(struct plx_dma_device *plx_dma_dev);
+int plx_dma_client_alloc_resources(struct plx_dma_client *client);
+void plx_dma_client_free_resources(struct plx_dma_client *client);
+struct dma_async_tx_descriptor *
+plx_dma_client_prep_memcpy(struct plx_dma_client *client, dma_addr_t dma_dest,
+			   dma_addr_t dma_src, size_t len, unsigned long flags);
+enum dma_status plx_dma_client_tx_status(struct plx_dma_client *client,
+					 dma_cookie_t cookie,
+					 dma_cookie_t *last, dma_cookie_t *used);
+void plx_dma_sched_debugfs_show(struct seq_file *s,
+				struct plx_dma_device *plx_dma_dev);
+
+/* plx_dma_bench.c */
+void plx_dma_bench_init(struct plx_dma_device *plx_dma_dev);
+void plx_dma_bench_uninit(struct plx_dma_device *plx_dma_dev);
 
 #ifdef PLX_DMA_DEBUG
 struct plx_debug {
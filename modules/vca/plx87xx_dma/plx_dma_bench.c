@@ -0,0 +1,713 @@
+/*
+ * Intel VCA Software Stack (VCASS)
+ *
+ * Copyright(c) 2015-2017 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * PLX87XX DMA driver - DMA benchmark
+ *
+ * The "bench" debugfs file runs memcpy transfers through the dmaengine
+ * interface of the device, so the same numbers are collected for the PLX
+ * channel, the client channels of the scheduler and the emulated channel.
+ * Parameters are written as key=value pairs, "run" starts the benchmark
+ * and blocks until it is done:
+ *   sizes=4K,64K,1M   transfer sizes, each one measured separately
+ *   qdepth=N          transfers kept in flight by each thread
+ *   threads=N         submitting threads, spread over client channels
+ *   duration=MS       measure time per size
+ *   align=N           offset of the buffers from a page boundary
+ *   dir=local|read|write
+ *                     local - both buffers in local memory,
+ *                     read - from peer to local, write - local to peer
+ *   peer=ADDR peer_size=N
+ *                     DMA address and size of the peer buffer, e.g. the
+ *                     test buffer of the vop debugfs
+ *   mix=0|1           1 - run all sizes at once, thread i submits
+ *                     sizes[i % number of sizes], e.g. sizes=4K,1M
+ *                     threads=2 shows the latency of small transfers of
+ *                     one client channel next to large ones of another
+ * Reading the file prints the parameters and one line of key=value
+ * results per size, or per thread in mixed mode: bandwidth in GB/s, IOPS
+ * and latency percentiles in ns.
+ */
+#include <linux/slab.h>
+#include <linux/kthread.h>
+#include <linux/wait.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/uaccess.h>
+#include <linux/seq_file.h>
+#include <linux/dma-mapping.h>
+#include <linux/version.h>
+#include "plx_dma.h"
+
+#define PLX_DMA_BENCH_MAX_SIZES		16
+#define PLX_DMA_BENCH_MAX_THREADS	8
+#define PLX_DMA_BENCH_MAX_QDEPTH	256
+#define PLX_DMA_BENCH_MAX_XFER		(4 * 1024 * 1024)
+#define PLX_DMA_BENCH_DRAIN_MS		5000
+/* Latency histogram, 16 linear buckets in each power of 2 of ns */
+#define PLX_DMA_BENCH_SUB_BITS		4
+#define PLX_DMA_BENCH_SUB_MASK		((1 << PLX_DMA_BENCH_SUB_BITS) - 1)
+#define PLX_DMA_BENCH_BUCKETS		((64 - PLX_DMA_BENCH_SUB_BITS + 1) << \
+					 PLX_DMA_BENCH_SUB_BITS)
+
+enum plx_dma_bench_dir {
+	PLX_DMA_BENCH_LOCAL,
+	PLX_DMA_BENCH_READ,
+	PLX_DMA_BENCH_WRITE,
+};
+
+static const char * const plx_dma_bench_dir_name[] = {
+	[PLX_DMA_BENCH_LOCAL] = "local",
+	[PLX_DMA_BENCH_READ] = "read",
+	[PLX_DMA_BENCH_WRITE] = "write",
+};
+
+/* Latency percentiles reported, in 1/1000 */
+static const unsigned int plx_dma_bench_pct[] = { 500, 900, 990, 999 };
+static const char * const plx_dma_bench_pct_name[] = {
+	"p50", "p90", "p99", "p999"
+};
+
+struct plx_dma_bench_config {
+	size_t sizes[PLX_DMA_BENCH_MAX_SIZES];
+	int num_sizes;
+	unsigned int qdepth;
+	unsigned int threads;
+	unsigned int duration_ms;
+	size_t align;
+	enum plx_dma_bench_dir dir;
+	u64 peer;
+	size_t peer_size;
+	bool mix;
+};
+
+struct plx_dma_bench_result {
+	int thread;
+	size_t size;
+	u64 bytes;
+	u64 ios;
+	u64 errors;
+	u64 time_ns;
+	u64 lat_ns[ARRAY_SIZE(plx_dma_bench_pct)];
+	u64 lat_max_ns;
+};
+
+/*
+ * plx_dma_bench - benchmark state of a device
+ *
+ * @lock: serializes runs and access to the results
+ * @cfg: parameters of the next run
+ * @results: results of the last run, one per size or thread
+ * @num_results: entries in results
+ * @status: error of the last run
+ */
+struct plx_dma_bench {
+	struct mutex lock;
+	struct plx_dma_bench_config cfg;
+	struct plx_dma_bench_result results[PLX_DMA_BENCH_MAX_SIZES];
+	int num_results;
+	int status;
+};
+
+struct plx_dma_bench_thread;
+
+struct plx_dma_bench_slot {
+	struct plx_dma_bench_thread *t;
+	u64 start_ns;
+};
+
+/*
+ * plx_dma_bench_thread - one submitting thread
+ *
+ * Completed slots are put on the ready stack by the DMA callback and
+ * resubmitted by the thread. The counters and the histogram are updated
+ * by the callback with lock held.
+ */
+struct plx_dma_bench_thread {
+	const struct plx_dma_bench_config *cfg;
+	struct dma_chan *chan;
+	size_t size;
+	dma_addr_t src;
+	dma_addr_t dst;
+	spinlock_t lock;
+	wait_queue_head_t wait;
+	struct completion done;
+	struct plx_dma_bench_slot *slots;
+	unsigned int *ready;
+	unsigned int nr_ready;
+	u32 *hist;
+	u64 bytes;
+	u64 ios;
+	u64 errors;
+	u64 lat_max_ns;
+	u64 time_ns;
+	int rc;
+};
+
+static inline u64 plx_dma_bench_now(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
+static unsigned int plx_dma_bench_bucket(u64 ns)
+{
+	unsigned int shift;
+
+	if (ns <= PLX_DMA_BENCH_SUB_MASK)
+		return ns;
+	shift = fls64(ns) - 1 - PLX_DMA_BENCH_SUB_BITS;
+	return ((shift + 1) << PLX_DMA_BENCH_SUB_BITS) +
+		((ns >> shift) & PLX_DMA_BENCH_SUB_MASK);
+}
+
+/* Lower bound of the bucket */
+static u64 plx_dma_bench_bucket_ns(unsigned int bucket)
+{
+	unsigned int shift;
+
+	if (bucket <= PLX_DMA_BENCH_SUB_MASK)
+		return bucket;
+	shift = (bucket >> PLX_DMA_BENCH_SUB_BITS) - 1;
+	return (u64)((1 << PLX_DMA_BENCH_SUB_BITS) |
+		     (bucket & PLX_DMA_BENCH_SUB_MASK)) << shift;
+}
+
+static void plx_dma_bench_done(struct plx_dma_bench_slot *slot, bool failed)
+{
+	struct plx_dma_bench_thread *t = slot->t;
+	u64 lat = plx_dma_bench_now() - slot->start_ns;
+
+	spin_lock(&t->lock);
+	if (failed) {
+		t->errors++;
+	} else {
+		t->ios++;
+		t->bytes += t->size;
+		t->hist[plx_dma_bench_bucket(lat)]++;
+		if (lat > t->lat_max_ns)
+			t->lat_max_ns = lat;
+	}
+	t->ready[t->nr_ready++] = slot - t->slots;
+	spin_unlock(&t->lock);
+	wake_up(&t->wait);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 9, 0)
+static void plx_dma_bench_callback(void *arg,
+				   const struct dmaengine_result *result)
+{
+	plx_dma_bench_done(arg, result->result != DMA_TRANS_NOERROR);
+}
+#else
+static void plx_dma_bench_callback(void *arg)
+{
+	plx_dma_bench_done(arg, false);
+}
+#endif
+
+static int plx_dma_bench_submit(struct plx_dma_bench_thread *t,
+				unsigned int idx)
+{
+	struct dma_async_tx_descriptor *tx;
+	struct plx_dma_bench_slot *slot = &t->slots[idx];
+
+	tx = t->chan->device->device_prep_dma_memcpy(t->chan, t->dst, t->src,
+						     t->size,
+						     DMA_PREP_INTERRUPT);
+	if (!tx)
+		return -ENOMEM;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 9, 0)
+	tx->callback_result = plx_dma_bench_callback;
+#else
+	tx->callback = plx_dma_bench_callback;
+#endif
+	tx->callback_param = slot;
+	slot->start_ns = plx_dma_bench_now();
+	if (dma_submit_error(tx->tx_submit(tx)))
+		return -EIO;
+	return 0;
+}
+
+static int plx_dma_bench_thread_fn(void *data)
+{
+	struct plx_dma_bench_thread *t = data;
+	unsigned long deadline = jiffies + msecs_to_jiffies(t->cfg->duration_ms);
+	unsigned int qdepth = t->cfg->qdepth;
+	u64 start = plx_dma_bench_now();
+
+	while (time_before(jiffies, deadline)) {
+		unsigned int idx;
+		bool issued = false;
+		int rc = 0;
+
+		spin_lock(&t->lock);
+		while (t->nr_ready && !rc) {
+			idx = t->ready[--t->nr_ready];
+			/* Callbacks may run from the prep when the ring is full */
+			spin_unlock(&t->lock);
+			rc = plx_dma_bench_submit(t, idx);
+			spin_lock(&t->lock);
+			if (rc)
+				t->ready[t->nr_ready++] = idx;
+			else
+				issued = true;
+		}
+		spin_unlock(&t->lock);
+
+		if (issued)
+			dma_async_issue_pending(t->chan);
+		if (rc == -EIO) {
+			t->rc = rc;
+			break;
+		}
+		/* Wait for a completion, or for ring space if the prep failed */
+		wait_event_timeout(t->wait, READ_ONCE(t->nr_ready) && !rc, 1);
+	}
+
+	dma_async_issue_pending(t->chan);
+	if (!wait_event_timeout(t->wait, READ_ONCE(t->nr_ready) == qdepth,
+				msecs_to_jiffies(PLX_DMA_BENCH_DRAIN_MS)))
+		t->rc = -ETIMEDOUT;
+	t->time_ns = plx_dma_bench_now() - start;
+
+	complete(&t->done);
+	return 0;
+}
+
+static struct dma_chan *plx_dma_bench_chan(struct plx_dma_device *plx_dma_dev,
+					   int i)
+{
+	if (plx_dma_dev->num_clients)
+		return &plx_dma_dev->clients[i % plx_dma_dev->num_clients].chan;
+	return &plx_dma_dev->plx_chan.chan;
+}
+
+/*
+ * Take the channel for the run if no consumer has it, channels in use are
+ * shared with their consumer. Returns true if the channel was taken.
+ */
+static bool plx_dma_bench_get_chan(struct dma_chan *chan, int *rc)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 13, 0)
+	if (dma_get_slave_channel(chan))
+		return true;
+#endif
+	if (!chan->client_count)
+		*rc = -ENODEV;
+	return false;
+}
+
+static void plx_dma_bench_merge(struct plx_dma_bench_result *res,
+				struct plx_dma_bench_thread *threads, int num,
+				u32 *hist)
+{
+	u64 total = 0, sum = 0;
+	unsigned int b, p = 0;
+	int i;
+
+	memset(hist, 0, PLX_DMA_BENCH_BUCKETS * sizeof(*hist));
+	for (i = 0; i < num; i++) {
+		struct plx_dma_bench_thread *t = &threads[i];
+
+		res->bytes += t->bytes;
+		res->ios += t->ios;
+		res->errors += t->errors;
+		res->time_ns = max(res->time_ns, t->time_ns);
+		res->lat_max_ns = max(res->lat_max_ns, t->lat_max_ns);
+		for (b = 0; b < PLX_DMA_BENCH_BUCKETS; b++)
+			hist[b] += t->hist[b];
+	}
+
+	for (b = 0; b < PLX_DMA_BENCH_BUCKETS; b++)
+		total += hist[b];
+	for (b = 0; b < PLX_DMA_BENCH_BUCKETS &&
+	     p < ARRAY_SIZE(plx_dma_bench_pct); b++) {
+		sum += hist[b];
+		while (p < ARRAY_SIZE(plx_dma_bench_pct) && sum &&
+		       sum * 1000 >= total * plx_dma_bench_pct[p])
+			res->lat_ns[p++] = plx_dma_bench_bucket_ns(b);
+	}
+}
+
+/* Run all threads for the duration, each with the size set in it */
+static int plx_dma_bench_run_threads(const struct plx_dma_bench_config *cfg,
+				     struct plx_dma_bench_thread *threads)
+{
+	int i, rc = 0;
+	unsigned int j;
+
+	for (i = 0; i < cfg->threads; i++) {
+		struct plx_dma_bench_thread *t = &threads[i];
+		struct task_struct *task;
+
+		t->bytes = t->ios = t->errors = 0;
+		t->lat_max_ns = t->time_ns = 0;
+		t->rc = 0;
+		memset(t->hist, 0, PLX_DMA_BENCH_BUCKETS * sizeof(*t->hist));
+		for (j = 0; j < cfg->qdepth; j++)
+			t->ready[j] = j;
+		t->nr_ready = cfg->qdepth;
+		init_completion(&t->done);
+
+		task = kthread_run(plx_dma_bench_thread_fn, t, "plx_dma_bench/%d",
+				   i);
+		if (IS_ERR(task)) {
+			rc = PTR_ERR(task);
+			break;
+		}
+	}
+
+	/* Threads are never stopped, each of them runs for the duration */
+	while (i--) {
+		wait_for_completion(&threads[i].done);
+		if (threads[i].rc && !rc)
+			rc = threads[i].rc;
+	}
+	return rc;
+}
+
+static int plx_dma_bench_run(struct plx_dma_device *plx_dma_dev,
+			     struct plx_dma_bench *bench)
+{
+	const struct plx_dma_bench_config *cfg = &bench->cfg;
+	struct device *dev = plx_dma_dev->dma_dev.dev;
+	struct plx_dma_bench_thread *threads;
+	bool taken[PLX_DMA_BENCH_MAX_THREADS] = { false };
+	size_t buf_size = cfg->align;
+	void *buf[PLX_DMA_BENCH_MAX_THREADS][2] = { { NULL } };
+	dma_addr_t buf_da[PLX_DMA_BENCH_MAX_THREADS][2] = { { 0 } };
+	u32 *hist;
+	int i, rc = 0;
+
+	for (i = 0; i < cfg->num_sizes; i++)
+		buf_size = max(buf_size, cfg->sizes[i] + cfg->align);
+	if (cfg->dir != PLX_DMA_BENCH_LOCAL && buf_size > cfg->peer_size) {
+		dev_err(dev, "%s peer buffer of %zu bytes too small\n",
+			__func__, cfg->peer_size);
+		return -EINVAL;
+	}
+
+	threads = kcalloc(cfg->threads, sizeof(*threads), GFP_KERNEL);
+	hist = kcalloc(PLX_DMA_BENCH_BUCKETS, sizeof(*hist), GFP_KERNEL);
+	if (!threads || !hist) {
+		rc = -ENOMEM;
+		goto free;
+	}
+
+	for (i = 0; i < cfg->threads; i++) {
+		struct plx_dma_bench_thread *t = &threads[i];
+		int j;
+
+		t->cfg = cfg;
+		t->chan = plx_dma_bench_chan(plx_dma_dev, i);
+		spin_lock_init(&t->lock);
+		init_waitqueue_head(&t->wait);
+		t->slots = kcalloc(cfg->qdepth, sizeof(*t->slots), GFP_KERNEL);
+		t->ready = kcalloc(cfg->qdepth, sizeof(*t->ready), GFP_KERNEL);
+		t->hist = kcalloc(PLX_DMA_BENCH_BUCKETS, sizeof(*t->hist),
+				  GFP_KERNEL);
+		if (!t->slots || !t->ready || !t->hist) {
+			rc = -ENOMEM;
+			goto free;
+		}
+		for (j = 0; j < cfg->qdepth; j++)
+			t->slots[j].t = t;
+
+		/* Thread i uses one local buffer, or two for local copies */
+		for (j = 0; j < (cfg->dir == PLX_DMA_BENCH_LOCAL ? 2 : 1); j++) {
+			buf[i][j] = dma_alloc_coherent(dev, buf_size,
+						       &buf_da[i][j],
+						       GFP_KERNEL);
+			if (!buf[i][j]) {
+				rc = -ENOMEM;
+				goto free;
+			}
+		}
+		switch (cfg->dir) {
+		case PLX_DMA_BENCH_LOCAL:
+			t->src = buf_da[i][0] + cfg->align;
+			t->dst = buf_da[i][1] + cfg->align;
+			break;
+		case PLX_DMA_BENCH_READ:
+			t->src = cfg->peer + cfg->align;
+			t->dst = buf_da[i][0] + cfg->align;
+			break;
+		case PLX_DMA_BENCH_WRITE:
+			t->src = buf_da[i][0] + cfg->align;
+			t->dst = cfg->peer + cfg->align;
+			break;
+		}
+
+		if (i < plx_dma_dev->num_clients || !i)
+			taken[i] = plx_dma_bench_get_chan(t->chan, &rc);
+		if (rc) {
+			dev_err(dev, "%s channel %d not allocated\n", __func__,
+				t->chan->chan_id);
+			goto free;
+		}
+	}
+
+	bench->num_results = 0;
+	if (cfg->mix) {
+		for (i = 0; i < cfg->threads; i++)
+			threads[i].size = cfg->sizes[i % cfg->num_sizes];
+		rc = plx_dma_bench_run_threads(cfg, threads);
+		if (rc) {
+			dev_err(dev, "%s mixed sizes ret %d\n", __func__, rc);
+			goto free;
+		}
+		for (i = 0; i < cfg->threads; i++) {
+			struct plx_dma_bench_result *res = &bench->results[i];
+
+			memset(res, 0, sizeof(*res));
+			res->thread = i;
+			res->size = threads[i].size;
+			plx_dma_bench_merge(res, &threads[i], 1, hist);
+			bench->num_results++;
+		}
+		goto free;
+	}
+
+	for (i = 0; i < cfg->num_sizes; i++) {
+		struct plx_dma_bench_result *res = &bench->results[i];
+		int j;
+
+		for (j = 0; j < cfg->threads; j++)
+			threads[j].size = cfg->sizes[i];
+		rc = plx_dma_bench_run_threads(cfg, threads);
+		if (rc) {
+			dev_err(dev, "%s size %zu ret %d\n", __func__,
+				cfg->sizes[i], rc);
+			break;
+		}
+		memset(res, 0, sizeof(*res));
+		res->thread = -1;
+		res->size = cfg->sizes[i];
+		plx_dma_bench_merge(res, threads, cfg->threads, hist);
+		bench->num_results++;
+	}
+
+free:
+	for (i = 0; threads && i < cfg->threads; i++) {
+		struct plx_dma_bench_thread *t = &threads[i];
+		int j;
+
+		if (taken[i])
+			dma_release_channel(t->chan);
+		/* Transfers which did not drain may still write the buffers */
+		if (rc == -ETIMEDOUT)
+			continue;
+		for (j = 0; j < 2; j++)
+			if (buf[i][j])
+				dma_free_coherent(dev, buf_size, buf[i][j],
+						  buf_da[i][j]);
+		kfree(t->slots);
+		kfree(t->ready);
+		kfree(t->hist);
+	}
+	if (rc != -ETIMEDOUT)
+		kfree(threads);
+	kfree(hist);
+	return rc;
+}
+
+static int plx_dma_bench_parse(struct plx_dma_bench_config *cfg, char *buf,
+			       bool *run)
+{
+	char *token;
+	int rc = 0;
+
+	while ((token = strsep(&buf, " \t\n")) && !rc) {
+		char *value;
+		unsigned long long val;
+
+		if (!*token)
+			continue;
+		if (!strcmp(token, "run")) {
+			*run = true;
+			continue;
+		}
+
+		value = strchr(token, '=');
+		if (!value)
+			return -EINVAL;
+		*value++ = '\0';
+
+		if (!strcmp(token, "sizes")) {
+			char *size;
+
+			cfg->num_sizes = 0;
+			while ((size = strsep(&value, ","))) {
+				if (cfg->num_sizes == PLX_DMA_BENCH_MAX_SIZES)
+					return -E2BIG;
+				val = memparse(size, NULL);
+				if (!val || val > PLX_DMA_BENCH_MAX_XFER)
+					return -EINVAL;
+				cfg->sizes[cfg->num_sizes++] = val;
+			}
+		} else if (!strcmp(token, "dir")) {
+			int i;
+
+			rc = -EINVAL;
+			for (i = 0; i < ARRAY_SIZE(plx_dma_bench_dir_name); i++) {
+				if (!strcmp(value, plx_dma_bench_dir_name[i])) {
+					cfg->dir = i;
+					rc = 0;
+				}
+			}
+		} else if (!strcmp(token, "peer_size")) {
+			cfg->peer_size = memparse(value, NULL);
+		} else if (!(rc = kstrtoull(value, 0, &val))) {
+			if (!strcmp(token, "qdepth") && val &&
+			    val <= PLX_DMA_BENCH_MAX_QDEPTH)
+				cfg->qdepth = val;
+			else if (!strcmp(token, "threads") && val &&
+				 val <= PLX_DMA_BENCH_MAX_THREADS)
+				cfg->threads = val;
+			else if (!strcmp(token, "duration") && val &&
+				 val <= 3600 * MSEC_PER_SEC)
+				cfg->duration_ms = val;
+			else if (!strcmp(token, "align") && val < PAGE_SIZE)
+				cfg->align = val;
+			else if (!strcmp(token, "peer"))
+				cfg->peer = val;
+			else if (!strcmp(token, "mix") && val <= 1)
+				cfg->mix = val;
+			else
+				rc = -EINVAL;
+		}
+	}
+	return rc;
+}
+
+static int plx_dma_bench_seq_show(struct seq_file *s, void *pos)
+{
+	struct plx_dma_device *plx_dma_dev = s->private;
+	struct plx_dma_bench *bench = plx_dma_dev->bench;
+	const struct plx_dma_bench_config *cfg = &bench->cfg;
+	int i;
+	unsigned int p;
+
+	mutex_lock(&bench->lock);
+	seq_puts(s, "# sizes=");
+	for (i = 0; i < cfg->num_sizes; i++)
+		seq_printf(s, "%s%zu", i ? "," : "", cfg->sizes[i]);
+	seq_printf(s, " qdepth=%u threads=%u duration=%u align=%zu dir=%s"
+		   " peer=0x%llx peer_size=%zu mix=%d clients=%d\n",
+		   cfg->qdepth, cfg->threads, cfg->duration_ms, cfg->align,
+		   plx_dma_bench_dir_name[cfg->dir], cfg->peer, cfg->peer_size,
+		   cfg->mix, plx_dma_dev->num_clients);
+	if (bench->status)
+		seq_printf(s, "status=%d\n", bench->status);
+
+	for (i = 0; i < bench->num_results; i++) {
+		struct plx_dma_bench_result *res = &bench->results[i];
+		u64 ns = max_t(u64, res->time_ns, 1);
+		/* bytes per ns is GB/s, printed with 3 decimal places */
+		u64 mgbps = div64_u64(res->bytes * 1000, ns);
+
+		if (res->thread >= 0)
+			seq_printf(s, "thread=%d ", res->thread);
+		seq_printf(s, "size=%zu bytes=%llu ios=%llu errors=%llu "
+			   "time_ns=%llu gbps=%llu.%03llu iops=%llu", res->size,
+			   res->bytes, res->ios, res->errors, res->time_ns,
+			   div_u64(mgbps, 1000), mgbps % 1000,
+			   div64_u64(res->ios * NSEC_PER_SEC, ns));
+		for (p = 0; p < ARRAY_SIZE(plx_dma_bench_pct); p++)
+			seq_printf(s, " lat_ns_%s=%llu",
+				   plx_dma_bench_pct_name[p], res->lat_ns[p]);
+		seq_printf(s, " lat_ns_max=%llu\n", res->lat_max_ns);
+	}
+	mutex_unlock(&bench->lock);
+	return 0;
+}
+
+static int plx_dma_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, plx_dma_bench_seq_show, inode->i_private);
+}
+
+static ssize_t plx_dma_bench_write(struct file *file,
+				   const char __user *ubuf, size_t count,
+				   loff_t *pos)
+{
+	struct seq_file *s = file->private_data;
+	struct plx_dma_device *plx_dma_dev = s->private;
+	struct plx_dma_bench *bench = plx_dma_dev->bench;
+	struct plx_dma_bench_config cfg;
+	char buf[256];
+	bool run = false;
+	int rc;
+
+	if (count >= sizeof(buf))
+		return -E2BIG;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+
+	mutex_lock(&bench->lock);
+	cfg = bench->cfg;
+	rc = plx_dma_bench_parse(&cfg, buf, &run);
+	if (!rc) {
+		bench->cfg = cfg;
+		if (run) {
+			rc = plx_dma_bench_run(plx_dma_dev, bench);
+			bench->status = rc;
+		}
+	}
+	mutex_unlock(&bench->lock);
+	return rc ? rc : count;
+}
+
+static const struct file_operations plx_dma_bench_ops = {
+	.owner   = THIS_MODULE,
+	.open    = plx_dma_bench_open,
+	.read    = seq_read,
+	.write   = plx_dma_bench_write,
+	.llseek  = seq_lseek,
+	.release = single_release
+};
+
+void plx_dma_bench_init(struct plx_dma_device *plx_dma_dev)
+{
+	struct plx_dma_bench *bench;
+
+	bench = kzalloc(sizeof(*bench), GFP_KERNEL);
+	if (!bench)
+		return;
+
+	mutex_init(&bench->lock);
+	bench->cfg.sizes[0] = 4096;
+	bench->cfg.sizes[1] = 64 * 1024;
+	bench->cfg.sizes[2] = 1024 * 1024;
+	bench->cfg.num_sizes = 3;
+	bench->cfg.qdepth = 16;
+	bench->cfg.threads = 1;
+	bench->cfg.duration_ms = 1000;
+	bench->cfg.dir = PLX_DMA_BENCH_LOCAL;
+	plx_dma_dev->bench = bench;
+
+	debugfs_create_file("bench", 0644, plx_dma_dev->dbg_dir, plx_dma_dev,
+			    &plx_dma_bench_ops);
+}
+
+void plx_dma_bench_uninit(struct plx_dma_device *plx_dma_dev)
+{
+	kfree(plx_dma_dev->bench);
+	plx_dma_dev->bench = NULL;
+}
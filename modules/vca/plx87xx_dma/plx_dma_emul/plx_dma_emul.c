@@ -0,0 +1,551 @@
+/*
+ * Intel VCA Software Stack (VCASS)
+ *
+ * Copyright(c) 2015-2017 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * PLX87XX DMA driver - software emulated DMA channel
+ *
+ * Replaces the PCIe glue (plx_pci.c) of plx87xx_dma with a platform device
+ * whose register space is emulated in memory. The driver itself (plx_dma.c)
+ * is built unchanged with PLX_DMA_EMUL, so the descriptor ring format,
+ * max_xfer_size splitting, write back and interrupt handling all run the
+ * same code as on the hardware.
+ *
+ * An engine thread executes valid descriptors from the ring with memcpy,
+ * optionally sleeping emul_latency_us per descriptor, and an interrupt
+ * thread calls the driver interrupt thread function for descriptors with
+ * the interrupt flag. Faults can be injected through the "emul" debugfs
+ * file:
+ *   echo "error [N]" - fail the N-th next descriptor with an error interrupt
+ *   echo "hang [N]"  - stall the engine on the N-th next descriptor
+ *   echo "none"      - clear the injected fault
+ *
+ * Buffers are accessed through the kernel direct mapping, so the platform
+ * device must use direct DMA mapping (no IOMMU translation).
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/platform_device.h>
+#include <linux/dma-mapping.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/seq_file.h>
+#include "../plx_dma.h"
+
+#define PLX_DRV_NAME			"plx87xx_dma_emul"
+#define PLX_DMA_EMUL_REG_SIZE		0x400
+#define PLX_DMA_EMUL_CTRL_W1C		(PLX_DMA_CTRL_STATUS_BITS | \
+					 PLX_DMA_CTRL_HEADER_LOG)
+#define PLX_DMA_EMUL_INTR_STATUS_MASK	0xffff0000UL
+
+struct dentry *plx_dma_dbg;
+
+static unsigned int emul_latency_us;
+module_param(emul_latency_us, uint, 0644);
+MODULE_PARM_DESC(emul_latency_us, "Latency injected per descriptor, in us");
+
+static unsigned int emul_max_xfer_kb = 1024;
+module_param(emul_max_xfer_kb, uint, 0444);
+MODULE_PARM_DESC(emul_max_xfer_kb, "Maximum transfer size per descriptor, in KB");
+
+enum plx_dma_emul_fault {
+	PLX_DMA_EMUL_FAULT_NONE,
+	PLX_DMA_EMUL_FAULT_ERROR,
+	PLX_DMA_EMUL_FAULT_HANG,
+};
+
+/*
+ * plx_dma_emul - emulated PLX DMA function
+ *
+ * @plx_dma_dev: driver instance, reg_base is not used
+ * @pdev: platform device the dma device is registered for
+ * @regs: emulated register space
+ * @reg_lock: protects regs and the fault state
+ * @engine: thread executing descriptors
+ * @engine_wait: wakes the engine on DMA start
+ * @kick: DMA start written since the engine last looked at the ring
+ * @irq_thread: thread calling the driver interrupt thread function
+ * @irq_wait: wakes the interrupt thread
+ * @irq_pending: interrupt raised and not handled yet
+ * @thread_fn: driver interrupt thread function
+ * @fault: injected fault
+ * @fault_after: descriptors executed before the fault triggers
+ * @hung: engine stalled by an injected hang, cleared by abort
+ * @descs: descriptors executed
+ * @bytes: bytes copied
+ * @unaligned: descriptors not aligned to PLX_DMA_ALIGN_BYTES
+ */
+struct plx_dma_emul {
+	struct plx_dma_device plx_dma_dev;
+	struct platform_device *pdev;
+	u32 regs[PLX_DMA_EMUL_REG_SIZE / sizeof(u32)];
+	spinlock_t reg_lock;
+	struct task_struct *engine;
+	wait_queue_head_t engine_wait;
+	bool kick;
+	struct task_struct *irq_thread;
+	wait_queue_head_t irq_wait;
+	bool irq_pending;
+	irq_handler_t thread_fn;
+	enum plx_dma_emul_fault fault;
+	u32 fault_after;
+	bool hung;
+	u64 descs;
+	u64 bytes;
+	u64 unaligned;
+};
+
+static struct platform_device *plx_dma_emul_pdev;
+
+static inline struct plx_dma_emul *to_plx_dma_emul(struct plx_dma_device *pdma)
+{
+	return container_of(pdma, struct plx_dma_emul, plx_dma_dev);
+}
+
+/* Channel register, reg_lock held */
+static inline u32 *plx_dma_emul_ch_reg(struct plx_dma_emul *emul, u32 offset)
+{
+	return &emul->regs[(emul->plx_dma_dev.plx_chan.ch_base_addr + offset) /
+			   sizeof(u32)];
+}
+
+static void plx_dma_emul_raise_irq(struct plx_dma_emul *emul)
+{
+	WRITE_ONCE(emul->irq_pending, true);
+	wake_up(&emul->irq_wait);
+}
+
+u32 plx_dma_emul_reg_read(struct plx_dma_device *pdma, u32 offset)
+{
+	struct plx_dma_emul *emul = to_plx_dma_emul(pdma);
+	u32 value;
+
+	if (offset >= PLX_DMA_EMUL_REG_SIZE)
+		return ~0U;
+
+	spin_lock(&emul->reg_lock);
+	value = emul->regs[offset / sizeof(u32)];
+	spin_unlock(&emul->reg_lock);
+	return value;
+}
+
+void plx_dma_emul_reg_write(struct plx_dma_device *pdma, u32 offset,
+			    u32 value)
+{
+	struct plx_dma_emul *emul = to_plx_dma_emul(pdma);
+	u64 ch_base = pdma->plx_chan.ch_base_addr;
+	u32 *reg, old;
+	bool kick = false, irq = false;
+
+	if (offset >= PLX_DMA_EMUL_REG_SIZE)
+		return;
+
+	spin_lock(&emul->reg_lock);
+	reg = &emul->regs[offset / sizeof(u32)];
+	old = *reg;
+
+	if (offset == ch_base + PLX_DMA_CTRL_STATUS) {
+		/* Status bits are write one to clear, in progress is read only */
+		*reg = (value & ~(PLX_DMA_EMUL_CTRL_W1C | PLX_DMA_CTRL_IN_PROGRESS)) |
+			(old & PLX_DMA_EMUL_CTRL_W1C & ~value) |
+			(old & PLX_DMA_CTRL_IN_PROGRESS);
+
+		if (value & PLX_DMA_CTRL_ABORT) {
+			emul->hung = false;
+			*reg &= ~(PLX_DMA_CTRL_ABORT | PLX_DMA_CTRL_START |
+				  PLX_DMA_CTRL_IN_PROGRESS);
+			*reg |= PLX_DMA_CTRL_ABORT_DONE_STATUS;
+			*plx_dma_emul_ch_reg(emul, PLX_DMA_INTR_CTRL_STATUS) |=
+				PLX_DMA_ABORT_DONE_INTR_STATUS;
+			irq = !!(*plx_dma_emul_ch_reg(emul, PLX_DMA_INTR_CTRL_STATUS) &
+				 PLX_DMA_ABORT_DONE_INTR_EN);
+		} else if ((value & PLX_DMA_CTRL_PAUSED) &&
+			   !(value & PLX_DMA_CTRL_START)) {
+			/* A stalled engine never finishes the graceful pause */
+			if (!emul->hung) {
+				*reg &= ~PLX_DMA_CTRL_IN_PROGRESS;
+				*reg |= PLX_DMA_CTRL_PAUSE_DONE_STATUS;
+			}
+		} else if (value & PLX_DMA_CTRL_START) {
+			kick = true;
+		}
+	} else if (offset == ch_base + PLX_DMA_INTR_CTRL_STATUS) {
+		*reg = (value & ~PLX_DMA_EMUL_INTR_STATUS_MASK) |
+			(old & PLX_DMA_EMUL_INTR_STATUS_MASK & ~value);
+	} else {
+		*reg = value;
+	}
+	spin_unlock(&emul->reg_lock);
+
+	if (kick) {
+		WRITE_ONCE(emul->kick, true);
+		wake_up(&emul->engine_wait);
+	}
+	if (irq)
+		plx_dma_emul_raise_irq(emul);
+}
+
+static void *plx_dma_emul_map(dma_addr_t addr, u32 size)
+{
+	if (!pfn_valid(addr >> PAGE_SHIFT) ||
+	    (size && !pfn_valid((addr + size - 1) >> PAGE_SHIFT)))
+		return NULL;
+	return phys_to_virt(addr);
+}
+
+/*
+ * Execute the descriptor pointed by the next descriptor register.
+ * Returns 1 if a descriptor was executed, 0 if the engine is idle and
+ * negative errno if it stopped on an error.
+ */
+static int plx_dma_emul_exec_desc(struct plx_dma_emul *emul)
+{
+	struct plx_dma_device *pdma = &emul->plx_dma_dev;
+	struct plx_dma_chan *ch = &pdma->plx_chan;
+	struct plx_dma_desc *desc;
+	u32 *ctrl, ring_low, ring_size, idx, dw0, size;
+	u64 ring_da, src, dst;
+	void *src_va, *dst_va;
+	bool fault_error = false, irq = false;
+	int err = 0;
+
+	spin_lock(&emul->reg_lock);
+	ctrl = plx_dma_emul_ch_reg(emul, PLX_DMA_CTRL_STATUS);
+	if (emul->hung) {
+		spin_unlock(&emul->reg_lock);
+		return 0;
+	}
+	if (!(*ctrl & PLX_DMA_CTRL_START) || (*ctrl & PLX_DMA_CTRL_PAUSED))
+		goto idle;
+
+	ring_low = *plx_dma_emul_ch_reg(emul, PLX_DMA_DESC_RING_ADDR_LOW);
+	ring_da = ((u64)*plx_dma_emul_ch_reg(emul, PLX_DMA_DESC_RING_ADDR_HIGH)
+		   << 32) | ring_low;
+	ring_size = *plx_dma_emul_ch_reg(emul, PLX_DMA_DESC_RING_SIZE);
+	if (!ring_size || !ch->desc_ring || ring_da != ch->desc_ring_da) {
+		*ctrl |= PLX_DMA_CTRL_DESC_INVLD_STATUS;
+		goto idle;
+	}
+
+	idx = ((*plx_dma_emul_ch_reg(emul, PLX_DMA_NEXT_DESC_ADDR_LOW) - ring_low) /
+	       sizeof(*desc)) % ring_size;
+	desc = &ch->desc_ring[idx];
+	dw0 = READ_ONCE(desc->dw0);
+	if (!(dw0 & PLX_DESC_VALID))
+		goto idle;
+
+	if (emul->fault != PLX_DMA_EMUL_FAULT_NONE && !emul->fault_after--) {
+		if (emul->fault == PLX_DMA_EMUL_FAULT_HANG) {
+			/* Keep in progress set and never complete */
+			emul->hung = true;
+			emul->fault = PLX_DMA_EMUL_FAULT_NONE;
+			*ctrl |= PLX_DMA_CTRL_IN_PROGRESS;
+			spin_unlock(&emul->reg_lock);
+			dev_info(&emul->pdev->dev, "%s injected hang at desc %u\n",
+				 __func__, idx);
+			return 0;
+		}
+		emul->fault = PLX_DMA_EMUL_FAULT_NONE;
+		fault_error = true;
+	}
+	*ctrl |= PLX_DMA_CTRL_IN_PROGRESS;
+	spin_unlock(&emul->reg_lock);
+
+	/* Read the descriptor body only after seeing the valid bit */
+	rmb();
+	size = dw0 & PLX_DESC_SIZE_MASK;
+	src = ((u64)(desc->dw1 & PLX_DESC_HALF_HIGH_MASK) << 16) | desc->dw3;
+	dst = ((u64)(desc->dw1 & PLX_DESC_HALF_LOW_MASK) << 32) | desc->dw2;
+
+	if (emul_latency_us)
+		usleep_range(emul_latency_us, emul_latency_us + 1);
+
+	if ((src | dst | size) & PLX_DMA_ALIGN_MASK)
+		emul->unaligned++;
+
+	src_va = plx_dma_emul_map(src, size);
+	dst_va = plx_dma_emul_map(dst, size);
+	if (fault_error || size > pdma->max_xfer_size ||
+	    (size && (!src_va || !dst_va))) {
+		dev_err(&emul->pdev->dev, "%s desc %u failed src 0x%llx "
+			"dst 0x%llx size 0x%x%s\n", __func__, idx, src, dst,
+			size, fault_error ? " (injected)" : "");
+		err = -EIO;
+	} else if (size) {
+		memcpy(dst_va, src_va, size);
+	}
+
+	/* Write back, the driver polls the valid bit for completion */
+	wmb();
+	WRITE_ONCE(desc->dw0, dw0 & ~PLX_DESC_VALID);
+	wmb();
+
+	spin_lock(&emul->reg_lock);
+	*plx_dma_emul_ch_reg(emul, PLX_DMA_LAST_DESC_ADDR_LOW) =
+		ring_low + idx * sizeof(*desc);
+	*plx_dma_emul_ch_reg(emul, PLX_DMA_LAST_DESC_XFER_SIZE) = size;
+	*plx_dma_emul_ch_reg(emul, PLX_DMA_NEXT_DESC_ADDR_LOW) =
+		ring_low + ((idx + 1) % ring_size) * sizeof(*desc);
+	if (err) {
+		/* Engine halts on errors until restarted */
+		*ctrl &= ~(PLX_DMA_CTRL_START | PLX_DMA_CTRL_IN_PROGRESS);
+		*plx_dma_emul_ch_reg(emul, PLX_DMA_INTR_CTRL_STATUS) |=
+			PLX_DMA_ERROR_INTR_STATUS;
+		irq = !!(*plx_dma_emul_ch_reg(emul, PLX_DMA_INTR_CTRL_STATUS) &
+			 PLX_DMA_ERROR_INTR_EN);
+	} else if (dw0 & PLX_DESC_INTR_ENABLE) {
+		*plx_dma_emul_ch_reg(emul, PLX_DMA_INTR_CTRL_STATUS) |=
+			PLX_DMA_DESC_DONE_INTR_STATUS;
+		irq = true;
+	}
+	emul->descs++;
+	emul->bytes += size;
+	spin_unlock(&emul->reg_lock);
+
+	if (irq)
+		plx_dma_emul_raise_irq(emul);
+	return err ? err : 1;
+idle:
+	*ctrl &= ~PLX_DMA_CTRL_IN_PROGRESS;
+	spin_unlock(&emul->reg_lock);
+	return 0;
+}
+
+static int plx_dma_emul_engine_fn(void *data)
+{
+	struct plx_dma_emul *emul = data;
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(emul->engine_wait,
+					 READ_ONCE(emul->kick) ||
+					 kthread_should_stop());
+		WRITE_ONCE(emul->kick, false);
+		while (!kthread_should_stop() &&
+		       plx_dma_emul_exec_desc(emul) > 0)
+			cond_resched();
+	}
+	return 0;
+}
+
+static int plx_dma_emul_irq_fn(void *data)
+{
+	struct plx_dma_emul *emul = data;
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(emul->irq_wait,
+					 READ_ONCE(emul->irq_pending) ||
+					 kthread_should_stop());
+		if (!READ_ONCE(emul->irq_pending))
+			continue;
+		WRITE_ONCE(emul->irq_pending, false);
+		emul->thread_fn(0, &emul->plx_dma_dev);
+	}
+	return 0;
+}
+
+int plx_dma_emul_setup_irq(struct plx_dma_device *pdma,
+			   irq_handler_t thread_fn)
+{
+	struct plx_dma_emul *emul = to_plx_dma_emul(pdma);
+
+	emul->thread_fn = thread_fn;
+	emul->irq_thread = kthread_run(plx_dma_emul_irq_fn, emul,
+				       "plx_dma_emul_irq");
+	if (IS_ERR(emul->irq_thread))
+		return PTR_ERR(emul->irq_thread);
+
+	emul->engine = kthread_run(plx_dma_emul_engine_fn, emul,
+				   "plx_dma_emul");
+	if (IS_ERR(emul->engine)) {
+		kthread_stop(emul->irq_thread);
+		return PTR_ERR(emul->engine);
+	}
+	return 0;
+}
+
+void plx_dma_emul_free_irq(struct plx_dma_device *pdma)
+{
+	struct plx_dma_emul *emul = to_plx_dma_emul(pdma);
+
+	kthread_stop(emul->engine);
+	kthread_stop(emul->irq_thread);
+}
+
+static int plx_dma_emul_seq_show(struct seq_file *s, void *pos)
+{
+	struct plx_dma_emul *emul = s->private;
+	static const char * const faults[] = { "none", "error", "hang" };
+
+	spin_lock(&emul->reg_lock);
+	seq_printf(s, "fault %s after %u hung %d dma_hang %d\n",
+		   faults[emul->fault], emul->fault_after, emul->hung,
+		   emul->plx_dma_dev.plx_chan.dma_hang);
+	seq_printf(s, "descs %llu bytes %llu unaligned %llu\n",
+		   emul->descs, emul->bytes, emul->unaligned);
+	spin_unlock(&emul->reg_lock);
+	return 0;
+}
+
+static int plx_dma_emul_debug_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, plx_dma_emul_seq_show, inode->i_private);
+}
+
+static ssize_t plx_dma_emul_debug_write(struct file *file,
+					const char __user *user_buf,
+					size_t count, loff_t *ppos)
+{
+	struct plx_dma_emul *emul =
+		((struct seq_file *)file->private_data)->private;
+	enum plx_dma_emul_fault fault;
+	char buf[32], cmd[8];
+	u32 after = 0;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, user_buf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+
+	if (sscanf(buf, "%7s %u", cmd, &after) < 1)
+		return -EINVAL;
+
+	if (!strcmp(cmd, "none"))
+		fault = PLX_DMA_EMUL_FAULT_NONE;
+	else if (!strcmp(cmd, "error"))
+		fault = PLX_DMA_EMUL_FAULT_ERROR;
+	else if (!strcmp(cmd, "hang"))
+		fault = PLX_DMA_EMUL_FAULT_HANG;
+	else
+		return -EINVAL;
+
+	spin_lock(&emul->reg_lock);
+	emul->fault = fault;
+	emul->fault_after = after;
+	spin_unlock(&emul->reg_lock);
+	return count;
+}
+
+static const struct file_operations plx_dma_emul_ops = {
+	.owner   = THIS_MODULE,
+	.open    = plx_dma_emul_debug_open,
+	.read    = seq_read,
+	.write   = plx_dma_emul_debug_write,
+	.llseek  = seq_lseek,
+	.release = single_release
+};
+
+static int plx_dma_emul_probe(struct platform_device *pdev)
+{
+	struct plx_dma_emul *emul;
+	int rc;
+
+	emul = kzalloc(sizeof(*emul), GFP_KERNEL);
+	if (!emul)
+		return -ENOMEM;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 13, 0)
+	rc = dma_coerce_mask_and_coherent(&pdev->dev, DMA_BIT_MASK(64));
+	if (rc)
+		goto free_emul;
+#else
+	pdev->dev.coherent_dma_mask = DMA_BIT_MASK(64);
+	pdev->dev.dma_mask = &pdev->dev.coherent_dma_mask;
+#endif
+
+	emul->pdev = pdev;
+	spin_lock_init(&emul->reg_lock);
+	init_waitqueue_head(&emul->engine_wait);
+	init_waitqueue_head(&emul->irq_wait);
+	emul->plx_dma_dev.dma_dev.dev = &pdev->dev;
+	emul->plx_dma_dev.max_xfer_size =
+		min_t(size_t, max(emul_max_xfer_kb, 1U) * 1024,
+		      PLX_DESC_SIZE_MASK);
+	platform_set_drvdata(pdev, emul);
+
+	rc = plx_dma_probe(&emul->plx_dma_dev);
+	if (rc) {
+		dev_err(&pdev->dev, "plx_dma_probe error rc %d\n", rc);
+		goto free_emul;
+	}
+
+	if (!IS_ERR_OR_NULL(emul->plx_dma_dev.dbg_dir))
+		debugfs_create_file("emul", 0644, emul->plx_dma_dev.dbg_dir,
+				    emul, &plx_dma_emul_ops);
+	return 0;
+free_emul:
+	kfree(emul);
+	return rc;
+}
+
+static int plx_dma_emul_remove(struct platform_device *pdev)
+{
+	struct plx_dma_emul *emul = platform_get_drvdata(pdev);
+
+	plx_dma_remove(&emul->plx_dma_dev);
+	kfree(emul);
+	return 0;
+}
+
+static struct platform_driver plx_dma_emul_driver = {
+	.probe  = plx_dma_emul_probe,
+	.remove = plx_dma_emul_remove,
+	.driver = {
+		.name  = PLX_DRV_NAME,
+		.owner = THIS_MODULE,
+	},
+};
+
+static int __init plx_dma_emul_init(void)
+{
+	int rc;
+
+	plx_dma_dbg = debugfs_create_dir(KBUILD_MODNAME, NULL);
+	rc = platform_driver_register(&plx_dma_emul_driver);
+	if (rc) {
+		pr_err("%s %d rc %x\n", __func__, __LINE__, rc);
+		goto error;
+	}
+
+	plx_dma_emul_pdev = platform_device_register_simple(PLX_DRV_NAME, -1,
+							    NULL, 0);
+	if (IS_ERR(plx_dma_emul_pdev)) {
+		rc = PTR_ERR(plx_dma_emul_pdev);
+		pr_err("%s %d rc %x\n", __func__, __LINE__, rc);
+		platform_driver_unregister(&plx_dma_emul_driver);
+		goto error;
+	}
+	return 0;
+error:
+	debugfs_remove_recursive(plx_dma_dbg);
+	return rc;
+}
+
+static void __exit plx_dma_emul_exit(void)
+{
+	platform_device_unregister(plx_dma_emul_pdev);
+	platform_driver_unregister(&plx_dma_emul_driver);
+	debugfs_remove_recursive(plx_dma_dbg);
+}
+
+module_init(plx_dma_emul_init);
+module_exit(plx_dma_emul_exit);
+
+MODULE_AUTHOR("Intel Corporation");
+MODULE_DESCRIPTION("PLX87XX DMA driver on an emulated DMA channel");
+MODULE_LICENSE("GPL v2");
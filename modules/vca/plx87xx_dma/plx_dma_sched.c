@@ -0,0 +1,584 @@
+/*
+ * Intel VCA Software Stack (VCASS)
+ *
+ * Copyright(c) 2015-2017 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * PLX87XX DMA driver - weighted fair arbitration of DMA consumers
+ *
+ * PLX 87XX has a single DMA channel per function which is shared by vop,
+ * blockio backend and LBP. Without arbitration a large transfer submitted
+ * by one consumer (e.g. a ramdisk upload) fills the descriptor ring and
+ * delays everybody else until it is done.
+ *
+ * When enabled, the driver exposes several client channels instead of the
+ * hardware one. Requests submitted on client channels are queued per
+ * client and programmed to the hardware ring in chunks of at most
+ * max_chunk bytes, picking clients with deficit round robin by weight.
+ * Only sched_depth chunks are kept in the ring, so a newly active client
+ * waits for at most that many chunks before its request is started.
+ */
+#include <linux/slab.h>
+#include <linux/delay.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/vmalloc.h>
+#include <linux/version.h>
+#include "plx_dma.h"
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 0, 0)
+#ifndef DMA_MIN_COOKIE
+#define DMA_MIN_COOKIE	1
+#endif
+#define client_completed_cookie(client)	((client)->completed_cookie)
+#else
+#define client_completed_cookie(client)	((client)->chan.completed_cookie)
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 13, 0)
+#define PLX_DMA_STATUS_DONE	DMA_SUCCESS
+#else
+#define PLX_DMA_STATUS_DONE	DMA_COMPLETE
+#endif
+
+/* Bytes added to the deficit of a client per unit of weight each round */
+#define PLX_DMA_SCHED_QUANTUM		(64 * 1024)
+/* Requests which may be outstanding on a single client channel */
+#define PLX_DMA_CLIENT_REQS		PLX_DMA_DESC_RX_SIZE
+#define PLX_DMA_CLIENT_DRAIN_MS		1000
+
+static unsigned int sched_clients;
+module_param(sched_clients, uint, 0444);
+MODULE_PARM_DESC(sched_clients, "Number of client DMA channels sharing "
+		 "the hardware channel with weighted arbitration (0 - disabled)");
+
+static unsigned int sched_weight[PLX_DMA_MAX_CLIENTS] = { 4, 2, 1, 1 };
+module_param_array(sched_weight, uint, NULL, 0444);
+MODULE_PARM_DESC(sched_weight, "Weight of each client DMA channel");
+
+static unsigned int sched_chunk_kb[PLX_DMA_MAX_CLIENTS] = { 64, 128, 256, 256 };
+module_param_array(sched_chunk_kb, uint, NULL, 0444);
+MODULE_PARM_DESC(sched_chunk_kb, "Largest piece of a request of each client "
+		 "DMA channel programmed to the hardware at once, in KB");
+
+static unsigned int sched_depth = 4;
+module_param(sched_depth, uint, 0444);
+MODULE_PARM_DESC(sched_depth, "Chunks kept in flight on the hardware channel");
+
+static void plx_dma_sched_req_complete(struct plx_dma_client *client,
+				       struct plx_dma_sched_req *req)
+{
+	BUG_ON(req->txd.cookie < DMA_MIN_COOKIE);
+	client_completed_cookie(client) = req->txd.cookie;
+	req->txd.cookie = 0;
+	client->completed++;
+
+	plx_dma_tx_callback(&req->txd, req->failed);
+
+	spin_lock(&client->lock);
+	list_add_tail(&req->list, &client->free);
+	spin_unlock(&client->lock);
+	atomic_dec(&client->pending);
+}
+
+/* Called from plx_dma_cleanup() for each completed chunk */
+static void plx_dma_sched_chunk_done(void *arg)
+{
+	struct plx_dma_sched_req *req = arg;
+	struct plx_dma_client *client = req->client;
+	struct plx_dma_device *plx_dma_dev = chan_to_plx_dma_dev(&client->chan);
+	bool done;
+
+	spin_lock(&plx_dma_dev->sched_lock);
+	plx_dma_dev->sched_inflight--;
+	done = !--req->chunks && !req->queued;
+	if (done)
+		list_del_init(&req->list);
+	spin_unlock(&plx_dma_dev->sched_lock);
+
+	if (done)
+		plx_dma_sched_req_complete(client, req);
+}
+
+/* Program next chunk of the request to the hardware ring, sched_lock held */
+static int plx_dma_sched_prog_chunk(struct plx_dma_device *plx_dma_dev,
+				    struct plx_dma_client *client,
+				    struct plx_dma_sched_req *req)
+{
+	struct plx_dma_chan *ch = &plx_dma_dev->plx_chan;
+	struct dma_async_tx_descriptor *tx;
+	size_t len = min(req->len, client->max_chunk);
+	int num_desc = max_t(int, 1,
+			     DIV_ROUND_UP(len, plx_dma_dev->max_xfer_size));
+
+	/*
+	 * Check the space here, so the hardware prep never falls back to
+	 * plx_dma_cleanup() and runs completion callbacks under sched_lock.
+	 */
+	if (plx_dma_ring_count(ch, READ_ONCE(ch->head),
+			       READ_ONCE(ch->last_tail)) < num_desc)
+		return -ENOSPC;
+
+	tx = plx_dma_hw_prep_memcpy(ch, req->dst, req->src, len,
+				    DMA_PREP_INTERRUPT);
+	if (!tx)
+		return -ENOMEM;
+
+	tx->callback = plx_dma_sched_chunk_done;
+	tx->callback_param = req;
+	tx->tx_submit(tx);
+
+	req->src += len;
+	req->dst += len;
+	req->len -= len;
+	req->chunks++;
+	plx_dma_dev->sched_inflight++;
+	client->deficit -= max_t(size_t, len, PLX_DMA_ALIGN_BYTES);
+	client->bytes += len;
+	return 0;
+}
+
+/**
+ * plx_dma_sched_run - program queued client requests to the hardware ring
+ * @plx_dma_dev: PLX DMA device
+ *
+ * Called on issue_pending of a client channel and from sched_work after
+ * each cleanup of the hardware ring. Clients with queued work are served in round robin
+ * order, each one programs chunks while its deficit is positive and is
+ * credited weight * PLX_DMA_SCHED_QUANTUM bytes when its turn comes again.
+ */
+void plx_dma_sched_run(struct plx_dma_device *plx_dma_dev)
+{
+	bool issued = false;
+
+	spin_lock(&plx_dma_dev->sched_lock);
+	while (plx_dma_dev->sched_inflight < sched_depth &&
+	       !list_empty(&plx_dma_dev->sched_active) &&
+	       !READ_ONCE(plx_dma_dev->plx_chan.recovering)) {
+		struct plx_dma_client *client =
+			list_first_entry(&plx_dma_dev->sched_active,
+					 struct plx_dma_client, active);
+		struct plx_dma_sched_req *req;
+
+		if (client->deficit <= 0) {
+			client->deficit += client->weight * PLX_DMA_SCHED_QUANTUM;
+			list_move_tail(&client->active, &plx_dma_dev->sched_active);
+			continue;
+		}
+
+		req = list_first_entry(&client->queue,
+				       struct plx_dma_sched_req, list);
+		if (plx_dma_sched_prog_chunk(plx_dma_dev, client, req))
+			break;
+		issued = true;
+
+		if (!req->len) {
+			req->queued = false;
+			list_move_tail(&req->list, &client->inflight);
+		}
+
+		if (list_empty(&client->queue)) {
+			/* Idle clients do not save up credit */
+			client->deficit = 0;
+			list_del_init(&client->active);
+		}
+	}
+	spin_unlock(&plx_dma_dev->sched_lock);
+
+	if (issued)
+		plx_dma_hw_issue_pending(&plx_dma_dev->plx_chan);
+}
+
+static void plx_dma_sched_work(struct work_struct *work)
+{
+	plx_dma_sched_run(container_of(work, struct plx_dma_device,
+				       sched_work));
+}
+
+/**
+ * plx_dma_sched_kick - run the scheduler after ring space was released
+ * @plx_dma_dev: PLX DMA device
+ *
+ * plx_dma_cleanup() may run with prep_lock of the hardware channel held
+ * (ring full in plx_dma_hw_prep_memcpy()), so it must not program chunks
+ * itself. The scheduler is deferred to a work item which runs without
+ * prep_lock and cleanup_lock.
+ */
+void plx_dma_sched_kick(struct plx_dma_device *plx_dma_dev)
+{
+	if (plx_dma_dev->num_clients &&
+	    !list_empty_careful(&plx_dma_dev->sched_active))
+		schedule_work(&plx_dma_dev->sched_work);
+}
+
+/**
+ * plx_dma_sched_abort - fail client requests with chunks in the ring
+ * @plx_dma_dev: PLX DMA device
+ *
+ * Called by the hang recovery with cleanup_lock of the hardware channel
+ * held, before the chunks left in the ring are completed with an error.
+ * A partially programmed request loses its remaining part, requests not
+ * started yet stay queued for the reinitialized ring.
+ */
+void plx_dma_sched_abort(struct plx_dma_device *plx_dma_dev)
+{
+	int i;
+
+	spin_lock(&plx_dma_dev->sched_lock);
+	for (i = 0; i < plx_dma_dev->num_clients; i++) {
+		struct plx_dma_client *client = &plx_dma_dev->clients[i];
+		struct plx_dma_sched_req *req, *last = NULL;
+
+		list_for_each_entry(req, &client->inflight, list) {
+			req->failed = true;
+			last = req;
+		}
+
+		if (!list_empty(&client->queue)) {
+			req = list_first_entry(&client->queue,
+					       struct plx_dma_sched_req, list);
+			if (req->chunks) {
+				req->failed = true;
+				req->queued = false;
+				req->len = 0;
+				list_move_tail(&req->list, &client->inflight);
+				last = req;
+			}
+			if (list_empty(&client->queue)) {
+				client->deficit = 0;
+				list_del_init(&client->active);
+			}
+		}
+
+		if (last) {
+			client->err_cookie_lo = client_completed_cookie(client);
+			client->err_cookie_hi = last->txd.cookie;
+		}
+	}
+	spin_unlock(&plx_dma_dev->sched_lock);
+}
+
+static dma_cookie_t
+plx_dma_client_tx_submit_unlock(struct dma_async_tx_descriptor *tx)
+{
+	struct plx_dma_sched_req *req =
+		container_of(tx, struct plx_dma_sched_req, txd);
+	struct plx_dma_client *client = req->client;
+	struct plx_dma_device *plx_dma_dev = chan_to_plx_dma_dev(&client->chan);
+	dma_cookie_t cookie;
+
+	cookie = client->chan.cookie + 1;
+	if (cookie < DMA_MIN_COOKIE)
+		cookie = DMA_MIN_COOKIE;
+	tx->cookie = client->chan.cookie = cookie;
+	atomic_inc(&client->pending);
+
+	spin_lock(&plx_dma_dev->sched_lock);
+	req->queued = true;
+	list_add_tail(&req->list, &client->queue);
+	if (list_empty(&client->active))
+		list_add_tail(&client->active, &plx_dma_dev->sched_active);
+	spin_unlock(&plx_dma_dev->sched_lock);
+
+	spin_unlock(&client->lock);
+	return cookie;
+}
+
+struct dma_async_tx_descriptor *
+plx_dma_client_prep_memcpy(struct plx_dma_client *client, dma_addr_t dma_dest,
+			   dma_addr_t dma_src, size_t len, unsigned long flags)
+{
+	struct plx_dma_sched_req *req;
+
+	spin_lock(&client->lock);
+	if (list_empty(&client->free)) {
+		spin_unlock(&client->lock);
+		dev_err(chan_to_plx_dma_dev(&client->chan)->dma_dev.dev,
+			"%s no free request on channel %d\n", __func__,
+			client->chan.chan_id);
+		return NULL;
+	}
+
+	req = list_first_entry(&client->free, struct plx_dma_sched_req, list);
+	list_del_init(&req->list);
+
+	dma_async_tx_descriptor_init(&req->txd, &client->chan);
+	req->txd.tx_submit = plx_dma_client_tx_submit_unlock;
+	req->txd.flags = flags;
+	req->txd.callback = NULL;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 9, 0)
+	req->txd.callback_result = NULL;
+#endif
+	req->txd.callback_param = NULL;
+	req->src = dma_src;
+	req->dst = dma_dest;
+	req->len = len;
+	req->size = len;
+	req->chunks = 0;
+	req->queued = false;
+	req->failed = false;
+	/* client->lock is released in tx_submit */
+	return &req->txd;
+}
+
+static enum dma_status
+plx_dma_client_cookie_status(struct plx_dma_client *client, dma_cookie_t cookie,
+			     dma_cookie_t *last, dma_cookie_t *used)
+{
+	dma_cookie_t last_complete, last_used;
+
+	last_used = client->chan.cookie;
+	last_complete = client_completed_cookie(client);
+
+	barrier();
+	if (last)
+		*last = last_complete;
+	if (used)
+		*used = last_used;
+
+	return dma_async_is_complete(cookie, last_complete, last_used);
+}
+
+enum dma_status plx_dma_client_tx_status(struct plx_dma_client *client,
+					 dma_cookie_t cookie,
+					 dma_cookie_t *last, dma_cookie_t *used)
+{
+	struct plx_dma_chan *ch = &chan_to_plx_dma_dev(&client->chan)->plx_chan;
+	enum dma_status status;
+
+	if (PLX_DMA_STATUS_DONE !=
+	    plx_dma_client_cookie_status(client, cookie, last, used))
+		ch->cleanup(ch);
+	status = plx_dma_client_cookie_status(client, cookie, last, used);
+	if (status != DMA_IN_PROGRESS &&
+	    plx_dma_cookie_failed(cookie, client->err_cookie_lo,
+				  client->err_cookie_hi))
+		return DMA_ERROR;
+	return status;
+}
+
+int plx_dma_client_alloc_resources(struct plx_dma_client *client)
+{
+	struct plx_dma_device *plx_dma_dev = chan_to_plx_dma_dev(&client->chan);
+	struct device *dev = plx_dma_dev->dma_dev.dev;
+	int i, rc;
+
+	if (client->reqs) {
+		/* Requests of the previous user never completed */
+		dev_err(dev, "%s channel %d still busy\n", __func__,
+			client->chan.chan_id);
+		return -EBUSY;
+	}
+
+	client->reqs = vzalloc(PLX_DMA_CLIENT_REQS * sizeof(*client->reqs));
+	if (!client->reqs)
+		return -ENOMEM;
+
+	rc = plx_dma_hw_get(plx_dma_dev);
+	if (rc) {
+		dev_err(dev, "%s ret %d\n", __func__, rc);
+		vfree(client->reqs);
+		client->reqs = NULL;
+		return rc;
+	}
+
+	INIT_LIST_HEAD(&client->free);
+	for (i = 0; i < PLX_DMA_CLIENT_REQS; i++) {
+		client->reqs[i].client = client;
+		list_add_tail(&client->reqs[i].list, &client->free);
+	}
+	client->deficit = 0;
+	return PLX_DMA_CLIENT_REQS;
+}
+
+/*
+ * Drop the chunks of a client which is released while they are still in
+ * the ring. The chunks are left to the hardware, only their completion
+ * callbacks are cleared so they never call back into the freed requests.
+ */
+static void plx_dma_client_detach(struct plx_dma_client *client)
+{
+	struct plx_dma_device *plx_dma_dev = chan_to_plx_dma_dev(&client->chan);
+	struct plx_dma_chan *ch = &plx_dma_dev->plx_chan;
+	struct plx_dma_sched_req *first = client->reqs;
+	struct plx_dma_sched_req *last = client->reqs + PLX_DMA_CLIENT_REQS;
+	struct dma_async_tx_descriptor *tx;
+	u32 idx;
+
+	/* Callbacks of a running cleanup batch are called without the lock */
+	spin_lock(&ch->cleanup_lock);
+	while (ch->cleanup_busy) {
+		spin_unlock(&ch->cleanup_lock);
+		usleep_range(10, 20);
+		spin_lock(&ch->cleanup_lock);
+	}
+
+	spin_lock(&plx_dma_dev->sched_lock);
+	for (idx = ch->last_tail; idx != ch->head;
+	     idx = (idx + 1) & (ch->ring_size - 1)) {
+		tx = &ch->tx_array[idx];
+		if (!tx->cookie || tx->callback != plx_dma_sched_chunk_done ||
+		    tx->callback_param < (void *)first ||
+		    tx->callback_param >= (void *)last)
+			continue;
+		tx->callback = NULL;
+		tx->callback_param = NULL;
+		plx_dma_dev->sched_inflight--;
+	}
+	spin_unlock(&plx_dma_dev->sched_lock);
+	spin_unlock(&ch->cleanup_lock);
+}
+
+/*
+ * Fail the requests of a client which did not complete in time. They are
+ * taken off the scheduler first so no more chunks are programmed, then
+ * detached from the ring and completed with an error in submission order.
+ */
+static void plx_dma_client_abort(struct plx_dma_client *client)
+{
+	struct plx_dma_device *plx_dma_dev = chan_to_plx_dma_dev(&client->chan);
+	struct plx_dma_sched_req *req;
+	LIST_HEAD(aborted);
+
+	spin_lock(&plx_dma_dev->sched_lock);
+	list_del_init(&client->active);
+	client->deficit = 0;
+	list_splice_tail_init(&client->inflight, &aborted);
+	list_splice_tail_init(&client->queue, &aborted);
+	spin_unlock(&plx_dma_dev->sched_lock);
+
+	/* Chunks completing until here still finish their requests */
+	plx_dma_client_detach(client);
+
+	if (list_empty(&aborted))
+		return;
+
+	client->err_cookie_lo = client_completed_cookie(client);
+	client->err_cookie_hi = list_entry(aborted.prev,
+					   struct plx_dma_sched_req,
+					   list)->txd.cookie;
+	while (!list_empty(&aborted)) {
+		req = list_first_entry(&aborted, struct plx_dma_sched_req, list);
+		list_del_init(&req->list);
+		req->failed = true;
+		req->queued = false;
+		plx_dma_sched_req_complete(client, req);
+	}
+}
+
+void plx_dma_client_free_resources(struct plx_dma_client *client)
+{
+	struct plx_dma_device *plx_dma_dev = chan_to_plx_dma_dev(&client->chan);
+	struct plx_dma_chan *ch = &plx_dma_dev->plx_chan;
+	bool last_user = plx_dma_dev->hw_users == 1;
+	int i;
+
+	for (i = 0; atomic_read(&client->pending) &&
+	     i < PLX_DMA_CLIENT_DRAIN_MS; i++) {
+		plx_dma_sched_run(plx_dma_dev);
+		ch->cleanup(ch);
+		msleep(1);
+	}
+
+	if (atomic_read(&client->pending)) {
+		dev_err(plx_dma_dev->dma_dev.dev,
+			"%s channel %d %d requests not completed\n", __func__,
+			client->chan.chan_id, atomic_read(&client->pending));
+		plx_dma_client_abort(client);
+	} else {
+		spin_lock(&plx_dma_dev->sched_lock);
+		list_del_init(&client->active);
+		spin_unlock(&plx_dma_dev->sched_lock);
+	}
+
+	plx_dma_hw_put(plx_dma_dev);
+
+	if (last_user)
+		plx_dma_dev->sched_inflight = 0;
+	atomic_set(&client->pending, 0);
+	vfree(client->reqs);
+	client->reqs = NULL;
+}
+
+void plx_dma_sched_debugfs_show(struct seq_file *s,
+				struct plx_dma_device *plx_dma_dev)
+{
+	int i;
+
+	seq_printf(s, "clients %d depth %u inflight %u\n",
+		   plx_dma_dev->num_clients, sched_depth,
+		   plx_dma_dev->sched_inflight);
+
+	for (i = 0; i < plx_dma_dev->num_clients; i++) {
+		struct plx_dma_client *client = &plx_dma_dev->clients[i];
+
+		seq_printf(s, "client %d weight %u chunk %zu pending %d "
+			   "deficit %ld bytes %llu requests %llu\n", i,
+			   client->weight, client->max_chunk,
+			   atomic_read(&client->pending), client->deficit,
+			   client->bytes, client->completed);
+	}
+}
+
+int plx_dma_sched_init(struct plx_dma_device *plx_dma_dev)
+{
+	int i;
+
+	spin_lock_init(&plx_dma_dev->sched_lock);
+	INIT_LIST_HEAD(&plx_dma_dev->sched_active);
+	plx_dma_dev->sched_inflight = 0;
+	INIT_WORK(&plx_dma_dev->sched_work, plx_dma_sched_work);
+
+	if (!sched_clients)
+		return 0;
+
+	plx_dma_dev->clients = kcalloc(min_t(unsigned int, sched_clients,
+					     PLX_DMA_MAX_CLIENTS),
+				       sizeof(*plx_dma_dev->clients),
+				       GFP_KERNEL);
+	if (!plx_dma_dev->clients)
+		return -ENOMEM;
+	plx_dma_dev->num_clients = min_t(unsigned int, sched_clients,
+					 PLX_DMA_MAX_CLIENTS);
+	if (!sched_depth)
+		sched_depth = 1;
+
+	for (i = 0; i < plx_dma_dev->num_clients; i++) {
+		struct plx_dma_client *client = &plx_dma_dev->clients[i];
+
+		client->weight = max(sched_weight[i], 1U);
+		client->max_chunk = ALIGN(max(sched_chunk_kb[i], 1U) * 1024,
+					  PLX_DMA_ALIGN_BYTES);
+		spin_lock_init(&client->lock);
+		INIT_LIST_HEAD(&client->free);
+		INIT_LIST_HEAD(&client->queue);
+		INIT_LIST_HEAD(&client->inflight);
+		INIT_LIST_HEAD(&client->active);
+		atomic_set(&client->pending, 0);
+		client->chan.cookie = DMA_MIN_COOKIE;
+		client_completed_cookie(client) = DMA_MIN_COOKIE;
+	}
+
+	dev_info(plx_dma_dev->dma_dev.dev, "%s %d client channels depth %u\n",
+		 __func__, plx_dma_dev->num_clients, sched_depth);
+	return 0;
+}
+
+void plx_dma_sched_uninit(struct plx_dma_device *plx_dma_dev)
+{
+	cancel_work_sync(&plx_dma_dev->sched_work);
+	kfree(plx_dma_dev->clients);
+	plx_dma_dev->clients = NULL;
+	plx_dma_dev->num_clients = 0;
+}
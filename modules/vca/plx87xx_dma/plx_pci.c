@@ -81,6 +81,7 @@ plx_alloc_dma(struct pci_dev *pdev, void __iomem *iobase)
 	if (!d)
 		return NULL;
 	d->pdev = pdev;
+	d->dma_dev.dev = &pdev->dev;
 	d->reg_base = iobase;
 	return d;
 }
@@ -85,6 +85,74 @@ struct vca_csm_ioctl_bios_param_desc {
 	} value;
 };
 
+/**
+ * struct vca_csm_ioctl_image_desc: structure for boot images kept in the
+ * driver, registered once and then booted on any node
+ *
+ * @ret: return value from IOCTL
+ * @id: image id, returned by register and passed to boot and unregister
+ * @mem: pointer to the image in user space, register only
+ * @mem_info: size of the image in @mem, register only
+ * @name: identifies the image contents on register, an image already
+ *	registered under the same name and size is shared instead of copied
+ */
+struct vca_csm_ioctl_image_desc {
+	enum vca_lbp_retval ret;
+	__u32 id;
+	void *mem;
+	size_t mem_info;
+	char name[VCA_LBP_IMAGE_NAME_LEN];
+};
+
+/**
+ * struct vca_csm_ioctl_stream_desc: structure for booting an image read
+ * from a file descriptor, e.g. a pipe from a decompressor
+ *
+ * @ret: return value from IOCTL
+ * @fd: file descriptor the image is read from, up to its end
+ * @size: exact size of the image read from @fd
+ */
+struct vca_csm_ioctl_stream_desc {
+	enum vca_lbp_retval ret;
+	int fd;
+	size_t size;
+};
+
+#define VCA_LBP_PHASE_NAME_LEN 16
+#define VCA_LBP_PHASES_MAX 16
+
+/**
+ * struct vca_lbp_phase_time: time spent by the driver in an LBP phase
+ *
+ * @name: name of the phase
+ * @count: number of times the phase was entered
+ * @last_start_ns: CLOCK_MONOTONIC time the last one started at
+ * @last_us: duration of the last one
+ * @max_us: longest duration
+ * @total_us: sum of the durations
+ */
+struct vca_lbp_phase_time {
+	char name[VCA_LBP_PHASE_NAME_LEN];
+	__u64 count;
+	__u64 last_start_ns;
+	__u64 last_us;
+	__u64 max_us;
+	__u64 total_us;
+};
+
+/**
+ * struct vca_csm_ioctl_phase_times: structure for reading LBP phase timing
+ *
+ * @ret: return value from IOCTL
+ * @nr_phases: number of valid entries of @phases
+ * @phases: timing of each phase
+ */
+struct vca_csm_ioctl_phase_times {
+	enum vca_lbp_retval ret;
+	__u32 nr_phases;
+	struct vca_lbp_phase_time phases[VCA_LBP_PHASES_MAX];
+};
+
 struct vca_csm_ioctl_agent_cmd {
 	enum vca_lbp_retval ret;
 	size_t buf_size;
@@ -139,4 +207,14 @@ struct vca_csm_ioctl_agent_cmd {
 
 #define LBP_SET_SERIAL_NR _IOWR('s', 23, struct vca_csm_ioctl_mem_desc *)
 
+#define LBP_REGISTER_IMAGE _IOWR('s', 24, struct vca_csm_ioctl_image_desc *)
+
+#define LBP_UNREGISTER_IMAGE _IOWR('s', 25, struct vca_csm_ioctl_image_desc *)
+
+#define LBP_BOOT_RAMDISK_IMAGE _IOWR('s', 26, struct vca_csm_ioctl_image_desc *)
+
+#define LBP_BOOT_RAMDISK_STREAM _IOWR('s', 27, struct vca_csm_ioctl_stream_desc *)
+
+#define LBP_GET_PHASE_TIMES _IOWR('s', 28, struct vca_csm_ioctl_phase_times *)
+
 #endif
@@ -112,6 +112,32 @@ static int vca_agent_command_ioctl(struct vca_csm_device *cdev, void __user *arg
 	return rc;
 }
 
+/**
+ * vca_lbp_phase_times_ioctl - handle LBP phase timing IOCTL
+ *
+ * @cdev: pointer to vca_csm_device instance
+ * @argp: IOCTL argument
+ *
+ * RETURNS: 0 in case of success or negative error code otherwise
+ */
+static int vca_lbp_phase_times_ioctl(struct vca_csm_device *cdev,
+	void __user *argp)
+{
+	struct vca_csm_ioctl_phase_times *times;
+	int rc = 0;
+
+	times = kzalloc(sizeof(*times), GFP_KERNEL);
+	if (!times)
+		return -ENOMEM;
+
+	times->ret = cdev->hw_ops->lbp_get_phase_times(cdev, times);
+	if (copy_to_user(argp, times, sizeof(*times)))
+		rc = -EFAULT;
+
+	kfree(times);
+	return rc;
+}
+
 static long vca_cpu_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
 {
 	int rc = 0;
@@ -178,6 +204,61 @@ static long vca_cpu_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
 		}
 		break;
 	}
+	case LBP_REGISTER_IMAGE:
+	case LBP_UNREGISTER_IMAGE:
+	case LBP_BOOT_RAMDISK_IMAGE:
+	{
+		struct vca_csm_ioctl_image_desc desc;
+		if (copy_from_user(&desc, argp, sizeof(desc))) {
+			rc = -EFAULT;
+			break;
+		}
+		desc.name[sizeof(desc.name) - 1] = '\0';
+		switch(cmd) {
+			case LBP_REGISTER_IMAGE:
+				desc.ret = cdev->hw_ops->lbp_register_image(cdev,
+					f, desc.name, desc.mem, desc.mem_info,
+					&desc.id);
+				break;
+			case LBP_UNREGISTER_IMAGE:
+				desc.ret = cdev->hw_ops->lbp_unregister_image(cdev,
+					f, desc.id);
+				break;
+			case LBP_BOOT_RAMDISK_IMAGE:
+				desc.ret = cdev->hw_ops->lbp_boot_ramdisk_image(
+					cdev, desc.id);
+				break;
+		}
+		if (copy_to_user(
+				(struct vca_csm_ioctl_image_desc __user *)argp,
+				&desc,
+				sizeof(desc))) {
+			rc = -EFAULT;
+		}
+		break;
+	}
+	case LBP_GET_PHASE_TIMES:
+	{
+		rc = vca_lbp_phase_times_ioctl(cdev, argp);
+		break;
+	}
+	case LBP_BOOT_RAMDISK_STREAM:
+	{
+		struct vca_csm_ioctl_stream_desc desc;
+		if (copy_from_user(&desc, argp, sizeof(desc))) {
+			rc = -EFAULT;
+			break;
+		}
+		desc.ret = cdev->hw_ops->lbp_boot_ramdisk_stream(cdev,
+			desc.fd, desc.size);
+		if (copy_to_user(
+				&((struct vca_csm_ioctl_stream_desc __user *)argp)->ret,
+				&desc.ret,
+				sizeof(desc.ret))) {
+			rc = -EFAULT;
+		}
+		break;
+	}
 	case LBP_HANDSHAKE:
 	{
 		enum vca_lbp_retval ret;
@@ -350,6 +431,11 @@ static int vca_cpu_open(struct inode *inode, struct file *f)
 }
 static int vca_cpu_release(struct inode *inode, struct file *f)
 {
+	struct vca_csm_device *cdev = f->private_data;
+
+	/* Boot images registered through the file and not dropped yet */
+	if (cdev && cdev->hw_ops->lbp_release_images)
+		cdev->hw_ops->lbp_release_images(cdev, f);
 	return 0;
 }
 
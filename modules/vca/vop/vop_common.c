@@ -69,6 +69,9 @@ static inline unsigned long get_time_jiff_not_zero(void)
 
 #define get_time_diff_ms(start, end) jiffies_to_msecs(end - start)
 
+/* Spreads threads of common devices over CPUs of their node */
+static atomic_t common_dev_count = ATOMIC_INIT(0);
+
 void transfer_done_callback(void *data);
 static void transfer_done(struct buffer_dma_item *item);
 
@@ -146,26 +149,25 @@ void common_dev_heads_up_avail_irq(struct vop_dev_common *cdev)
 }
 
 /**
- * kthread_run_on_node - Create and run thread only on node's cpu.
+ * kthread_run_on_cpu_mask - Create and run thread only on given cpus.
  *
  * @threadfn: thread function
  * @data: data passed to function
- * @node: node ID to be run on
+ * @mask: cpus to be run on
  * @namefmt: thread name
  *
  */
-#define kthread_run_on_node(threadfn, data, node, namefmt, ...)	\
+#define kthread_run_on_cpu_mask(threadfn, data, mask, namefmt, ...)	\
 ({								\
-    const struct cpumask *nodecpumask;				\
 	struct task_struct *__k					\
 		= kthread_create(threadfn,			\
 			data, 					\
 			namefmt, 				\
 			## __VA_ARGS__); 			\
-    nodecpumask = cpumask_of_node(node);			\
-    set_cpus_allowed_ptr(__k, nodecpumask);			\
-	if (!IS_ERR(__k))					\
+	if (!IS_ERR(__k)) {					\
+		set_cpus_allowed_ptr(__k, mask);		\
 		wake_up_process(__k);				\
+	}							\
 	__k;							\
 })
 
@@ -1311,14 +1313,14 @@ static void common_dev_init_mode(struct vop_dev_common *cdev)
 			cdev->write_in_thread? ", write in thread":"");
 }
 
-static int common_dev_init_task(void *data)
+/**
+ * common_dev_node - node whose CPUs run the device threads
+ *
+ * @cdev: common device
+ */
+static int common_dev_node(struct vop_dev_common *cdev)
 {
-	struct vop_dev_common *cdev = (struct vop_dev_common *)data;
-	struct vop_device *vdev = cdev->vdev;
-	int ret = 0;
-	char name_task[16];
 	struct plx_device *xdev = dev_get_drvdata(cdev->vdev->dev.parent);
-	unsigned char card_id = xdev->card_id;
 	unsigned char bus_number = xdev->pdev->bus->number;
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5,1,0)
@@ -1326,7 +1328,75 @@ static int common_dev_init_task(void *data)
 #else
 	unsigned char nr_nodes = max(1, nr_online_nodes);
 #endif
-	int node = bus_number / ( 256 / nr_nodes);
+	return bus_number / ( 256 / nr_nodes);
+}
+
+/**
+ * common_dev_thread_cpu - CPU running one of the device threads
+ *
+ * @cdev: common device
+ * @thread: thread of the device
+ *
+ * Threads of a device take consecutive CPUs of its node starting at
+ * cpu_base, so devices are spread over the node and the heads up doorbells
+ * can be steered to the CPU of the thread they wake up.
+ */
+static int common_dev_thread_cpu(struct vop_dev_common *cdev,
+				 enum vop_dev_thread thread)
+{
+	const struct cpumask *node_mask = cpumask_of_node(common_dev_node(cdev));
+	unsigned int weight = cpumask_weight(node_mask);
+	unsigned int n;
+	int cpu;
+
+	if (!weight)
+		return cpumask_first(cpu_online_mask);
+
+	n = (cdev->cpu_base + thread) % weight;
+	for_each_cpu(cpu, node_mask)
+		if (!n--)
+			break;
+	return cpu;
+}
+
+/**
+ * common_dev_declare_affinity - steer heads up doorbells to device threads
+ *
+ * @cdev: common device
+ * @avail_db: doorbell waking the vrd and vdm threads
+ * @used_db: doorbell waking the vsd thread
+ */
+void common_dev_declare_affinity(struct vop_dev_common *cdev, int avail_db,
+				 int used_db)
+{
+	struct vop_device *vpdev = cdev->vdev;
+	cpumask_var_t mask;
+
+	if (!vpdev->hw_ops->set_irq_affinity)
+		return;
+
+	if (zalloc_cpumask_var(&mask, GFP_KERNEL)) {
+		/* vdm waits for avail descriptors when it runs, vrd otherwise */
+		cpumask_set_cpu(common_dev_thread_cpu(cdev, VOP_DEV_THREAD_VRD),
+				mask);
+		cpumask_set_cpu(common_dev_thread_cpu(cdev, VOP_DEV_THREAD_VDM),
+				mask);
+		vpdev->hw_ops->set_irq_affinity(vpdev, avail_db, mask);
+		free_cpumask_var(mask);
+	}
+	vpdev->hw_ops->set_irq_affinity(vpdev, used_db,
+		cpumask_of(common_dev_thread_cpu(cdev, VOP_DEV_THREAD_VSD)));
+}
+
+static int common_dev_init_task(void *data)
+{
+	struct vop_dev_common *cdev = (struct vop_dev_common *)data;
+	struct vop_device *vdev = cdev->vdev;
+	int ret = 0;
+	char name_task[16];
+	struct plx_device *xdev = dev_get_drvdata(cdev->vdev->dev.parent);
+	unsigned char card_id = xdev->card_id;
+	unsigned char bus_number = xdev->pdev->bus->number;
 
 	dev_dbg(&vdev->dev,"%s card %u, bus number %u\n",
 					__func__, card_id, bus_number);
@@ -1345,15 +1415,21 @@ static int common_dev_init_task(void *data)
 	}
 
 	snprintf(name_task, sizeof(name_task), "vrd%u_%u", card_id, bus_number);
-	kthread_run_on_node(sync_descriptors_read_task, cdev, node, name_task);
+	kthread_run_on_cpu_mask(sync_descriptors_read_task, cdev,
+			cpumask_of(common_dev_thread_cpu(cdev, VOP_DEV_THREAD_VRD)),
+			name_task);
 
 	if (cdev->write_in_thread) {
 		snprintf(name_task, sizeof(name_task), "vdm%u_%u", card_id, bus_number);
-		kthread_run_on_node(sync_descriptors_dma_task, cdev, node, name_task);
+		kthread_run_on_cpu_mask(sync_descriptors_dma_task, cdev,
+			cpumask_of(common_dev_thread_cpu(cdev, VOP_DEV_THREAD_VDM)),
+			name_task);
 	}
 
 	snprintf(name_task, sizeof(name_task), "vsd%u_%u", card_id, bus_number);
-	kthread_run_on_node(spin_for_used_descriptors_task, cdev, node, name_task);
+	kthread_run_on_cpu_mask(spin_for_used_descriptors_task, cdev,
+			cpumask_of(common_dev_thread_cpu(cdev, VOP_DEV_THREAD_VSD)),
+			name_task);
 
 	cdev->ready = VOP_DEV_READY_STATE_WORK;
 
@@ -1472,6 +1548,7 @@ int common_dev_init(
 		num_write_descriptors);
 
 	cdev->ready = VOP_DEV_READY_STATE_STOP;
+	cdev->cpu_base = atomic_inc_return(&common_dev_count) * VOP_DEV_THREADS;
 	cdev->buffers_ring = NULL;
 	cdev->vringh_tx = vringh_tx;
 	cdev->vringh_rcv = vringh_rcv;
@@ -181,8 +181,17 @@ typedef void (*vop_send_heads_up_pfn)(
 #define VOP_DEV_READY_STATE_STARTING    (1)
 #define VOP_DEV_READY_STATE_WORK        (2)
 
+/* Threads of a common device, each one runs on its own CPU of the node */
+enum vop_dev_thread {
+	VOP_DEV_THREAD_VRD,
+	VOP_DEV_THREAD_VDM,
+	VOP_DEV_THREAD_VSD,
+	VOP_DEV_THREADS
+};
+
 struct vop_dev_common {
 	volatile u8 ready;
+	unsigned int cpu_base;
 	struct completion sync_desc_read;
 	struct buffers_dma_ring *buffers_ring;
 
@@ -223,6 +232,8 @@ int common_dev_init(
 void common_dev_deinit(struct vop_dev_common *cdev, struct vop_device *vdev);
 
 int common_dev_start(struct vop_dev_common *cdev);
+void common_dev_declare_affinity(struct vop_dev_common *cdev, int avail_db,
+				 int used_db);
 void common_dev_stop(struct vop_dev_common *cdev);
 
 void descriptor_read_notification(struct vop_dev_common *cdev);
@@ -644,10 +644,10 @@ static dma_cookie_t vop_dma_async(struct vop_device *vpdev, dma_addr_t dst,
 	}
 	ddev = vop_ch->device;
 
-	plx_ch = to_plx_dma_chan(vop_ch);
+	plx_ch = &chan_to_plx_dma_dev(vop_ch)->plx_chan;
 	/* Check that DMA ring is full. */
 	/* Left always some space in buffer.*/
-	if (20 >= plx_dma_ring_count(plx_ch->head, plx_ch->last_tail)) {
+	if (20 >= plx_dma_ring_count(plx_ch, plx_ch->head, plx_ch->last_tail)) {
 		cookie = -EBUSY;
 		goto error;
 	}
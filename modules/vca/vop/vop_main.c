@@ -729,6 +729,8 @@ static int _vop_add_device(struct vca_device_desc __iomem *d,
 	ret = _vop_common_dev_init(vdev, num_rcv_descs, host_dd);
 	if (ret)
 		return ret;
+	common_dev_declare_affinity(&vdev->cdev, vdev->h2c_vdev_avail_db,
+				    vdev->h2c_vdev_used_db);
 	/* this is written to HOST device control */
 	host_dc->kvec_buf_address = vdev->cdev.kvec_buff.local_write_kvecs.pa;
 	host_dc->kvec_buf_elems  = num_rcv_descs;
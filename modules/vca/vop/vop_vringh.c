@@ -940,6 +940,9 @@ static int vop_setup_irqs(struct vop_card_virtio_dev *vdev)
 	}
 	vdev->dc->c2h_vdev_used_db = vdev->virtio_used_db;
 
+	common_dev_declare_affinity(&vdev->cdev, vdev->virtio_avail_db,
+				    vdev->virtio_used_db);
+
 	return 0;
 
 free_avail_irq: